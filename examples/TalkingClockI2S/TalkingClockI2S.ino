@@ -93,26 +93,26 @@ void sayTime(int hour, int minutes, AudioGeneratorTalkie *talkie)
                            sizeof(spFOUR), sizeof(spFIVE), sizeof(spSIX),
                            sizeof(spSEVEN), sizeof(spEIGHT), sizeof(spNINE) };
 
-  talkie->say(spTHE, sizeof(spTHE));
-  talkie->say(spTIME, sizeof(spTIME));
-  talkie->say(spIS, sizeof(spIS));
+  talkie->say(spTHE, sizeof(spTHE), true);
+  talkie->say(spTIME, sizeof(spTIME), true);
+  talkie->say(spIS, sizeof(spIS), true);
 
   hour = hour % 12;
-  talkie->say(spHour[hour], spHourLen[hour]);
+  talkie->say(spHour[hour], spHourLen[hour], true);
   if (minutes==0) {
-    talkie->say(spOCLOCK, sizeof(spOCLOCK));
+    talkie->say(spOCLOCK, sizeof(spOCLOCK), true);
   } else if (minutes<=10 || minutes >=20) {
-    talkie->say(spMinDec[minutes / 10], spMinDecLen[minutes /10]);
+    talkie->say(spMinDec[minutes / 10], spMinDecLen[minutes /10], true);
     if (minutes % 10) {
-      talkie->say(spMinLow[(minutes % 10) - 1], spMinLowLen[(minutes % 10) - 1]);
+      talkie->say(spMinLow[(minutes % 10) - 1], spMinLowLen[(minutes % 10) - 1], true);
     }
   } else {
-    talkie->say(spMinSpecial[minutes - 11], spMinSpecialLen[minutes - 11]);
+    talkie->say(spMinSpecial[minutes - 11], spMinSpecialLen[minutes - 11], true);
   }
   if (pm) {
-    talkie->say(spP_M_, sizeof(spP_M_));
+    talkie->say(spP_M_, sizeof(spP_M_), true);
   } else {
-    talkie->say(spA_M_, sizeof(spA_M_));
+    talkie->say(spA_M_, sizeof(spA_M_), true);
   }
 }
 
@@ -180,6 +180,16 @@ void setup()
 
 void loop()
 {
+  static unsigned long quietSince = 0;
+
+  // The phrases are queued, so speaking them doesn't hold up the rest of the sketch
+  if (talkie->isRunning()) {
+    talkie->loop();
+    quietSince = millis();
+    return;
+  }
+  if (millis() - quietSince < 1000) return;
+
   struct tm tmstruct ;
   tmstruct.tm_year = 0;
   GetLocalTime(&tmstruct, 5000);
@@ -188,6 +198,5 @@ void loop()
                 tmstruct.tm_mday, tmstruct.tm_hour,
                 tmstruct.tm_min, tmstruct.tm_sec);
   sayTime(tmstruct.tm_hour, tmstruct.tm_min, talkie);
-  delay(1000);
 }
 #endif
@@ -0,0 +1,58 @@
+/*
+  AudioConfig
+  Compile-time feature selection for the bundled codec libraries
+
+  Copyright (C) 2022  Earle F. Philhower, III
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _AUDIOCONFIG_H
+#define _AUDIOCONFIG_H
+
+// Every library under src/ is compiled whether or not a sketch uses it, so flash and IRAM can
+// only be won back by removing code before the compiler sees it.  Either uncomment the lines
+// below or pass the same names as -D build flags (i.e. PlatformIO's build_flags).
+
+// Profiles, which simply turn on a sensible set of the individual options
+//#define AUDIO_PROFILE_SMALL       // Decode-only, no HE-AAC SBR, no FLAC MD5
+//#define AUDIO_PROFILE_SMALL_MONO  // AUDIO_PROFILE_SMALL plus mono-only AAC and FLAC
+
+// Individual options
+//#define AUDIO_DECODE_ONLY  // Drop the Opus/CELT/SILK encoders and libflac's encoder-only windowing
+//#define AUDIO_NO_AAC_SBR   // HE-AAC streams play their AAC-LC core at half the sample rate (always so on ESP8266)
+//#define AUDIO_NO_FLAC_MD5  // libflac can't verify the STREAMINFO MD5 signature
+//#define AUDIO_MONO_ONLY    // AAC and FLAC decoders sized for one channel, stereo streams are rejected
+
+#if defined(AUDIO_PROFILE_SMALL_MONO) && !defined(AUDIO_PROFILE_SMALL)
+  #define AUDIO_PROFILE_SMALL
+#endif
+
+#if defined(AUDIO_PROFILE_SMALL_MONO) && !defined(AUDIO_MONO_ONLY)
+  #define AUDIO_MONO_ONLY
+#endif
+
+#if defined(AUDIO_PROFILE_SMALL)
+  #ifndef AUDIO_DECODE_ONLY
+    #define AUDIO_DECODE_ONLY
+  #endif
+  #ifndef AUDIO_NO_AAC_SBR
+    #define AUDIO_NO_AAC_SBR
+  #endif
+  #ifndef AUDIO_NO_FLAC_MD5
+    #define AUDIO_NO_FLAC_MD5
+  #endif
+#endif
+
+#endif // _AUDIOCONFIG_H
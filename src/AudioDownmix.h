@@ -0,0 +1,69 @@
+/*
+  AudioDownmix
+  Default stereo downmixes for 3 to 8 channel streams, shared by the multichannel generators
+
+  Copyright (C) 2022  Earle F. Philhower, III
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _AUDIODOWNMIX_H
+#define _AUDIODOWNMIX_H
+
+#include <Arduino.h>
+
+class AudioDownmix
+{
+  public:
+    // How a format numbers its channels, which decides which table row each one takes
+    typedef enum {
+      ORDER_VORBIS, // Vorbis and Opus: L C R, FL FR RL RR, FL C FR RL RR LFE, ...
+      ORDER_WAVE    // FLAC and WAVEFORMATEXTENSIBLE: FL FR C LFE BL BR SL SR
+    } ChannelOrder;
+
+    // Q14 {left, right} gain of channel ch (in the given order) of an n = 3..8 channel stream
+    static void Gains(int n, int ch, ChannelOrder order, int16_t gains[2])
+    {
+      // Stereo downmixes in Vorbis order, from opusfile's (unused) float ones.  LFE rows are
+      // zero, so LFE streams never need decoding.
+      static const int16_t downmixQ14[6][8][2] PROGMEM = {
+        { {9598, 0}, {6786, 6786}, {0, 9598} },                                            // 3.0
+        { {6924, 0}, {0, 6924}, {5996, 3464}, {3464, 5996} },                              // Quad
+        { {10666, 0}, {7537, 7537}, {0, 10666}, {9234, 5331}, {5331, 9234} },              // 5.0
+        { {10666, 0}, {7537, 7537}, {0, 10666}, {9234, 5331}, {5331, 9234}, {0, 0} },      // 5.1
+        { {7459, 0}, {5275, 5275}, {0, 7459}, {6460, 3731}, {3731, 6460}, {4568, 4568}, {0, 0} }, // 6.1
+        { {6368, 0}, {4502, 4502}, {0, 6368}, {5515, 3183}, {3183, 5515}, {5515, 3183}, {3183, 5515}, {0, 0} } // 7.1
+      };
+      // The Vorbis row for each WAVE order channel
+      static const uint8_t waveToVorbis[6][8] PROGMEM = {
+        { 0, 2, 1 },                   // L R C
+        { 0, 1, 2, 3 },                // FL FR BL BR
+        { 0, 2, 1, 3, 4 },             // FL FR C BL BR
+        { 0, 2, 1, 5, 3, 4 },          // FL FR C LFE BL BR
+        { 0, 2, 1, 6, 5, 3, 4 },       // FL FR C LFE BC SL SR
+        { 0, 2, 1, 7, 5, 6, 3, 4 }     // FL FR C LFE BL BR SL SR
+      };
+      int row = (order == ORDER_WAVE) ? pgm_read_byte(&waveToVorbis[n - 3][ch]) : ch;
+      gains[0] = pgm_read_word(&downmixQ14[n - 3][row][0]);
+      gains[1] = pgm_read_word(&downmixQ14[n - 3][row][1]);
+    }
+
+    // Fills matrix[n][2] with the whole downmix of an n = 3..8 channel stream
+    static void Matrix(int n, ChannelOrder order, int16_t *matrix)
+    {
+      for (int ch = 0; ch < n; ch++) Gains(n, ch, order, &matrix[ch * 2]);
+    }
+};
+
+#endif
@@ -25,6 +25,7 @@
 #include "AudioStatus.h"
 #include "AudioFileSource.h"
 #include "AudioOutput.h"
+#include "AudioMemory.h"
 
 class AudioGenerator
 {
@@ -41,14 +42,39 @@ class AudioGenerator
     virtual bool RegisterMetadataCB(AudioStatus::metadataCBFn fn, void *data) { return cb.RegisterMetadataCB(fn, data); }
     virtual bool RegisterStatusCB(AudioStatus::statusCBFn fn, void *data) { return cb.RegisterStatusCB(fn, data); }
 
+    // Heap used by the wrapped codec is allocated via this hook, and along with stack depth is tracked per-instance
+    virtual bool RegisterAllocator(const AudioMemory::Allocator *a) { return mem.RegisterAllocator(a); }
+    const AudioMemory::Stats &GetMemoryStats() { return mem.GetStats(); }
+    void ResetMemoryPeaks() { mem.ResetPeaks(); }
+    void SetStackPaint(uint32_t bytes) { mem.SetStackPaint(bytes); }
+
   protected:
     bool running;
     AudioFileSource *file;
     AudioOutput *output;
     int16_t lastSample[2];
-
-  protected:
     AudioStatus cb;
+    AudioMemory mem;
+
+    // Generators which synthesize their audio a block of stereo frames at a time fill their block
+    // here, returning how many frames it holds or 0 when there's nothing more to play for now
+    virtual int RenderBlock() { return 0; }
+    // Hands block[*blockPtr..*blockLen) to the output, and renders another block whenever the last
+    // one is gone.  Returns true once the output is full, false when RenderBlock() comes up empty.
+    bool PushBlocks(int16_t *block, int *blockLen, int *blockPtr)
+    {
+      while (true) {
+        if (*blockPtr == *blockLen) {
+          *blockLen = RenderBlock();
+          *blockPtr = 0;
+          if (!*blockLen) return false;
+        }
+        int want = *blockLen - *blockPtr;
+        int n = output->ConsumeSamples(block + *blockPtr * 2, want);
+        *blockPtr += n;
+        if (n < want) return true; // FIFO full, wait...
+      }
+    }
 };
 
 #endif
@@ -24,6 +24,8 @@
 
 AudioGeneratorAAC::AudioGeneratorAAC()
 {
+  AudioMemory::Scope scope(&mem);
+
   preallocateSpace = NULL;
   preallocateSize = 0;
 
@@ -31,8 +33,8 @@ AudioGeneratorAAC::AudioGeneratorAAC()
   file = NULL;
   output = NULL;
 
-  buff = (uint8_t*)malloc(buffLen);
-  outSample = (int16_t*)malloc(1024 * 2 * sizeof(uint16_t));
+  buff = (uint8_t*)audio_malloc(buffLen);
+  outSample = (int16_t*)audio_malloc(outSampleLen * sizeof(int16_t));
   if (!buff || !outSample) {
     audioLogger->printf_P(PSTR("ERROR: Out of memory in AAC\n"));
     Serial.flush();
@@ -46,10 +48,16 @@ AudioGeneratorAAC::AudioGeneratorAAC()
 
   buffValid = 0;
   lastFrameEnd = 0;
+  frameStart = 0;
   validSamples = 0;
   curSample = 0;
   lastRate = 0;
   lastChannels = 0;
+  sbrMode = SBR_ON;
+  sbrBypassed = false;
+  sbrMaxLoad = 80;
+  sbrFrames = 0;
+  decodeLoad = 0;
 }
 
 AudioGeneratorAAC::AudioGeneratorAAC(void *preallocateData, int preallocateSz)
@@ -65,7 +73,7 @@ AudioGeneratorAAC::AudioGeneratorAAC(void *preallocateData, int preallocateSz)
   buff = (uint8_t*) p;
   p += (buffLen + 7) & ~7;
   outSample = (int16_t*) p;
-  p += (1024 * 2 * sizeof(int16_t) + 7) & ~7;
+  p += (outSampleLen * sizeof(int16_t) + 7) & ~7;
   int used = p - (uint8_t*)preallocateSpace;
   int availSpace = preallocateSize - used;
   if (availSpace < 0 ) {
@@ -79,25 +87,33 @@ AudioGeneratorAAC::AudioGeneratorAAC(void *preallocateData, int preallocateSz)
   }
   buffValid = 0;
   lastFrameEnd = 0;
+  frameStart = 0;
   validSamples = 0;
   curSample = 0;
   lastRate = 0;
   lastChannels = 0;
+  sbrMode = SBR_ON;
+  sbrBypassed = false;
+  sbrMaxLoad = 80;
+  sbrFrames = 0;
+  decodeLoad = 0;
 }
 
 
 
 AudioGeneratorAAC::~AudioGeneratorAAC()
 {
+  AudioMemory::Scope scope(&mem);
   if (!preallocateSpace) {
     AACFreeDecoder(hAACDecoder);
-    free(buff);
-    free(outSample);
+    audio_free(buff);
+    audio_free(outSample);
   }
 }
 
 bool AudioGeneratorAAC::stop()
 {
+  AudioMemory::Scope scope(&mem);
   running = false;
   output->stop();
   return file->close();
@@ -108,38 +124,88 @@ bool AudioGeneratorAAC::isRunning()
   return running;
 }
 
+// Slide the unconsumed tail (less than one frame) down to buff[0] and top the window back up
+int AudioGeneratorAAC::RefillBuffer()
+{
+  int keep = buffValid - lastFrameEnd;
+  if (keep && lastFrameEnd) memmove(buff, buff + lastFrameEnd, keep);
+  lastFrameEnd = 0;
+  int got = file->read(buff + keep, buffLen - keep);
+  buffValid = keep + got;
+  return got;
+}
+
 bool AudioGeneratorAAC::FillBufferWithValidFrame()
 {
-  buff[0] = 0; // Destroy any existing sync word @ 0
-  int nextSync;
-  do {
-    nextSync = AACFindSyncWord(buff + lastFrameEnd, buffValid - lastFrameEnd);
-    if (nextSync >= 0) nextSync += lastFrameEnd;
-    lastFrameEnd = 0;
-    if (nextSync == -1) {
-      if (buffValid && buff[buffValid-1]==0xff) { // Could be 1st half of syncword, preserve it...
-        buff[0] = 0xff;
-        buffValid = file->read(buff+1, buffLen-1);
-        if (buffValid==0) return false; // No data available, EOF
-      } else { // Try a whole new buffer
-        buffValid = file->read(buff, buffLen-1);
-        if (buffValid==0) return false; // No data available, EOF
+  // Frames are decoded in place wherever they sit in buff[], so a file read is only needed
+  // once the next frame runs off the end of what's already buffered
+  while (true) {
+    int avail = buffValid - lastFrameEnd;
+    int sync = (avail > 0) ? AACFindSyncWord(buff + lastFrameEnd, avail) : -1;
+    if (sync < 0) {
+      // Could be the 1st half of a syncword, preserve it...
+      lastFrameEnd = (avail > 0 && buff[buffValid - 1] == 0xff) ? buffValid - 1 : buffValid;
+      if (!RefillBuffer()) return false; // No data available, EOF
+      continue;
+    }
+    frameStart = lastFrameEnd + sync;
+    uint8_t *h = buff + frameStart;
+    int have = buffValid - frameStart;
+    int need = 7; // ADTS header, which holds the frame length
+    if (have >= need) {
+      need = ((h[3] & 3) << 11) | (h[4] << 3) | (h[5] >> 5);
+      if ((need < 7) || (need > buffLen)) {
+        lastFrameEnd = frameStart + 1; // Not a real sync word, keep looking
+        continue;
       }
     }
-  } while (nextSync == -1);
+    if (have >= need) return true;
+    lastFrameEnd = frameStart;
+    if (!RefillBuffer()) {
+      frameStart = 0;
+      return buffValid > 0; // Truncated last frame, let the decoder have what there is
+    }
+  }
+}
 
-  // Move the frame to start at offset 0 in the buffer
-  buffValid -= nextSync; // Throw out prior to nextSync
-  memmove(buff, buff+nextSync, buffValid);
+void AudioGeneratorAAC::SetSBRMode(SBRMode mode, int maxLoad)
+{
+  sbrMode = mode;
+  sbrMaxLoad = maxLoad;
+  sbrFrames = 0;
+  decodeLoad = 0;
+  SetSBRBypass(mode == SBR_OFF);
+}
 
-  // We have a sync word at 0 now, try and fill remainder of buffer
-  buffValid += file->read(buff + buffValid, buffLen - buffValid);
+void AudioGeneratorAAC::SetSBRBypass(bool bypass)
+{
+  sbrBypassed = bypass;
+  if (hAACDecoder) AACSetSBRBypass(hAACDecoder, bypass ? 1 : 0);
+}
 
-  return true;
+// Compare the time spent in AACDecode() with how long the frame plays for.  Output and
+// file I/O also take their share, so maxLoad should leave some headroom.
+void AudioGeneratorAAC::TrackDecodeLoad(uint32_t us, const AACFrameInfo *fi)
+{
+  uint32_t frameUs = (uint64_t)(fi->outputSamps / fi->nChans) * 1000000 / fi->sampRateOut;
+  if (!frameUs) return;
+  uint32_t load = (uint64_t)us * (100 << 8) / frameUs;
+  decodeLoad = decodeLoad ? decodeLoad + ((int32_t)(load - decodeLoad) >> 3) : load;
+
+  if ((sbrMode != SBR_AUTO) || sbrBypassed || (fi->sampRateOut == fi->sampRateCore)) return;
+  if (sbrFrames < 16) {
+    sbrFrames++; // Let the average settle first
+  } else if ((int)(decodeLoad >> 8) > sbrMaxLoad) {
+    SetSBRBypass(true);
+    decodeLoad = 0;
+    cb.st(STATUS_SBR_BYPASSED, PSTR("HE-AAC too slow, playing without SBR"));
+  }
 }
 
 bool AudioGeneratorAAC::loop()
 {
+  AudioMemory::Scope scope(&mem);
+
   if (!running) goto done; // Nothing to do here!
 
   // If we've got data, try and pump it out...
@@ -158,12 +224,15 @@ bool AudioGeneratorAAC::loop()
 
   // No samples available, need to decode a new frame
   if (FillBufferWithValidFrame()) {
-    // buff[0] start of frame, decode it...
-    unsigned char *inBuff = reinterpret_cast<unsigned char *>(buff);
-    int bytesLeft = buffValid;
+    // buff[frameStart] start of frame, decode it...
+    unsigned char *inBuff = reinterpret_cast<unsigned char *>(buff + frameStart);
+    int bytesLeft = buffValid - frameStart;
+    uint32_t start = micros();
     int ret = AACDecode(hAACDecoder, &inBuff, &bytesLeft, outSample);
+    uint32_t spent = micros() - start;
     if (ret) {
       // Error, skip the frame...
+      lastFrameEnd = frameStart + 1;
       char buff[48];
       sprintf_P(buff, PSTR("AAC decode error %d"), ret);
       cb.st(ret, buff);
@@ -181,6 +250,8 @@ bool AudioGeneratorAAC::loop()
       }
       curSample = 0;
       validSamples = fi.outputSamps / lastChannels;
+      TrackDecodeLoad(spent, &fi);
+      FrameDecoded();
     }
   } else {
     running = false; // No more data, we're done here...
@@ -195,6 +266,7 @@ done:
 
 bool AudioGeneratorAAC::begin(AudioFileSource *source, AudioOutput *output)
 {
+  AudioMemory::Scope scope(&mem);
   if (!source) return false;
   file = source;
   if (!output) return false;
@@ -208,9 +280,14 @@ bool AudioGeneratorAAC::begin(AudioFileSource *source, AudioOutput *output)
  
 
   memset(buff, 0, buffLen);
-  memset(outSample, 0, 1024*2*sizeof(int16_t));
+  memset(outSample, 0, outSampleLen*sizeof(int16_t));
+  buffValid = 0;
+  lastFrameEnd = 0;
+  frameStart = 0;
+
+  // Every stream gets a fresh chance at SBR
+  SetSBRMode(sbrMode, sbrMaxLoad);
 
- 
   running = true;
   
   return true;
@@ -35,6 +35,16 @@ class AudioGeneratorAAC : public AudioGenerator
     virtual bool stop() override;
     virtual bool isRunning() override;
 
+    // HE-AAC's SBR layer doubles the output rate and roughly the CPU needed.  SBR_OFF plays only
+    // the AAC-LC core at half the rate, and SBR_AUTO starts with SBR but drops it for the rest of
+    // the stream if decoding takes more than maxLoad percent of real time.  No effect on plain AAC.
+    typedef enum { SBR_ON, SBR_OFF, SBR_AUTO } SBRMode;
+    void SetSBRMode(SBRMode mode, int maxLoad = 80);
+    bool IsSBRBypassed() { return sbrBypassed; }
+    int GetDecodeLoad() { return decodeLoad >> 8; } // Percent of real time spent in the decoder, smoothed
+
+    enum { STATUS_SBR_BYPASSED = 2 };
+
   protected:
     void *preallocateSpace;
     int preallocateSize;
@@ -45,12 +55,20 @@ class AudioGeneratorAAC : public AudioGenerator
     // Input buffering
     const int buffLen = 1600;
     uint8_t *buff; //[1600]; // File buffer required to store at least a whole compressed frame
-    int16_t buffValid;
-    int16_t lastFrameEnd;
-    bool FillBufferWithValidFrame(); // Read until we get a valid syncword and min(feof, 2048) butes in the buffer
+    int16_t buffValid;    // Bytes in buff[]
+    int16_t lastFrameEnd; // Start of the unconsumed data in buff[]
+    int16_t frameStart;   // Where the frame to decode begins
+    virtual bool FillBufferWithValidFrame(); // Find a sync word with its whole frame in buff[], reading only when needed
+    int RefillBuffer();
+    virtual void FrameDecoded() { }; // Called with the new frame in outSample[curSample...], containers may trim it
 
     // Output buffering
-    int16_t *outSample; //[1024 * 2]; // Interleaved L/R
+#ifdef AAC_ENABLE_SBR
+    static constexpr int outSampleLen = AAC_MAX_NCHANS * AAC_MAX_NSAMPS * 2; // SBR doubles the samples per frame
+#else
+    static constexpr int outSampleLen = AAC_MAX_NCHANS * AAC_MAX_NSAMPS;
+#endif
+    int16_t *outSample; //[outSampleLen]; // Interleaved L/R
     int16_t validSamples;
     int16_t curSample;
 
@@ -58,6 +76,15 @@ class AudioGeneratorAAC : public AudioGenerator
     unsigned int lastRate;
     int lastChannels;
 
+    // SBR bypass and CPU load tracking
+    SBRMode sbrMode;
+    bool sbrBypassed;
+    int sbrMaxLoad;
+    uint16_t sbrFrames;   // Frames decoded with SBR, load isn't judged until a few are in
+    uint32_t decodeLoad;  // Percent << 8, running average
+    void SetSBRBypass(bool bypass);
+    void TrackDecodeLoad(uint32_t us, const AACFrameInfo *fi);
+
 };
 
 #endif
@@ -19,22 +19,61 @@
 */
 
 #include <AudioGeneratorFLAC.h>
+#include <AudioDownmix.h>
 
-AudioGeneratorFLAC::AudioGeneratorFLAC()
+AudioGeneratorFLAC::AudioGeneratorFLAC() : arena(NULL, 0)
 {
+  preallocateSpace = NULL;
   flac = NULL;
   channels = 0;
   sampleRate = 0;
   bitsPerSample = 0;
-  buff[0] = NULL;
-  buff[1] = NULL;
+  for (unsigned i = 0; i < FLAC__MAX_CHANNELS; i++) buff[i] = NULL;
   buffPtr = 0;
   buffLen = 0;
+  wide = false;
+  mixing = false;
+  dither = true;
+  ditherSeed = 0x12345678;
+  userMatrix = NULL;
+  userMatrixChannels = 0;
+  blockPtr = 0;
+  blockLen = 0;
+  md5Check = false;
+  md5Active = false;
+  md5Ptr = 0;
+  running = false;
+}
+
+AudioGeneratorFLAC::AudioGeneratorFLAC(void *space, int size) : arena(space, size)
+{
+  preallocateSpace = space;
+  mem.RegisterAllocator(arena.GetAllocator());
+  flac = NULL;
+  channels = 0;
+  sampleRate = 0;
+  bitsPerSample = 0;
+  for (unsigned i = 0; i < FLAC__MAX_CHANNELS; i++) buff[i] = NULL;
+  buffPtr = 0;
+  buffLen = 0;
+  wide = false;
+  mixing = false;
+  dither = true;
+  ditherSeed = 0x12345678;
+  userMatrix = NULL;
+  userMatrixChannels = 0;
+  blockPtr = 0;
+  blockLen = 0;
+  md5Check = false;
+  md5Active = false;
+  md5Ptr = 0;
   running = false;
 }
 
 AudioGeneratorFLAC::~AudioGeneratorFLAC()
 {
+  AudioMemory::Scope scope(&mem);
+  FinishMD5(false);
   if (flac)
     FLAC__stream_decoder_delete(flac);
   flac = NULL;
@@ -42,6 +81,7 @@ AudioGeneratorFLAC::~AudioGeneratorFLAC()
 
 bool AudioGeneratorFLAC::begin(AudioFileSource *source, AudioOutput *output)
 {
+  AudioMemory::Scope scope(&mem);
   if (!source) return false;
   file = source;
   if (!output) return false;
@@ -49,75 +89,91 @@ bool AudioGeneratorFLAC::begin(AudioFileSource *source, AudioOutput *output)
   if (!file->isOpen()) return false; // Error
 
   flac = FLAC__stream_decoder_new();
-  if (!flac) return false;
+  if (!flac) {
+    if (preallocateSpace) audioLogger->printf_P(PSTR("OOM error in FLAC:  Preallocated arena too small for decoder state\n"));
+    return false;
+  }
   
   (void)FLAC__stream_decoder_set_md5_checking(flac, false);
+  // STREAMINFO always comes through, and the seek table is kept inside libflac
+  (void)FLAC__stream_decoder_set_metadata_respond(flac, FLAC__METADATA_TYPE_VORBIS_COMMENT);
+  (void)FLAC__stream_decoder_set_metadata_respond(flac, FLAC__METADATA_TYPE_CUESHEET);
 
   FLAC__StreamDecoderInitStatus ret = FLAC__stream_decoder_init_stream(flac, _read_cb, _seek_cb, _tell_cb, _length_cb, _eof_cb, _write_cb, _metadata_cb, _error_cb, reinterpret_cast<void*>(this) );
   if (ret != FLAC__STREAM_DECODER_INIT_STATUS_OK) {
+    if (ret == FLAC__STREAM_DECODER_INIT_STATUS_MEMORY_ALLOCATION_ERROR && preallocateSpace) {
+      audioLogger->printf_P(PSTR("OOM error in FLAC:  Preallocated arena too small for decoder state\n"));
+    }
     FLAC__stream_decoder_delete(flac);
     flac = NULL;
     return false;
   }
 
+  // Hashing waits on STREAMINFO to know whether there's a signature to check against
+  FinishMD5(false);
+  md5Ptr = 0;
+
   output->begin();
   running = true;
-  lastSample[0] = 0;
-  lastSample[1] = 0;
   channels = 0;
+  bitsPerSample = 0;
+  buffPtr = 0;
+  buffLen = 0;
+  blockPtr = 0;
+  blockLen = 0;
   return true;
 }
 
 bool AudioGeneratorFLAC::loop()
 {
+  AudioMemory::Scope scope(&mem);
   FLAC__bool ret;
 
   if (!running) goto done;
 
-  if (channels && !output->ConsumeSample(lastSample)) goto done; // Try and send last buffered sample
+  while (true) {
+    // Anything already converted goes first
+    if (blockPtr < blockLen) {
+      blockPtr += output->ConsumeSamples(block + blockPtr * 2, blockLen - blockPtr);
+      if (blockPtr < blockLen) goto done; // Output's full
+    }
 
-  do {
     if (buffPtr == buffLen) {
+      if (md5Active) HashBlock(buffLen); // libflac reuses the buffers for the next block
       ret = FLAC__stream_decoder_process_single(flac);
       if (!ret) {
+        if (FLAC__stream_decoder_get_state(flac) == FLAC__STREAM_DECODER_MEMORY_ALLOCATION_ERROR) {
+          audioLogger->printf_P(PSTR("OOM error in FLAC:  Block size or channel count too large for available memory\n"));
+        }
         running = false;
         goto done;
       } else {
         // We might be done...
         if (FLAC__stream_decoder_get_state(flac)==FLAC__STREAM_DECODER_END_OF_STREAM) {
+          FinishMD5(true);
           running = false;
           goto done;
         }
-        unsigned newsr = FLAC__stream_decoder_get_sample_rate(flac);
-        unsigned newch = FLAC__stream_decoder_get_channels(flac);
-        unsigned newbps = FLAC__stream_decoder_get_bits_per_sample(flac);
-        if (newsr != sampleRate) output->SetRate(sampleRate = newsr);
-        if (newch != channels) output->SetChannels(channels = newch);
-        if (newbps != bitsPerSample) output->SetBitsPerSample( bitsPerSample = newbps);
+        CheckFormat();
       }
+      // Check for some weird case where above didn't give any data
+      if (buffPtr == buffLen) goto done; // At some point the flac better error and we'll return
     }
 
-    // Check for some weird case where above didn't give any data
-    if (buffPtr == buffLen) {
-      goto done; // At some point the flac better error and we'll return 
-    }
-    if (bitsPerSample <= 16) {
-      lastSample[AudioOutput::LEFTCHANNEL] = buff[0][buffPtr] & 0xffff; 
-      if (channels==2) lastSample[AudioOutput::RIGHTCHANNEL] = buff[1][buffPtr] & 0xffff; 
-      else lastSample[AudioOutput::RIGHTCHANNEL] = lastSample[AudioOutput::LEFTCHANNEL];
-    } else if (bitsPerSample <= 24) {
-      lastSample[AudioOutput::LEFTCHANNEL] = (buff[0][buffPtr]>>8) & 0xffff; 
-      if (channels==2) lastSample[AudioOutput::RIGHTCHANNEL] = (buff[1][buffPtr]>>8) & 0xffff; 
-      else lastSample[AudioOutput::RIGHTCHANNEL] = lastSample[AudioOutput::LEFTCHANNEL];
+    if (wide) {
+      // Straight from libflac's own buffers, no conversion or copy at all
+      const int32_t *chan[2] = { buff[0] + buffPtr, buff[channels - 1] + buffPtr };
+      buffPtr += output->ConsumeSamplesWide(chan, buffLen - buffPtr);
+      if (buffPtr < buffLen) goto done;
     } else {
-      lastSample[AudioOutput::LEFTCHANNEL] = (buff[0][buffPtr]>>16) & 0xffff; 
-      if (channels==2) lastSample[AudioOutput::RIGHTCHANNEL] = (buff[1][buffPtr]>>16) & 0xffff; 
-      else lastSample[AudioOutput::RIGHTCHANNEL] = lastSample[AudioOutput::LEFTCHANNEL];
+      ConvertBlock();
     }
-    buffPtr++;
-  } while (running && output->ConsumeSample(lastSample));
+  }
 
 done:
+  // The output's full, so there's time to spare for the signature
+  if (md5Active && (md5Ptr < buffLen)) HashBlock((buffLen - md5Ptr > md5Frames) ? md5Ptr + md5Frames : buffLen);
+
   file->loop();
   output->loop();
 
@@ -126,6 +182,8 @@ done:
 
 bool AudioGeneratorFLAC::stop()
 {
+  AudioMemory::Scope scope(&mem);
+  FinishMD5(false);
   if (flac)
     FLAC__stream_decoder_delete(flac);
   flac = NULL;
@@ -139,6 +197,166 @@ bool AudioGeneratorFLAC::isRunning()
   return running;
 }
 
+bool AudioGeneratorFLAC::seek(uint32_t sample)
+{
+  AudioMemory::Scope scope(&mem);
+  if (!running) return false;
+
+  // Whatever was decoded or converted is stale now, and the signature can't be vouched for
+  FinishMD5(false);
+  buffPtr = 0;
+  buffLen = 0;
+  blockPtr = 0;
+  blockLen = 0;
+  // libflac hands write_cb the target frame, trimmed to start at the sample asked for
+  if (!FLAC__stream_decoder_seek_absolute(flac, sample)) {
+    if (FLAC__stream_decoder_get_state(flac) == FLAC__STREAM_DECODER_SEEK_ERROR) FLAC__stream_decoder_flush(flac);
+    buffLen = 0;
+    return false;
+  }
+  CheckFormat(); // Metadata may only just have been read
+  return true;
+}
+
+void AudioGeneratorFLAC::SetDownmixMatrix(const int16_t *matrix, int channels)
+{
+  userMatrix = matrix;
+  userMatrixChannels = matrix ? channels : 0;
+}
+
+// Feed the current block's frames up to upTo into the running MD5, as the little-endian bytes the signature covers.
+// libflac grows its byte staging buffer to fit each call, so never hand it more than md5Frames at once.
+void AudioGeneratorFLAC::HashBlock(uint16_t upTo)
+{
+#ifndef AUDIO_NO_FLAC_MD5
+  while (md5Active && (md5Ptr < upTo)) {
+    int n = (upTo - md5Ptr > md5Frames) ? md5Frames : upTo - md5Ptr;
+    const FLAC__int32 *signal[FLAC__MAX_CHANNELS];
+    for (int i = 0; i < channels; i++) signal[i] = buff[i] + md5Ptr;
+    if (!FLAC__MD5Accumulate(&md5, signal, channels, n, (bitsPerSample + 7) / 8)) {
+      audioLogger->printf_P(PSTR("OOM error in FLAC:  No memory for MD5 check\n"));
+      FinishMD5(false);
+      return;
+    }
+    md5Ptr += n;
+  }
+#else
+  (void) upTo;
+#endif
+}
+
+// Stop hashing, and if asked say whether the stream matched its signature
+void AudioGeneratorFLAC::FinishMD5(bool report)
+{
+#ifndef AUDIO_NO_FLAC_MD5
+  if (!md5Active) {
+    if (report && md5Check) cb.st(STATUS_MD5_UNCHECKED, PSTR("FLAC MD5 not checked"));
+    return;
+  }
+  FLAC__byte digest[16];
+  FLAC__MD5Final(digest, &md5); // Also frees its staging buffer
+  md5Active = false;
+  if (!report) return;
+  if (!memcmp(digest, md5Expected, sizeof(digest))) cb.st(STATUS_MD5_OK, PSTR("FLAC MD5 OK"));
+  else cb.st(STATUS_MD5_MISMATCH, PSTR("FLAC MD5 mismatch"));
+#else
+  if (report && md5Check) cb.st(STATUS_MD5_UNCHECKED, PSTR("FLAC MD5 not checked"));
+#endif
+}
+
+// Follow the stream's format, reconfiguring the output when it changes
+void AudioGeneratorFLAC::CheckFormat()
+{
+  unsigned newsr = FLAC__stream_decoder_get_sample_rate(flac);
+  unsigned newch = FLAC__stream_decoder_get_channels(flac);
+  unsigned newbps = FLAC__stream_decoder_get_bits_per_sample(flac);
+  if (newsr != sampleRate) output->SetRate(sampleRate = newsr);
+  if ((newch != channels) || (newbps != bitsPerSample)) {
+    channels = newch;
+    bitsPerSample = newbps;
+    Configure();
+  }
+}
+
+// Pick the conversion for a new channel count or bit depth and tell the output what's coming
+void AudioGeneratorFLAC::Configure()
+{
+  mixing = channels > 2;
+  if (mixing) {
+    if (userMatrix && (channels == userMatrixChannels)) {
+      memcpy(matrix, userMatrix, channels * 2 * sizeof(int16_t));
+    } else {
+      AudioDownmix::Matrix(channels, AudioDownmix::ORDER_WAVE, &matrix[0][0]);
+    }
+  }
+  output->SetChannels(mixing ? 2 : channels);
+  wide = !mixing && (bitsPerSample > 16) && output->SupportsBitsPerSample(bitsPerSample);
+  output->SetBitsPerSample(wide ? bitsPerSample : 16);
+}
+
+// Round a sample carrying shift extra fraction bits to 16, with TPDF dither of +/-1 LSB
+inline int16_t AudioGeneratorFLAC::Reduce(int32_t v, int shift)
+{
+  if (dither) {
+    uint32_t r = ditherSeed;
+    r ^= r << 13;
+    r ^= r >> 17;
+    r ^= r << 5;
+    ditherSeed = r;
+    uint32_t mask = (1 << shift) - 1;
+    v += (int32_t)(r & mask) - (int32_t)((r >> 16) & mask);
+  }
+  v = (v + (1 << (shift - 1))) >> shift;
+  if (v > 32767) return 32767;
+  if (v < -32768) return -32768;
+  return (int16_t)v;
+}
+
+// Convert the next run of frames from libflac's planar buffers into block[] for the output
+void AudioGeneratorFLAC::ConvertBlock()
+{
+  int n = buffLen - buffPtr;
+  if (n > blockFrames) n = blockFrames;
+  int16_t *out = block;
+  const FLAC__int32 *l = buff[0] + buffPtr;
+  const FLAC__int32 *r = buff[mixing ? 1 : channels - 1] + buffPtr;
+
+  if (mixing) {
+    // Work at 24 bits, where each product fits 32 bits as (x>>8)*w plus the low byte's share,
+    // leaving 14 bits of fraction below the 16-bit output
+    int up = (bitsPerSample < 24) ? 24 - bitsPerSample : 0;
+    int down = (bitsPerSample > 24) ? bitsPerSample - 24 : 0;
+    for (int i = 0; i < n; i++) {
+      int32_t accL = 0, accR = 0;
+      for (int c = 0; c < channels; c++) {
+        int32_t x = (buff[c][buffPtr + i] * (1 << up)) >> down;
+        int32_t hi = x >> 8, lo = x & 0xff;
+        accL += hi * matrix[c][0] + ((lo * matrix[c][0]) >> 8);
+        accR += hi * matrix[c][1] + ((lo * matrix[c][1]) >> 8);
+      }
+      *out++ = Reduce(accL, 14);
+      *out++ = Reduce(accR, 14);
+    }
+  } else if (bitsPerSample <= 16) {
+    // Nothing lost, just scaled up to 16 bits
+    int up = 16 - bitsPerSample;
+    for (int i = 0; i < n; i++) {
+      *out++ = l[i] * (1 << up);
+      *out++ = r[i] * (1 << up);
+    }
+  } else {
+    int down = (bitsPerSample > 24) ? bitsPerSample - 24 : 0;
+    int shift = bitsPerSample - down - 16;
+    for (int i = 0; i < n; i++) {
+      *out++ = Reduce(l[i] >> down, shift);
+      *out++ = Reduce(r[i] >> down, shift);
+    }
+  }
+  buffPtr += n;
+  blockPtr = 0;
+  blockLen = n;
+}
+
 
 
 FLAC__StreamDecoderReadStatus AudioGeneratorFLAC::read_cb(const FLAC__StreamDecoder *decoder, FLAC__byte buffer[], size_t *bytes)
@@ -180,17 +398,54 @@ FLAC__StreamDecoderWriteStatus AudioGeneratorFLAC::write_cb(const FLAC__StreamDe
   // Hackish warning here.  FLAC sends the buffer but doesn't free it until the next call to decode_frame, so we stash
   // the pointers here and use it in our loop() instead of memcpy()'ing into yet another buffer.
   buffLen = frame->header.blocksize;
-  buff[0] = (const int *)buffer[0];
-  if (frame->header.channels>1) buff[1] = (const int *)buffer[1];
-  else buff[1] = (const int *)buffer[0];
+  for (unsigned i = 0; (i < frame->header.channels) && (i < FLAC__MAX_CHANNELS); i++) buff[i] = buffer[i];
   buffPtr = 0;
+  md5Ptr = 0;
   return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
 }
 void AudioGeneratorFLAC::metadata_cb(const FLAC__StreamDecoder *decoder, const FLAC__StreamMetadata *metadata)
 {
   (void) decoder;
-  (void) metadata;
-  audioLogger->printf_P(PSTR("Metadata\n"));
+  if (metadata->type == FLAC__METADATA_TYPE_VORBIS_COMMENT) {
+    // "NAME=value" pairs, passed on as type "NAME" with its UTF-8 value
+    const FLAC__StreamMetadata_VorbisComment *vc = &metadata->data.vorbis_comment;
+    for (uint32_t i = 0; i < vc->num_comments; i++) {
+      const char *entry = (const char *)vc->comments[i].entry;
+      const char *eq = (const char *)memchr(entry, '=', vc->comments[i].length);
+      if (!eq) continue;
+      char name[24];
+      size_t len = eq - entry;
+      if (len >= sizeof(name)) len = sizeof(name) - 1;
+      memcpy(name, entry, len);
+      name[len] = 0;
+      cb.md(name, false, eq + 1);
+    }
+  } else if (metadata->type == FLAC__METADATA_TYPE_CUESHEET) {
+    // One "CueTrack" per track, "number sample" with the sample where its INDEX 01 (or failing that, the track) starts
+    const FLAC__StreamMetadata_CueSheet *cs = &metadata->data.cue_sheet;
+    for (uint32_t i = 0; i < cs->num_tracks; i++) {
+      const FLAC__StreamMetadata_CueSheet_Track *t = &cs->tracks[i];
+      if ((t->number == 170) || (t->number == 255)) continue; // Lead-out
+      FLAC__uint64 start = t->offset;
+      for (int j = 0; j < t->num_indices; j++) {
+        if (t->indices[j].number == 1) start += t->indices[j].offset;
+      }
+      char str[24];
+      snprintf_P(str, sizeof(str), PSTR("%u %lu"), t->number, (unsigned long)start);
+      cb.md("CueTrack", false, str);
+    }
+  }
+#ifndef AUDIO_NO_FLAC_MD5
+  if (md5Check && (metadata->type == FLAC__METADATA_TYPE_STREAMINFO)) {
+    static const FLAC__byte none[16] = { 0 };
+    memcpy(md5Expected, metadata->data.stream_info.md5sum, sizeof(md5Expected));
+    if (memcmp(md5Expected, none, sizeof(none))) { // All zeros means the encoder didn't compute one
+      FLAC__MD5Init(&md5);
+      md5Active = true;
+      md5Ptr = 0;
+    }
+  }
+#endif
 }
 char AudioGeneratorFLAC::error_cb_str[64];
 void AudioGeneratorFLAC::error_cb(const FLAC__StreamDecoder *decoder, FLAC__StreamDecoderErrorStatus status)
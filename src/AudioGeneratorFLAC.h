@@ -24,30 +24,108 @@
 #include <AudioGenerator.h>
 extern "C" {
     #include "libflac/FLAC/stream_decoder.h"
+    #include "libflac/private/md5.h"
 };
 
 class AudioGeneratorFLAC : public AudioGenerator
 {
   public:
     AudioGeneratorFLAC();
+    AudioGeneratorFLAC(void *preallocateSpace, int preallocateSize);
     virtual ~AudioGeneratorFLAC() override;
     virtual bool begin(AudioFileSource *source, AudioOutput *output) override;
     virtual bool loop() override;
     virtual bool stop() override;
     virtual bool isRunning() override;
 
+    // Jump to the given sample, counted from the start of the stream, while playing.  The file's
+    // SEEKTABLE, when it has one, bounds libflac's search to the stretch between two seek points;
+    // otherwise it bisects the whole file, which can take many reads on a slow source.
+    bool seek(uint32_t sample);
+    uint32_t getLength() { return flac ? (uint32_t)FLAC__stream_decoder_get_total_samples(flac) : 0; }
+
+    // Streams of 3 to 8 channels are mixed down to stereo while converting.  To use your own
+    // mix for streams of exactly this many channels, give one row of Q14 {left, right} weights
+    // per channel in FLAC order (L, R, C, LFE, ...), each output's weights summing to under 4.0.
+    // The matrix is used in place, not copied.
+    void SetDownmixMatrix(const int16_t *matrix, int channels);
+    // Samples which must lose bits to fit a 16-bit output get TPDF dither (on by default),
+    // which trades truncation distortion for a slight, constant noise floor
+    void SetDither(bool enabled) { dither = enabled; }
+    // Check the decoded audio against the STREAMINFO MD5 signature.  Hashing only happens while the
+    // output is full, and whatever's left of a block just before the next is decoded, so playback
+    // keeps its pace.  The verdict arrives through the status callback at the end of the stream, as
+    // one of the codes below.  Call before begin(), no effect with AUDIO_NO_FLAC_MD5.
+    void SetMD5Check(bool enabled) { md5Check = enabled; }
+    enum { STATUS_MD5_OK = 100, STATUS_MD5_MISMATCH, STATUS_MD5_UNCHECKED }; // Above libflac's error codes
+
+    // Arena needed to play streams up to the given block size, channel count and seek table size without
+    // using the heap.  Rice partitions deeper than maxRiceOrder (the reference encoder stops at 6) need more.
+    // Vorbis comments and cue sheets are held only while they're passed to the metadata callback, but they
+    // must fit: maxTagBytes of comment text in at most maxComments entries, and maxCueTracks tracks.
+    static constexpr int preAllocSize(int maxBlocksize = 4608, int channels = 2, int maxSeekPoints = 128, int maxRiceOrder = 8,
+                                      int maxTagBytes = 2048, int maxComments = 32, int maxCueTracks = 24) {
+      return AudioMemoryArena::Footprint(sizeof(FLAC__StreamDecoder)) +
+             AudioMemoryArena::Footprint(FLAC__STREAM_DECODER_PROTECTED_SIZE_MAX) +
+             AudioMemoryArena::Footprint(FLAC__STREAM_DECODER_PRIVATE_SIZE_MAX) +
+             AudioMemoryArena::Footprint(FLAC__STREAM_DECODER_FILTER_IDS_SIZE) +
+             AudioMemoryArena::Footprint(FLAC__BITREADER_SIZE_MAX) +
+             AudioMemoryArena::Footprint(FLAC__BITREADER_BUFFER_SIZE) +
+             AudioMemoryArena::Footprint(maxSeekPoints * FLAC__STREAM_DECODER_SEEKPOINT_SIZE) +
+             channels * (AudioMemoryArena::Footprint((maxBlocksize + 4) * sizeof(FLAC__int32)) + // Output
+                         AudioMemoryArena::Footprint(maxBlocksize * sizeof(FLAC__int32) + 31) +  // Aligned residual
+                         4 * AudioMemoryArena::Footprint(sizeof(uint32_t) << maxRiceOrder)) + // Rice params and raw bits, twice for realloc()s
+             2 * AudioMemoryArena::Footprint(channels * md5Frames * sizeof(FLAC__int32)) + // MD5 byte staging, grown by realloc()
+             AudioMemoryArena::Footprint(maxTagBytes) + (maxComments + 1) * AudioMemoryArena::Footprint(8) + // Vendor and comment strings
+             AudioMemoryArena::Footprint(maxComments * sizeof(FLAC__StreamMetadata_VorbisComment_Entry)) +
+             AudioMemoryArena::Footprint((maxCueTracks + 1) * sizeof(FLAC__StreamMetadata_CueSheet_Track)) + // Plus the lead-out
+             maxCueTracks * AudioMemoryArena::Footprint(2 * sizeof(FLAC__StreamMetadata_CueSheet_Index)); // INDEX 00 and 01
+    }
+
   protected:
+    // Non-NULL when all libflac allocations come from a caller-supplied arena
+    void *preallocateSpace;
+    AudioMemoryArena arena;
+
     // FLAC info
     uint16_t channels;
     uint32_t sampleRate;
     uint16_t bitsPerSample;
 
     // We need to buffer some data in-RAM to avoid doing 1000s of small reads
-    const int *buff[2];
+    const FLAC__int32 *buff[FLAC__MAX_CHANNELS];
     uint16_t buffPtr;
     uint16_t buffLen;
     FLAC__StreamDecoder *flac;
 
+    // Conversion from libflac's planar 32-bit samples to what the output takes
+    static constexpr int blockFrames = 64;
+    bool wide;              // Output takes bitsPerSample as-is, straight from buff[]
+    bool mixing;            // More than two channels, mixed through matrix[]
+    bool dither;
+    uint32_t ditherSeed;
+    int16_t matrix[FLAC__MAX_CHANNELS][2];
+    const int16_t *userMatrix;
+    int userMatrixChannels;
+    int16_t block[blockFrames * 2];
+    uint16_t blockPtr;
+    uint16_t blockLen;
+
+    void CheckFormat();
+    void Configure();
+    void ConvertBlock();
+    inline int16_t Reduce(int32_t v, int shift);
+
+    // Incremental MD5 over the blocks libflac decodes, md5Frames at a time
+    static constexpr int md5Frames = 128;
+    bool md5Check;
+    bool md5Active;         // Hashing this stream, which has a signature to compare with
+    uint16_t md5Ptr;        // Frames of the current block already hashed
+    FLAC__MD5Context md5;
+    FLAC__byte md5Expected[16];
+    void HashBlock(uint16_t upTo);
+    void FinishMD5(bool report);
+
     // FLAC callbacks, need static functions to bounce into c++ from c
     static FLAC__StreamDecoderReadStatus _read_cb(const FLAC__StreamDecoder *decoder, FLAC__byte buffer[], size_t *bytes, void *client_data) {
       return static_cast<AudioGeneratorFLAC*>(client_data)->read_cb(decoder, buffer, bytes);
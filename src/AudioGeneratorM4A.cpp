@@ -0,0 +1,560 @@
+/*
+  AudioGeneratorM4A
+  Audio output generator for AAC in MP4/M4A (ISO BMFF) files, using the Helix AAC decoder
+
+  Copyright (C) 2022  Earle F. Philhower, III
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "AudioGeneratorM4A.h"
+
+#define FOURCC(a, b, c, d) (((uint32_t)(a) << 24) | ((uint32_t)(b) << 16) | ((uint32_t)(c) << 8) | (uint32_t)(d))
+
+static inline uint32_t BE16(const uint8_t *p) { return (p[0] << 8) | p[1]; }
+static inline uint32_t BE32(const uint8_t *p) { return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; }
+
+static const uint32_t ascRates[] PROGMEM = { 96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000, 7350 };
+
+// MSB-first bit reader for the AudioSpecificConfig
+static uint32_t GetBits(const uint8_t *p, int len, int *bit, int n)
+{
+  uint32_t v = 0;
+  while (n--) {
+    int byte = *bit >> 3;
+    uint32_t b = (byte < len) ? (p[byte] >> (7 - (*bit & 7))) & 1 : 0;
+    v = (v << 1) | b;
+    (*bit)++;
+  }
+  return v;
+}
+
+// Expandable descriptor length, 1 to 4 bytes of 7 bits each
+static uint32_t GetDescLen(const uint8_t *p, int len, int *pos)
+{
+  uint32_t v = 0;
+  for (int i = 0; (i < 4) && (*pos < len); i++) {
+    uint8_t b = p[(*pos)++];
+    v = (v << 7) | (b & 0x7f);
+    if (!(b & 0x80)) break;
+  }
+  return v;
+}
+
+AudioGeneratorM4A::AudioGeneratorM4A() : AudioGeneratorAAC()
+{
+  timescale = 0;
+  presentStart = 0;
+  presentEnd = 0;
+  found = false;
+}
+
+AudioGeneratorM4A::AudioGeneratorM4A(void *preallocateData, int preallocateSz) : AudioGeneratorAAC(preallocateData, preallocateSz)
+{
+  timescale = 0;
+  presentStart = 0;
+  presentEnd = 0;
+  found = false;
+}
+
+AudioGeneratorM4A::~AudioGeneratorM4A()
+{
+}
+
+void AudioGeneratorM4A::Table::Set(uint32_t pos, uint32_t count, uint8_t entrySize)
+{
+  this->pos = pos;
+  this->count = count;
+  this->entrySize = entrySize;
+  cacheFirst = 0;
+  cacheCount = 0;
+}
+
+bool AudioGeneratorM4A::Table::Get(AudioFileSource *file, uint32_t idx, uint32_t *a, uint32_t *b, uint32_t *c)
+{
+  if (idx >= count) return false;
+  if ((idx < cacheFirst) || (idx >= cacheFirst + cacheCount)) {
+    uint32_t n = sizeof(cache) / entrySize;
+    if (n > count - idx) n = count - idx;
+    cacheCount = 0;
+    if (!file->seek(pos + idx * entrySize, SEEK_SET)) return false;
+    if (file->read(cache, n * entrySize) != n * entrySize) return false;
+    cacheFirst = idx;
+    cacheCount = n;
+  }
+  const uint8_t *p = cache + (idx - cacheFirst) * entrySize;
+  *a = BE32(p);
+  if (b) *b = BE32(p + 4);
+  if (c) *c = BE32(p + 8);
+  return true;
+}
+
+bool AudioGeneratorM4A::ReadAt(uint32_t pos, void *dst, int len)
+{
+  if (!file->seek(pos, SEEK_SET)) return false;
+  return file->read(dst, len) == (uint32_t)len;
+}
+
+bool AudioGeneratorM4A::SampleSize(uint32_t idx, uint32_t *size)
+{
+  if (fixedSize) {
+    *size = fixedSize;
+    return idx < stsz.count;
+  }
+  return stsz.Get(file, idx, size);
+}
+
+bool AudioGeneratorM4A::ChunkOffset(uint32_t idx, uint32_t *offset)
+{
+  if (!co64) return stco.Get(file, idx, offset);
+  uint32_t hi;
+  if (!stco.Get(file, idx, &hi, offset)) return false;
+  return hi == 0; // Data past 4GB can't be seek()ed to anyway
+}
+
+bool AudioGeneratorM4A::ParseSampleEntry(uint32_t pos, uint32_t end)
+{
+  uint8_t hdr[36];
+  if ((end - pos < sizeof(hdr)) || !ReadAt(pos, hdr, sizeof(hdr))) return false;
+  if (BE32(hdr + 4) != FOURCC('m', 'p', '4', 'a')) return true; // Not AAC, but not an error either
+  uint32_t entryEnd = pos + BE32(hdr);
+  if ((entryEnd > end) || (entryEnd < pos + sizeof(hdr))) return false;
+  trk.channels = BE16(hdr + 24);
+  trk.sampleRate = BE32(hdr + 32) >> 16;
+  // QuickTime sound description versions 1 and 2 carry extra fields before the child boxes
+  uint32_t child = pos + 36;
+  if (BE16(hdr + 16) == 1) child += 16;
+  else if (BE16(hdr + 16) == 2) child += 36;
+
+  while (child + 8 <= entryEnd) {
+    if (!ReadAt(child, hdr, 8)) return false;
+    uint32_t size = BE32(hdr);
+    uint32_t type = BE32(hdr + 4);
+    if ((size < 8) || (child + size > entryEnd)) return false;
+    if (type == FOURCC('w', 'a', 'v', 'e')) {
+      // QuickTime wraps the esds one level deeper
+      entryEnd = child + size;
+      child += 8;
+      continue;
+    }
+    if (type != FOURCC('e', 's', 'd', 's')) {
+      child += size;
+      continue;
+    }
+
+    // The whole ES_Descriptor is only a few dozen bytes, and buff[] is idle until playback
+    int len = size - 8;
+    if (len > buffLen) len = buffLen;
+    if (!ReadAt(child + 8, buff, len)) return false;
+    int p = 4; // Version and flags
+    while (p + 2 <= len) {
+      uint8_t tag = buff[p++];
+      uint32_t dlen = GetDescLen(buff, len, &p);
+      if (tag == 0x03) { // ES_Descriptor, step inside
+        if (p + 3 > len) return false;
+        uint8_t flags = buff[p + 2];
+        p += 3;
+        if (flags & 0x80) p += 2;
+        if ((flags & 0x40) && (p < len)) p += 1 + buff[p];
+        if (flags & 0x20) p += 2;
+      } else if (tag == 0x04) { // DecoderConfigDescriptor, step inside
+        if ((p >= len) || (buff[p] != 0x40)) return true; // Not MPEG-4 audio
+        p += 13;
+      } else if (tag == 0x05) { // DecoderSpecificInfo is the AudioSpecificConfig
+        const uint8_t *asc = buff + p;
+        int ascLen = ((uint32_t)(len - p) < dlen) ? len - p : dlen;
+        int bit = 0;
+        uint32_t aot = GetBits(asc, ascLen, &bit, 5);
+        if (aot == 31) aot = 32 + GetBits(asc, ascLen, &bit, 6);
+        uint32_t sfi = GetBits(asc, ascLen, &bit, 4);
+        uint32_t rate = (sfi == 0xf) ? GetBits(asc, ascLen, &bit, 24) : (sfi < 13) ? pgm_read_dword(&ascRates[sfi]) : 0;
+        uint32_t chanCfg = GetBits(asc, ascLen, &bit, 4);
+        if ((aot == 5) || (aot == 29)) {
+          // Explicit HE-AAC(v2) signalling, the core is described next and the SBR layer rides along
+          sfi = GetBits(asc, ascLen, &bit, 4);
+          if (sfi == 0xf) GetBits(asc, ascLen, &bit, 24);
+          aot = GetBits(asc, ascLen, &bit, 5);
+          if (aot == 31) aot = 32 + GetBits(asc, ascLen, &bit, 6);
+        }
+        if (aot != 2) {
+          audioLogger->printf_P(PSTR("M4A: Unsupported audio object type %d\n"), (int)aot);
+          return true;
+        }
+        trk.isAAC = true;
+        if (rate) trk.sampleRate = rate;
+        if ((chanCfg == 1) || (chanCfg == 2)) trk.channels = chanCfg;
+        return true;
+      } else {
+        p += dlen;
+      }
+    }
+    return true;
+  }
+  return true;
+}
+
+bool AudioGeneratorM4A::ParseBoxes(uint32_t pos, uint32_t end, int depth)
+{
+  uint8_t hdr[24];
+  if (depth > 8) return false;
+  while (pos + 8 <= end) {
+    if (!ReadAt(pos, hdr, 8)) return false;
+    uint32_t size = BE32(hdr);
+    uint32_t type = BE32(hdr + 4);
+    uint32_t hdrLen = 8;
+    if (size == 1) {
+      // 64-bit size, only mdat is ever that big and it's skipped
+      if (!ReadAt(pos + 8, hdr + 8, 8)) return false;
+      hdrLen = 16;
+      size = BE32(hdr + 8) ? end - pos : BE32(hdr + 12);
+    } else if (size == 0) {
+      size = end - pos;
+    }
+    if (size < hdrLen) return false;
+    if (size > end - pos) size = end - pos; // Truncated file, take what's there
+    uint32_t body = pos + hdrLen;
+    uint32_t bodyLen = size - hdrLen;
+
+    switch (type) {
+      case FOURCC('m', 'o', 'o', 'v'):
+      case FOURCC('m', 'd', 'i', 'a'):
+      case FOURCC('m', 'i', 'n', 'f'):
+      case FOURCC('s', 't', 'b', 'l'):
+      case FOURCC('e', 'd', 't', 's'):
+        if (!ParseBoxes(body, body + bodyLen, depth + 1)) return false;
+        break;
+
+      case FOURCC('t', 'r', 'a', 'k'): {
+        if (found) break; // First AAC track wins, and trk[] still describes it
+        uint32_t mts = trk.movieTimescale;
+        memset(&trk, 0, sizeof(trk));
+        trk.movieTimescale = mts;
+        if (!ParseBoxes(body, body + bodyLen, depth + 1)) return false;
+        if (trk.isSound && trk.isAAC && trk.timescale && trk.stszCount && trk.stcoCount && trk.stscCount && trk.sttsCount) {
+          found = true;
+          timescale = trk.timescale;
+          stsz.Set(trk.stszPos, trk.stszCount, 4);
+          fixedSize = trk.stszFixed;
+          co64 = trk.co64;
+          stco.Set(trk.stcoPos, trk.stcoCount, co64 ? 8 : 4);
+          stsc.Set(trk.stscPos, trk.stscCount, 12);
+          stts.Set(trk.sttsPos, trk.sttsCount, 8);
+          presentStart = trk.hasEdit ? trk.editTime : 0;
+          presentEnd = trk.duration ? trk.duration : 0xffffffff;
+          if (trk.hasEdit && trk.editDuration && trk.movieTimescale) {
+            uint64_t d = (uint64_t)trk.editDuration * trk.timescale / trk.movieTimescale;
+            if (presentStart + d < presentEnd) presentEnd = presentStart + d;
+          }
+        }
+        break;
+      }
+
+      case FOURCC('m', 'v', 'h', 'd'):
+        if (bodyLen < 24) return false;
+        if (!ReadAt(body, hdr, 24)) return false;
+        trk.movieTimescale = BE32(hdr + ((hdr[0] == 1) ? 20 : 12));
+        break;
+
+      case FOURCC('m', 'd', 'h', 'd'):
+        if (bodyLen < 24) return false;
+        if (!ReadAt(body, hdr, 24)) return false;
+        if (hdr[0] == 1) {
+          if (bodyLen < 32 || !ReadAt(body + 20, hdr, 12)) return false;
+          trk.timescale = BE32(hdr);
+          trk.duration = BE32(hdr + 4) ? 0 : BE32(hdr + 8);
+        } else {
+          trk.timescale = BE32(hdr + 12);
+          trk.duration = BE32(hdr + 16);
+        }
+        break;
+
+      case FOURCC('h', 'd', 'l', 'r'):
+        if (bodyLen < 12) return false;
+        if (!ReadAt(body, hdr, 12)) return false;
+        trk.isSound = BE32(hdr + 8) == FOURCC('s', 'o', 'u', 'n');
+        break;
+
+      case FOURCC('e', 'l', 's', 't'): {
+        if (bodyLen < 8) return false;
+        if (!ReadAt(body, hdr, 8)) return false;
+        bool v1 = hdr[0] == 1;
+        uint32_t entries = BE32(hdr + 4);
+        uint32_t entrySize = v1 ? 20 : 12;
+        for (uint32_t i = 0; (i < entries) && (8 + (i + 1) * entrySize <= bodyLen); i++) {
+          if (!ReadAt(body + 8 + i * entrySize, hdr, entrySize)) return false;
+          // Empty edits (media_time -1) only delay the track, which doesn't matter for playback
+          if (v1) {
+            if ((BE32(hdr + 8) == 0xffffffff) && (BE32(hdr + 12) == 0xffffffff)) continue;
+            trk.editDuration = BE32(hdr) ? 0xffffffff : BE32(hdr + 4);
+            trk.editTime = BE32(hdr + 12);
+          } else {
+            if (BE32(hdr + 4) == 0xffffffff) continue;
+            trk.editDuration = BE32(hdr);
+            trk.editTime = BE32(hdr + 4);
+          }
+          trk.hasEdit = true;
+          break;
+        }
+        break;
+      }
+
+      case FOURCC('s', 't', 's', 'd'):
+        if (bodyLen < 8 + 36) return false;
+        if (!ParseSampleEntry(body + 8, body + bodyLen)) return false;
+        break;
+
+      case FOURCC('s', 't', 't', 's'):
+      case FOURCC('s', 't', 's', 'c'):
+      case FOURCC('s', 't', 'c', 'o'):
+      case FOURCC('c', 'o', '6', '4'): {
+        if (bodyLen < 8) return false;
+        if (!ReadAt(body, hdr, 8)) return false;
+        uint32_t entrySize = (type == FOURCC('s', 't', 's', 'c')) ? 12 : (type == FOURCC('s', 't', 'c', 'o')) ? 4 : 8;
+        uint32_t count = BE32(hdr + 4);
+        if (count > (bodyLen - 8) / entrySize) return false;
+        if (type == FOURCC('s', 't', 't', 's')) {
+          trk.sttsPos = body + 8;
+          trk.sttsCount = count;
+        } else if (type == FOURCC('s', 't', 's', 'c')) {
+          trk.stscPos = body + 8;
+          trk.stscCount = count;
+        } else {
+          trk.stcoPos = body + 8;
+          trk.stcoCount = count;
+          trk.co64 = type == FOURCC('c', 'o', '6', '4');
+        }
+        break;
+      }
+
+      case FOURCC('s', 't', 's', 'z'): {
+        if (bodyLen < 12) return false;
+        if (!ReadAt(body, hdr, 12)) return false;
+        trk.stszFixed = BE32(hdr + 4);
+        trk.stszCount = BE32(hdr + 8);
+        trk.stszPos = body + 12;
+        if (!trk.stszFixed && (trk.stszCount > (bodyLen - 12) / 4)) return false;
+        break;
+      }
+
+      default:
+        break;
+    }
+    pos += size;
+  }
+  return true;
+}
+
+// Find the AU holding media time target, back up by preroll AUs, and point every table cursor at it
+bool AudioGeneratorM4A::PositionCursor(uint32_t target, uint32_t preroll)
+{
+  uint32_t count, delta;
+  uint32_t first = 0;
+  uint64_t t = 0;
+  uint32_t idx;
+  for (idx = 0; ; idx++) {
+    if (!stts.Get(file, idx, &count, &delta)) return false;
+    if (delta && (target < t + (uint64_t)count * delta)) break;
+    t += (uint64_t)count * delta;
+    first += count;
+  }
+  uint32_t k = first + (uint32_t)((target - t) / delta);
+  k = (k > preroll) ? k - preroll : 0;
+  if (k >= stsz.count) return false;
+
+  // Now the timing of AU k itself
+  first = 0;
+  t = 0;
+  for (idx = 0; ; idx++) {
+    if (!stts.Get(file, idx, &count, &delta)) return false;
+    if (k < first + count) break;
+    t += (uint64_t)count * delta;
+    first += count;
+  }
+  timeIdx = idx;
+  timeLeft = first + count - k;
+  timeDelta = delta;
+  auTime = t + (uint64_t)(k - first) * delta;
+
+  // Which chunk, from the runs of equally-filled chunks in stsc
+  uint32_t runFirstAU = 0;
+  for (idx = 0; ; idx++) {
+    uint32_t firstChunk, spc, next;
+    if (!stsc.Get(file, idx, &firstChunk, &spc)) return false;
+    if (!stsc.Get(file, idx + 1, &next)) next = stco.count + 1;
+    if (!firstChunk || (next <= firstChunk) || !spc) return false;
+    uint32_t runAUs = (next - firstChunk) * spc;
+    if (k < runFirstAU + runAUs) {
+      runIdx = idx;
+      runSamples = spc;
+      runEndChunk = next - 1;
+      chunk = firstChunk - 1 + (k - runFirstAU) / spc;
+      uint32_t chunkFirstAU = k - (k - runFirstAU) % spc;
+      chunkEndAU = chunkFirstAU + spc;
+      if (!ChunkOffset(chunk, &auPos)) return false;
+      for (uint32_t i = chunkFirstAU; i < k; i++) {
+        uint32_t size;
+        if (!SampleSize(i, &size)) return false;
+        auPos += size;
+      }
+      break;
+    }
+    runFirstAU += runAUs;
+  }
+  au = k;
+  return true;
+}
+
+bool AudioGeneratorM4A::NextChunk()
+{
+  chunk++;
+  if (chunk >= runEndChunk) {
+    uint32_t firstChunk, next;
+    runIdx++;
+    if (!stsc.Get(file, runIdx, &firstChunk, &runSamples)) return false;
+    if (!stsc.Get(file, runIdx + 1, &next)) next = stco.count + 1;
+    if (!runSamples || (next <= firstChunk)) return false;
+    runEndChunk = next - 1;
+  }
+  chunkEndAU = au + runSamples;
+  return ChunkOffset(chunk, &auPos);
+}
+
+bool AudioGeneratorM4A::FillBufferWithValidFrame()
+{
+  while (true) {
+    if ((au >= stsz.count) || (auTime >= presentEnd)) return false;
+    uint32_t size;
+    if (!SampleSize(au, &size)) return false;
+    uint32_t pos = auPos;
+    frameTime = auTime;
+    frameDelta = timeDelta;
+
+    // Step the cursor past this AU
+    auPos += size;
+    au++;
+    auTime += timeDelta;
+    if (!--timeLeft) {
+      uint32_t delta;
+      while (stts.Get(file, ++timeIdx, &timeLeft, &delta) && !timeLeft) { /* skip empty entries */ }
+      if (timeLeft) timeDelta = delta;
+      else timeLeft = 0xffffffff; // Table ran out early, keep the last duration
+    }
+    if ((au == chunkEndAU) && (au < stsz.count) && !NextChunk()) au = stsz.count;
+
+    if (size > (uint32_t)buffLen) {
+      cb.st(ERR_AAC_INVALID_FRAME, PSTR("M4A access unit too large"));
+      continue;
+    }
+    if (!ReadAt(pos, buff, size)) return false;
+    buffValid = size;
+    lastFrameEnd = 0;
+    frameStart = 0;
+    return true;
+  }
+}
+
+// Drop whatever falls outside [winStart, presentEnd), which takes care of encoder delay,
+// padding at the end, and the preroll AU decoded before a seek point
+void AudioGeneratorM4A::FrameDecoded()
+{
+  if (!frameDelta || !validSamples) return;
+  uint32_t lo = (frameTime < winStart) ? winStart : frameTime;
+  uint32_t hi = frameTime + frameDelta;
+  if (hi > presentEnd) hi = presentEnd;
+  if (hi <= lo) {
+    validSamples = 0;
+    return;
+  }
+  // The decoder may output at a different rate than the track's timescale (SBR)
+  int skip = (uint64_t)(lo - frameTime) * validSamples / frameDelta;
+  int keep = (uint64_t)(hi - frameTime) * validSamples / frameDelta;
+  curSample = skip;
+  validSamples = keep - skip;
+}
+
+bool AudioGeneratorM4A::seek(uint32_t sample)
+{
+  AudioMemory::Scope scope(&mem);
+  if (!running) return false;
+  uint32_t target = presentStart + sample;
+  if ((target < presentStart) || (target >= presentEnd)) return false;
+  // AAC frames overlap by half, so the AU before the target must be decoded to rebuild it
+  if (!PositionCursor(target, 1)) {
+    running = false;
+    return false;
+  }
+  AACFlushCodec(hAACDecoder);
+  winStart = target;
+  buffValid = 0;
+  validSamples = 0;
+  curSample = 0;
+  return true;
+}
+
+bool AudioGeneratorM4A::begin(AudioFileSource *source, AudioOutput *output)
+{
+  AudioMemory::Scope scope(&mem);
+  if (!source) return false;
+  file = source;
+  if (!output) return false;
+  this->output = output;
+  if (!file->isOpen()) return false; // Error
+
+  memset(&trk, 0, sizeof(trk));
+  found = false;
+  if (!ParseBoxes(0, file->getSize(), 0) || !found) {
+    audioLogger->printf_P(PSTR("ERROR: No AAC-LC track found in M4A\n"));
+    return false;
+  }
+  if ((trk.channels < 1) || (trk.channels > AAC_MAX_NCHANS)) {
+    audioLogger->printf_P(PSTR("ERROR: Unsupported M4A channel count %d\n"), trk.channels);
+    return false;
+  }
+
+  // No ADTS headers, so the decoder is told up front what it's getting
+  AACFrameInfo fi;
+  memset(&fi, 0, sizeof(fi));
+  fi.nChans = trk.channels;
+  fi.sampRateCore = trk.sampleRate;
+  fi.profile = AAC_PROFILE_LC;
+  if (AACSetRawBlockParams(hAACDecoder, 0, &fi)) {
+    audioLogger->printf_P(PSTR("ERROR: Unsupported M4A sample rate %d\n"), trk.sampleRate);
+    return false;
+  }
+  AACFlushCodec(hAACDecoder);
+  SetSBRMode(sbrMode, sbrMaxLoad);
+
+  // Start right at the first AU, the edit list trims the priming samples in FrameDecoded()
+  if (!PositionCursor(0, 0)) {
+    audioLogger->printf_P(PSTR("ERROR: Corrupt M4A sample tables\n"));
+    return false;
+  }
+  winStart = presentStart;
+  buffValid = 0;
+  lastFrameEnd = 0;
+  frameStart = 0;
+  validSamples = 0;
+  curSample = 0;
+
+  output->begin();
+
+  // AAC always comes out at 16 bits
+  output->SetBitsPerSample(16);
+
+  memset(outSample, 0, outSampleLen*sizeof(int16_t));
+
+  running = true;
+
+  return true;
+}
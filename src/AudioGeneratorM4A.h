@@ -0,0 +1,119 @@
+/*
+  AudioGeneratorM4A
+  Audio output generator for AAC in MP4/M4A (ISO BMFF) files, using the Helix AAC decoder
+
+  Copyright (C) 2022  Earle F. Philhower, III
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _AUDIOGENERATORM4A_H
+#define _AUDIOGENERATORM4A_H
+
+#include "AudioGeneratorAAC.h"
+
+// Raw AAC access units have no sync word or length, so the sample tables in the 'moov' box are
+// the only way to find them.  Those tables are left in the file and walked through a few small
+// windows, so RAM use doesn't grow with the length of the track, but the source must support
+// seek() (SPIFFS, LittleFS, SD, PROGMEM, ...).  The 'moov' box may come before or after 'mdat'.
+class AudioGeneratorM4A : public AudioGeneratorAAC
+{
+  public:
+    AudioGeneratorM4A();
+    AudioGeneratorM4A(void *preallocateData, int preallocateSize);
+    virtual ~AudioGeneratorM4A() override;
+    virtual bool begin(AudioFileSource *source, AudioOutput *output) override;
+
+    // Positions are in the track's timescale (normally its sample rate) and count from the first
+    // sample the edit list presents, so encoder delay and padding are never heard
+    bool seek(uint32_t sample);
+    uint32_t getLength() { return presentEnd - presentStart; }
+    uint32_t getTimescale() { return timescale; }
+
+  protected:
+    // Read-through cache onto one table of fixed-size big-endian entries
+    class Table
+    {
+      public:
+        void Set(uint32_t pos, uint32_t count, uint8_t entrySize);
+        bool Get(AudioFileSource *file, uint32_t idx, uint32_t *a, uint32_t *b = NULL, uint32_t *c = NULL);
+        uint32_t count;
+
+      private:
+        uint32_t pos;
+        uint32_t cacheFirst;
+        uint8_t cacheCount;
+        uint8_t entrySize;
+        uint8_t cache[64];
+    };
+    Table stsz, stco, stsc, stts;
+    uint32_t fixedSize;   // Nonzero when every access unit is this big and stsz has no table
+    bool co64;
+
+    uint32_t timescale;
+    uint32_t presentStart; // Media time of the first presented sample (edit list)
+    uint32_t presentEnd;   // ...and one past the last
+    uint32_t winStart;     // Output before this is dropped (presentStart, or a seek target)
+
+    // Cursor over the access units
+    uint32_t au;           // Next AU to read
+    uint32_t auPos;        // File offset of au
+    uint32_t auTime;       // Media time of au
+    uint32_t chunk;        // Chunk holding au
+    uint32_t chunkEndAU;   // First AU of the following chunk
+    uint32_t runIdx;       // stsc entry in effect for chunk
+    uint32_t runEndChunk;  // First chunk of the next stsc entry
+    uint32_t runSamples;   // AUs per chunk in this run
+    uint32_t timeIdx;      // stts entry in effect for au
+    uint32_t timeLeft;     // AUs left in it
+    uint32_t timeDelta;    // Duration of each of them
+
+    // Time span of the AU sitting in buff[]
+    uint32_t frameTime;
+    uint32_t frameDelta;
+
+    bool ParseBoxes(uint32_t pos, uint32_t end, int depth);
+    bool ParseSampleEntry(uint32_t pos, uint32_t end);
+    bool ReadAt(uint32_t pos, void *dst, int len);
+    bool SampleSize(uint32_t idx, uint32_t *size);
+    bool ChunkOffset(uint32_t idx, uint32_t *offset);
+    bool PositionCursor(uint32_t target, uint32_t preroll);
+    bool NextChunk();
+    virtual bool FillBufferWithValidFrame() override;
+    virtual void FrameDecoded() override;
+
+  private:
+    // Scratch state filled in while walking one 'trak'
+    typedef struct {
+      uint32_t movieTimescale;
+      uint32_t timescale;
+      uint32_t duration;
+      uint32_t editTime;
+      uint32_t editDuration; // In the movie timescale
+      bool hasEdit;
+      bool isSound;
+      bool isAAC;
+      int channels;
+      int sampleRate;
+      uint32_t stszPos, stszCount, stszFixed;
+      uint32_t stcoPos, stcoCount;
+      bool co64;
+      uint32_t stscPos, stscCount;
+      uint32_t sttsPos, sttsCount;
+    } Track;
+    Track trk;
+    bool found;
+};
+
+#endif
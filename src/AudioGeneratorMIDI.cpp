@@ -66,6 +66,24 @@
 
 #define TSF_NO_STDIO
 #define TSF_IMPLEMENTATION
+#ifndef TSF_FIXEDPOINT
+// Render without any float math in the voices, build with TSF_FIXEDPOINT=0 for the older
+// nearest-sample renderer without the lowpass filter
+#define TSF_FIXEDPOINT 1
+#endif
+#define TSF_MALLOC  audio_malloc
+#define TSF_FREE    audio_free
+#define TSF_REALLOC audio_realloc
+#ifdef ESP32
+// Cache blocks are only touched on a miss or once per voice per block, so PSRAM is fine for them
+static void *midi_cache_malloc(size_t size)
+{
+  void *p = ps_malloc(size);
+  return p ? p : malloc(size);
+}
+#define TSF_CACHE_MALLOC midi_cache_malloc
+#define TSF_CACHE_FREE   free
+#endif
 #include "libtinysoundfont/tsf.h"
 
 /****************  utility routines  **********************/
@@ -335,164 +353,326 @@ note_off:
 }
 
 
-// Open file, parse headers, get ready to process MIDI
-void AudioGeneratorMIDI::PrepareMIDI(AudioFileSource *src)
-{
-  MakeStreamFromAFS(src, &afsMIDI);
-  tsf_stream_wrap_cached(&afsMIDI, 32, 64, &buffer);
-  buflen = buffer.size (buffer.data);
-
-  /* process the MIDI file header */
-
-  hdrptr = buffer.tell (buffer.data);  /* pointer to file and track headers */
-  process_header ();
-  printf ("  Processing %d tracks.\n", num_tracks);
-  if (num_tracks > MAX_TRACKS)
-    midi_error ("Too many tracks", buffer.tell (buffer.data));
-
-  /* initialize processing of all the tracks */
+/* Rewind every track to its first note on/off and put them all in the merge heap */
 
+void AudioGeneratorMIDI::start_tracks (void) {
+  memset(track, 0, sizeof(track));
+  memset(midi_chan_instrument, 0, sizeof(midi_chan_instrument));
+  tracks_done = 0;
+  timenow = 0;
+  tempo = 500000;              /* 120 beats per minute until told otherwise */
+  hdrptr = tracksptr;
+  heapLen = 0;
   for (tracknum = 0; tracknum < num_tracks; ++tracknum) {
     start_track (tracknum);   /* process the track header */
     find_note (tracknum);     /* position to the first note on/off */
+    track[tracknum].order = tracknum;
+    if (track[tracknum].cmd != CMD_TRACKDONE)
+      heap[heapLen++] = tracknum;
   }
+  nextOrder = num_tracks;
+  for (int i = heapLen / 2 - 1; i >= 0; --i)
+    heap_down (i);
+}
 
-  notes_skipped = 0;
-  tracknum = 0;
-  earliest_tracknum = 0;
-  earliest_time = 0;
+/* Sift a heap entry down until neither child has an earlier event, or an equally early one
+   from a track which has waited longer for its turn */
+
+void AudioGeneratorMIDI::heap_down (int i) {
+  while (true) {
+    int first = i;
+    for (int c = 2 * i + 1; c <= 2 * i + 2 && c < heapLen; ++c) {
+      struct track_status *a = &track[heap[c]], *b = &track[heap[first]];
+      if (a->time < b->time || (a->time == b->time && a->order < b->order))
+        first = c;
+    }
+    if (first == i)
+      return;
+    unsigned char t = heap[i];
+    heap[i] = heap[first];
+    heap[first] = t;
+    i = first;
+  }
 }
 
-// Parses the note on/offs until we are ready to render some more samples.  Then return the
-// total number of samples to render before we need to be called again
-int AudioGeneratorMIDI::PlayMIDI()
-{
-  /* Continue processing all tracks, in an order based on the simulated time.
-    This is not unlike multiway merging used for tape sorting algorithms in the 50's! */
-
-  do {                         /* while there are still track notes to process */
-    static struct track_status *trk;
-    static struct tonegen_status *tg;
-    static int tgnum;
-    static int count_tracks;
-    static unsigned long delta_time, delta_msec;
-
-    /* Find the track with the earliest event time,
-       and output a delay command if time has advanced.
-
-       A potential improvement: If there are multiple tracks with the same time,
-       first do the ones with STOPNOTE as the next command, if any.  That would
-       help avoid running out of tone generators.  In practice, though, most MIDI
-       files do all the STOPNOTEs first anyway, so it won't have much effect.
-    */
-
-    earliest_time = 0x7fffffff;
-
-    /* Usually we start with the track after the one we did last time (tracknum),
-       so that if we run out of tone generators, we have been fair to all the tracks.
-       The alternate "strategy1" says we always start with track 0, which means
-       that we favor early tracks over later ones when there aren't enough tone generators.
-    */
-
-    count_tracks = num_tracks;
-    do {
-      if (++tracknum >= num_tracks)
-        tracknum = 0;
-      trk = &track[tracknum];
-      if (trk->cmd != CMD_TRACKDONE && trk->time < earliest_time) {
-        earliest_time = trk->time;
-        earliest_tracknum = tracknum;
-      }
-    } while (--count_tracks);
+/* Use up the event of the track at the top of the heap, which then goes behind any other tracks
+   with events at the same time so that if we run out of tone generators, we have been fair to
+   all the tracks.  A "stop note" keeps the turn while the track has more "stop notes" at the same
+   time, though, which frees up as many tone generators as possible. */
+
+void AudioGeneratorMIDI::next_note (int tracknum) {
+  struct track_status *trk = &track[tracknum];
+  bool stopping = (trk->cmd == CMD_STOPNOTE);
+  find_note (tracknum);
+  if (trk->cmd == CMD_TRACKDONE)
+    heap[0] = heap[--heapLen];
+  else if (!stopping || trk->cmd != CMD_STOPNOTE || trk->time != timenow)
+    trk->order = nextOrder++;
+  heap_down (0);
+}
+
+/* Continue processing all tracks, in an order based on the simulated time.  This is not unlike
+   multiway merging used for tape sorting algorithms in the 50's!  Returns the next note event,
+   or the delay before it, and false once every track is done. */
 
-    tracknum = earliest_tracknum;     /* the track we picked */
-    trk = &track[tracknum];
-    if (earliest_time < timenow)
+bool AudioGeneratorMIDI::next_event (struct midi_event *ev) {
+  while (heapLen && running) {
+    int tn = heap[0];         /* the track with the earliest event */
+    struct track_status *trk = &track[tn];
+    if (trk->time < timenow)
       midi_error ("INTERNAL: time went backwards", trk->trkptr);
 
     /* If time has advanced, output a "delay" command */
 
-    delta_time = earliest_time - timenow;
+    unsigned long delta_time = trk->time - timenow;
     if (delta_time) {
       /* Convert ticks to milliseconds based on the current tempo */
       unsigned long long temp;
       temp = ((unsigned long long) delta_time * tempo) / ticks_per_beat;
-      delta_msec = temp / 1000;      // get around LCC compiler bug
+      unsigned long delta_msec = temp / 1000;      // get around LCC compiler bug
       if (delta_msec > 0x7fff)
         midi_error ("INTERNAL: time delta too big", trk->trkptr);
-      int samples = (((int) delta_msec) * freq) / 1000;
-      timenow = earliest_time;
-      return samples;
+      ev->type = EVENT_DELAY;
+      ev->samples = (((int) delta_msec) * freq) / 1000;
+      timenow = trk->time;
+      return true;
     }
-    timenow = earliest_time;
 
     /*  If this track event is "set tempo", just change the global tempo.
        That affects how we generate "delay" commands. */
 
     if (trk->cmd == CMD_TEMPO) {
       tempo = trk->tempo;
-      find_note (tracknum);
+      next_note (tn);
+      continue;
+    }
+
+    ev->type = (trk->cmd == CMD_STOPNOTE) ? EVENT_NOTEOFF : EVENT_NOTEON;
+    ev->track = tn;
+    ev->note = trk->note;
+    ev->velocity = trk->velocity;
+    ev->instrument = midi_chan_instrument[trk->chan];
+    next_note (tn);           // use up the note
+    return true;
+  }
+  return false;
+}
+
+/* Encode an event for the preparsed list, returning its length.  Only counts when out is NULL. */
+
+int AudioGeneratorMIDI::put_event (uint8_t *out, const struct midi_event *ev) {
+  uint8_t buf[6];
+  int len = 0;
+  switch (ev->type) {
+    case EVENT_NOTEOFF:
+      buf[len++] = EVENT_NOTEOFF | ev->track;
+      buf[len++] = ev->note;
+      break;
+    case EVENT_NOTEON:
+      buf[len++] = EVENT_NOTEON | ev->track;
+      buf[len++] = ev->note;
+      buf[len++] = ev->velocity;
+      buf[len++] = ev->instrument;
+      break;
+    case EVENT_DELAY:
+      if (!ev->samples)
+        return 0;
+      buf[len++] = EVENT_DELAY;
+      /* same variable-length form as the MIDI file itself, most significant 7 bits first */
+      for (int shift = 28; shift > 0; shift -= 7)
+        if (ev->samples >> shift)
+          buf[len++] = 0x80 | ((ev->samples >> shift) & 0x7f);
+      buf[len++] = ev->samples & 0x7f;
+      break;
+    default:
+      buf[len++] = EVENT_END;
+      break;
+  }
+  if (out)
+    memcpy(out, buf, len);
+  return len;
+}
+
+bool AudioGeneratorMIDI::read_event (struct midi_event *ev) {
+  uint8_t type = events[eventPos];
+  if (type == EVENT_END)
+    return false;
+  eventPos++;
+  ev->type = type & 0xe0;
+  ev->track = type & 0x1f;
+  if (type == EVENT_DELAY) {
+    uint8_t byte;
+    ev->samples = 0;
+    do {
+      byte = events[eventPos++];
+      ev->samples = (ev->samples << 7) | (byte & 0x7f);
+    } while (byte & 0x80);
+  } else {
+    ev->note = events[eventPos++];
+    if (ev->type == EVENT_NOTEON) {
+      ev->velocity = events[eventPos++];
+      ev->instrument = events[eventPos++];
     }
+  }
+  return true;
+}
 
-    /*  If this track event is "stop note", process it and all subsequent "stop notes" for this track
-       that are happening at the same time. Doing so frees up as many tone generators as possible.  */
-
-    else if (trk->cmd == CMD_STOPNOTE)
-      do {
-        // stop a note
-        for (tgnum = 0; tgnum < num_tonegens; ++tgnum) {    /* find which generator is playing it */
-          tg = &tonegen[tgnum];
-          if (tg->playing && tg->track == tracknum && tg->note == trk->note) {
-            tsf_note_off (g_tsf, tg->instrument, tg->note);
-            tg->playing = false;
-            trk->tonegens[tgnum] = false;
-          }
-        }
-        find_note (tracknum);       // use up the note
-      } while (trk->cmd == CMD_STOPNOTE && trk->time == timenow);
-
-    /*  If this track event is "start note", process only it.
-       Don't do more than one, so we allow other tracks their chance at grabbing tone generators. */
-
-    else if (trk->cmd == CMD_PLAYNOTE) {
-      bool foundgen = false;
-      /* if not, then try for any free tone generator */
-      if (!foundgen)
-        for (tgnum = 0; tgnum < num_tonegens; ++tgnum) {
-          tg = &tonegen[tgnum];
-          if (!tg->playing) {
-            foundgen = true;
-            break;
-          }
-        }
-      if (foundgen) {
-        if (tgnum + 1 > num_tonegens_used)
-          num_tonegens_used = tgnum + 1;
-        tg->playing = true;
-        tg->track = tracknum;
-        tg->note = trk->note;
-        trk->tonegens[tgnum] = true;
-        trk->preferred_tonegen = tgnum;
-        if (tg->instrument != midi_chan_instrument[trk->chan]) {    /* new instrument for this generator */
-          tg->instrument = midi_chan_instrument[trk->chan];
-        }
-        tsf_note_on (g_tsf, tg->instrument, tg->note, trk->velocity / 127.0); // velocity = 0...127
-      } else {
-        ++notes_skipped;
+// Runs the whole merge ahead of time, counting on the first pass so the list can be allocated
+// once at its final size and filled on the second
+bool AudioGeneratorMIDI::Preparse()
+{
+  struct midi_event ev;
+  uint32_t len = 0;
+  while (next_event (&ev))
+    len += put_event (NULL, &ev);
+  if (!running)
+    return false;
+  ev.type = EVENT_END;
+  len += put_event (NULL, &ev);
+
+  start_tracks ();
+  events = reinterpret_cast<uint8_t*>(TSF_CACHE_MALLOC(len));
+  if (!events) {
+    audioLogger->printf_P(PSTR("AudioGeneratorMIDI: Not enough memory to preparse %u bytes, streaming instead\n"), (unsigned)len);
+    return true;
+  }
+  eventsLen = 0;
+  while (next_event (&ev))
+    eventsLen += put_event (events + eventsLen, &ev);
+  ev.type = EVENT_END;
+  eventsLen += put_event (events + eventsLen, &ev);
+  eventPos = 0;
+  return true;
+}
+
+// Open file, parse headers, get ready to process MIDI
+bool AudioGeneratorMIDI::PrepareMIDI(AudioFileSource *src)
+{
+  MakeStreamFromAFS(src, &afsMIDI);
+  if (!tsf_stream_wrap_cached(&afsMIDI, 32, 64, &buffer)) {
+    midi_error("Out of memory", 0);
+    return false;
+  }
+  buflen = buffer.size (buffer.data);
+
+  /* process the MIDI file header */
+
+  hdrptr = buffer.tell (buffer.data);  /* pointer to file and track headers */
+  process_header ();
+  printf ("  Processing %d tracks.\n", num_tracks);
+  if (num_tracks > MAX_TRACKS) {
+    midi_error ("Too many tracks", buffer.tell (buffer.data));
+    return false;
+  }
+
+  /* initialize processing of all the tracks */
+
+  tracksptr = hdrptr;
+  start_tracks ();
+  notes_skipped = 0;
+  eventsLen = 0;
+
+  if (preparse)
+    return Preparse();
+  return running;
+}
+
+/* Start or stop a note on a tone generator */
+
+void AudioGeneratorMIDI::play_event (const struct midi_event *ev) {
+  struct tonegen_status *tg;
+  int tgnum;
+
+  if (ev->type == EVENT_NOTEOFF) {
+    for (tgnum = 0; tgnum < num_tonegens; ++tgnum) {    /* find which generator is playing it */
+      tg = &tonegen[tgnum];
+      if (tg->playing && tg->track == ev->track && tg->note == ev->note) {
+        tsf_note_off (g_tsf, tg->instrument, tg->note);
+        tg->playing = false;
+        track[ev->track].tonegens[tgnum] = false;
       }
-      find_note (tracknum);     // use up the note
+    }
+  } else if (ev->type == EVENT_NOTEON) {
+    /* try for any free tone generator */
+    for (tgnum = 0; tgnum < num_tonegens; ++tgnum)
+      if (!tonegen[tgnum].playing)
+        break;
+    if (tgnum < num_tonegens) {
+      tg = &tonegen[tgnum];
+      if (tgnum + 1 > num_tonegens_used)
+        num_tonegens_used = tgnum + 1;
+      tg->playing = true;
+      tg->track = ev->track;
+      tg->note = ev->note;
+      track[ev->track].tonegens[tgnum] = true;
+      track[ev->track].preferred_tonegen = tgnum;
+      tg->instrument = ev->instrument;
+      tsf_note_on (g_tsf, tg->instrument, tg->note, ev->velocity / 127.0); // velocity = 0...127
+    } else {
+      ++notes_skipped;
     }
   }
-  while (tracks_done < num_tracks);
+}
+
+// Plays the note on/offs until we are ready to render some more samples.  Then return the
+// total number of samples to render before we need to be called again
+int AudioGeneratorMIDI::PlayMIDI()
+{
+  struct midi_event ev;
+  while (fetch_event (&ev)) {
+    if (ev.type == EVENT_DELAY)
+      return ev.samples;
+    play_event (&ev);
+  }
   return -1; // EOF
 }
 
+bool AudioGeneratorMIDI::seek(uint32_t sample)
+{
+  AudioMemory::Scope scope(&mem);
+
+  if (!running) return false;
+
+  // Quickly fade out whatever is playing, and find the spot without playing anything on the way
+  tsf_reset(g_tsf);
+  for (int i = 0; i < MAX_TONEGENS; i++) tonegen[i].playing = false;
+  if (events)
+    eventPos = 0;
+  else
+    start_tracks ();
+
+  struct midi_event ev;
+  uint32_t at = 0;
+  samplesToPlay = 0;
+  while (fetch_event (&ev)) {
+    if (ev.type != EVENT_DELAY) continue;
+    if (at + ev.samples > sample) {
+      samplesToPlay = at + ev.samples - sample;
+      break;
+    }
+    at += ev.samples;
+  }
+  numSamplesRendered = 0;
+  sentSamplesRendered = 0;
+  sawEOF = false;
+  return running;
+}
+
 
 void AudioGeneratorMIDI::StopMIDI()
 {
+  GetCacheStats(); // Keep the final numbers
+  GetPolyphonyStats();
 
-  buffer.close(buffer.data);
+  if (!live) buffer.close(buffer.data);
+  TSF_CACHE_FREE(events);
+  events = NULL;
   tsf_close(g_tsf);
+  g_tsf = NULL;
+  if (live) {
+    live = false;
+    return;
+  }
   printf ("  %s %d tone generators were used.\n",
           num_tonegens_used < num_tonegens ? "Only" : "All", num_tonegens_used);
   if (notes_skipped)
@@ -503,84 +683,249 @@ void AudioGeneratorMIDI::StopMIDI()
 }
 
 
+// Loads the SoundFont and gets it and the output ready, for files and live input alike
+bool AudioGeneratorMIDI::StartSynth(AudioOutput *out)
+{
+  g_tsf = tsf_load(&afsSF2);
+  if (!g_tsf) return false;
+  if (!tsf_set_cache(g_tsf, cacheBlocks, cacheBlockSamples, cacheReadAhead) ||
+      !out->SetRate( freq ) || !out->SetBitsPerSample( 16 ) || !out->SetChannels( stereo ? 2 : 1 ) || !out->begin()) {
+    tsf_close(g_tsf);
+    g_tsf = NULL;
+    return false;
+  }
+  tsf_set_output (g_tsf, stereo ? TSF_STEREO_INTERLEAVED : TSF_MONO, freq, -10 /* dB gain -10 */ );
+  tsf_set_max_voices(g_tsf, maxVoices);
+  memset(&polyStats, 0, sizeof(polyStats));
+  polyStats.limit = maxVoices;
+
+  output = out;
+  samplesToPlay = 0;
+  numSamplesRendered = 0;
+  sentSamplesRendered = 0;
+  sawEOF = false;
+  return true;
+}
+
+
 bool AudioGeneratorMIDI::begin(AudioFileSource *src, AudioOutput *out)
 {
+  AudioMemory::Scope scope(&mem);
+
   // Clear out status variables
   for (int i=0; i<MAX_TONEGENS; i++) memset(&tonegen[i], 0, sizeof(struct tonegen_status));
   for (int i=0; i<MAX_TRACKS; i++) memset(&track[i], 0, sizeof(struct track_status));
   memset(midi_chan_instrument, 0, sizeof(midi_chan_instrument));
 
-  g_tsf = tsf_load(&afsSF2);
-  if (!g_tsf) return false;
-  tsf_set_output (g_tsf, TSF_MONO, freq, -10 /* dB gain -10 */ );
+  live = false;
+  if (!StartSynth(out)) return false;
+  file = src;
 
-  if (!out->SetRate( freq )) return false;
-  if (!out->SetBitsPerSample( 16 )) return false;
-  if (!out->SetChannels( 1 )) return false;
-  if (!out->begin()) return false;
+  running = true;
 
-  output = out;
-  file = src;
+  if (!PrepareMIDI(src)) {
+    tsf_close(g_tsf);
+    g_tsf = NULL;
+    running = false;
+    return false;
+  }
+  return running;
+}
+
+
+bool AudioGeneratorMIDI::beginLive(AudioOutput *out)
+{
+  AudioMemory::Scope scope(&mem);
+
+  live = true;
+  if (!StartSynth(out)) {
+    live = false;
+    return false;
+  }
+  file = NULL;
+
+  // Set all 16 channels up now so nothing is allocated while playing, the last first so it's
+  // done in one go.  Channel 10 gets the drum kits.
+  for (int chan = 15; chan >= 0; chan--)
+    tsf_channel_set_presetnumber(g_tsf, chan, 0, chan == 9);
+
+  cacheStats.midiHits = 0;
+  cacheStats.midiMisses = 0;
+
+  // Anything sent before now is stale
+  liveTail.store(liveHead.load(std::memory_order_acquire), std::memory_order_release);
+  liveDropped = 0;
 
   running = true;
+  return true;
+}
 
-  PrepareMIDI(src);
 
-  samplesToPlay = 0;
-  numSamplesRendered = 0;
+bool AudioGeneratorMIDI::Send(uint8_t status, uint8_t data1, uint8_t data2)
+{
+  if ((status < 0x80) || (status >= 0xf0)) return false; // Channel messages only
+  uint32_t head = liveHead.load(std::memory_order_relaxed);
+  if (head - liveTail.load(std::memory_order_acquire) >= LIVEQUEUE) {
+    liveDropped++;
+    return false;
+  }
+  liveQueue[head & (LIVEQUEUE - 1)] = status | ((data1 & 0x7f) << 8) | ((data2 & 0x7f) << 16);
+  liveHead.store(head + 1, std::memory_order_release); // Only now can loop() see it
+  return true;
+}
+
+
+// Applies everything queued so far to the synth's channels
+void AudioGeneratorMIDI::PlayLive()
+{
+  uint32_t tail = liveTail.load(std::memory_order_relaxed);
+  uint32_t head = liveHead.load(std::memory_order_acquire);
+  while (tail != head) {
+    uint32_t msg = liveQueue[tail & (LIVEQUEUE - 1)];
+    tail++;
+    int chan = msg & 0x0f;
+    int data1 = (msg >> 8) & 0x7f;
+    int data2 = (msg >> 16) & 0x7f;
+    switch ((msg >> 4) & 0x0f) {
+      case 0x8:
+        tsf_channel_note_off(g_tsf, chan, data1);
+        break;
+      case 0x9:
+        if (data2) tsf_channel_note_on(g_tsf, chan, data1, data2 / 127.0f);
+        else tsf_channel_note_off(g_tsf, chan, data1); // Note-on with zero velocity is a note-off
+        break;
+      case 0xb:
+        tsf_channel_midi_control(g_tsf, chan, data1, data2);
+        break;
+      case 0xc:
+        tsf_channel_set_presetnumber(g_tsf, chan, data1, chan == 9);
+        break;
+      case 0xe:
+        tsf_channel_set_pitchwheel(g_tsf, chan, data1 | (data2 << 7));
+        break;
+      default: // Aftertouch means nothing to a SoundFont here
+        break;
+    }
+  }
+  liveTail.store(tail, std::memory_order_release); // Hands the slots back to Send()
+}
+
+
+const AudioGeneratorMIDI::CacheStats &AudioGeneratorMIDI::GetCacheStats()
+{
+  if (g_tsf) {
+    unsigned int hits, misses;
+    tsf_get_cache_stats(g_tsf, &hits, &misses);
+    cacheStats.sampleHits = hits;
+    cacheStats.sampleMisses = misses;
+    if (!live) {
+      tsf_stream_cached_stats(&buffer, &hits, &misses);
+      cacheStats.midiHits = hits;
+      cacheStats.midiMisses = misses;
+    }
+  }
+  return cacheStats;
+}
+
+
+const AudioGeneratorMIDI::PolyphonyStats &AudioGeneratorMIDI::GetPolyphonyStats()
+{
+  if (g_tsf) {
+    polyStats.voices = tsf_active_voice_count(g_tsf);
+    polyStats.stolen = tsf_get_stolen_voices(g_tsf);
+  }
+  return polyStats;
+}
+
+
+// Keeps rendering within cpuBudget percent of the time each block takes to play.  Over it, the
+// cap drops below the voices now playing so the least audible fade out, and under 3/4 of it the
+// cap rises again by one voice a block.
+void AudioGeneratorMIDI::UpdateBudget(uint32_t elapsed, int frames)
+{
+  uint32_t playTime = (uint32_t)frames * 1000000UL / freq;
+  if (!playTime) return;
+  // Smoothed over a few blocks, a single slow one (an SF2 cache miss, say) is no reason to cut
+  polyStats.load = (polyStats.load * 3 + (int)(elapsed * 100 / playTime)) / 4;
+
+  int limit = polyStats.limit;
+  if (polyStats.load > cpuBudget) {
+    int voices = tsf_active_voice_count(g_tsf);
+    int cap = (limit && (limit < voices)) ? limit : voices;
+    if (cap > 1) limit = cap - 1;
+  } else if (limit && (polyStats.load < cpuBudget * 3 / 4)) {
+    limit++;
+    if (maxVoices && (limit > maxVoices)) limit = maxVoices;
+    else if (!maxVoices && (limit > polyStats.peakVoices)) limit = 0; // Back to no cap at all
+  }
+  if (limit != polyStats.limit) {
+    polyStats.limit = limit;
+    tsf_set_max_voices(g_tsf, limit);
+  }
+}
+
+
+// Renders the next frames into samplesRendered, ready to go out as stereo frames
+void AudioGeneratorMIDI::RenderFrames(int frames)
+{
+  numSamplesRendered = frames;
+  uint32_t start = micros();
+  tsf_render_short_fast(g_tsf, samplesRendered, numSamplesRendered, 0);
+  uint32_t elapsed = micros() - start;
+  int voices = tsf_active_voice_count(g_tsf);
+  if (voices > polyStats.peakVoices) polyStats.peakVoices = voices;
+  if (cpuBudget) UpdateBudget(elapsed, numSamplesRendered);
+  if (!stereo) {
+    // Spread the mono render out into frames, from the back so nothing is overwritten early
+    for (int i = numSamplesRendered - 1; i >= 0; i--) {
+      samplesRendered[i * 2 + 1] = samplesRendered[i];
+      samplesRendered[i * 2] = samplesRendered[i];
+    }
+  }
   sentSamplesRendered = 0;
-  
-  sawEOF = false;
-  return running;
 }
 
 
+// Plays the file's events up to the next delay and renders what they've set sounding, or in live
+// mode whatever messages have come in since the last block
+int AudioGeneratorMIDI::RenderBlock()
+{
+  if (live) {
+    // Render a little at a time so the messages come in promptly, but don't run forever
+    if (liveBudget <= 0) return 0;
+    liveBudget -= liveFrames;
+    PlayLive();
+    RenderFrames(liveFrames);
+    return numSamplesRendered;
+  }
+  while (!samplesToPlay) {
+    if (sawEOF) {
+      running = false;
+      return 0;
+    }
+    samplesToPlay = PlayMIDI();
+    if (!running) return 0; // Bad file
+    if (samplesToPlay == -1) {
+      sawEOF = true;
+      samplesToPlay = freq / 2;
+    }
+  }
+  RenderFrames((samplesToPlay < RENDERFRAMES) ? samplesToPlay : RENDERFRAMES);
+  samplesToPlay -= numSamplesRendered;
+  return numSamplesRendered;
+}
+
 bool AudioGeneratorMIDI::loop()
 {
-  static int c = 0;
+  AudioMemory::Scope scope(&mem);
 
   if (!running) goto done; // Nothing to do here!
 
-  // First, try and push in the stored sample.  If we can't, then punt and try later
-  if (!output->ConsumeSample(lastSample)) goto done; // Can't send, but no error detected
-
-  // Try and stuff the buffer one sample at a time
-  do {
-    c++;
-    if (c%44100 == 0) yield();
-
-play:
-
-    if (sentSamplesRendered < numSamplesRendered) {
-      lastSample[AudioOutput::LEFTCHANNEL] = samplesRendered[sentSamplesRendered];
-      lastSample[AudioOutput::RIGHTCHANNEL] = samplesRendered[sentSamplesRendered];
-      sentSamplesRendered++;
-    } else if (samplesToPlay) {
-      numSamplesRendered = sizeof(samplesRendered)/sizeof(samplesRendered[0]);
-      if ((int)samplesToPlay < (int)(sizeof(samplesRendered)/sizeof(samplesRendered[0]))) numSamplesRendered = samplesToPlay;
-      tsf_render_short_fast(g_tsf, samplesRendered, numSamplesRendered, 0);
-      lastSample[AudioOutput::LEFTCHANNEL] = samplesRendered[0];
-      lastSample[AudioOutput::RIGHTCHANNEL] = samplesRendered[0];
-      sentSamplesRendered = 1;
-      samplesToPlay -= numSamplesRendered;
-    } else {
-      numSamplesRendered = 0;
-      sentSamplesRendered = 0;
-      if (sawEOF) {
-        running = false;
-      } else {
-        samplesToPlay = PlayMIDI();
-        if (samplesToPlay == -1) {
-            sawEOF = true;
-            samplesToPlay = freq / 2;
-        }
-        goto play;
-      }
-    }
-  } while (running && output->ConsumeSample(lastSample));
+  liveBudget = RENDERFRAMES;
+  PushBlocks(samplesRendered, &numSamplesRendered, &sentSamplesRendered);
 
 done:
-  file->loop();
+  if (file) file->loop();
   output->loop();
 
   return running;
@@ -588,7 +933,9 @@ done:
  
 bool AudioGeneratorMIDI::stop()
 {
+  AudioMemory::Scope scope(&mem);
   StopMIDI();
+  running = false;
   output->stop();
   return true;
 }
@@ -25,6 +25,7 @@
 // Do not build, GCC8 has a compiler bug
 #else // __GNUC__ == 8
 
+#include <atomic>
 #include "AudioGenerator.h"
 
 #define TSF_NO_STDIO
@@ -33,7 +34,22 @@
 class AudioGeneratorMIDI : public AudioGenerator
 {
   public:
-    AudioGeneratorMIDI() { freq=44100; running = false; };
+    typedef struct {
+      uint32_t sampleHits;   // SoundFont sample blocks found in the cache
+      uint32_t sampleMisses; // ...and read from the SF2 source
+      uint32_t midiHits;     // Same for the MIDI file
+      uint32_t midiMisses;
+    } CacheStats;
+
+    typedef struct {
+      int voices;            // SoundFont voices playing now
+      int peakVoices;        // ...and the most there have been at once
+      int limit;             // Voices allowed now, 0 for no limit
+      int load;              // Render time as a percentage of the time it plays for, smoothed
+      uint32_t stolen;       // Voices cut short to stay within the limit
+    } PolyphonyStats;
+
+    AudioGeneratorMIDI() { freq=44100; stereo = true; cacheBlocks = 16; cacheBlockSamples = 512; cacheReadAhead = 0; memset(&cacheStats, 0, sizeof(cacheStats)); maxVoices = 0; cpuBudget = 0; memset(&polyStats, 0, sizeof(polyStats)); preparse = false; events = NULL; eventsLen = 0; live = false; liveFrames = 32; liveHead = 0; liveTail = 0; liveDropped = 0; g_tsf = NULL; running = false; };
     virtual ~AudioGeneratorMIDI() override {};
     bool SetSoundfont(AudioFileSource *newsf2) {
       if (isRunning()) return false;
@@ -46,6 +62,70 @@ class AudioGeneratorMIDI : public AudioGenerator
       freq = newfreq;
       return true;
     }
+    // Stereo (the default) follows the SoundFont's and controllers' panning, mono is a little cheaper
+    bool SetStereo(bool newstereo) {
+      if (isRunning()) return false;
+      stereo = newstereo;
+      return true;
+    }
+    // SoundFont sample cache: blocks * blockSamples * 2 bytes, in PSRAM when there is some.  More
+    // blocks help once many voices play at once, larger ones suit slow-to-seek sources, and
+    // readAhead blocks are read after each miss in the same pass.  Call before begin().
+    bool SetCache(int blocks, int blockSamples, int readAhead = 0) {
+      if (isRunning() || (blocks < 1) || (blockSamples < 1)) return false;
+      cacheBlocks = blocks;
+      cacheBlockSamples = blockSamples;
+      cacheReadAhead = readAhead;
+      return true;
+    }
+    // Live while playing, and kept from the last song after stop()
+    const CacheStats &GetCacheStats();
+    // Polyphony budget: at most maxVoices SoundFont voices at once, 0 for no fixed cap.  Past it, a
+    // new note takes over a released voice first, then the quietest, then the oldest.  With
+    // cpuPercent set, blocks taking longer than that share of their playing time to render lower
+    // the cap further, so dense passages thin out instead of starving the output, and it creeps
+    // back up once there is time to spare.  Call before begin().
+    bool SetPolyphony(int newMaxVoices, int cpuPercent = 0) {
+      if (isRunning() || (newMaxVoices < 0) || (cpuPercent < 0)) return false;
+      maxVoices = newMaxVoices;
+      cpuBudget = cpuPercent;
+      return true;
+    }
+    // Live while playing, and kept from the last song after stop()
+    const PolyphonyStats &GetPolyphonyStats();
+    // Merge the tracks once at begin() into a compact, time-ordered list of note events (a few
+    // bytes each, in PSRAM when there is some) and play from that, so nothing is parsed while
+    // playing and seek() is instant.  Without enough memory it quietly streams as usual.
+    bool SetPreparse(bool newpreparse) {
+      if (isRunning()) return false;
+      preparse = newpreparse;
+      return true;
+    }
+    bool IsPreparsed() const { return events != NULL; }
+    uint32_t GetPreparsedSize() const { return eventsLen; }
+    // Jumps to the given output sample.  Notes held across that point are not restarted.  Without
+    // a preparsed list the tracks are parsed again from the start to get there.
+    bool seek(uint32_t sample);
+
+    // Live input: plays MIDI channel messages as they arrive, with the SoundFont set as usual but no
+    // file.  Queued messages are applied before each block of SetLiveBlock() frames (32 unless
+    // changed), so latency comes down to that and the output's own buffering.  Channel 10 is drums.
+    bool beginLive(AudioOutput *output);
+    bool SetLiveBlock(int frames) {
+      if (isRunning() || (frames < 1) || (frames > RENDERFRAMES)) return false;
+      liveFrames = frames;
+      return true;
+    }
+    // Queues a note on/off, controller, program change or pitch bend.  The queue is lock-free for
+    // one producer, i.e. a serial or USB-MIDI task, running alongside loop().  Returns false,
+    // counting the message as dropped, when it is full.
+    bool Send(uint8_t status, uint8_t data1, uint8_t data2 = 0);
+    bool NoteOn(int channel, int note, int velocity) { return Send(0x90 | (channel & 0x0f), note, velocity); }
+    bool NoteOff(int channel, int note) { return Send(0x80 | (channel & 0x0f), note, 0); }
+    bool ControlChange(int channel, int controller, int value) { return Send(0xb0 | (channel & 0x0f), controller, value); }
+    bool ProgramChange(int channel, int program) { return Send(0xc0 | (channel & 0x0f), program); }
+    bool PitchBend(int channel, int value) { return Send(0xe0 | (channel & 0x0f), value & 0x7f, (value >> 7) & 0x7f); } // 0...16383, 8192 is centered
+    uint32_t GetDroppedMessages() const { return liveDropped; }
     virtual bool begin(AudioFileSource *mid, AudioOutput *output) override;
     virtual bool loop() override;
     virtual bool stop() override;
@@ -53,6 +133,14 @@ class AudioGeneratorMIDI : public AudioGenerator
 
   private:
     int freq;
+    bool stereo;
+    int cacheBlocks;
+    int cacheBlockSamples;
+    int cacheReadAhead;
+    CacheStats cacheStats;
+    int maxVoices;
+    int cpuBudget;
+    PolyphonyStats polyStats;
     tsf *g_tsf;
     struct tsf_stream buffer;
     struct tsf_stream afsMIDI;
@@ -90,8 +178,12 @@ class AudioGeneratorMIDI : public AudioGenerator
     // State needed for PlayMID()
     int notes_skipped = 0;
     int tracknum = 0;
-    int earliest_tracknum = 0;
-    unsigned long earliest_time = 0;
+    int tracksptr;                  /* the first track header */
+
+    /* Tracks with events still to come, a min-heap on (time, order) */
+    unsigned char heap[MAX_TRACKS];
+    int heapLen;
+    unsigned long nextOrder;
 
     struct tonegen_status {         /* current status of a tone generator */
       bool playing;                /* is it playing? */
@@ -105,6 +197,7 @@ class AudioGeneratorMIDI : public AudioGenerator
       int trkend;                  /* ptr past the end of the track */
       unsigned long time;          /* what time we're at in the score */
       unsigned long tempo;         /* the tempo last set, in usec per qnote */
+      unsigned long order;         /* when it last had a turn, to share out tone generators fairly */
       unsigned int preferred_tonegen;      /* for strategy2, try to use this generator */
       unsigned char cmd;           /* CMD_xxxx next to do */
       unsigned char note;          /* for which note */
@@ -116,6 +209,35 @@ class AudioGeneratorMIDI : public AudioGenerator
 
     int midi_chan_instrument[16];   /* which instrument is currently being played on each channel */
 
+    /* One step of the merged tracks, as played or as stored in the preparsed list.  Stored, it is a
+       type byte (with the track in the low bits for notes) and then the note, velocity and
+       instrument for note-ons, the note for note-offs, or a variable-length count of samples. */
+    struct midi_event {
+      unsigned char type;
+      unsigned char track, note, velocity, instrument;
+      uint32_t samples;
+    };
+    enum { EVENT_NOTEOFF = 0x00,
+           EVENT_NOTEON  = 0x20,
+           EVENT_DELAY   = 0x40,
+           EVENT_END     = 0xff
+         };
+
+    bool preparse;
+    uint8_t *events;                /* the preparsed list, or NULL when streaming */
+    uint32_t eventsLen;
+    uint32_t eventPos;
+
+    /* Live input queue: packed status and data bytes, and free-running counts of those queued
+       and those played.  Send() alone writes liveHead, loop() alone liveTail. */
+    bool live;
+    int liveFrames;
+    enum { LIVEQUEUE = 64 };        /* a power of 2 */
+    uint32_t liveQueue[LIVEQUEUE];
+    std::atomic<uint32_t> liveHead;
+    std::atomic<uint32_t> liveTail;
+    uint32_t liveDropped;
+
     /* output bytestream commands, which are also stored in track_status.cmd */
     enum { CMD_PLAYNOTE   = 0x90,    /* play a note: low nibble is generator #, note is next byte */
            CMD_STOPNOTE   = 0x80,    /* stop a note: low nibble is generator # */
@@ -160,9 +282,23 @@ class AudioGeneratorMIDI : public AudioGenerator
 
     unsigned long get_varlen (int *ptr);
     void find_note (int tracknum);
-    void PrepareMIDI(AudioFileSource *src);
+    void start_tracks (void);
+    void heap_down (int i);
+    void next_note (int tracknum);
+    bool next_event (struct midi_event *ev);
+    int put_event (uint8_t *out, const struct midi_event *ev);
+    bool read_event (struct midi_event *ev);
+    bool fetch_event (struct midi_event *ev) { return events ? read_event (ev) : next_event (ev); }
+    void play_event (const struct midi_event *ev);
+    bool Preparse();
+    bool PrepareMIDI(AudioFileSource *src);
+    bool StartSynth(AudioOutput *out);
+    void RenderFrames(int frames);
+    virtual int RenderBlock() override;
+    void PlayLive();
     int PlayMIDI();
     void StopMIDI();
+    void UpdateBudget(uint32_t elapsed, int frames);
 
     // tsf_stream <-> AudioFileSource
     static int afs_read(void *data, void *ptr, unsigned int size);
@@ -176,8 +312,10 @@ class AudioGeneratorMIDI : public AudioGenerator
     int samplesToPlay;
     bool sawEOF;
     int numSamplesRendered;
-    int sentSamplesRendered ;
-    short samplesRendered[256];
+    int sentSamplesRendered;
+    int liveBudget;     // Frames loop() may still render for live messages before handing back
+    enum { RENDERFRAMES = 128 };
+    int16_t samplesRendered[RENDERFRAMES * 2]; // Interleaved L/R, handed straight to ConsumeSamples()
 };
 
 #endif //__GNUC__ == 8
@@ -1,6 +1,6 @@
 /*
   AudioGeneratorMOD
-  Audio output generator that plays Amiga MOD tracker files
+  Audio output generator that plays Amiga MOD, Scream Tracker S3M and FastTracker XM files
     
   Copyright (C) 2017  Earle F. Philhower, III
 
@@ -35,7 +35,6 @@
 
 #pragma GCC optimize ("O3")
 
-#define NOTE(r, c) (Player.currentPattern.note8[r][c]==NONOTE8?NONOTE:8*Player.currentPattern.note8[r][c])
 
 #ifndef min
 #define min(X,Y) ((X) < (Y) ? (X) : (Y))
@@ -52,31 +51,54 @@ AudioGeneratorMOD::AudioGeneratorMOD()
   running = false;
   file = NULL;
   output = NULL;
+  preload = false;
+  sampleData = NULL;
+  format = FORMAT_MOD;
+  interpolation = INTERPOLATION_LINEAR;
+  memset(&Mod, 0, sizeof(Mod));
+  Player.currentPattern = NULL;
+  Track = NULL;
 }
 
 AudioGeneratorMOD::~AudioGeneratorMOD()
 {
   // Free any remaining buffers
-  for (int i = 0; i < CHANNELS; i++) {
-    FatBuffer.channels[i] = NULL;
+  FreeSong();
+}
+
+void AudioGeneratorMOD::FreeSong()
+{
+  if (Track) {
+    for (int i = 0; i < Mod.numberOfChannels; i++) {
+      free(Track[i].buffer);
+    }
   }
+  free(Track);
+  Track = NULL;
+  free(Player.currentPattern);
+  Player.currentPattern = NULL;
+  free(Mod.samples);
+  free(Mod.instruments);
+  free(Mod.patternOffset);
+  free(Mod.patternRows);
+  free(Mod.patternSize);
+  memset(&Mod, 0, sizeof(Mod));
+  free(sampleData);
+  sampleData = NULL;
 }
 
 bool AudioGeneratorMOD::stop()
 {
   // We may be stopping because of allocation failures, so always deallocate
-  for (int i = 0; i < CHANNELS; i++) {
-    free(FatBuffer.channels[i]);
-    FatBuffer.channels[i] = NULL;
-  }
+  FreeSong();
 
   if(running || ((file != NULL) && (file->isOpen() == true))) {
 	output->flush();  //flush I2S output buffer, if the player was actually running before.
+	output->stop();   // Only once, stop() is called again after the song ends by itself
   }
 
   if (file) file->close();
   running = false;
-  output->stop();
   return true;
 }
 
@@ -84,40 +106,25 @@ bool AudioGeneratorMOD::loop()
 {
   if (!running) goto done; // Easy-peasy
 
-  // First, try and push in the stored sample.  If we can't, then punt and try later
-  if (!output->ConsumeSample(lastSample)) goto done; // FIFO full, wait...
-
-  // Now advance enough times to fill the i2s buffer
-  do {
-    if (mixerTick == 0) {
-      running = RunPlayer();
-      if (!running) {
-        stop();
-        goto done;
-      }
-      mixerTick = Player.samplesPerTick;
-    }
-    GetSample( lastSample );
-    mixerTick--;
-  } while (output->ConsumeSample(lastSample));
+  // Nothing mixed means the song is over, if an error hasn't stopped it already
+  if (!PushBlocks(block, &blockLen, &blockPtr) && running) stop();
 
 done:
   file->loop();
   output->loop();
 
-  // We'll be left with one sample still in our buffer because it couldn't fit in the FIFO
   return running;
 }
 
 bool AudioGeneratorMOD::begin(AudioFileSource *source, AudioOutput *out)
 {
   if (running) stop();
-  
+
   if (!source) return false;
   file = source;
   if (!out) return false;
   output = out;
-  
+
   if (!file->isOpen()) return false; // Can't read the file!
 
   // Set the output values properly
@@ -128,17 +135,36 @@ bool AudioGeneratorMOD::begin(AudioFileSource *source, AudioOutput *out)
 
   UpdateAmiga();
 
-  for (int i = 0; i < CHANNELS; i++) {
-    FatBuffer.channels[i] = reinterpret_cast<uint8_t*>(calloc(fatBufferSize, 1));
-    if (!FatBuffer.channels[i]) {
+  if (!LoadMOD()) {
+    stop();
+    return false;
+  }
+  if ((format == FORMAT_XM) || preload) {
+    if (!PreloadSamples() && (format == FORMAT_XM)) {
+      audioLogger->printf_P(PSTR("AudioGeneratorMOD: Not enough memory to load the XM samples\n"));
       stop();
       return false;
     }
   }
-  if (!LoadMOD()) {
-    stop();
-    return false;
+  if (!sampleData) {
+    for (int i = 0; i < Mod.numberOfChannels; i++) {
+      Track[i].buffer = reinterpret_cast<int8_t*>(calloc(fatBufferSize, 1));
+      if (!Track[i].buffer) {
+        stop();
+        return false;
+      }
+    }
+    for (int i = 0; i < Mod.numberOfSamples; i++) {
+      if (!ReadGuard(i)) {
+        stop();
+        return false;
+      }
+    }
   }
+  mixerTick = 0;
+  blockPtr = 0;
+  blockLen = 0;
+  ending = false;
   running = true;
   return true;
 }
@@ -193,8 +219,303 @@ static const uint8_t sine[64] PROGMEM = {
 };
 #define ReadSine(a) pgm_read_byte(sine + (a))
 
+// Catmull-Rom cubic Hermite weights for frames -1, 0, 1 and 2, 2.14 fixed point, 256 phases
+static const int16_t cubicTable[256 * 4] PROGMEM = {
+  0, 16384, 0, 0, -32, 16384, 32, 0, -63, 16381, 66, 0, -94, 16379, 100, -1,
+  -124, 16374, 136, -2, -154, 16369, 172, -3, -183, 16361, 210, -4, -212, 16354, 248, -6,
+  -240, 16345, 287, -8, -268, 16335, 327, -10, -295, 16322, 369, -12, -322, 16309, 411, -14,
+  -349, 16297, 453, -17, -375, 16282, 497, -20, -400, 16265, 542, -23, -425, 16247, 588, -26,
+  -450, 16230, 634, -30, -474, 16211, 681, -34, -498, 16191, 729, -38, -521, 16169, 778, -42,
+  -544, 16146, 828, -46, -566, 16122, 879, -51, -588, 16097, 930, -55, -610, 16071, 983, -60,
+  -631, 16044, 1036, -65, -651, 16015, 1090, -70, -672, 15988, 1144, -76, -691, 15957, 1200, -82,
+  -711, 15926, 1256, -87, -730, 15894, 1313, -93, -748, 15861, 1370, -99, -766, 15827, 1429, -106,
+  -784, 15792, 1488, -112, -801, 15756, 1548, -119, -818, 15719, 1608, -125, -835, 15681, 1670, -132,
+  -851, 15642, 1732, -139, -866, 15602, 1794, -146, -882, 15562, 1858, -154, -897, 15520, 1922, -161,
+  -911, 15478, 1986, -169, -925, 15433, 2052, -176, -939, 15390, 2117, -184, -953, 15345, 2184, -192,
+  -966, 15299, 2251, -200, -978, 15252, 2319, -209, -991, 15205, 2387, -217, -1002, 15155, 2456, -225,
+  -1014, 15106, 2526, -234, -1025, 15056, 2596, -243, -1036, 15004, 2667, -251, -1047, 14953, 2738, -260,
+  -1057, 14900, 2810, -269, -1066, 14846, 2882, -278, -1076, 14793, 2955, -288, -1085, 14737, 3029, -297,
+  -1094, 14681, 3103, -306, -1102, 14625, 3177, -316, -1110, 14567, 3252, -325, -1118, 14509, 3328, -335,
+  -1125, 14450, 3404, -345, -1133, 14391, 3480, -354, -1139, 14330, 3557, -364, -1146, 14270, 3634, -374,
+  -1152, 14208, 3712, -384, -1158, 14146, 3790, -394, -1163, 14082, 3869, -404, -1169, 14019, 3948, -414,
+  -1174, 13955, 4027, -424, -1178, 13890, 4107, -435, -1182, 13823, 4188, -445, -1187, 13758, 4268, -455,
+  -1190, 13691, 4349, -466, -1194, 13623, 4431, -476, -1197, 13556, 4512, -487, -1200, 13486, 4595, -497,
+  -1202, 13417, 4677, -508, -1205, 13347, 4760, -518, -1207, 13277, 4843, -529, -1208, 13205, 4926, -539,
+  -1210, 13134, 5010, -550, -1211, 13062, 5094, -561, -1212, 12989, 5178, -571, -1213, 12916, 5263, -582,
+  -1213, 12842, 5348, -593, -1214, 12768, 5433, -603, -1214, 12694, 5518, -614, -1213, 12618, 5604, -625,
+  -1213, 12542, 5690, -635, -1212, 12466, 5776, -646, -1211, 12390, 5862, -657, -1210, 12312, 5949, -667,
+  -1208, 12235, 6035, -678, -1207, 12157, 6122, -688, -1205, 12079, 6209, -699, -1202, 11998, 6297, -709,
+  -1200, 11920, 6384, -720, -1197, 11839, 6472, -730, -1195, 11761, 6559, -741, -1192, 11680, 6647, -751,
+  -1188, 11599, 6735, -762, -1185, 11518, 6823, -772, -1181, 11436, 6911, -782, -1177, 11354, 7000, -793,
+  -1173, 11272, 7088, -803, -1169, 11189, 7177, -813, -1165, 11107, 7265, -823, -1160, 11023, 7354, -833,
+  -1155, 10939, 7443, -843, -1150, 10856, 7531, -853, -1145, 10772, 7620, -863, -1140, 10687, 7709, -872,
+  -1134, 10602, 7798, -882, -1128, 10517, 7887, -892, -1122, 10431, 7976, -901, -1116, 10346, 8065, -911,
+  -1110, 10260, 8154, -920, -1104, 10175, 8242, -929, -1097, 10088, 8331, -938, -1091, 10002, 8420, -947,
+  -1084, 9915, 8509, -956, -1077, 9829, 8597, -965, -1070, 9742, 8686, -974, -1062, 9653, 8775, -982,
+  -1055, 9567, 8863, -991, -1047, 9479, 8951, -999, -1040, 9392, 9040, -1008, -1032, 9304, 9128, -1016,
+  -1024, 9216, 9216, -1024, -1016, 9128, 9304, -1032, -1008, 9040, 9392, -1040, -999, 8951, 9479, -1047,
+  -991, 8863, 9567, -1055, -982, 8775, 9653, -1062, -974, 8686, 9742, -1070, -965, 8597, 9829, -1077,
+  -956, 8509, 9915, -1084, -947, 8420, 10002, -1091, -938, 8331, 10088, -1097, -929, 8242, 10175, -1104,
+  -920, 8154, 10260, -1110, -911, 8065, 10346, -1116, -901, 7976, 10431, -1122, -892, 7887, 10517, -1128,
+  -882, 7798, 10602, -1134, -872, 7709, 10687, -1140, -863, 7620, 10772, -1145, -853, 7531, 10856, -1150,
+  -843, 7443, 10939, -1155, -833, 7354, 11023, -1160, -823, 7265, 11107, -1165, -813, 7177, 11189, -1169,
+  -803, 7088, 11272, -1173, -793, 7000, 11354, -1177, -782, 6911, 11436, -1181, -772, 6823, 11518, -1185,
+  -762, 6735, 11599, -1188, -751, 6647, 11680, -1192, -741, 6559, 11761, -1195, -730, 6472, 11839, -1197,
+  -720, 6384, 11920, -1200, -709, 6297, 11998, -1202, -699, 6209, 12079, -1205, -688, 6122, 12157, -1207,
+  -678, 6035, 12235, -1208, -667, 5949, 12312, -1210, -657, 5862, 12390, -1211, -646, 5776, 12466, -1212,
+  -635, 5690, 12542, -1213, -625, 5604, 12618, -1213, -614, 5518, 12694, -1214, -603, 5433, 12768, -1214,
+  -593, 5348, 12842, -1213, -582, 5263, 12916, -1213, -571, 5178, 12989, -1212, -561, 5094, 13062, -1211,
+  -550, 5010, 13134, -1210, -539, 4926, 13205, -1208, -529, 4843, 13277, -1207, -518, 4760, 13347, -1205,
+  -508, 4677, 13417, -1202, -497, 4595, 13486, -1200, -487, 4512, 13556, -1197, -476, 4431, 13623, -1194,
+  -466, 4349, 13691, -1190, -455, 4268, 13758, -1187, -445, 4188, 13823, -1182, -435, 4107, 13890, -1178,
+  -424, 4027, 13955, -1174, -414, 3948, 14019, -1169, -404, 3869, 14082, -1163, -394, 3790, 14146, -1158,
+  -384, 3712, 14208, -1152, -374, 3634, 14270, -1146, -364, 3557, 14330, -1139, -354, 3480, 14391, -1133,
+  -345, 3404, 14450, -1125, -335, 3328, 14509, -1118, -325, 3252, 14567, -1110, -316, 3177, 14625, -1102,
+  -306, 3103, 14681, -1094, -297, 3029, 14737, -1085, -288, 2955, 14793, -1076, -278, 2882, 14846, -1066,
+  -269, 2810, 14900, -1057, -260, 2738, 14953, -1047, -251, 2667, 15004, -1036, -243, 2596, 15056, -1025,
+  -234, 2526, 15106, -1014, -225, 2456, 15155, -1002, -217, 2387, 15205, -991, -209, 2319, 15252, -978,
+  -200, 2251, 15299, -966, -192, 2184, 15345, -953, -184, 2117, 15390, -939, -176, 2052, 15433, -925,
+  -169, 1986, 15478, -911, -161, 1922, 15520, -897, -154, 1858, 15562, -882, -146, 1794, 15602, -866,
+  -139, 1732, 15642, -851, -132, 1670, 15681, -835, -125, 1608, 15719, -818, -119, 1548, 15756, -801,
+  -112, 1488, 15792, -784, -106, 1429, 15827, -766, -99, 1370, 15861, -748, -93, 1313, 15894, -730,
+  -87, 1256, 15926, -711, -82, 1200, 15957, -691, -76, 1144, 15988, -672, -70, 1090, 16015, -651,
+  -65, 1036, 16044, -631, -60, 983, 16071, -610, -55, 930, 16097, -588, -51, 879, 16122, -566,
+  -46, 828, 16146, -544, -42, 778, 16169, -521, -38, 729, 16191, -498, -34, 681, 16211, -474,
+  -30, 634, 16230, -450, -26, 588, 16247, -425, -23, 542, 16265, -400, -20, 497, 16282, -375,
+  -17, 453, 16297, -349, -14, 411, 16309, -322, -12, 369, 16322, -295, -10, 327, 16335, -268,
+  -8, 287, 16345, -240, -6, 248, 16354, -212, -4, 210, 16361, -183, -3, 172, 16369, -154,
+  -2, 136, 16374, -124, -1, 100, 16379, -94, 0, 66, 16381, -63, 0, 32, 16384, -32
+};
+#define ReadCubic(a) (int16_t)pgm_read_word(cubicTable + (a))
+
+// Kaiser-windowed sinc (cutoff 0.9 of Nyquist, beta 5) weights for frames -3 to 4, 2.14 fixed point, 256 phases
+static const int16_t sincTable[256 * 8] PROGMEM = {
+  323, -844, 1393, 14685, 1393, -844, 323, -45, 318, -827, 1339, 14685, 1448, -860, 327, -46,
+  314, -811, 1285, 14685, 1503, -877, 332, -47, 309, -794, 1232, 14685, 1558, -894, 336, -48,
+  305, -778, 1179, 14681, 1614, -910, 341, -48, 300, -762, 1126, 14681, 1670, -927, 345, -49,
+  296, -745, 1074, 14677, 1726, -944, 350, -50, 292, -729, 1022, 14674, 1783, -961, 354, -51,
+  287, -713, 970, 14670, 1840, -977, 359, -52, 283, -696, 919, 14664, 1897, -994, 363, -52,
+  278, -680, 868, 14659, 1955, -1011, 368, -53, 274, -664, 818, 14653, 2013, -1028, 372, -54,
+  269, -648, 768, 14646, 2071, -1044, 377, -55, 265, -632, 718, 14638, 2130, -1061, 381, -55,
+  260, -616, 669, 14630, 2189, -1078, 386, -56, 256, -600, 620, 14621, 2249, -1095, 390, -57,
+  252, -584, 571, 14612, 2308, -1111, 394, -58, 247, -568, 523, 14602, 2368, -1128, 399, -59,
+  243, -552, 475, 14590, 2429, -1145, 403, -59, 238, -537, 428, 14579, 2489, -1161, 408, -60,
+  234, -521, 381, 14567, 2550, -1178, 412, -61, 230, -505, 334, 14555, 2611, -1195, 416, -62,
+  225, -490, 288, 14540, 2673, -1211, 421, -62, 221, -474, 242, 14526, 2735, -1228, 425, -63,
+  217, -459, 197, 14512, 2797, -1245, 429, -64, 212, -444, 152, 14498, 2859, -1261, 433, -65,
+  208, -428, 107, 14481, 2922, -1278, 438, -66, 204, -413, 63, 14463, 2985, -1294, 442, -66,
+  200, -398, 19, 14446, 3048, -1310, 446, -67, 195, -383, -24, 14430, 3111, -1327, 450, -68,
+  191, -368, -67, 14411, 3175, -1343, 454, -69, 187, -353, -110, 14391, 3239, -1359, 458, -69,
+  183, -338, -152, 14372, 3303, -1376, 462, -70, 179, -324, -193, 14351, 3368, -1392, 466, -71,
+  175, -309, -235, 14330, 3433, -1408, 470, -72, 170, -294, -276, 14308, 3498, -1424, 474, -72,
+  166, -280, -316, 14286, 3563, -1440, 478, -73, 162, -266, -356, 14264, 3628, -1456, 482, -74,
+  158, -251, -396, 14239, 3694, -1472, 486, -74, 154, -237, -435, 14215, 3760, -1488, 490, -75,
+  150, -223, -474, 14190, 3826, -1503, 494, -76, 146, -209, -512, 14165, 3893, -1519, 497, -77,
+  142, -195, -550, 14139, 3959, -1535, 501, -77, 138, -181, -587, 14111, 4026, -1550, 505, -78,
+  135, -168, -624, 14083, 4093, -1565, 509, -79, 131, -154, -661, 14055, 4161, -1581, 512, -79,
+  127, -140, -697, 14026, 4228, -1596, 516, -80, 123, -127, -733, 13998, 4296, -1611, 519, -81,
+  119, -114, -768, 13968, 4363, -1626, 523, -81, 115, -100, -803, 13938, 4431, -1641, 526, -82,
+  112, -87, -838, 13906, 4500, -1656, 529, -82, 108, -74, -872, 13875, 4568, -1671, 533, -83,
+  104, -61, -906, 13844, 4636, -1685, 536, -84, 101, -49, -939, 13811, 4705, -1700, 539, -84,
+  97, -36, -972, 13778, 4774, -1714, 542, -85, 94, -23, -1004, 13741, 4843, -1728, 546, -85,
+  90, -11, -1036, 13708, 4912, -1742, 549, -86, 86, 1, -1067, 13673, 4982, -1756, 552, -87,
+  83, 14, -1098, 13636, 5051, -1770, 555, -87, 79, 26, -1129, 13601, 5121, -1784, 558, -88,
+  76, 38, -1159, 13565, 5190, -1798, 560, -88, 73, 50, -1189, 13527, 5260, -1811, 563, -89,
+  69, 61, -1218, 13489, 5330, -1824, 566, -89, 66, 73, -1247, 13451, 5400, -1838, 569, -90,
+  63, 85, -1276, 13412, 5470, -1851, 571, -90, 59, 96, -1304, 13373, 5541, -1864, 574, -91,
+  56, 107, -1331, 13332, 5611, -1876, 576, -91, 53, 119, -1359, 13290, 5682, -1889, 579, -91,
+  50, 130, -1385, 13249, 5752, -1901, 581, -92, 47, 141, -1412, 13208, 5823, -1914, 583, -92,
+  43, 151, -1438, 13168, 5894, -1926, 585, -93, 40, 162, -1463, 13124, 5964, -1938, 588, -93,
+  37, 173, -1488, 13079, 6035, -1949, 590, -93, 34, 183, -1513, 13037, 6106, -1961, 592, -94,
+  31, 193, -1537, 12992, 6177, -1972, 594, -94, 28, 204, -1561, 12948, 6248, -1984, 595, -94,
+  25, 214, -1584, 12902, 6319, -1995, 597, -94, 23, 224, -1607, 12855, 6391, -2006, 599, -95,
+  20, 234, -1629, 12807, 6462, -2016, 601, -95, 17, 243, -1651, 12762, 6533, -2027, 602, -95,
+  14, 253, -1673, 12714, 6604, -2037, 604, -95, 11, 262, -1694, 12667, 6676, -2047, 605, -96,
+  9, 272, -1715, 12618, 6747, -2057, 606, -96, 6, 281, -1735, 12570, 6818, -2067, 607, -96,
+  3, 290, -1755, 12520, 6889, -2076, 609, -96, 1, 299, -1775, 12469, 6961, -2085, 610, -96,
+  -2, 308, -1794, 12419, 7032, -2094, 611, -96, -4, 316, -1813, 12369, 7103, -2103, 612, -96,
+  -7, 325, -1831, 12318, 7175, -2112, 612, -96, -9, 333, -1849, 12266, 7246, -2120, 613, -96,
+  -12, 342, -1866, 12213, 7317, -2128, 614, -96, -14, 350, -1883, 12161, 7388, -2136, 614, -96,
+  -16, 358, -1900, 12108, 7459, -2144, 615, -96, -19, 366, -1916, 12055, 7530, -2151, 615, -96,
+  -21, 374, -1932, 12001, 7601, -2158, 615, -96, -23, 381, -1947, 11947, 7672, -2165, 615, -96,
+  -25, 389, -1962, 11891, 7743, -2172, 616, -96, -27, 396, -1977, 11838, 7814, -2179, 615, -96,
+  -30, 404, -1991, 11781, 7885, -2185, 615, -95, -32, 411, -2005, 11725, 7956, -2191, 615, -95,
+  -34, 418, -2018, 11668, 8026, -2196, 615, -95, -36, 425, -2031, 11612, 8097, -2202, 614, -95,
+  -38, 431, -2044, 11555, 8167, -2207, 614, -94, -40, 438, -2056, 11497, 8238, -2212, 613, -94,
+  -42, 445, -2068, 11439, 8308, -2217, 613, -94, -43, 451, -2079, 11379, 8378, -2221, 612, -93,
+  -45, 457, -2090, 11321, 8448, -2225, 611, -93, -47, 463, -2101, 11263, 8518, -2229, 610, -93,
+  -49, 469, -2111, 11203, 8587, -2232, 609, -92, -51, 475, -2121, 11145, 8657, -2236, 607, -92,
+  -52, 481, -2131, 11083, 8726, -2238, 606, -91, -54, 487, -2140, 11022, 8796, -2241, 605, -91,
+  -56, 492, -2149, 10962, 8865, -2243, 603, -90, -57, 497, -2157, 10901, 8934, -2246, 601, -89,
+  -59, 503, -2165, 10838, 9003, -2247, 600, -89, -60, 508, -2173, 10777, 9071, -2249, 598, -88,
+  -62, 513, -2180, 10714, 9140, -2250, 596, -87, -63, 518, -2187, 10652, 9208, -2251, 594, -87,
+  -65, 522, -2193, 10590, 9276, -2251, 591, -86, -66, 527, -2200, 10527, 9344, -2252, 589, -85,
+  -67, 531, -2205, 10462, 9412, -2252, 587, -84, -69, 536, -2211, 10400, 9479, -2251, 584, -84,
+  -70, 540, -2216, 10336, 9546, -2250, 581, -83, -71, 544, -2221, 10271, 9613, -2249, 579, -82,
+  -72, 548, -2225, 10206, 9680, -2248, 576, -81, -74, 552, -2229, 10141, 9747, -2246, 573, -80,
+  -75, 556, -2233, 10076, 9813, -2244, 570, -79, -76, 559, -2236, 10012, 9879, -2242, 566, -78,
+  -77, 563, -2239, 9945, 9945, -2239, 563, -77, -78, 566, -2242, 9879, 10012, -2236, 559, -76,
+  -79, 570, -2244, 9813, 10076, -2233, 556, -75, -80, 573, -2246, 9747, 10141, -2229, 552, -74,
+  -81, 576, -2248, 9680, 10206, -2225, 548, -72, -82, 579, -2249, 9613, 10271, -2221, 544, -71,
+  -83, 581, -2250, 9546, 10336, -2216, 540, -70, -84, 584, -2251, 9479, 10400, -2211, 536, -69,
+  -84, 587, -2252, 9412, 10462, -2205, 531, -67, -85, 589, -2252, 9344, 10527, -2200, 527, -66,
+  -86, 591, -2251, 9276, 10590, -2193, 522, -65, -87, 594, -2251, 9208, 10652, -2187, 518, -63,
+  -87, 596, -2250, 9140, 10714, -2180, 513, -62, -88, 598, -2249, 9071, 10777, -2173, 508, -60,
+  -89, 600, -2247, 9003, 10838, -2165, 503, -59, -89, 601, -2246, 8934, 10901, -2157, 497, -57,
+  -90, 603, -2243, 8865, 10962, -2149, 492, -56, -91, 605, -2241, 8796, 11022, -2140, 487, -54,
+  -91, 606, -2238, 8726, 11083, -2131, 481, -52, -92, 607, -2236, 8657, 11145, -2121, 475, -51,
+  -92, 609, -2232, 8587, 11203, -2111, 469, -49, -93, 610, -2229, 8518, 11263, -2101, 463, -47,
+  -93, 611, -2225, 8448, 11321, -2090, 457, -45, -93, 612, -2221, 8378, 11379, -2079, 451, -43,
+  -94, 613, -2217, 8308, 11439, -2068, 445, -42, -94, 613, -2212, 8238, 11497, -2056, 438, -40,
+  -94, 614, -2207, 8167, 11555, -2044, 431, -38, -95, 614, -2202, 8097, 11612, -2031, 425, -36,
+  -95, 615, -2196, 8026, 11668, -2018, 418, -34, -95, 615, -2191, 7956, 11725, -2005, 411, -32,
+  -95, 615, -2185, 7885, 11781, -1991, 404, -30, -96, 615, -2179, 7814, 11838, -1977, 396, -27,
+  -96, 616, -2172, 7743, 11891, -1962, 389, -25, -96, 615, -2165, 7672, 11947, -1947, 381, -23,
+  -96, 615, -2158, 7601, 12001, -1932, 374, -21, -96, 615, -2151, 7530, 12055, -1916, 366, -19,
+  -96, 615, -2144, 7459, 12108, -1900, 358, -16, -96, 614, -2136, 7388, 12161, -1883, 350, -14,
+  -96, 614, -2128, 7317, 12213, -1866, 342, -12, -96, 613, -2120, 7246, 12266, -1849, 333, -9,
+  -96, 612, -2112, 7175, 12318, -1831, 325, -7, -96, 612, -2103, 7103, 12369, -1813, 316, -4,
+  -96, 611, -2094, 7032, 12419, -1794, 308, -2, -96, 610, -2085, 6961, 12469, -1775, 299, 1,
+  -96, 609, -2076, 6889, 12520, -1755, 290, 3, -96, 607, -2067, 6818, 12570, -1735, 281, 6,
+  -96, 606, -2057, 6747, 12618, -1715, 272, 9, -96, 605, -2047, 6676, 12667, -1694, 262, 11,
+  -95, 604, -2037, 6604, 12714, -1673, 253, 14, -95, 602, -2027, 6533, 12762, -1651, 243, 17,
+  -95, 601, -2016, 6462, 12807, -1629, 234, 20, -95, 599, -2006, 6391, 12855, -1607, 224, 23,
+  -94, 597, -1995, 6319, 12902, -1584, 214, 25, -94, 595, -1984, 6248, 12948, -1561, 204, 28,
+  -94, 594, -1972, 6177, 12992, -1537, 193, 31, -94, 592, -1961, 6106, 13037, -1513, 183, 34,
+  -93, 590, -1949, 6035, 13079, -1488, 173, 37, -93, 588, -1938, 5964, 13124, -1463, 162, 40,
+  -93, 585, -1926, 5894, 13168, -1438, 151, 43, -92, 583, -1914, 5823, 13208, -1412, 141, 47,
+  -92, 581, -1901, 5752, 13249, -1385, 130, 50, -91, 579, -1889, 5682, 13290, -1359, 119, 53,
+  -91, 576, -1876, 5611, 13332, -1331, 107, 56, -91, 574, -1864, 5541, 13373, -1304, 96, 59,
+  -90, 571, -1851, 5470, 13412, -1276, 85, 63, -90, 569, -1838, 5400, 13451, -1247, 73, 66,
+  -89, 566, -1824, 5330, 13489, -1218, 61, 69, -89, 563, -1811, 5260, 13527, -1189, 50, 73,
+  -88, 560, -1798, 5190, 13565, -1159, 38, 76, -88, 558, -1784, 5121, 13601, -1129, 26, 79,
+  -87, 555, -1770, 5051, 13636, -1098, 14, 83, -87, 552, -1756, 4982, 13673, -1067, 1, 86,
+  -86, 549, -1742, 4912, 13708, -1036, -11, 90, -85, 546, -1728, 4843, 13741, -1004, -23, 94,
+  -85, 542, -1714, 4774, 13778, -972, -36, 97, -84, 539, -1700, 4705, 13811, -939, -49, 101,
+  -84, 536, -1685, 4636, 13844, -906, -61, 104, -83, 533, -1671, 4568, 13875, -872, -74, 108,
+  -82, 529, -1656, 4500, 13906, -838, -87, 112, -82, 526, -1641, 4431, 13938, -803, -100, 115,
+  -81, 523, -1626, 4363, 13968, -768, -114, 119, -81, 519, -1611, 4296, 13998, -733, -127, 123,
+  -80, 516, -1596, 4228, 14026, -697, -140, 127, -79, 512, -1581, 4161, 14055, -661, -154, 131,
+  -79, 509, -1565, 4093, 14083, -624, -168, 135, -78, 505, -1550, 4026, 14111, -587, -181, 138,
+  -77, 501, -1535, 3959, 14139, -550, -195, 142, -77, 497, -1519, 3893, 14165, -512, -209, 146,
+  -76, 494, -1503, 3826, 14190, -474, -223, 150, -75, 490, -1488, 3760, 14215, -435, -237, 154,
+  -74, 486, -1472, 3694, 14239, -396, -251, 158, -74, 482, -1456, 3628, 14264, -356, -266, 162,
+  -73, 478, -1440, 3563, 14286, -316, -280, 166, -72, 474, -1424, 3498, 14308, -276, -294, 170,
+  -72, 470, -1408, 3433, 14330, -235, -309, 175, -71, 466, -1392, 3368, 14351, -193, -324, 179,
+  -70, 462, -1376, 3303, 14372, -152, -338, 183, -69, 458, -1359, 3239, 14391, -110, -353, 187,
+  -69, 454, -1343, 3175, 14411, -67, -368, 191, -68, 450, -1327, 3111, 14430, -24, -383, 195,
+  -67, 446, -1310, 3048, 14446, 19, -398, 200, -66, 442, -1294, 2985, 14463, 63, -413, 204,
+  -66, 438, -1278, 2922, 14481, 107, -428, 208, -65, 433, -1261, 2859, 14498, 152, -444, 212,
+  -64, 429, -1245, 2797, 14512, 197, -459, 217, -63, 425, -1228, 2735, 14526, 242, -474, 221,
+  -62, 421, -1211, 2673, 14540, 288, -490, 225, -62, 416, -1195, 2611, 14555, 334, -505, 230,
+  -61, 412, -1178, 2550, 14567, 381, -521, 234, -60, 408, -1161, 2489, 14579, 428, -537, 238,
+  -59, 403, -1145, 2429, 14590, 475, -552, 243, -59, 399, -1128, 2368, 14602, 523, -568, 247,
+  -58, 394, -1111, 2308, 14612, 571, -584, 252, -57, 390, -1095, 2249, 14621, 620, -600, 256,
+  -56, 386, -1078, 2189, 14630, 669, -616, 260, -55, 381, -1061, 2130, 14638, 718, -632, 265,
+  -55, 377, -1044, 2071, 14646, 768, -648, 269, -54, 372, -1028, 2013, 14653, 818, -664, 274,
+  -53, 368, -1011, 1955, 14659, 868, -680, 278, -52, 363, -994, 1897, 14664, 919, -696, 283,
+  -52, 359, -977, 1840, 14670, 970, -713, 287, -51, 354, -961, 1783, 14674, 1022, -729, 292,
+  -50, 350, -944, 1726, 14677, 1074, -745, 296, -49, 345, -927, 1670, 14681, 1126, -762, 300,
+  -48, 341, -910, 1614, 14681, 1179, -778, 305, -48, 336, -894, 1558, 14685, 1232, -794, 309,
+  -47, 332, -877, 1503, 14685, 1285, -811, 314, -46, 327, -860, 1448, 14685, 1339, -827, 318
+};
+#define ReadSinc(a) (int16_t)pgm_read_word(sincTable + (a))
+
+// 2^(i/12) and 2^(i/768), both 1.15 fixed point, for S3M/XM pitches
+static const uint16_t semitones[12] PROGMEM = {
+  32768, 34716, 36781, 38968, 41285, 43740, 46341, 49097, 52016, 55109, 58386, 61858
+};
+#define ReadSemitones(a) (uint16_t)pgm_read_word(semitones + (a))
+
+static const uint16_t finetunes[64] PROGMEM = {
+  32768, 32798, 32827, 32857, 32887, 32916, 32946, 32976, 33005, 33035, 33065, 33095, 33125, 33155, 33185, 33215,
+  33245, 33275, 33305, 33335, 33365, 33395, 33425, 33455, 33486, 33516, 33546, 33576, 33607, 33637, 33667, 33698,
+  33728, 33759, 33789, 33820, 33850, 33881, 33911, 33942, 33973, 34003, 34034, 34065, 34095, 34126, 34157, 34188,
+  34219, 34250, 34281, 34312, 34343, 34374, 34405, 34436, 34467, 34498, 34529, 34560, 34591, 34623, 34654, 34685
+};
+#define ReadFinetunes(a) (uint16_t)pgm_read_word(finetunes + (a))
+
+// Scream Tracker's octave 0 periods, 4x finer than the Amiga's
+static const uint16_t s3mPeriods[12] PROGMEM = {
+  1712, 1616, 1524, 1440, 1356, 1280, 1208, 1140, 1076, 1016, 960, 907
+};
+#define ReadS3MPeriods(a) (uint16_t)pgm_read_word(s3mPeriods + (a))
+
+// 2^(x/768) in 16.16 fixed point, x < 768 * 15
+static uint32_t Pow2(uint32_t x)
+{
+  uint32_t octave = x / 768;
+  uint32_t rem = x % 768;
+  uint32_t m = (uint32_t)ReadSemitones(rem / 64) * ReadFinetunes(rem % 64) >> 14;
+  return m << octave;
+}
 
 static inline uint16_t MakeWord(uint8_t h, uint8_t l) { return h << 8 | l; }
+static inline uint16_t Read16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+static inline uint32_t Read32(const uint8_t *p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+
+bool AudioGeneratorMOD::LoadMOD()
+{
+  uint8_t channel;
+  uint8_t id[17];
+
+  // XM starts with a signature, S3M has one a little way in, MOD only has a weak one near the end
+  format = FORMAT_MOD;
+  if (file->seek(0, SEEK_SET) && (17 == file->read(id, 17)) && !memcmp(id, "Extended Module: ", 17)) {
+    format = FORMAT_XM;
+  } else if (file->seek(44, SEEK_SET) && (4 == file->read(id, 4)) && !memcmp(id, "SCRM", 4)) {
+    format = FORMAT_S3M;
+  }
+  if (!file->seek(0, SEEK_SET)) return false;
+
+  switch (format) {
+    case FORMAT_XM:
+      if (!LoadXM()) return false;
+      break;
+    case FORMAT_S3M:
+      if (!LoadS3M()) return false;
+      break;
+    default:
+      if (!LoadHeader()) return false;
+      LoadSamples();
+      break;
+  }
+  if (!AllocateSong()) return false;
+
+  Player.amiga = AMIGA;
+  Player.samplesPerTick = sampleRate / (2 * Mod.initialTempo / 5); // Hz = 2 * BPM / 5
+  Player.speed = Mod.initialSpeed;
+  Player.tick = Player.speed;
+  Player.row = 0;
+  Player.rows = Mod.maxRows;
+  Player.globalVolume = Mod.initialGlobalVolume;
+
+  Player.orderIndex = 0;
+  Player.oldOrderIndex = 0xFFFF;
+  Player.patternDelay = 0;
+
+  for (channel = 0; channel < Mod.numberOfChannels; channel++) {
+    Track[channel].keyOn = true;
+    Track[channel].envelopeVolume = 64;
+    Track[channel].fadeout = 65536;
+    Track[channel].bufferSample = 0xFFFF;
+    Track[channel].channelPanning = Mod.initialPanning[channel];
+  }
+  return true;
+}
+
+// Everything sized by the song is allocated here, once the loader has filled in Mod
+bool AudioGeneratorMOD::AllocateSong()
+{
+  if (!Mod.numberOfChannels || !Mod.songLength || !Mod.numberOfSamples) return false;
+  Track = reinterpret_cast<track*>(calloc(Mod.numberOfChannels, sizeof(track)));
+  Player.currentPattern = reinterpret_cast<cell*>(calloc(Mod.maxRows * Mod.numberOfChannels, sizeof(cell)));
+  if (!Track || !Player.currentPattern) {
+    audioLogger->printf_P(PSTR("AudioGeneratorMOD: Not enough memory for %d channels\n"), Mod.numberOfChannels);
+    return false;
+  }
+  return true;
+}
 
 bool AudioGeneratorMOD::LoadHeader()
 {
@@ -202,12 +523,17 @@ bool AudioGeneratorMOD::LoadHeader()
   uint8_t temp[4];
   uint8_t junk[22];
 
+  Mod.samples = reinterpret_cast<Sample*>(calloc(SAMPLES, sizeof(Sample)));
+  if (!Mod.samples) return false;
+  Mod.numberOfSamples = SAMPLES;
+
   if (20 != file->read(/*Mod.name*/junk, 20)) return false; // Skip MOD name
   for (i = 0; i < SAMPLES; i++) {
     if (22 != file->read(junk /*Mod.samples[i].name*/, 22)) return false; // Skip sample name
     if (2 != file->read(temp, 2)) return false;
     Mod.samples[i].length = MakeWord(temp[0], temp[1]) * 2;
-    if (1 != file->read(reinterpret_cast<uint8_t*>(&Mod.samples[i].fineTune), 1)) return false;
+    if (1 != file->read(temp, 1)) return false;
+    Mod.samples[i].fineTune = temp[0];
     if (Mod.samples[i].fineTune > 7) Mod.samples[i].fineTune -= 16;
     if (1 != file->read(&Mod.samples[i].volume, 1)) return false;
     if (2 != file->read(temp, 2)) return false;
@@ -218,7 +544,8 @@ bool AudioGeneratorMOD::LoadHeader()
       Mod.samples[i].loopLength = Mod.samples[i].length - Mod.samples[i].loopBegin;
   }
 
-  if (1 != file->read(&Mod.songLength, 1)) return false;
+  if (1 != file->read(temp, 1)) return false;
+  Mod.songLength = temp[0];
   if (1 != file->read(temp, 1)) return false; // Discard this byte
 
   Mod.numberOfPatterns = 0;
@@ -238,38 +565,267 @@ bool AudioGeneratorMOD::LoadHeader()
   else
     Mod.numberOfChannels = 4;
   
-  if (Mod.numberOfChannels > CHANNELS) {
-    audioLogger->printf("\nAudioGeneratorMOD::LoadHeader abort - too many channels (configured: %d, needed: %d)\n", CHANNELS, Mod.numberOfChannels);
+  if (Mod.numberOfChannels > MAXCHANNELS) {
+    audioLogger->printf("\nAudioGeneratorMOD::LoadHeader abort - too many channels (supported: %d, needed: %d)\n", MAXCHANNELS, Mod.numberOfChannels);
     return(false);
   }
 
+  Mod.maxRows = ROWS;
+  Mod.initialSpeed = 6;
+  Mod.initialTempo = 125;
+  Mod.initialGlobalVolume = 64;
+  for (i = 0; i < Mod.numberOfChannels; i++) {
+    switch (i % 4) {
+      case 0:
+      case 3:
+        Mod.initialPanning[i] = stereoSeparation;
+        break;
+      default:
+        Mod.initialPanning[i] = 128 - stereoSeparation;
+    }
+  }
+
   return true;
 }
 
 void AudioGeneratorMOD::LoadSamples()
 {
   uint8_t i;
-  uint32_t fileOffset = 1084 + Mod.numberOfPatterns * ROWS * Mod.numberOfChannels * 4 - 1;
+  uint32_t fileOffset = 1084 + Mod.numberOfPatterns * ROWS * Mod.numberOfChannels * 4;
 
   for (i = 0; i < SAMPLES; i++) {
+    Mod.samples[i].fileOffset = fileOffset;
+    if (Mod.samples[i].loopLength <= 2) {
+      Mod.samples[i].loopBegin = 0;
+      Mod.samples[i].loopLength = 0;
+    }
+    fileOffset += Mod.samples[i].length;
+  }
+}
 
-    if (Mod.samples[i].length) {
-      Mixer.sampleBegin[i] = fileOffset;
-      Mixer.sampleEnd[i] = fileOffset + Mod.samples[i].length;
-      if (Mod.samples[i].loopLength > 2) {
-        Mixer.sampleloopBegin[i] = fileOffset + Mod.samples[i].loopBegin;
-        Mixer.sampleLoopLength[i] = Mod.samples[i].loopLength;
-        Mixer.sampleLoopEnd[i] = Mixer.sampleloopBegin[i] + Mixer.sampleLoopLength[i];
-      } else {
-        Mixer.sampleloopBegin[i] = 0;
-        Mixer.sampleLoopLength[i] = 0;
-        Mixer.sampleLoopEnd[i] = 0;
-      }
-      fileOffset += Mod.samples[i].length;
+bool AudioGeneratorMOD::LoadS3M()
+{
+  uint8_t hdr[64];
+  uint8_t settings[32];
+  uint8_t temp[36];
+  uint16_t i;
+
+  if (64 != file->read(hdr, 64)) return false;
+  if (32 != file->read(settings, 32)) return false;
+  uint16_t orders = Read16(hdr + 32);
+  uint16_t instruments = Read16(hdr + 34);
+  uint16_t patterns = Read16(hdr + 36);
+  bool isSigned = Read16(hdr + 42) == 1;
+  bool stereo = hdr[51] & 0x80;
+  if ((orders > 256) || (instruments > 255) || (patterns > 256)) return false;
+
+  Mod.initialGlobalVolume = min(hdr[48], 64);
+  Mod.initialSpeed = hdr[49] ? hdr[49] : 6;
+  Mod.initialTempo = (hdr[50] >= 32) ? hdr[50] : 125;
+  Mod.maxRows = ROWS;
+
+  // Only the PCM channels get played, packed together
+  Mod.numberOfChannels = 0;
+  for (i = 0; i < 32; i++) {
+    if (settings[i] < 16) {
+      Mod.channelMap[i] = Mod.numberOfChannels;
+      if (!stereo) Mod.initialPanning[Mod.numberOfChannels] = 64;
+      else if (settings[i] < 8) Mod.initialPanning[Mod.numberOfChannels] = stereoSeparation;
+      else Mod.initialPanning[Mod.numberOfChannels] = 128 - stereoSeparation;
+      Mod.numberOfChannels++;
+    } else {
+      Mod.channelMap[i] = 0xff;
+    }
+  }
+
+  // Order list, without the "+++" markers and stopping at the first "---"
+  if (orders != file->read(Mod.order, orders)) return false;
+  Mod.songLength = 0;
+  for (i = 0; i < orders; i++) {
+    if (Mod.order[i] == 255) break;
+    if (Mod.order[i] != 254) Mod.order[Mod.songLength++] = Mod.order[i];
+  }
+
+  // Instruments and patterns are found through paragraph (16 byte) pointers
+  uint32_t instrumentPointers = 96 + orders;
+  uint32_t patternPointers = instrumentPointers + instruments * 2;
+  Mod.patternOffset = reinterpret_cast<uint32_t*>(calloc(patterns ? patterns : 1, sizeof(uint32_t)));
+  Mod.samples = reinterpret_cast<Sample*>(calloc(instruments ? instruments : 1, sizeof(Sample)));
+  if (!Mod.patternOffset || !Mod.samples) return false;
+  Mod.numberOfPatterns = patterns;
+  Mod.numberOfSamples = instruments;
+
+  if (!file->seek(patternPointers, SEEK_SET)) return false;
+  for (i = 0; i < patterns; i++) {
+    if (2 != file->read(temp, 2)) return false;
+    Mod.patternOffset[i] = Read16(temp) * 16;
+  }
+  if (hdr[53] == 252) {
+    if (32 != file->read(temp, 32)) return false;
+    for (i = 0; i < 32; i++) {
+      if ((Mod.channelMap[i] != 0xff) && (temp[i] & 0x20))
+        Mod.initialPanning[Mod.channelMap[i]] = (temp[i] & 0xf) * 128 / 15;
+    }
+  }
+
+  for (i = 0; i < instruments; i++) {
+    Sample *s = &Mod.samples[i];
+    if (!file->seek(instrumentPointers + i * 2, SEEK_SET)) return false;
+    if (2 != file->read(temp, 2)) return false;
+    if (!file->seek(Read16(temp) * 16, SEEK_SET)) return false;
+    if (36 != file->read(temp, 36)) return false;
+    if ((temp[0] != 1) || temp[30]) continue; // Not a sample, or packed
+
+    s->fileOffset = ((temp[13] << 16) | (temp[15] << 8) | temp[14]) * 16;
+    s->length = Read32(temp + 16);
+    s->volume = min(temp[28], 64);
+    s->flags = ((temp[31] & 4) ? SAMPLE_16BIT : 0) | (isSigned ? 0 : SAMPLE_UNSIGNED);
+    s->c4Speed = Read32(temp + 32);
+    uint32_t loopBegin = Read32(temp + 20);
+    uint32_t loopEnd = Read32(temp + 24);
+    if ((temp[31] & 1) && (loopBegin < loopEnd) && (loopEnd <= s->length)) {
+      s->loopBegin = loopBegin;
+      s->loopLength = loopEnd - loopBegin;
     }
+  }
+  return true;
+}
 
+bool AudioGeneratorMOD::LoadXM()
+{
+  uint8_t temp[48];
+  uint16_t i, j;
+
+  if (!file->seek(60, SEEK_SET)) return false;
+  if (20 != file->read(temp, 20)) return false;
+  uint32_t headerSize = Read32(temp);
+  Mod.songLength = Read16(temp + 4);
+  Mod.numberOfChannels = Read16(temp + 8);
+  uint16_t patterns = Read16(temp + 10);
+  uint16_t instruments = Read16(temp + 12);
+  Mod.linearFrequencies = Read16(temp + 14) & 1;
+  Mod.initialSpeed = Read16(temp + 16) ? Read16(temp + 16) : 6;
+  Mod.initialTempo = (Read16(temp + 18) >= 32) ? Read16(temp + 18) : 125;
+  Mod.initialGlobalVolume = 64;
+  if ((headerSize < 20) || (Mod.songLength > 256) || (patterns > 256) || (instruments > 128)) return false;
+  if (Mod.numberOfChannels > MAXCHANNELS) {
+    audioLogger->printf_P(PSTR("AudioGeneratorMOD: XM has %d channels, only %d are supported\n"), Mod.numberOfChannels, MAXCHANNELS);
+    return false;
+  }
+  uint32_t orders = min(headerSize - 20, 256U);
+  if (orders != file->read(Mod.order, orders)) return false;
+  for (i = 0; i < Mod.numberOfChannels; i++) {
+    Mod.initialPanning[i] = 64;
   }
 
+  // Patterns are packed, so note where each one's data is
+  Mod.numberOfPatterns = patterns;
+  Mod.patternOffset = reinterpret_cast<uint32_t*>(calloc(patterns ? patterns : 1, sizeof(uint32_t)));
+  Mod.patternRows = reinterpret_cast<uint16_t*>(calloc(patterns ? patterns : 1, sizeof(uint16_t)));
+  Mod.patternSize = reinterpret_cast<uint16_t*>(calloc(patterns ? patterns : 1, sizeof(uint16_t)));
+  if (!Mod.patternOffset || !Mod.patternRows || !Mod.patternSize) return false;
+  Mod.maxRows = ROWS; // Orders past the last pattern play an empty 64 rows
+  uint32_t pos = 60 + headerSize;
+  for (i = 0; i < patterns; i++) {
+    if (!file->seek(pos, SEEK_SET)) return false;
+    if (9 != file->read(temp, 9)) return false;
+    uint32_t len = Read32(temp);
+    Mod.patternRows[i] = Read16(temp + 5);
+    if (!Mod.patternRows[i] || (Mod.patternRows[i] > MAXROWS)) Mod.patternRows[i] = ROWS;
+    Mod.patternSize[i] = Read16(temp + 7);
+    Mod.patternOffset[i] = pos + len;
+    if (Mod.patternRows[i] > Mod.maxRows) Mod.maxRows = Mod.patternRows[i];
+    pos += len + Mod.patternSize[i];
+  }
+
+  Mod.numberOfInstruments = instruments;
+  Mod.instruments = reinterpret_cast<instrument*>(calloc(instruments ? instruments : 1, sizeof(instrument)));
+  if (!Mod.instruments) return false;
+  for (i = 0; i < instruments; i++) {
+    instrument *ins = &Mod.instruments[i];
+    if (!file->seek(pos, SEEK_SET)) return false;
+    if (29 != file->read(temp, 29)) return false;
+    uint32_t size = Read32(temp);
+    uint16_t samples = Read16(temp + 27);
+    uint32_t sampleHeaderSize = 0;
+    ins->firstSample = Mod.numberOfSamples;
+    if (samples > 16) return false;
+    if (samples) {
+      if (4 != file->read(temp, 4)) return false;
+      sampleHeaderSize = Read32(temp);
+      if (96 != file->read(ins->sampleMap, 96)) return false;
+      for (j = 0; j < 96; j++) {
+        if (ins->sampleMap[j] >= samples) ins->sampleMap[j] = 0;
+      }
+      if (48 != file->read(temp, 48)) return false;
+      for (j = 0; j < 12; j++) {
+        ins->envelopeTick[j] = Read16(temp + j * 4);
+        ins->envelopeVolume[j] = min(Read16(temp + j * 4 + 2), 64);
+      }
+      // Skip the panning envelope
+      if (!file->seek(pos + 29 + 4 + 96 + 48 + 48, SEEK_SET)) return false;
+      if (16 != file->read(temp, 16)) return false;
+      ins->envelopePoints = min(temp[0], 12);
+      ins->envelopeSustain = temp[2];
+      ins->envelopeLoopBegin = temp[3];
+      ins->envelopeLoopEnd = temp[4];
+      ins->envelopeFlags = temp[8] & (ENVELOPE_ON | ENVELOPE_SUSTAIN | ENVELOPE_LOOP);
+      ins->fadeout = Read16(temp + 14);
+      if (!ins->envelopePoints) ins->envelopeFlags = 0;
+      if (ins->envelopeSustain >= ins->envelopePoints) ins->envelopeFlags &= ~ENVELOPE_SUSTAIN;
+      if ((ins->envelopeLoopBegin > ins->envelopeLoopEnd) || (ins->envelopeLoopEnd >= ins->envelopePoints))
+        ins->envelopeFlags &= ~ENVELOPE_LOOP;
+    }
+    pos += size;
+    if (!samples) continue;
+
+    Sample *grown = reinterpret_cast<Sample*>(realloc(Mod.samples, (Mod.numberOfSamples + samples) * sizeof(Sample)));
+    if (!grown) return false;
+    Mod.samples = grown;
+    ins->numberOfSamples = samples;
+    Mod.numberOfSamples += samples;
+
+    // All the sample headers, then all their data
+    for (j = 0; j < samples; j++) {
+      Sample *s = &Mod.samples[ins->firstSample + j];
+      memset(s, 0, sizeof(*s));
+      if (!file->seek(pos, SEEK_SET)) return false;
+      if (18 != file->read(temp, 18)) return false;
+      s->length = Read32(temp);        // In bytes for now
+      s->loopBegin = Read32(temp + 4);
+      s->loopLength = Read32(temp + 8);
+      s->volume = min(temp[12], 64);
+      s->fineTune = temp[13];
+      s->flags = SAMPLE_DELTA | ((temp[14] & 0x10) ? SAMPLE_16BIT : 0) | (((temp[14] & 3) == 2) ? SAMPLE_PINGPONG : 0);
+      s->panning = temp[15];
+      s->relativeNote = temp[16];
+      if (!(temp[14] & 3)) s->loopLength = 0;
+      pos += sampleHeaderSize;
+    }
+    for (j = 0; j < samples; j++) {
+      Sample *s = &Mod.samples[ins->firstSample + j];
+      s->fileOffset = pos;
+      pos += s->length;
+      if (s->flags & SAMPLE_16BIT) {
+        s->length /= 2;
+        s->loopBegin /= 2;
+        s->loopLength /= 2;
+      }
+      if (s->loopBegin >= s->length) s->loopLength = 0;
+      if (s->loopBegin + s->loopLength > s->length) s->loopLength = s->length - s->loopBegin;
+      if (!s->loopLength) {
+        s->loopBegin = 0;
+        s->flags &= ~SAMPLE_PINGPONG;
+      }
+    }
+  }
+  if (!Mod.numberOfSamples) {
+    // Nothing to play, but keep the player happy
+    Mod.samples = reinterpret_cast<Sample*>(calloc(1, sizeof(Sample)));
+    if (!Mod.samples) return false;
+    Mod.numberOfSamples = 1;
+  }
+  return true;
 }
 
 bool AudioGeneratorMOD::LoadPattern(uint8_t pattern)
@@ -280,44 +836,301 @@ bool AudioGeneratorMOD::LoadPattern(uint8_t pattern)
   uint8_t temp[4];
   uint16_t amigaPeriod;
 
+  if (format == FORMAT_S3M) return LoadPatternS3M(pattern);
+  if (format == FORMAT_XM) return LoadPatternXM(pattern);
+
   if (!file->seek(1084 + pattern * ROWS * Mod.numberOfChannels * 4, SEEK_SET)) return false;
 
+  Player.rows = ROWS;
   for (row = 0; row < ROWS; row++) {
     for (channel = 0; channel < Mod.numberOfChannels; channel++) {
+      cell *c = &Player.currentPattern[row * Mod.numberOfChannels + channel];
 
       if (4 != file->read(temp, 4)) return false;
 
-      Player.currentPattern.sampleNumber[row][channel] = (temp[0] & 0xF0) + (temp[2] >> 4);
+      c->sampleNumber = (temp[0] & 0xF0) + (temp[2] >> 4);
 
       amigaPeriod = ((temp[0] & 0xF) << 8) + temp[1];
-      //   Player.currentPattern.note[row][channel] = NONOTE;
-      Player.currentPattern.note8[row][channel] = NONOTE8;
+      c->note = NONOTE8;
       for (i = 1; i < 37; i++)
         if (amigaPeriod > ReadAmigaPeriods(i * 8) - 3 &&
             amigaPeriod < ReadAmigaPeriods(i * 8) + 3)
-          Player.currentPattern.note8[row][channel] = i;
+          c->note = i;
 
-      Player.currentPattern.effectNumber[row][channel] = temp[2] & 0xF;
-      Player.currentPattern.effectParameter[row][channel] = temp[3];
+      c->volume = 0;
+      c->effectNumber = temp[2] & 0xF;
+      c->effectParameter = temp[3];
     }
   }
 
   return true;
 }
 
+int AudioGeneratorMOD::ReadByte()
+{
+  if (readPos == readLen) {
+    readLen = file->read(readBuffer, sizeof(readBuffer));
+    readPos = 0;
+    if (!readLen) return -1;
+  }
+  return readBuffer[readPos++];
+}
+
+bool AudioGeneratorMOD::LoadPatternS3M(uint8_t pattern)
+{
+  cell unused;
+
+  Player.rows = ROWS;
+  for (int i = 0; i < ROWS * Mod.numberOfChannels; i++) {
+    memset(&Player.currentPattern[i], 0, sizeof(cell));
+    Player.currentPattern[i].note = NONOTE8;
+  }
+  if ((pattern >= Mod.numberOfPatterns) || !Mod.patternOffset[pattern]) return true; // Empty
+
+  if (!file->seek(Mod.patternOffset[pattern] + 2, SEEK_SET)) return false;
+  readPos = readLen = 0;
+  uint8_t row = 0;
+  while (row < ROWS) {
+    int what = ReadByte();
+    if (what < 0) return false;
+    if (!what) {
+      row++;
+      continue;
+    }
+    uint8_t channel = Mod.channelMap[what & 31];
+    cell *c = (channel == 0xff) ? &unused : &Player.currentPattern[row * Mod.numberOfChannels + channel];
+    if (what & 32) {
+      int note = ReadByte();
+      int sampleNumber = ReadByte();
+      if (sampleNumber < 0) return false;
+      if (note == 255) c->note = NONOTE8;
+      else if (note == 254) c->note = KEYOFF8;
+      else if ((note & 0xf) < 12) c->note = (note >> 4) * 12 + (note & 0xf);
+      c->sampleNumber = sampleNumber;
+    }
+    if (what & 64) {
+      int volume = ReadByte();
+      if (volume < 0) return false;
+      if (volume <= 64) c->volume = 0x10 + volume; // Same as an XM volume column
+    }
+    if (what & 128) {
+      int effect = ReadByte();
+      int param = ReadByte();
+      if (param < 0) return false;
+      c->effectNumber = effect; // Converted when played, after the last parameter's been recalled
+      c->effectParameter = param;
+    }
+  }
+  return true;
+}
+
+bool AudioGeneratorMOD::LoadPatternXM(uint8_t pattern)
+{
+  uint8_t v[5];
+
+  Player.rows = (pattern < Mod.numberOfPatterns) ? Mod.patternRows[pattern] : ROWS;
+  for (int i = 0; i < Player.rows * Mod.numberOfChannels; i++) {
+    memset(&Player.currentPattern[i], 0, sizeof(cell));
+    Player.currentPattern[i].note = NONOTE8;
+  }
+  if ((pattern >= Mod.numberOfPatterns) || !Mod.patternSize[pattern]) return true; // Empty
+
+  if (!file->seek(Mod.patternOffset[pattern], SEEK_SET)) return false;
+  readPos = readLen = 0;
+  for (int i = 0; i < Player.rows * Mod.numberOfChannels; i++) {
+    cell *c = &Player.currentPattern[i];
+    int b = ReadByte();
+    if (b < 0) return false;
+    memset(v, 0, sizeof(v));
+    if (b & 0x80) {
+      // Packed, the low bits say which fields follow
+      for (int j = 0; j < 5; j++) {
+        if (b & (1 << j)) {
+          int x = ReadByte();
+          if (x < 0) return false;
+          v[j] = x;
+        }
+      }
+    } else {
+      v[0] = b;
+      for (int j = 1; j < 5; j++) {
+        int x = ReadByte();
+        if (x < 0) return false;
+        v[j] = x;
+      }
+    }
+    if (v[0] == 97) c->note = KEYOFF8;
+    else if (v[0] && (v[0] < 97)) c->note = v[0] - 1;
+    c->sampleNumber = v[1];
+    c->volume = v[2];
+    c->effectNumber = v[3];
+    c->effectParameter = v[4];
+  }
+  return true;
+}
+
+// Reads every sample into RAM, undoing XM's delta coding and S3M's unsigned data, unrolling
+// ping-pong loops into forward ones and surrounding each with its guard frames
+bool AudioGeneratorMOD::PreloadSamples()
+{
+  uint32_t size = 2;
+  uint16_t i;
+
+  for (i = 0; i < Mod.numberOfSamples; i++) {
+    const Sample *s = &Mod.samples[i];
+    uint32_t frames = GUARDPRE + s->length + GUARDPOST + ((s->flags & SAMPLE_PINGPONG) ? s->loopLength : 0);
+    size += ((frames * ((s->flags & SAMPLE_16BIT) ? 2 : 1)) + 1) & ~1;
+  }
+
+#ifdef ESP32
+  sampleData = reinterpret_cast<int8_t*>(ps_malloc(size));
+  if (!sampleData)
+#endif
+  sampleData = reinterpret_cast<int8_t*>(malloc(size));
+  if (!sampleData) return false;
+
+  uint32_t at = 0;
+  for (i = 0; i < Mod.numberOfSamples; i++) {
+    Sample *s = &Mod.samples[i];
+    int bytes = (s->flags & SAMPLE_16BIT) ? 2 : 1;
+    uint32_t frames = GUARDPRE + s->length + GUARDPOST + ((s->flags & SAMPLE_PINGPONG) ? s->loopLength : 0);
+    memset(sampleData + at, 0, GUARDPRE * bytes);
+    s->data = sampleData + at + GUARDPRE * bytes;
+    at += ((frames * bytes) + 1) & ~1;
+
+    uint32_t got = 0;
+    if (s->length && file->seek(s->fileOffset, SEEK_SET)) {
+      got = file->read(s->data, s->length * bytes) / bytes;
+    }
+    if (got < s->length) memset(s->data + got * bytes, 0, (s->length - got) * bytes); // Truncated file
+
+    if (bytes == 2) {
+      int16_t *d = reinterpret_cast<int16_t*>(s->data);
+      int16_t acc = 0;
+      for (uint32_t j = 0; j < s->length; j++) {
+        if (s->flags & SAMPLE_DELTA) d[j] = acc += d[j];
+        if (s->flags & SAMPLE_UNSIGNED) d[j] ^= 0x8000;
+      }
+      if (s->flags & SAMPLE_PINGPONG) {
+        uint32_t loopEnd = s->loopBegin + s->loopLength;
+        for (uint32_t j = 0; j < s->loopLength; j++) d[loopEnd + j] = d[loopEnd - 1 - j];
+      }
+    } else {
+      int8_t *d = s->data;
+      int8_t acc = 0;
+      for (uint32_t j = 0; j < s->length; j++) {
+        if (s->flags & SAMPLE_DELTA) d[j] = acc += d[j];
+        if (s->flags & SAMPLE_UNSIGNED) d[j] ^= 0x80;
+      }
+      if (s->flags & SAMPLE_PINGPONG) {
+        uint32_t loopEnd = s->loopBegin + s->loopLength;
+        for (uint32_t j = 0; j < s->loopLength; j++) d[loopEnd + j] = d[loopEnd - 1 - j];
+      }
+    }
+    if (s->flags & SAMPLE_PINGPONG) {
+      // Forwards then backwards is just a loop twice as long
+      s->length = s->loopBegin + s->loopLength * 2;
+      s->loopLength *= 2;
+      s->flags &= ~SAMPLE_PINGPONG;
+    }
+
+    for (int j = 0; j < GUARDPOST; j++) {
+      uint32_t from = s->loopBegin + (s->loopLength ? j % s->loopLength : 0);
+      if (bytes == 2) {
+        int16_t *d = reinterpret_cast<int16_t*>(s->data);
+        d[s->length + j] = s->loopLength ? d[from] : 0;
+      } else {
+        s->data[s->length + j] = s->loopLength ? s->data[from] : 0;
+      }
+    }
+  }
+  return true;
+}
+
+// The guard frames for a streamed sample: where a loop goes back to, or silence
+bool AudioGeneratorMOD::ReadGuard(uint16_t sample)
+{
+  Sample *s = &Mod.samples[sample];
+  uint8_t temp[GUARDPOST * 2];
+
+  memset(s->guard, 0, sizeof(s->guard));
+  if (!s->loopLength) return true;
+  int bytes = (s->flags & SAMPLE_16BIT) ? 2 : 1;
+  int frames = min(s->loopLength, (uint32_t)GUARDPOST);
+  if (!file->seek(s->fileOffset + s->loopBegin * bytes, SEEK_SET)) return false;
+  if (frames * bytes != (int)file->read(temp, frames * bytes)) return false;
+  for (int j = 0; j < GUARDPOST; j++) {
+    int k = j % frames;
+    if (bytes == 2) s->guard[j] = (int16_t)(Read16(temp + k * 2) ^ ((s->flags & SAMPLE_UNSIGNED) ? 0x8000 : 0));
+    else s->guard[j] = (int8_t)(temp[k] ^ ((s->flags & SAMPLE_UNSIGNED) ? 0x80 : 0));
+  }
+  return true;
+}
+
+// Unpacks a pattern cell's note: MOD notes index amigaPeriods[], S3M and XM ones are semitones above C-0
+#define NOTE(c) ((c)->note == NONOTE8 ? NONOTE : (c)->note == KEYOFF8 ? KEYOFF : (format == FORMAT_MOD) ? 8 * (c)->note : (c)->note)
+
+// MOD periods are the Amiga's, S3M and XM ones are 4x finer
+#define PERIODSCALE (format == FORMAT_MOD ? 1 : 4)
+
+int32_t AudioGeneratorMOD::NotePeriod(uint16_t note, uint16_t sampleNumber)
+{
+  const Sample *s = &Mod.samples[sampleNumber];
+
+  switch (format) {
+    case FORMAT_MOD:
+      return ReadAmigaPeriods(note + s->fineTune);
+    case FORMAT_S3M:
+      return ((8363UL * 16 * ReadS3MPeriods(note % 12)) / (s->c4Speed ? s->c4Speed : 8363)) >> (note / 12);
+    default: {
+      // 64 steps a semitone up from C-0
+      int32_t x = ((int32_t)note + s->relativeNote) * 64 + s->fineTune / 2;
+      if (Mod.linearFrequencies) return 10 * 12 * 16 * 4 - x;
+      if (x < 0) x = 0;
+      if (x >= 768 * 15) x = 768 * 15 - 1;
+      return (27392UL << 16) / Pow2(x);
+    }
+  }
+}
+
+// Mixer step (Q FIXED_DIVIDER sample frames per output frame) for a period
+uint32_t AudioGeneratorMOD::PeriodToFrequency(int32_t period)
+{
+  if (period < 1) period = 1;
+
+  switch (format) {
+    case FORMAT_MOD:
+      return Player.amiga / period;
+    case FORMAT_S3M:
+      return ((uint64_t)14317056 << FIXED_DIVIDER) / ((uint64_t)period * sampleRate);
+    default: {
+      if (!Mod.linearFrequencies) return ((uint64_t)(8363 * 1712) << FIXED_DIVIDER) / ((uint64_t)period * sampleRate);
+      // 8363Hz at C-4 (period 4608), and an octave every 768
+      int32_t x = 6 * 12 * 16 * 4 - period;
+      int shift = 0;
+      while (x < 0) {
+        x += 768;
+        shift++;
+      }
+      if (shift > 31) return 0;
+      return (((uint64_t)8363 * Pow2(x) << FIXED_DIVIDER) / ((uint64_t)sampleRate << 16)) >> shift;
+    }
+  }
+}
+
 void AudioGeneratorMOD::Portamento(uint8_t channel)
 {
-  if (Player.lastAmigaPeriod[channel] < Player.portamentoNote[channel]) {
-    Player.lastAmigaPeriod[channel] += Player.portamentoSpeed[channel];
-    if (Player.lastAmigaPeriod[channel] > Player.portamentoNote[channel])
-      Player.lastAmigaPeriod[channel] = Player.portamentoNote[channel];
+  if (Track[channel].lastAmigaPeriod < Track[channel].portamentoNote) {
+    Track[channel].lastAmigaPeriod += Track[channel].portamentoSpeed * PERIODSCALE;
+    if (Track[channel].lastAmigaPeriod > Track[channel].portamentoNote)
+      Track[channel].lastAmigaPeriod = Track[channel].portamentoNote;
   }
-  if (Player.lastAmigaPeriod[channel] > Player.portamentoNote[channel]) {
-    Player.lastAmigaPeriod[channel] -= Player.portamentoSpeed[channel];
-    if (Player.lastAmigaPeriod[channel] < Player.portamentoNote[channel])
-      Player.lastAmigaPeriod[channel] = Player.portamentoNote[channel];
+  if (Track[channel].lastAmigaPeriod > Track[channel].portamentoNote) {
+    Track[channel].lastAmigaPeriod -= Track[channel].portamentoSpeed * PERIODSCALE;
+    if (Track[channel].lastAmigaPeriod < Track[channel].portamentoNote)
+      Track[channel].lastAmigaPeriod = Track[channel].portamentoNote;
   }
-  Mixer.channelFrequency[channel] = Player.amiga / Player.lastAmigaPeriod[channel];
+  Track[channel].channelFrequency = PeriodToFrequency(Track[channel].lastAmigaPeriod);
 }
 
 void AudioGeneratorMOD::Vibrato(uint8_t channel)
@@ -325,15 +1138,15 @@ void AudioGeneratorMOD::Vibrato(uint8_t channel)
   uint16_t delta;
   uint16_t temp;
 
-  temp = Player.vibratoPos[channel] & 31;
+  temp = Track[channel].vibratoPos & 31;
 
-  switch (Player.waveControl[channel] & 3) {
+  switch (Track[channel].waveControl & 3) {
     case 0:
       delta = ReadSine(temp);
       break;
     case 1:
       temp <<= 3;
-      if (Player.vibratoPos[channel] < 0)
+      if (Track[channel].vibratoPos < 0)
         temp = 255 - temp;
       delta = temp;
       break;
@@ -345,16 +1158,17 @@ void AudioGeneratorMOD::Vibrato(uint8_t channel)
       break;
   }
 
-  delta *= Player.vibratoDepth[channel];
+  delta *= Track[channel].vibratoDepth;
   delta >>= 7;
+  delta *= PERIODSCALE;
 
-  if (Player.vibratoPos[channel] >= 0)
-    Mixer.channelFrequency[channel] = Player.amiga / (Player.lastAmigaPeriod[channel] + delta);
+  if (Track[channel].vibratoPos >= 0)
+    Track[channel].channelFrequency = PeriodToFrequency(Track[channel].lastAmigaPeriod + delta);
   else
-    Mixer.channelFrequency[channel] = Player.amiga / (Player.lastAmigaPeriod[channel] - delta);
+    Track[channel].channelFrequency = PeriodToFrequency(Track[channel].lastAmigaPeriod - delta);
 
-  Player.vibratoPos[channel] += Player.vibratoSpeed[channel];
-  if (Player.vibratoPos[channel] > 31) Player.vibratoPos[channel] -= 64;
+  Track[channel].vibratoPos += Track[channel].vibratoSpeed;
+  if (Track[channel].vibratoPos > 31) Track[channel].vibratoPos -= 64;
 }
 
 void AudioGeneratorMOD::Tremolo(uint8_t channel)
@@ -362,15 +1176,15 @@ void AudioGeneratorMOD::Tremolo(uint8_t channel)
   uint16_t delta;
   uint16_t temp;
 
-  temp = Player.tremoloPos[channel] & 31;
+  temp = Track[channel].tremoloPos & 31;
 
-  switch (Player.waveControl[channel] & 3) {
+  switch (Track[channel].waveControl & 3) {
     case 0:
       delta = ReadSine(temp);
       break;
     case 1:
       temp <<= 3;
-      if (Player.tremoloPos[channel] < 0)
+      if (Track[channel].tremoloPos < 0)
         temp = 255 - temp;
       delta = temp;
       break;
@@ -382,19 +1196,248 @@ void AudioGeneratorMOD::Tremolo(uint8_t channel)
       break;
   }
 
-  delta *= Player.tremoloDepth[channel];
+  delta *= Track[channel].tremoloDepth;
   delta >>= 6;
 
-  if (Player.tremoloPos[channel] >= 0) {
-    if (Player.volume[channel] + delta > 64) delta = 64 - Player.volume[channel];
-    Mixer.channelVolume[channel] = Player.volume[channel] + delta;
+  if (Track[channel].tremoloPos >= 0) {
+    if (Track[channel].volume + delta > 64) delta = 64 - Track[channel].volume;
+    Track[channel].channelVolume = Track[channel].volume + delta;
   } else {
-    if (Player.volume[channel] - delta < 0) delta = Player.volume[channel];
-    Mixer.channelVolume[channel] = Player.volume[channel] - delta;
+    if (Track[channel].volume - delta < 0) delta = Track[channel].volume;
+    Track[channel].channelVolume = Track[channel].volume - delta;
   }
 
-  Player.tremoloPos[channel] += Player.tremoloSpeed[channel];
-  if (Player.tremoloPos[channel] > 31) Player.tremoloPos[channel] -= 64;
+  Track[channel].tremoloPos += Track[channel].tremoloSpeed;
+  if (Track[channel].tremoloPos > 31) Track[channel].tremoloPos -= 64;
+}
+
+// Releases the note: the envelope leaves its sustain point and fades out, or without one it's silenced
+void AudioGeneratorMOD::KeyOff(uint8_t channel)
+{
+  Track[channel].keyOn = false;
+  if ((format != FORMAT_XM) || !(Mod.instruments[Track[channel].lastInstrument].envelopeFlags & ENVELOPE_ON)) {
+    Track[channel].volume = 0;
+    Track[channel].channelVolume = 0;
+  }
+}
+
+void AudioGeneratorMOD::Envelope(uint8_t channel)
+{
+  if ((format != FORMAT_XM) || !Mod.numberOfInstruments) return;
+
+  const instrument *ins = &Mod.instruments[Track[channel].lastInstrument];
+  if (ins->envelopeFlags & ENVELOPE_ON) {
+    uint16_t tick = Track[channel].envelopeTick;
+    uint8_t last = ins->envelopePoints - 1;
+    uint8_t i = 0;
+    while ((i < last) && (tick >= ins->envelopeTick[i + 1])) i++;
+    if ((i == last) || (ins->envelopeTick[i + 1] <= ins->envelopeTick[i])) {
+      Track[channel].envelopeVolume = ins->envelopeVolume[i];
+    } else {
+      int32_t y0 = ins->envelopeVolume[i];
+      int32_t y1 = ins->envelopeVolume[i + 1];
+      Track[channel].envelopeVolume = y0 + (y1 - y0) * (tick - ins->envelopeTick[i]) / (ins->envelopeTick[i + 1] - ins->envelopeTick[i]);
+    }
+
+    // Hold at the sustain point while the key is down, otherwise move on and maybe go round the loop
+    if (!(Track[channel].keyOn && (ins->envelopeFlags & ENVELOPE_SUSTAIN) && (tick == ins->envelopeTick[ins->envelopeSustain]))) {
+      tick++;
+      if ((ins->envelopeFlags & ENVELOPE_LOOP) && (tick >= ins->envelopeTick[ins->envelopeLoopEnd]))
+        tick = ins->envelopeTick[ins->envelopeLoopBegin];
+      Track[channel].envelopeTick = tick;
+    }
+  } else {
+    Track[channel].envelopeVolume = 64;
+  }
+
+  if (!Track[channel].keyOn) {
+    uint32_t step = ins->fadeout * 2;
+    Track[channel].fadeout = (Track[channel].fadeout > step) ? Track[channel].fadeout - step : 0;
+  }
+}
+
+void AudioGeneratorMOD::UpdateGain(uint8_t channel)
+{
+  uint32_t gain = Track[channel].channelVolume * Track[channel].envelopeVolume;
+  gain = gain * Player.globalVolume >> 6;
+  gain = gain * (Track[channel].fadeout >> 4) >> 12;
+  Track[channel].channelGain = gain;
+}
+
+// Scream Tracker's lettered commands, as their ProTracker/FastTracker equivalents
+void AudioGeneratorMOD::ConvertS3MEffect(uint8_t channel, uint8_t *effect, uint8_t *param)
+{
+  uint8_t e = *effect;
+  uint8_t p = *param;
+  uint8_t x = p >> 4;
+  uint8_t y = p & 0xF;
+
+  // D, E, F, I, J, K, L, Q, R and S all reuse the last non-zero parameter
+  switch (e) {
+    case 'D' - '@': case 'E' - '@': case 'F' - '@': case 'I' - '@': case 'J' - '@':
+    case 'K' - '@': case 'L' - '@': case 'Q' - '@': case 'R' - '@': case 'S' - '@':
+      if (p) Track[channel].memory[0] = p;
+      else p = Track[channel].memory[0];
+      x = p >> 4;
+      y = p & 0xF;
+      break;
+  }
+
+  *effect = ARPEGGIO;
+  *param = 0;
+  switch (e) {
+    case 'A' - '@': // Speed
+      if (p) {
+        *effect = SETSPEED;
+        *param = min(p, 0x1F);
+      }
+      break;
+    case 'B' - '@': *effect = JUMPTOORDER; *param = p; break;
+    case 'C' - '@': *effect = BREAKPATTERNTOROW; *param = p; break;
+    case 'D' - '@': // Volume slide, with the fine ones folded in
+      if ((y == 0xF) && x) {
+        *effect = ESUBSET;
+        *param = (FINEVOLUMESLIDEUP << 4) | x;
+      } else if ((x == 0xF) && y) {
+        *effect = ESUBSET;
+        *param = (FINEVOLUMESLIDEDOWN << 4) | y;
+      } else {
+        *effect = VOLUMESLIDE;
+        *param = y ? y : p;
+      }
+      break;
+    case 'E' - '@': // Portamento down
+    case 'F' - '@': // ...and up
+      if (x == 0xF) {
+        *effect = ESUBSET;
+        *param = (((e == 'E' - '@') ? FINEPORTAMENTODOWN : FINEPORTAMENTOUP) << 4) | y;
+      } else if (x == 0xE) {
+        *effect = EXTRAFINEPORTAMENTO;
+        *param = ((e == 'E' - '@') ? 0x20 : 0x10) | y;
+      } else {
+        *effect = (e == 'E' - '@') ? PORTAMENTODOWN : PORTAMENTOUP;
+        *param = p;
+      }
+      break;
+    case 'G' - '@': *effect = TONEPORTAMENTO; *param = p; break;
+    case 'H' - '@': *effect = VIBRATO; *param = p; break;
+    case 'J' - '@': *effect = ARPEGGIO; *param = p; break;
+    case 'K' - '@': *effect = VIBRATOVOLUMESLIDE; *param = p; break;
+    case 'L' - '@': *effect = PORTAMENTOVOLUMESLIDE; *param = p; break;
+    case 'O' - '@': *effect = SETSAMPLEOFFSET; *param = p; break;
+    case 'Q' - '@': *effect = MULTIRETRIG; *param = p; break;
+    case 'R' - '@': *effect = TREMOLO; *param = p; break;
+    case 'S' - '@':
+      switch (x) {
+        case 0x1: *effect = ESUBSET; *param = (GLISSANDOCONTROL << 4) | y; break;
+        case 0x3: *effect = ESUBSET; *param = (SETVIBRATOWAVEFORM << 4) | y; break;
+        case 0x4: *effect = ESUBSET; *param = (SETTREMOLOWAVEFORM << 4) | y; break;
+        case 0x8: *effect = SETCHANNELPANNING; *param = y * 17; break;
+        case 0xB: *effect = ESUBSET; *param = (PATTERNLOOP << 4) | y; break;
+        case 0xC: *effect = ESUBSET; *param = (NOTECUT << 4) | y; break;
+        case 0xD: *effect = ESUBSET; *param = (NOTEDELAY << 4) | y; break;
+        case 0xE: *effect = ESUBSET; *param = (PATTERNDELAY << 4) | y; break;
+      }
+      break;
+    case 'T' - '@': // Tempo
+      if (p >= 0x20) {
+        *effect = SETSPEED;
+        *param = p;
+      }
+      break;
+    case 'U' - '@': *effect = VIBRATO; *param = (x << 4) | (y >> 2); break; // Fine vibrato, near enough
+    case 'V' - '@': *effect = SETGLOBALVOLUME; *param = p; break;
+    case 'X' - '@': *effect = SETCHANNELPANNING; *param = min(p * 2, 255); break;
+  }
+}
+
+// FastTracker effects which reuse their last parameter when given zero
+void AudioGeneratorMOD::RecallXMEffect(uint8_t channel, uint8_t *effect, uint8_t *param)
+{
+  int slot = -1;
+  uint8_t x = *param >> 4;
+
+  switch (*effect) {
+    case PORTAMENTOUP: slot = MEM_PORTAUP; break;
+    case PORTAMENTODOWN: slot = MEM_PORTADOWN; break;
+    case VOLUMESLIDE:
+    case PORTAMENTOVOLUMESLIDE:
+    case VIBRATOVOLUMESLIDE: slot = MEM_VOLSLIDE; break;
+    case GLOBALVOLUMESLIDE: slot = MEM_GLOBALVOLSLIDE; break;
+    case PANNINGSLIDE: slot = MEM_PANSLIDE; break;
+    case MULTIRETRIG: slot = MEM_RETRIG; break;
+    case ESUBSET:
+    case EXTRAFINEPORTAMENTO:
+      // These only remember the low nibble
+      if (*effect == ESUBSET) {
+        if (x == FINEPORTAMENTOUP) slot = MEM_FINEPORTAUP;
+        else if (x == FINEPORTAMENTODOWN) slot = MEM_FINEPORTADOWN;
+        else if (x == FINEVOLUMESLIDEUP) slot = MEM_FINEVOLUP;
+        else if (x == FINEVOLUMESLIDEDOWN) slot = MEM_FINEVOLDOWN;
+      } else {
+        if (x == 1) slot = MEM_EXTRAFINEUP;
+        else if (x == 2) slot = MEM_EXTRAFINEDOWN;
+      }
+      if (slot < 0) return;
+      if (*param & 0xF) Track[channel].memory[slot] = *param & 0xF;
+      else *param |= Track[channel].memory[slot];
+      return;
+  }
+  if (slot < 0) return;
+  if (*param) Track[channel].memory[slot] = *param;
+  else *param = Track[channel].memory[slot];
+}
+
+// XM volume column (S3M volumes are stored as its set-volume range)
+void AudioGeneratorMOD::VolumeColumn(uint8_t channel, bool firstTick)
+{
+  uint8_t v = Track[channel].volumeColumn;
+  uint8_t x = v & 0xF;
+
+  switch (v >> 4) {
+    case 0x1: case 0x2: case 0x3: case 0x4: case 0x5:
+      if (firstTick) Track[channel].volume = min(v - 0x10, 64);
+      break;
+    case 0x6:
+      if (!firstTick) Track[channel].volume = (Track[channel].volume > x) ? Track[channel].volume - x : 0;
+      break;
+    case 0x7:
+      if (!firstTick) Track[channel].volume = min(Track[channel].volume + x, 64);
+      break;
+    case 0x8:
+      if (firstTick) Track[channel].volume = (Track[channel].volume > x) ? Track[channel].volume - x : 0;
+      break;
+    case 0x9:
+      if (firstTick) Track[channel].volume = min(Track[channel].volume + x, 64);
+      break;
+    case 0xA:
+      if (firstTick && x) Track[channel].vibratoSpeed = x;
+      break;
+    case 0xB:
+      if (firstTick) {
+        if (x) Track[channel].vibratoDepth = x;
+      } else {
+        Vibrato(channel);
+      }
+      break;
+    case 0xC:
+      if (firstTick) Track[channel].channelPanning = x << 3;
+      break;
+    case 0xD:
+      if (!firstTick) Track[channel].channelPanning = (Track[channel].channelPanning > x) ? Track[channel].channelPanning - x : 0;
+      break;
+    case 0xE:
+      if (!firstTick) Track[channel].channelPanning = min(Track[channel].channelPanning + x, 128);
+      break;
+    case 0xF:
+      if (firstTick) {
+        if (x) Track[channel].portamentoSpeed = x << 4;
+        Track[channel].portamentoNote = Track[channel].amigaPeriod;
+      } else {
+        Portamento(channel);
+      }
+      break;
+  }
 }
 
 bool AudioGeneratorMOD::ProcessRow()
@@ -417,61 +1460,96 @@ bool AudioGeneratorMOD::ProcessRow()
   breakFlag = false;
   for (channel = 0; channel < Mod.numberOfChannels; channel++) {
 
-    sampleNumber = Player.currentPattern.sampleNumber[Player.lastRow][channel];
-    note = NOTE(Player.lastRow, channel);
-    effectNumber = Player.currentPattern.effectNumber[Player.lastRow][channel];
-    effectParameter = Player.currentPattern.effectParameter[Player.lastRow][channel];
+    const cell *c = &Player.currentPattern[Player.lastRow * Mod.numberOfChannels + channel];
+    sampleNumber = c->sampleNumber;
+    note = NOTE(c);
+    effectNumber = c->effectNumber;
+    effectParameter = c->effectParameter;
+    if (format == FORMAT_S3M) ConvertS3MEffect(channel, &effectNumber, &effectParameter);
+    else if (format == FORMAT_XM) RecallXMEffect(channel, &effectNumber, &effectParameter);
     effectParameterX = effectParameter >> 4;
     effectParameterY = effectParameter & 0xF;
     sampleOffset = 0;
 
+    // Kept for the ticks which follow
+    Track[channel].note = note;
+    Track[channel].sampleNumber = sampleNumber;
+    Track[channel].volumeColumn = c->volume;
+    Track[channel].effectNumber = effectNumber;
+    Track[channel].effectParameter = effectParameter;
+
+    if (note == KEYOFF) {
+      KeyOff(channel);
+      note = NONOTE;
+    }
+
+    if (format == FORMAT_XM) {
+      // The instrument picks the sample from the note
+      if (sampleNumber && (sampleNumber <= Mod.numberOfInstruments)) {
+        Track[channel].lastInstrument = sampleNumber - 1;
+        Track[channel].keyOn = true;
+        Track[channel].envelopeTick = 0;
+        Track[channel].fadeout = 65536;
+      }
+      if ((note != NONOTE) && Mod.numberOfInstruments) {
+        const instrument *ins = &Mod.instruments[Track[channel].lastInstrument];
+        if (ins->numberOfSamples) Track[channel].lastSampleNumber = ins->firstSample + ins->sampleMap[min(note, 95)];
+      }
+    } else if (sampleNumber && (sampleNumber <= Mod.numberOfSamples)) {
+      Track[channel].lastSampleNumber = sampleNumber - 1;
+    }
+
     if (sampleNumber) {
-      Player.lastSampleNumber[channel] = sampleNumber - 1;
-      if (!(effectNumber == 0xE && effectParameterX == NOTEDELAY))
-        Player.volume[channel] = Mod.samples[Player.lastSampleNumber[channel]].volume;
+      if (!(effectNumber == 0xE && effectParameterX == NOTEDELAY)) {
+        Track[channel].volume = Mod.samples[Track[channel].lastSampleNumber].volume;
+        if (format == FORMAT_XM) Track[channel].channelPanning = Mod.samples[Track[channel].lastSampleNumber].panning >> 1;
+      }
     }
 
     if (note != NONOTE) {
-      Player.lastNote[channel] = note;
-      Player.amigaPeriod[channel] = ReadAmigaPeriods(note + Mod.samples[Player.lastSampleNumber[channel]].fineTune);
+      Track[channel].lastNote = note;
+      Track[channel].amigaPeriod = NotePeriod(note, Track[channel].lastSampleNumber);
 
-      if (effectNumber != TONEPORTAMENTO && effectNumber != PORTAMENTOVOLUMESLIDE)
-        Player.lastAmigaPeriod[channel] = Player.amigaPeriod[channel];
+      if (effectNumber != TONEPORTAMENTO && effectNumber != PORTAMENTOVOLUMESLIDE && c->volume < 0xF0)
+        Track[channel].lastAmigaPeriod = Track[channel].amigaPeriod;
 
-      if (!(Player.waveControl[channel] & 0x80)) Player.vibratoPos[channel] = 0;
-      if (!(Player.waveControl[channel] & 0x08)) Player.tremoloPos[channel] = 0;
+      if (!(Track[channel].waveControl & 0x80)) Track[channel].vibratoPos = 0;
+      if (!(Track[channel].waveControl & 0x08)) Track[channel].tremoloPos = 0;
     }
 
+    VolumeColumn(channel, true);
+    if (c->volume >= 0xF0) note = NONOTE; // Tone portamento from the volume column
+
     switch (effectNumber) {
       case TONEPORTAMENTO:
-        if (effectParameter) Player.portamentoSpeed[channel] = effectParameter;
-        Player.portamentoNote[channel] = Player.amigaPeriod[channel];
+        if (effectParameter) Track[channel].portamentoSpeed = effectParameter;
+        Track[channel].portamentoNote = Track[channel].amigaPeriod;
         note = NONOTE;
         break;
 
       case VIBRATO:
-        if (effectParameterX) Player.vibratoSpeed[channel] = effectParameterX;
-        if (effectParameterY) Player.vibratoDepth[channel] = effectParameterY;
+        if (effectParameterX) Track[channel].vibratoSpeed = effectParameterX;
+        if (effectParameterY) Track[channel].vibratoDepth = effectParameterY;
         break;
 
       case PORTAMENTOVOLUMESLIDE:
-        Player.portamentoNote[channel] = Player.amigaPeriod[channel];
+        Track[channel].portamentoNote = Track[channel].amigaPeriod;
         note = NONOTE;
         break;
 
       case TREMOLO:
-        if (effectParameterX) Player.tremoloSpeed[channel] = effectParameterX;
-        if (effectParameterY) Player.tremoloDepth[channel] = effectParameterY;
+        if (effectParameterX) Track[channel].tremoloSpeed = effectParameterX;
+        if (effectParameterY) Track[channel].tremoloDepth = effectParameterY;
         break;
 
       case SETCHANNELPANNING:
-        Mixer.channelPanning[channel] = effectParameter >> 1;
+        Track[channel].channelPanning = effectParameter >> 1;
         break;
 
       case SETSAMPLEOFFSET:
         sampleOffset = effectParameter << 8;
-        if (sampleOffset > Mod.samples[Player.lastSampleNumber[channel]].length)
-          sampleOffset = Mod.samples[Player.lastSampleNumber[channel]].length;
+        if (sampleOffset > Mod.samples[Track[channel].lastSampleNumber].length)
+          sampleOffset = Mod.samples[Track[channel].lastSampleNumber].length;
         break;
 
       case JUMPTOORDER:
@@ -483,13 +1561,13 @@ bool AudioGeneratorMOD::ProcessRow()
         break;
 
       case SETVOLUME:
-        if (effectParameter > 64) Player.volume[channel] = 64;
-        else Player.volume[channel] = effectParameter;
+        if (effectParameter > 64) Track[channel].volume = 64;
+        else Track[channel].volume = effectParameter;
         break;
 
       case BREAKPATTERNTOROW:
         Player.row = effectParameterX * 10 + effectParameterY;
-        if (Player.row >= ROWS)
+        if (Player.row >= Mod.maxRows)
           Player.row = 0;
         if (!jumpFlag && !breakFlag) {
           Player.orderIndex++;
@@ -502,49 +1580,50 @@ bool AudioGeneratorMOD::ProcessRow()
       case 0xE:
         switch (effectParameterX) {
           case FINEPORTAMENTOUP:
-            Player.lastAmigaPeriod[channel] -= effectParameterY;
+            Track[channel].lastAmigaPeriod -= effectParameterY * PERIODSCALE;
             break;
 
           case FINEPORTAMENTODOWN:
-            Player.lastAmigaPeriod[channel] += effectParameterY;
+            Track[channel].lastAmigaPeriod += effectParameterY * PERIODSCALE;
             break;
 
           case SETVIBRATOWAVEFORM:
-            Player.waveControl[channel] &= 0xF0;
-            Player.waveControl[channel] |= effectParameterY;
+            Track[channel].waveControl &= 0xF0;
+            Track[channel].waveControl |= effectParameterY;
             break;
 
           case SETFINETUNE:
-            Mod.samples[Player.lastSampleNumber[channel]].fineTune = effectParameterY;
-            if (Mod.samples[Player.lastSampleNumber[channel]].fineTune > 7)
-              Mod.samples[Player.lastSampleNumber[channel]].fineTune -= 16;
+            if (format != FORMAT_MOD) break;
+            Mod.samples[Track[channel].lastSampleNumber].fineTune = effectParameterY;
+            if (Mod.samples[Track[channel].lastSampleNumber].fineTune > 7)
+              Mod.samples[Track[channel].lastSampleNumber].fineTune -= 16;
             break;
 
           case PATTERNLOOP:
             if (effectParameterY) {
-              if (Player.patternLoopCount[channel])
-                Player.patternLoopCount[channel]--;
+              if (Track[channel].patternLoopCount)
+                Track[channel].patternLoopCount--;
               else
-                Player.patternLoopCount[channel] = effectParameterY;
-              if (Player.patternLoopCount[channel])
-                Player.row = Player.patternLoopRow[channel] - 1;
+                Track[channel].patternLoopCount = effectParameterY;
+              if (Track[channel].patternLoopCount)
+                Player.row = Track[channel].patternLoopRow - 1;
             } else
-              Player.patternLoopRow[channel] = Player.row;
+              Track[channel].patternLoopRow = Player.row;
             break;
 
           case SETTREMOLOWAVEFORM:
-            Player.waveControl[channel] &= 0xF;
-            Player.waveControl[channel] |= effectParameterY << 4;
+            Track[channel].waveControl &= 0xF;
+            Track[channel].waveControl |= effectParameterY << 4;
             break;
 
           case FINEVOLUMESLIDEUP:
-            Player.volume[channel] += effectParameterY;
-            if (Player.volume[channel] > 64) Player.volume[channel] = 64;
+            Track[channel].volume += effectParameterY;
+            if (Track[channel].volume > 64) Track[channel].volume = 64;
             break;
 
           case FINEVOLUMESLIDEDOWN:
-            Player.volume[channel] -= effectParameterY;
-            if (Player.volume[channel] < 0) Player.volume[channel] = 0;
+            Track[channel].volume -= effectParameterY;
+            if (Track[channel].volume < 0) Track[channel].volume = 0;
             break;
 
           case NOTECUT:
@@ -562,26 +1641,44 @@ bool AudioGeneratorMOD::ProcessRow()
         break;
 
       case SETSPEED:
+        if (!effectParameter) break;
         if (effectParameter < 0x20)
           Player.speed = effectParameter;
         else
           Player.samplesPerTick = sampleRate / (2 * effectParameter / 5);
         break;
+
+      case SETGLOBALVOLUME:
+        Player.globalVolume = min(effectParameter, 64);
+        break;
+
+      case KEYOFFEFFECT:
+        if (!effectParameter) KeyOff(channel);
+        break;
+
+      case SETENVELOPEPOSITION:
+        Track[channel].envelopeTick = effectParameter;
+        break;
+
+      case EXTRAFINEPORTAMENTO:
+        if (effectParameterX == 1) Track[channel].lastAmigaPeriod -= effectParameterY;
+        else if (effectParameterX == 2) Track[channel].lastAmigaPeriod += effectParameterY;
+        break;
     }
 
-    if (note != NONOTE || (Player.lastAmigaPeriod[channel] &&
+    if (note != NONOTE || (Track[channel].lastAmigaPeriod &&
         effectNumber != VIBRATO && effectNumber != VIBRATOVOLUMESLIDE &&
         !(effectNumber == 0xE && effectParameterX == NOTEDELAY)))
-      Mixer.channelFrequency[channel] = Player.amiga / Player.lastAmigaPeriod[channel];
+      Track[channel].channelFrequency = PeriodToFrequency(Track[channel].lastAmigaPeriod);
 
     if (note != NONOTE)
-      Mixer.channelSampleOffset[channel] = sampleOffset << FIXED_DIVIDER;
+      Track[channel].channelSampleOffset = sampleOffset << FIXED_DIVIDER;
 
-    if (sampleNumber)
-      Mixer.channelSampleNumber[channel] = Player.lastSampleNumber[channel];
+    if (sampleNumber || ((format == FORMAT_XM) && (note != NONOTE)))
+      Track[channel].channelSampleNumber = Track[channel].lastSampleNumber;
 
     if (effectNumber != TREMOLO)
-      Mixer.channelVolume[channel] = Player.volume[channel];
+      Track[channel].channelVolume = Track[channel].volume;
 
   }
   return true;
@@ -602,44 +1699,61 @@ bool AudioGeneratorMOD::ProcessTick()
 
   for (channel = 0; channel < Mod.numberOfChannels; channel++) {
 
-    if (Player.lastAmigaPeriod[channel]) {
+    if (Track[channel].lastAmigaPeriod) {
 
-      sampleNumber = Player.currentPattern.sampleNumber[Player.lastRow][channel];
-      //   note = Player.currentPattern.note[Player.lastRow][channel];
-      note = NOTE(Player.lastRow, channel);
-      effectNumber = Player.currentPattern.effectNumber[Player.lastRow][channel];
-      effectParameter = Player.currentPattern.effectParameter[Player.lastRow][channel];
+      sampleNumber = Track[channel].sampleNumber;
+      note = Track[channel].note;
+      effectNumber = Track[channel].effectNumber;
+      effectParameter = Track[channel].effectParameter;
       effectParameterX = effectParameter >> 4;
       effectParameterY = effectParameter & 0xF;
 
+      if (Track[channel].volumeColumn >= 0x60) {
+        VolumeColumn(channel, false);
+        Track[channel].channelVolume = Track[channel].volume;
+      }
+
       switch (effectNumber) {
         case ARPEGGIO:
           if (effectParameter)
             switch (Player.tick % 3) {
               case 0:
-                Mixer.channelFrequency[channel] = Player.amiga / Player.lastAmigaPeriod[channel];
+                Track[channel].channelFrequency = PeriodToFrequency(Track[channel].lastAmigaPeriod);
                 break;
               case 1:
-                tempNote = Player.lastNote[channel] + effectParameterX * 8 + Mod.samples[Player.lastSampleNumber[channel]].fineTune;
-                if (tempNote < 296) Mixer.channelFrequency[channel] = Player.amiga / ReadAmigaPeriods(tempNote);
-                break;
-              case 2:
-                tempNote = Player.lastNote[channel] + effectParameterY * 8 + Mod.samples[Player.lastSampleNumber[channel]].fineTune;
-                if (tempNote < 296) Mixer.channelFrequency[channel] = Player.amiga / ReadAmigaPeriods(tempNote);
+              case 2: {
+                uint8_t semitones = (Player.tick % 3 == 1) ? effectParameterX : effectParameterY;
+                if (format == FORMAT_MOD) {
+                  tempNote = Track[channel].lastNote + semitones * 8 + Mod.samples[Track[channel].lastSampleNumber].fineTune;
+                  if (tempNote < 296) Track[channel].channelFrequency = Player.amiga / ReadAmigaPeriods(tempNote);
+                } else if ((format == FORMAT_XM) && Mod.linearFrequencies) {
+                  Track[channel].channelFrequency = PeriodToFrequency(Track[channel].lastAmigaPeriod - semitones * 64);
+                } else {
+                  Track[channel].channelFrequency = PeriodToFrequency(((uint64_t)Track[channel].lastAmigaPeriod << 16) / Pow2(semitones * 64));
+                }
                 break;
+              }
             }
           break;
 
         case PORTAMENTOUP:
-          Player.lastAmigaPeriod[channel] -= effectParameter;
-          if (Player.lastAmigaPeriod[channel] < 113) Player.lastAmigaPeriod[channel] = 113;
-          Mixer.channelFrequency[channel] = Player.amiga / Player.lastAmigaPeriod[channel];
+          Track[channel].lastAmigaPeriod -= effectParameter * PERIODSCALE;
+          if (format == FORMAT_MOD) {
+            if (Track[channel].lastAmigaPeriod < 113) Track[channel].lastAmigaPeriod = 113;
+          } else if (Track[channel].lastAmigaPeriod < 1) {
+            Track[channel].lastAmigaPeriod = 1;
+          }
+          Track[channel].channelFrequency = PeriodToFrequency(Track[channel].lastAmigaPeriod);
           break;
 
         case PORTAMENTODOWN:
-          Player.lastAmigaPeriod[channel] += effectParameter;
-          if (Player.lastAmigaPeriod[channel] > 856) Player.lastAmigaPeriod[channel] = 856;
-          Mixer.channelFrequency[channel] = Player.amiga / Player.lastAmigaPeriod[channel];
+          Track[channel].lastAmigaPeriod += effectParameter * PERIODSCALE;
+          if (format == FORMAT_MOD) {
+            if (Track[channel].lastAmigaPeriod > 856) Track[channel].lastAmigaPeriod = 856;
+          } else if (Track[channel].lastAmigaPeriod > 32000) {
+            Track[channel].lastAmigaPeriod = 32000;
+          }
+          Track[channel].channelFrequency = PeriodToFrequency(Track[channel].lastAmigaPeriod);
           break;
 
         case TONEPORTAMENTO:
@@ -652,18 +1766,18 @@ bool AudioGeneratorMOD::ProcessTick()
 
         case PORTAMENTOVOLUMESLIDE:
           Portamento(channel);
-          Player.volume[channel] += effectParameterX - effectParameterY;
-          if (Player.volume[channel] < 0) Player.volume[channel] = 0;
-          else if (Player.volume[channel] > 64) Player.volume[channel] = 64;
-          Mixer.channelVolume[channel] = Player.volume[channel];
+          Track[channel].volume += effectParameterX - effectParameterY;
+          if (Track[channel].volume < 0) Track[channel].volume = 0;
+          else if (Track[channel].volume > 64) Track[channel].volume = 64;
+          Track[channel].channelVolume = Track[channel].volume;
           break;
 
         case VIBRATOVOLUMESLIDE:
           Vibrato(channel);
-          Player.volume[channel] += effectParameterX - effectParameterY;
-          if (Player.volume[channel] < 0) Player.volume[channel] = 0;
-          else if (Player.volume[channel] > 64) Player.volume[channel] = 64;
-          Mixer.channelVolume[channel] = Player.volume[channel];
+          Track[channel].volume += effectParameterX - effectParameterY;
+          if (Track[channel].volume < 0) Track[channel].volume = 0;
+          else if (Track[channel].volume > 64) Track[channel].volume = 64;
+          Track[channel].channelVolume = Track[channel].volume;
           break;
 
         case TREMOLO:
@@ -671,10 +1785,10 @@ bool AudioGeneratorMOD::ProcessTick()
           break;
 
         case VOLUMESLIDE:
-          Player.volume[channel] += effectParameterX - effectParameterY;
-          if (Player.volume[channel] < 0) Player.volume[channel] = 0;
-          else if (Player.volume[channel] > 64) Player.volume[channel] = 64;
-          Mixer.channelVolume[channel] = Player.volume[channel];
+          Track[channel].volume += effectParameterX - effectParameterY;
+          if (Track[channel].volume < 0) Track[channel].volume = 0;
+          else if (Track[channel].volume > 64) Track[channel].volume = 64;
+          Track[channel].channelVolume = Track[channel].volume;
           break;
 
         case 0xE:
@@ -682,25 +1796,63 @@ bool AudioGeneratorMOD::ProcessTick()
             case RETRIGGERNOTE:
               if (!effectParameterY) break;
               if (!(Player.tick % effectParameterY)) {
-                Mixer.channelSampleOffset[channel] = 0;
+                Track[channel].channelSampleOffset = 0;
               }
               break;
 
             case NOTECUT:
               if (Player.tick == effectParameterY)
-                Mixer.channelVolume[channel] = Player.volume[channel] = 0;
+                Track[channel].channelVolume = Track[channel].volume = 0;
               break;
 
             case NOTEDELAY:
               if (Player.tick == effectParameterY) {
-                if (sampleNumber) Player.volume[channel] = Mod.samples[Player.lastSampleNumber[channel]].volume;
-                if (note != NONOTE) Mixer.channelSampleOffset[channel] = 0;
-                Mixer.channelFrequency[channel] = Player.amiga / Player.lastAmigaPeriod[channel];
-                Mixer.channelVolume[channel] = Player.volume[channel];
+                if (sampleNumber) Track[channel].volume = Mod.samples[Track[channel].lastSampleNumber].volume;
+                if (note != NONOTE) Track[channel].channelSampleOffset = 0;
+                Track[channel].channelFrequency = PeriodToFrequency(Track[channel].lastAmigaPeriod);
+                Track[channel].channelVolume = Track[channel].volume;
               }
               break;
           }
           break;
+
+        case GLOBALVOLUMESLIDE: {
+          int volume = Player.globalVolume + effectParameterX - effectParameterY;
+          Player.globalVolume = (volume < 0) ? 0 : (volume > 64) ? 64 : volume;
+          break;
+        }
+
+        case PANNINGSLIDE: {
+          int panning = Track[channel].channelPanning + effectParameterX - effectParameterY;
+          Track[channel].channelPanning = (panning < 0) ? 0 : (panning > 128) ? 128 : panning;
+          break;
+        }
+
+        case KEYOFFEFFECT:
+          if (Player.tick == effectParameter) KeyOff(channel);
+          break;
+
+        case MULTIRETRIG:
+          if (!effectParameterY || (Player.tick % effectParameterY)) break;
+          Track[channel].channelSampleOffset = 0;
+          {
+            int volume = Track[channel].volume;
+            switch (effectParameterX) {
+              case 0x1: case 0x2: case 0x3: case 0x4: case 0x5:
+                volume -= 1 << (effectParameterX - 1);
+                break;
+              case 0x6: volume = volume * 2 / 3; break;
+              case 0x7: volume /= 2; break;
+              case 0x9: case 0xA: case 0xB: case 0xC: case 0xD:
+                volume += 1 << (effectParameterX - 9);
+                break;
+              case 0xE: volume = volume * 3 / 2; break;
+              case 0xF: volume *= 2; break;
+            }
+            Track[channel].volume = (volume < 0) ? 0 : (volume > 64) ? 64 : volume;
+            Track[channel].channelVolume = Track[channel].volume;
+          }
+          break;
       }
 
     }
@@ -716,9 +1868,9 @@ bool AudioGeneratorMOD::RunPlayer()
   if (Player.tick == Player.speed) {
     Player.tick = 0;
 
-    if (Player.row == ROWS) {
+    if (Player.row >= Player.rows) {
       Player.orderIndex++;
-      if (Player.orderIndex == Mod.songLength)
+      if (Player.orderIndex >= Mod.songLength)
       {
         //Player.orderIndex = 0;
         // No loop, just say we're done!
@@ -733,6 +1885,7 @@ bool AudioGeneratorMOD::RunPlayer()
       if (Player.orderIndex != Player.oldOrderIndex)
         if (!LoadPattern(Mod.order[Player.orderIndex])) return false;
       Player.oldOrderIndex = Player.orderIndex;
+      if (Player.row >= Player.rows) Player.row = 0;
       if (!ProcessRow()) return false;
     }
 
@@ -740,173 +1893,339 @@ bool AudioGeneratorMOD::RunPlayer()
     if (!ProcessTick()) return false;
   }
   Player.tick++;
+
+  for (uint8_t channel = 0; channel < Mod.numberOfChannels; channel++) {
+    Envelope(channel);
+    UpdateGain(channel);
+  }
   return true;
 }
 
-void AudioGeneratorMOD::GetSample(int16_t sample[2])
+int AudioGeneratorMOD::RenderBlock()
 {
-  int32_t sumL;
-  int32_t sumR;
-  uint8_t channel;
-  uint32_t samplePointer;
-  int8_t current;
-  int8_t next;
-  int16_t out;
-  int32_t out32;
-
-  if (!running) return;
-
-  sumL = 0;
-  sumR = 0;
-  for (channel = 0; channel < Mod.numberOfChannels; channel++) {
-
-    if (!Mixer.channelFrequency[channel] ||
-        !Mod.samples[Mixer.channelSampleNumber[channel]].length) continue;
-
-    Mixer.channelSampleOffset[channel] += Mixer.channelFrequency[channel];
-
-    if (!Mixer.channelVolume[channel]) continue;
+  int filled = 0;
+  if (ending) return 0; // The last block went out
 
-    samplePointer = Mixer.sampleBegin[Mixer.channelSampleNumber[channel]] +
-                    (Mixer.channelSampleOffset[channel] >> FIXED_DIVIDER);
-
-    if (Mixer.sampleLoopLength[Mixer.channelSampleNumber[channel]]) {
-
-      if (samplePointer >= Mixer.sampleLoopEnd[Mixer.channelSampleNumber[channel]]) {
-        Mixer.channelSampleOffset[channel] -= Mixer.sampleLoopLength[Mixer.channelSampleNumber[channel]] << FIXED_DIVIDER;
-        samplePointer -= Mixer.sampleLoopLength[Mixer.channelSampleNumber[channel]];
+  while (filled < BLOCKFRAMES) {
+    if (mixerTick == 0) {
+      if (!RunPlayer()) {
+        ending = true;
+        break;
       }
+      mixerTick = Player.samplesPerTick;
+    }
+    int n = min(BLOCKFRAMES - filled, mixerTick);
+    if (!Mix(block + filled * 2, n)) {
+      stop();
+      return 0;
+    }
+    filled += n;
+    mixerTick -= n;
+  }
+  return filled;
+}
 
-    } else {
-
-      if (samplePointer >= Mixer.sampleEnd[Mixer.channelSampleNumber[channel]]) {
-        Mixer.channelFrequency[channel] = 0;
-        samplePointer = Mixer.sampleEnd[Mixer.channelSampleNumber[channel]];
-      }
+bool AudioGeneratorMOD::Mix(int16_t *dst, int frames)
+{
+  if (!running) return false;
 
+  // Get every channel's data in place first, so nothing below has to wait on the file
+  if (!sampleData && !ReadAhead(frames)) return false;
+
+  memset(mixL, 0, frames * sizeof(mixL[0]));
+  memset(mixR, 0, frames * sizeof(mixR[0]));
+  for (uint8_t channel = 0; channel < Mod.numberOfChannels; channel++) {
+    if (Track[channel].channelSampleNumber >= Mod.numberOfSamples) continue;
+    bool wide = Mod.samples[Track[channel].channelSampleNumber].flags & SAMPLE_16BIT;
+    bool ok;
+    switch (interpolation) {
+      case INTERPOLATION_NEAREST:
+        ok = wide ? MixChannel<int16_t, INTERPOLATION_NEAREST>(channel, frames) : MixChannel<int8_t, INTERPOLATION_NEAREST>(channel, frames);
+        break;
+      case INTERPOLATION_CUBIC:
+        ok = wide ? MixChannel<int16_t, INTERPOLATION_CUBIC>(channel, frames) : MixChannel<int8_t, INTERPOLATION_CUBIC>(channel, frames);
+        break;
+      case INTERPOLATION_SINC:
+        ok = wide ? MixChannel<int16_t, INTERPOLATION_SINC>(channel, frames) : MixChannel<int8_t, INTERPOLATION_SINC>(channel, frames);
+        break;
+      default:
+        ok = wide ? MixChannel<int16_t, INTERPOLATION_LINEAR>(channel, frames) : MixChannel<int8_t, INTERPOLATION_LINEAR>(channel, frames);
+        break;
     }
+    if (!ok) return false;
+  }
 
-    if (samplePointer < FatBuffer.samplePointer[channel] ||
-        samplePointer >= FatBuffer.samplePointer[channel] + fatBufferSize - 1 ||
-        Mixer.channelSampleNumber[channel] != FatBuffer.channelSampleNumber[channel]) {
-
-      uint32_t toRead = Mixer.sampleEnd[Mixer.channelSampleNumber[channel]] - samplePointer + 1;
-      if (toRead > (uint32_t)fatBufferSize) toRead  = fatBufferSize;
+  for (int i = 0; i < frames; i++) {
+    int32_t sumL = mixL[i];
+    int32_t sumR = mixR[i];
 
-      if (!file->seek(samplePointer, SEEK_SET)) {
-        stop();
-        return;
-      }
-      if (toRead != file->read(FatBuffer.channels[channel], toRead)) {
-        stop();
-        return;
+    // Downscale to BITDEPTH - a bit faster because the compiler can replaced division by constants with proper "right shift" + correct handling of sign bit
+    if (Mod.numberOfChannels <= 4) {
+        // up to 4 channels
+        sumL /= 4;
+        sumR /= 4;
+    } else {
+      if (Mod.numberOfChannels <= 6) {
+        // 5 or 6 channels - pre-multiply be 1.5, then divide by 8 -> same as division by 6
+        sumL = (sumL + (sumL/2)) / 8;
+        sumR = (sumR + (sumR/2)) / 8;
+      } else if (Mod.numberOfChannels <= 8) {
+        // 7 or 8 channels
+        sumL /= 8;
+        sumR /= 8;
+      } else {
+        // S3M and XM can have more, but rarely play them all at full volume
+        sumL /= 16;
+        sumR /= 16;
       }
-
-      FatBuffer.samplePointer[channel] = samplePointer;
-      FatBuffer.channelSampleNumber[channel] = Mixer.channelSampleNumber[channel];
     }
 
-    current = FatBuffer.channels[channel][(samplePointer - FatBuffer.samplePointer[channel]) /*& (FATBUFFERSIZE - 1)*/];
-    next = FatBuffer.channels[channel][(samplePointer + 1 - FatBuffer.samplePointer[channel]) /*& (FATBUFFERSIZE - 1)*/];
-	
-	// preserve a few more bits from sample interpolation, by upscaling input values.
-	// This does (slightly) reduce quantization noise in higher frequencies, typically above 8kHz.
-	// Actually we could could even gain more bits, I was just not sure if more bits would cause overflows in other conputations.
-    int16_t current16 = (int16_t) current << 2;
-    int16_t next16    = (int16_t) next << 2;	  
-	  
-    out = current16;
+    // clip samples to 16bit (with saturation in case of overflow)
+    if(sumL <= INT16_MIN) sumL = INT16_MIN;
+      else if (sumL >= INT16_MAX) sumL = INT16_MAX;
+    if(sumR <= INT16_MIN) sumR = INT16_MIN;
+      else if (sumR >= INT16_MAX) sumR = INT16_MAX;
 
-    // Integer linear interpolation - only works correctly in 16bit
-    out += (next16 - current16) * (Mixer.channelSampleOffset[channel] & ((1 << FIXED_DIVIDER) - 1)) >> FIXED_DIVIDER;
+    // Fill the sound buffer with signed values
+    dst[i * 2 + AudioOutput::LEFTCHANNEL] = sumL;
+    dst[i * 2 + AudioOutput::RIGHTCHANNEL] = sumR;
+  }
+  return true;
+}
 
-    // Upscale to BITDEPTH, considering the we already gained two bits in the previous step
-    out32 = (int32_t)out << (BITDEPTH - 10);
+// One frame scaled to 16 bits
+static inline int32_t Frame(const int8_t *p, int i) { return p[i] * 256; }
+static inline int32_t Frame(const int16_t *p, int i) { return p[i]; }
 
-    // Channel volume
-    out32 = out32 * Mixer.channelVolume[channel] >> 6;
+// Linear interpolation between two frames, scaled to 16 bits.  8-bit samples get a few more
+// bits preserved by upscaling the input values first, as the mixer always has.
+static inline int32_t Linear(const int8_t *p, int32_t frac)
+{
+  int16_t current16 = p[0] * 4;
+  int16_t next16 = p[1] * 4;
+  int16_t out = current16 + ((next16 - current16) * frac >> 10);
+  return out * (1 << 6);
+}
 
-    // Channel panning
-    sumL += out32 * min(128 - Mixer.channelPanning[channel], 64) >> 6;
-    sumR += out32 * min(Mixer.channelPanning[channel], 64) >> 6;
-  }
+static inline int32_t Linear(const int16_t *p, int32_t frac)
+{
+  return p[0] + ((p[1] - p[0]) * frac >> 10);
+}
 
-  // Downscale to BITDEPTH - a bit faster because the compiler can replaced division by constants with proper "right shift" + correct handling of sign bit
-  if (Mod.numberOfChannels <= 4) {
-      // up to 4 channels
-      sumL /= 4;
-      sumR /= 4;
-  } else {
-    if (Mod.numberOfChannels <= 6) {
-      // 5 or 6 channels - pre-multiply be 1.5, then divide by 8 -> same as division by 6
-      sumL = (sumL + (sumL/2)) / 8;
-      sumR = (sumR + (sumR/2)) / 8;      
-    } else {
-      // 7,8, or more channels
-      sumL /= 8;
-      sumR /= 8;
+// The frame at p, frac/1024 of the way to the next one.  Q is a constant, so each mixer
+// instantiation only carries its own kernel.
+template <int Q, typename T>
+static inline int32_t Interpolate(const T *p, int32_t frac)
+{
+  switch (Q) {
+    case AudioGeneratorMOD::INTERPOLATION_NEAREST:
+      return Frame(p, 0);
+    case AudioGeneratorMOD::INTERPOLATION_CUBIC: {
+      int phase = (frac >> 2) * 4;
+      return (Frame(p, -1) * ReadCubic(phase) + Frame(p, 0) * ReadCubic(phase + 1) +
+              Frame(p, 1) * ReadCubic(phase + 2) + Frame(p, 2) * ReadCubic(phase + 3)) >> 14;
+    }
+    case AudioGeneratorMOD::INTERPOLATION_SINC: {
+      int phase = (frac >> 2) * 8;
+      int32_t sum = 0;
+      for (int i = 0; i < 8; i++) sum += Frame(p, i - 3) * ReadSinc(phase + i);
+      return sum >> 14;
     }
+    default:
+      return Linear(p, frac);
   }
-
-  // clip samples to 16bit (with saturation in case of overflow)
-  if(sumL <= INT16_MIN) sumL = INT16_MIN;
-    else if (sumL >= INT16_MAX) sumL = INT16_MAX;
-  if(sumR <= INT16_MIN) sumR = INT16_MIN;
-    else if (sumR >= INT16_MAX) sumR = INT16_MAX;
-  
-  // Fill the sound buffer with signed values
-  sample[AudioOutput::LEFTCHANNEL] = sumL;
-  sample[AudioOutput::RIGHTCHANNEL] = sumR;
 }
 
-bool AudioGeneratorMOD::LoadMOD()
+// Adds frames of one channel into mixL/mixR.  Runs of frames which stay inside the sample (or its
+// loop) and inside the buffered window are mixed without any checks, only the frames which wrap a
+// loop, end the sample or leave the window go through the careful path.  Positions are in frames
+// from the start of the sample, and the guard frames either side of the window are there for the
+// interpolator to read, so any position inside it can be mixed.
+template <typename T, int Q>
+bool AudioGeneratorMOD::MixChannel(uint8_t channel, int frames)
 {
-  uint8_t channel;
-
-  if (!LoadHeader()) return false;
-  LoadSamples();
+  track *t = &Track[channel];
+  const uint16_t sampleNumber = t->channelSampleNumber;
+  const Sample *s = &Mod.samples[sampleNumber];
+  uint32_t frequency = t->channelFrequency;
+  uint32_t offset = t->channelSampleOffset;
+
+  if (!frequency || !s->length) return true;
+
+  const uint32_t length = s->length;
+  const uint32_t loopLength = s->loopLength;
+  const uint32_t loopBegin = s->loopBegin;
+  const uint32_t loopEnd = loopBegin + loopLength;
+  const uint32_t limit = loopLength ? loopEnd : length;
+
+  const int32_t gain = t->channelGain;
+  if (!gain) {
+    // Muted channels still move along, kept inside their loop or stopped at their end
+    offset += frequency * frames;
+    uint32_t pos = offset >> FIXED_DIVIDER;
+    if (loopLength && (pos >= loopEnd)) offset -= ((pos - loopBegin) / loopLength * loopLength) << FIXED_DIVIDER;
+    else if (!loopLength && (pos >= length)) frequency = 0;
+    t->channelSampleOffset = offset;
+    t->channelFrequency = frequency;
+    return true;
+  }
 
-  Player.amiga = AMIGA;
-  Player.samplesPerTick = sampleRate / (2 * 125 / 5); // Hz = 2 * BPM / 5
-  Player.speed = 6;
-  Player.tick = Player.speed;
-  Player.row = 0;
+  const int32_t panL = min(128 - t->channelPanning, 64);
+  const int32_t panR = min(t->channelPanning, 64);
+  int32_t *sumL = mixL;
+  int32_t *sumR = mixR;
+
+  const T *data = NULL;
+  uint32_t winStart = 0, winEnd = 0;
+  if (s->data) {
+    data = reinterpret_cast<const T*>(s->data);
+    winEnd = length;
+  } else if (t->bufferSample == sampleNumber) {
+    data = reinterpret_cast<const T*>(t->buffer) + GUARDPRE;
+    winStart = t->bufferStart;
+    winEnd = t->bufferEnd;
+  }
 
-  Player.orderIndex = 0;
-  Player.oldOrderIndex = 0xFF;
-  Player.patternDelay = 0;
+  while (frames) {
+    int n = 0;
+    uint32_t samplePointer = (offset + frequency) >> FIXED_DIVIDER;
+    if (samplePointer < limit && samplePointer >= winStart && samplePointer < winEnd) {
+      // Every pointer below hi is good, so count the steps until one reaches it
+      uint32_t hi = min(limit, winEnd);
+      n = min((int)(((hi << FIXED_DIVIDER) - offset - 1) / frequency), frames);
+    }
 
-  for (channel = 0; channel < Mod.numberOfChannels; channel++) {
-    Player.patternLoopCount[channel] = 0;
-    Player.patternLoopRow[channel] = 0;
+    if (n) {
+      for (int i = 0; i < n; i++) {
+        offset += frequency;
+        int32_t out32 = Interpolate<Q>(data + ((offset >> FIXED_DIVIDER) - winStart), offset & ((1 << FIXED_DIVIDER) - 1)) * gain >> 12;
+        sumL[i] += out32 * panL >> 6;
+        sumR[i] += out32 * panR >> 6;
+      }
+      sumL += n;
+      sumR += n;
+      frames -= n;
+      continue;
+    }
 
-    Player.lastAmigaPeriod[channel] = 0;
+    // A single frame at a boundary
+    offset += frequency;
+    samplePointer = offset >> FIXED_DIVIDER;
+    if (loopLength) {
+      if (samplePointer >= loopEnd) {
+        uint32_t back = (samplePointer - loopBegin) / loopLength * loopLength;
+        offset -= back << FIXED_DIVIDER;
+        samplePointer -= back;
+      }
+    } else if (samplePointer >= length) {
+      frequency = 0; // Sample's over
+      break;
+    }
 
-    Player.waveControl[channel] = 0;
+    if (!s->data && (samplePointer < winStart || samplePointer >= winEnd)) {
+      if (!Refill(channel, samplePointer)) return false;
+      data = reinterpret_cast<const T*>(t->buffer) + GUARDPRE;
+      winStart = t->bufferStart;
+      winEnd = t->bufferEnd;
+    }
+    int32_t out32 = Interpolate<Q>(data + (samplePointer - winStart), offset & ((1 << FIXED_DIVIDER) - 1)) * gain >> 12;
+    *sumL++ += out32 * panL >> 6;
+    *sumR++ += out32 * panR >> 6;
+    frames--;
+  }
 
-    Player.vibratoSpeed[channel] = 0;
-    Player.vibratoDepth[channel] = 0;
-    Player.vibratoPos[channel] = 0;
+  t->channelSampleOffset = offset;
+  t->channelFrequency = frequency;
+  return true;
+}
 
-    Player.tremoloSpeed[channel] = 0;
-    Player.tremoloDepth[channel] = 0;
-    Player.tremoloPos[channel] = 0;
+// Makes sure each channel's buffer holds everything the next frames will touch, including the
+// start of its loop if it wraps, so the mixer itself never has to seek
+bool AudioGeneratorMOD::ReadAhead(int frames)
+{
+  for (uint8_t channel = 0; channel < Mod.numberOfChannels; channel++) {
+    const track *t = &Track[channel];
+    uint16_t sampleNumber = t->channelSampleNumber;
+    uint32_t frequency = t->channelFrequency;
+    uint32_t offset = t->channelSampleOffset;
+
+    if (!frequency || !t->channelGain || (sampleNumber >= Mod.numberOfSamples)) continue;
+    const Sample *s = &Mod.samples[sampleNumber];
+    if (!s->length) continue;
+
+    uint32_t first = (offset + frequency) >> FIXED_DIVIDER;
+    uint32_t last = (offset + frequency * frames) >> FIXED_DIVIDER;
+    uint32_t start = t->bufferStart;
+    uint32_t end = t->bufferEnd;
+    bool wraps = false;
+
+    if (s->loopLength) {
+      uint32_t loopEnd = s->loopBegin + s->loopLength;
+      if (first >= loopEnd) first = s->loopBegin + (first - s->loopBegin) % s->loopLength;
+      if (last >= loopEnd) {
+        last = loopEnd - 1;
+        wraps = true;
+      }
+    } else {
+      if (first >= s->length) continue; // Nothing left to play
+      if (last >= s->length) last = s->length - 1;
+    }
+    if (last < first) last = first;
 
-    FatBuffer.samplePointer[channel] = 0;
-    FatBuffer.channelSampleNumber[channel] = 0xFF;
+    bool ok = (t->bufferSample == sampleNumber) && (first >= start) && (last < end);
+    if (wraps) ok = ok && (s->loopBegin >= start);
 
-    Mixer.channelSampleOffset[channel] = 0;
-    Mixer.channelFrequency[channel] = 0;
-    Mixer.channelVolume[channel] = 0;
-    switch (channel % 4) {
-      case 0:
-      case 3:
-        Mixer.channelPanning[channel] = stereoSeparation;
-        break;
-      default:
-        Mixer.channelPanning[channel] = 128 - stereoSeparation;
-    }
+    if (!ok && !Refill(channel, first)) return false;
   }
   return true;
 }
 
+// Reads a channel's buffer full of its sample from frame pos on, with the guard frames either side:
+// silence before the start, and the loop start or silence after the end
+bool AudioGeneratorMOD::Refill(uint8_t channel, uint32_t pos)
+{
+  track *t = &Track[channel];
+  const Sample *s = &Mod.samples[t->channelSampleNumber];
+  const int bytes = (s->flags & SAMPLE_16BIT) ? 2 : 1;
+  const uint32_t capacity = fatBufferSize / bytes - GUARDPRE - GUARDPOST;
+  const uint32_t loopEnd = s->loopBegin + s->loopLength;
+  uint32_t start = pos;
+
+  // Keep a whole loop resident when it fits, so going round it never needs the file again
+  if (s->loopLength && (pos >= s->loopBegin) && (pos < loopEnd) && (s->loopLength <= capacity)) {
+    start = s->loopBegin;
+  }
+  uint32_t count = (start < s->length) ? min(capacity, s->length - start) : capacity;
+
+  // Frames first to last, GUARDPRE before start up to GUARDPOST after the window
+  int32_t first = (int32_t)start - GUARDPRE;
+  uint32_t last = start + count + GUARDPOST;
+  uint32_t lead = (first < 0) ? -first : 0;
+  uint32_t from = first + lead;
+  uint32_t to = min(last, s->length);
+  uint32_t fromFile = (to > from) ? to - from : 0;
+
+  memset(t->buffer, 0, lead * bytes);
+  uint32_t got = 0;
+  if (fromFile) {
+    if (!file->seek(s->fileOffset + from * bytes, SEEK_SET)) return false;
+    got = file->read(t->buffer + lead * bytes, fromFile * bytes) / bytes;
+  }
+  uint32_t filled = lead + got;
+  uint32_t total = last - first;
+  if (filled < total) memset(t->buffer + filled * bytes, 0, (total - filled) * bytes); // Ran off the end of the file
+
+  if (bytes == 2) {
+    int16_t *d = reinterpret_cast<int16_t*>(t->buffer);
+    if (s->flags & SAMPLE_UNSIGNED) for (uint32_t i = lead; i < filled; i++) d[i] ^= 0x8000;
+    for (uint32_t f = s->length; (f < last) && (f - s->length < GUARDPOST); f++) d[f - first] = s->guard[f - s->length];
+  } else {
+    if (s->flags & SAMPLE_UNSIGNED) for (uint32_t i = lead; i < filled; i++) t->buffer[i] ^= 0x80;
+    for (uint32_t f = s->length; (f < last) && (f - s->length < GUARDPOST); f++) t->buffer[f - first] = s->guard[f - s->length];
+  }
+
+  t->bufferSample = t->channelSampleNumber;
+  t->bufferStart = start;
+  t->bufferEnd = start + count;
+  return true;
+}
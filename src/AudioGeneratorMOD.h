@@ -1,6 +1,6 @@
 /*
   AudioGeneratorMOD
-  Audio output generator that plays Amiga MOD tracker files
+  Audio output generator that plays Amiga MOD, Scream Tracker S3M and FastTracker XM files
     
   Copyright (C) 2017  Earle F. Philhower, III
 
@@ -23,6 +23,9 @@
 
 #include "AudioGenerator.h"
 
+// The file type is found from its contents at begin().  Everything which depends on the number of
+// channels, samples, instruments or rows is allocated then, so an 8-channel MOD or a 32-channel XM
+// only needs as much RAM as it uses.  XM sample data is delta-coded, so it is always preloaded.
 class AudioGeneratorMOD : public AudioGenerator
 {
   public:
@@ -33,19 +36,55 @@ class AudioGeneratorMOD : public AudioGenerator
     virtual bool stop() override;
     virtual bool isRunning() override { return running; }
     bool SetSampleRate(int hz) { if (running || (hz < 1) || (hz > 96000) ) return false; sampleRate = hz; return true; }
-    bool SetBufferSize(int sz) { if (running || (sz < 1) ) return false; fatBufferSize = sz; return true; }
+    bool SetBufferSize(int sz) { if (running || (sz < 16) ) return false; fatBufferSize = sz; return true; }
     bool SetStereoSeparation(int sep) { if (running || (sep<0) || (sep>64)) return false; stereoSeparation = sep; return true; }
     bool SetPAL(bool use) { if (running) return false; usePAL = use; return true; }
+    // Read all the instrument samples into RAM (PSRAM first, on the ESP32) at begin(), so the file is
+    // only touched once per pattern.  If there isn't room the per-channel buffers are used instead.
+    bool SetPreload(bool use) { if (running) return false; preload = use; return true; }
+    bool IsPreloaded() { return sampleData != NULL; }
+
+    // How the mixer fills in between sample frames, cheapest first.  Nearest is fine for an ESP8266,
+    // linear is the default, cubic (4-point Hermite) and sinc (8-tap windowed) want an ESP32.
+    // May be changed while playing.
+    typedef enum { INTERPOLATION_NEAREST, INTERPOLATION_LINEAR, INTERPOLATION_CUBIC, INTERPOLATION_SINC } Interpolation;
+    bool SetInterpolation(Interpolation mode) { if (mode > INTERPOLATION_SINC) return false; interpolation = mode; return true; }
+    Interpolation GetInterpolation() { return interpolation; }
+
+    typedef enum { FORMAT_MOD, FORMAT_S3M, FORMAT_XM } Format;
+    Format GetFormat() { return format; }
+    int GetChannels() { return Mod.numberOfChannels; }
 
   protected:
     bool LoadMOD();
     bool LoadHeader();
-    void GetSample(int16_t sample[2]);
+    bool LoadS3M();
+    bool LoadXM();
+    bool AllocateSong();
+    void FreeSong();
+    virtual int RenderBlock() override;
+    bool Mix(int16_t *dst, int frames);
+    template <typename T, int Q> bool MixChannel(uint8_t channel, int frames);
+    bool ReadAhead(int frames);
+    bool Refill(uint8_t channel, uint32_t pos);
+    bool PreloadSamples();
+    bool ReadGuard(uint16_t sample);
     bool RunPlayer();
     void LoadSamples();
     bool LoadPattern(uint8_t pattern);
+    bool LoadPatternS3M(uint8_t pattern);
+    bool LoadPatternXM(uint8_t pattern);
+    int ReadByte();
     bool ProcessTick();
     bool ProcessRow();
+    void VolumeColumn(uint8_t channel, bool firstTick);
+    void ConvertS3MEffect(uint8_t channel, uint8_t *effect, uint8_t *param);
+    void RecallXMEffect(uint8_t channel, uint8_t *effect, uint8_t *param);
+    void KeyOff(uint8_t channel);
+    void Envelope(uint8_t channel);
+    void UpdateGain(uint8_t channel);
+    int32_t NotePeriod(uint16_t note, uint16_t sample);
+    uint32_t PeriodToFrequency(int32_t period);
     void Tremolo(uint8_t channel);
     void Portamento(uint8_t channel);
     void Vibrato(uint8_t channel);
@@ -54,8 +93,9 @@ class AudioGeneratorMOD : public AudioGenerator
   protected:
     int mixerTick;
     enum {BITDEPTH = 16};
+    enum {BLOCKFRAMES = 64};               // Frames mixed per channel in one pass
     int sampleRate; 
-    int fatBufferSize; //(6*1024) // File system buffers per-CHANNEL (i.e. total mem required is 4 * FATBUFFERSIZE)
+    int fatBufferSize; //(6*1024) // File system buffers per-CHANNEL (i.e. total mem required is channels * FATBUFFERSIZE)
     enum {FIXED_DIVIDER = 10};             // Fixed-point mantissa used for integer arithmetic
     int stereoSeparation; //STEREOSEPARATION = 32;    // 0 (max) to 64 (mono)
     bool usePAL;
@@ -65,110 +105,183 @@ class AudioGeneratorMOD : public AudioGenerator
     int AMIGA;
     void UpdateAmiga() { AMIGA = ((usePAL?7159091:7093789) / 2 / sampleRate << FIXED_DIVIDER); }
  
-#ifdef ESP8266 // Not sure if C3/C2 have RAM constraints, maybe add them here?
-    // support max 4 channels
-    enum {ROWS = 64, SAMPLES = 31, CHANNELS = 4, NONOTE = 0xFFFF, NONOTE8 = 0xff };
-#else
-    // support max 8 channels
-    enum {ROWS = 64, SAMPLES = 31, CHANNELS = 8, NONOTE = 0xFFFF, NONOTE8 = 0xff };
-#endif
+    enum {ROWS = 64, SAMPLES = 31, MAXCHANNELS = 32, MAXROWS = 256, NONOTE = 0xFFFF, NONOTE8 = 0xff, KEYOFF = 0xFFFE, KEYOFF8 = 0xfe };
+
+    Format format;
+    Interpolation interpolation;
+
+    // Frames kept before and after each sample (and streaming window) for the interpolators to read
+    enum { GUARDPRE = 3, GUARDPOST = 4 };
 
     typedef struct Sample {
-      uint16_t length;
-      int8_t fineTune;
+      uint32_t length;       // In frames
+      uint32_t loopBegin;
+      uint32_t loopLength;   // 0 if the sample doesn't loop
+      uint32_t fileOffset;   // Where its data starts in the file
+      int8_t *data;          // Preloaded frames, or NULL if streamed
+      uint32_t c4Speed;      // S3M: Hz played at C-4
+      int16_t guard[GUARDPOST]; // Frames after the last one, for interpolating into
+      int8_t fineTune;       // MOD: -8..7, XM: -128..127
+      int8_t relativeNote;   // XM: semitones added to each note
       uint8_t volume;
-      uint16_t loopBegin;
-      uint16_t loopLength;
+      uint8_t panning;       // XM: 0..255
+      uint8_t flags;
     } Sample;
-    
+    enum { SAMPLE_16BIT = 1, SAMPLE_UNSIGNED = 2, SAMPLE_DELTA = 4, SAMPLE_PINGPONG = 8 };
+
+    // XM instruments pick a sample for each note and carry a volume envelope
+    typedef struct instrument {
+      uint8_t sampleMap[96];
+      uint16_t firstSample;
+      uint8_t numberOfSamples;
+      uint8_t envelopePoints;
+      uint16_t envelopeTick[12];
+      uint8_t envelopeVolume[12];
+      uint8_t envelopeSustain;
+      uint8_t envelopeLoopBegin;
+      uint8_t envelopeLoopEnd;
+      uint8_t envelopeFlags;
+      uint16_t fadeout;
+    } instrument;
+    enum { ENVELOPE_ON = 1, ENVELOPE_SUSTAIN = 2, ENVELOPE_LOOP = 4 };
+
     typedef struct mod {
-      Sample samples[SAMPLES];
-      uint8_t songLength;
-      uint8_t numberOfPatterns;
-      uint8_t order[128];
+      Sample *samples;
+      uint16_t numberOfSamples;
+      instrument *instruments;
+      uint8_t numberOfInstruments;
+      uint16_t songLength;
+      uint16_t numberOfPatterns;
+      uint8_t order[256];
       uint8_t numberOfChannels;
+      bool linearFrequencies;  // XM
+      uint32_t *patternOffset; // S3M and XM patterns are packed, so their start (and XM's row counts) are kept
+      uint16_t *patternRows;
+      uint16_t *patternSize;
+      uint16_t maxRows;
+      uint8_t channelMap[MAXCHANNELS]; // S3M channel to our channel, or 0xff if unused
+      uint8_t initialPanning[MAXCHANNELS];
+      uint8_t initialSpeed;
+      uint8_t initialTempo;
+      uint8_t initialGlobalVolume;
     } mod;
     
-    // Save 256 bytes by storing raw note values, unpack with macro NOTE
-    typedef struct Pattern {
-      uint8_t sampleNumber[ROWS][CHANNELS];
-      uint8_t note8[ROWS][CHANNELS];
-      uint8_t effectNumber[ROWS][CHANNELS];
-      uint8_t effectParameter[ROWS][CHANNELS];
-    } Pattern;
+    typedef struct cell {
+      uint8_t note;       // NONOTE8, KEYOFF8, MOD period table index / 8, or S3M/XM semitone from C-0
+      uint8_t sampleNumber;
+      uint8_t volume;     // XM volume column (S3M volumes are stored as XM ones)
+      uint8_t effectNumber;
+      uint8_t effectParameter;
+    } cell;
     
     typedef struct player {
-      Pattern currentPattern;
+      cell *currentPattern; // rows * numberOfChannels
+      uint16_t rows;
     
       uint32_t amiga;
       uint16_t samplesPerTick;
       uint8_t speed;
       uint8_t tick;
-      uint8_t row;
-      uint8_t lastRow;
+      uint16_t row;
+      uint16_t lastRow;
     
-      uint8_t orderIndex;
-      uint8_t oldOrderIndex;
+      uint16_t orderIndex;
+      uint16_t oldOrderIndex;
       uint8_t patternDelay;
-      uint8_t patternLoopCount[CHANNELS];
-      uint8_t patternLoopRow[CHANNELS];
-    
-      uint8_t lastSampleNumber[CHANNELS];
-      int8_t volume[CHANNELS];
-      uint16_t lastNote[CHANNELS];
-      uint16_t amigaPeriod[CHANNELS];
-      int16_t lastAmigaPeriod[CHANNELS];
-    
-      uint16_t portamentoNote[CHANNELS];
-      uint8_t portamentoSpeed[CHANNELS];
-    
-      uint8_t waveControl[CHANNELS];
+      uint8_t globalVolume;
+    } player;
+
+    // Everything about one channel, for the player and the mixer
+    typedef struct track {
+      uint8_t patternLoopCount;
+      uint8_t patternLoopRow;
     
-      uint8_t vibratoSpeed[CHANNELS];
-      uint8_t vibratoDepth[CHANNELS];
-      int8_t vibratoPos[CHANNELS];
+      uint16_t lastSampleNumber;
+      uint8_t lastInstrument;
+      int8_t volume;
+      uint16_t lastNote;
+      int32_t amigaPeriod;      // Period of the last note.  MOD: Amiga periods, S3M/XM: 4x finer
+      int32_t lastAmigaPeriod;  // ...and the one playing now
     
-      uint8_t tremoloSpeed[CHANNELS];
-      uint8_t tremoloDepth[CHANNELS];
-      int8_t tremoloPos[CHANNELS];
-    } player;
+      int32_t portamentoNote;
+      uint16_t portamentoSpeed;
     
-    typedef struct mixer {
-      uint32_t sampleBegin[SAMPLES];
-      uint32_t sampleEnd[SAMPLES];
-      uint32_t sampleloopBegin[SAMPLES];
-      uint16_t sampleLoopLength[SAMPLES];
-      uint32_t sampleLoopEnd[SAMPLES];
+      uint8_t waveControl;
     
-      uint8_t channelSampleNumber[CHANNELS];
-      uint32_t channelSampleOffset[CHANNELS];
-      uint16_t channelFrequency[CHANNELS];
-      uint8_t channelVolume[CHANNELS];
-      uint8_t channelPanning[CHANNELS];
-    } mixer;
+      uint8_t vibratoSpeed;
+      uint8_t vibratoDepth;
+      int8_t vibratoPos;
     
-    typedef struct fatBuffer {
-      uint8_t *channels[CHANNELS]; // Make dynamically allocated [FATBUFFERSIZE];
-      uint32_t samplePointer[CHANNELS];
-      uint8_t channelSampleNumber[CHANNELS];
-    } fatBuffer;
+      uint8_t tremoloSpeed;
+      uint8_t tremoloDepth;
+      int8_t tremoloPos;
+
+      // The row being played
+      uint16_t note;
+      uint8_t sampleNumber;
+      uint8_t volumeColumn;
+      uint8_t effectNumber;
+      uint8_t effectParameter;
+      uint8_t memory[12];       // S3M and XM reuse the last parameter when given zero
+
+      // Instrument envelope
+      bool keyOn;
+      uint16_t envelopeTick;
+      uint8_t envelopeVolume;   // 0..64
+      uint32_t fadeout;         // 65536 is full volume
+
+      // Mixer
+      uint16_t channelSampleNumber;
+      uint32_t channelSampleOffset;
+      uint32_t channelFrequency;
+      uint8_t channelVolume;    // 0..64, as set by the effects
+      uint16_t channelGain;     // ...with envelope, fadeout and global volume applied, 4096 is full
+      uint8_t channelPanning;
+
+      // Streaming buffer, holding frames bufferStart to bufferEnd of bufferSample plus the guards either side
+      int8_t *buffer;
+      uint32_t bufferStart;
+      uint32_t bufferEnd;
+      uint16_t bufferSample;
+    } track;
 
-    // Effects
+    // Effects, FastTracker numbering (the first 16 are ProTracker's)
     typedef enum { ARPEGGIO = 0, PORTAMENTOUP, PORTAMENTODOWN, TONEPORTAMENTO, VIBRATO, PORTAMENTOVOLUMESLIDE,
                    VIBRATOVOLUMESLIDE, TREMOLO, SETCHANNELPANNING, SETSAMPLEOFFSET, VOLUMESLIDE, JUMPTOORDER,
-                   SETVOLUME, BREAKPATTERNTOROW, ESUBSET, SETSPEED } EffectsValues;
+                   SETVOLUME, BREAKPATTERNTOROW, ESUBSET, SETSPEED, SETGLOBALVOLUME, GLOBALVOLUMESLIDE,
+                   KEYOFFEFFECT = 0x14, SETENVELOPEPOSITION, PANNINGSLIDE = 0x19, MULTIRETRIG = 0x1B,
+                   EXTRAFINEPORTAMENTO = 0x21 } EffectsValues;
     
     // 0xE subset
     typedef enum { SETFILTER = 0, FINEPORTAMENTOUP, FINEPORTAMENTODOWN, GLISSANDOCONTROL, SETVIBRATOWAVEFORM,
                    SETFINETUNE, PATTERNLOOP, SETTREMOLOWAVEFORM, SUBEFFECT8, RETRIGGERNOTE, FINEVOLUMESLIDEUP,
                    FINEVOLUMESLIDEDOWN, NOTECUT, NOTEDELAY, PATTERNDELAY, INVERTLOOP } Effect08Subvalues;
+
+    // Slots in track::memory
+    enum { MEM_PORTAUP, MEM_PORTADOWN, MEM_VOLSLIDE, MEM_GLOBALVOLSLIDE, MEM_PANSLIDE, MEM_RETRIG,
+           MEM_FINEPORTAUP, MEM_FINEPORTADOWN, MEM_FINEVOLUP, MEM_FINEVOLDOWN, MEM_EXTRAFINEUP, MEM_EXTRAFINEDOWN };
     
     // Our state lives here...
     player Player;
     mod Mod;
-    mixer Mixer;
-    fatBuffer FatBuffer;
+    track *Track;
+
+    // Preloaded sample data, every sample's frames in one allocation
+    bool preload;
+    int8_t *sampleData;
+
+    // Small read buffer for unpacking S3M and XM patterns
+    uint8_t readBuffer[32];
+    uint8_t readPos;
+    uint8_t readLen;
+
+    // Mixed output waiting for the sink
+    int32_t mixL[BLOCKFRAMES];
+    int32_t mixR[BLOCKFRAMES];
+    int16_t block[BLOCKFRAMES * 2];
+    int blockPtr;
+    int blockLen;
+    bool ending;
 };
 
 #endif
-
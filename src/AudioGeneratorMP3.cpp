@@ -57,17 +57,19 @@ AudioGeneratorMP3::AudioGeneratorMP3(void *buff, int buffSize, void *stream, int
 
 AudioGeneratorMP3::~AudioGeneratorMP3()
 {
+  AudioMemory::Scope scope(&mem);
   if (!preallocateSpace) {
-    free(buff);
-    free(synth);
-    free(frame);
-    free(stream);
+    audio_free(buff);
+    audio_free(synth);
+    audio_free(frame);
+    audio_free(stream);
   } 
 }
 
 
 bool AudioGeneratorMP3::stop()
 {
+  AudioMemory::Scope scope(&mem);
   if (madInitted) {
     mad_synth_finish(synth);
     mad_frame_finish(frame);
@@ -76,10 +78,10 @@ bool AudioGeneratorMP3::stop()
   }
 
   if (!preallocateSpace) {
-    free(buff);
-    free(synth);
-    free(frame);
-    free(stream);
+    audio_free(buff);
+    audio_free(synth);
+    audio_free(frame);
+    audio_free(stream);
   }
 
   buff = NULL;
@@ -209,6 +211,7 @@ bool AudioGeneratorMP3::GetOneSample(int16_t sample[2])
 
 bool AudioGeneratorMP3::loop()
 {
+  AudioMemory::Scope scope(&mem);
   if (!running) goto done; // Nothing to do here!
 
   // First, try and push in the stored sample.  If we can't, then punt and try later
@@ -265,6 +268,7 @@ done:
 
 bool AudioGeneratorMP3::begin(AudioFileSource *source, AudioOutput *output)
 {
+  AudioMemory::Scope scope(&mem);
   if (!source)  return false;
   file = source;
   if (!output) return false;
@@ -323,15 +327,15 @@ bool AudioGeneratorMP3::begin(AudioFileSource *source, AudioOutput *output)
       return false;
     }
   } else {
-    buff = reinterpret_cast<unsigned char *>(malloc(buffLen));
-    stream = reinterpret_cast<struct mad_stream *>(malloc(sizeof(struct mad_stream)));
-    frame = reinterpret_cast<struct mad_frame *>(malloc(sizeof(struct mad_frame)));
-    synth = reinterpret_cast<struct mad_synth *>(malloc(sizeof(struct mad_synth)));
+    buff = reinterpret_cast<unsigned char *>(audio_malloc(buffLen));
+    stream = reinterpret_cast<struct mad_stream *>(audio_malloc(sizeof(struct mad_stream)));
+    frame = reinterpret_cast<struct mad_frame *>(audio_malloc(sizeof(struct mad_frame)));
+    synth = reinterpret_cast<struct mad_synth *>(audio_malloc(sizeof(struct mad_synth)));
     if (!buff || !stream || !frame || !synth) {
-      free(buff);
-      free(stream);
-      free(frame);
-      free(synth);
+      audio_free(buff);
+      audio_free(stream);
+      audio_free(frame);
+      audio_free(synth);
       buff = NULL;
       stream = NULL;
       frame = NULL;
@@ -25,6 +25,8 @@
 
 AudioGeneratorMP3a::AudioGeneratorMP3a()
 {
+  AudioMemory::Scope scope(&mem);
+
   running = false;
   file = NULL;
   output = NULL;
@@ -38,6 +40,7 @@ AudioGeneratorMP3a::AudioGeneratorMP3a()
   memset(outSample, 0, sizeof(outSample));
   buffValid = 0;
   lastFrameEnd = 0;
+  frameStart = 0;
   validSamples = 0;
   curSample = 0;
   lastRate = 0;
@@ -46,11 +49,13 @@ AudioGeneratorMP3a::AudioGeneratorMP3a()
 
 AudioGeneratorMP3a::~AudioGeneratorMP3a()
 {
+  AudioMemory::Scope scope(&mem);
   MP3FreeDecoder(hMP3Decoder);
 }
 
 bool AudioGeneratorMP3a::stop()
 {
+  AudioMemory::Scope scope(&mem);
   if (!running) return true;
   running = false;
   output->stop();
@@ -62,38 +67,71 @@ bool AudioGeneratorMP3a::isRunning()
   return running;
 }
 
+// Slide the unconsumed tail (less than one frame) down to buff[0] and top the window back up
+int AudioGeneratorMP3a::RefillBuffer()
+{
+  int keep = buffValid - lastFrameEnd;
+  if (keep && lastFrameEnd) memmove(buff, buff + lastFrameEnd, keep);
+  lastFrameEnd = 0;
+  int got = file->read(buff + keep, sizeof(buff) - keep);
+  buffValid = keep + got;
+  return got;
+}
+
+// Layer III frame size from its 4-byte header, 0 for free format or -1 if it's no header at all
+int AudioGeneratorMP3a::FrameLength(const uint8_t *hdr)
+{
+  static const uint16_t kbpsV1[16] PROGMEM = { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0 };
+  static const uint16_t kbpsV2[16] PROGMEM = { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0 };
+  static const uint16_t rates[4] PROGMEM = { 44100, 48000, 32000, 0 };
+  int version = (hdr[1] >> 3) & 3; // 3 = MPEG1, 2 = MPEG2, 0 = MPEG2.5
+  int layer = (hdr[1] >> 1) & 3;   // 1 = Layer III, the only one Helix decodes
+  int brIdx = hdr[2] >> 4;
+  int srIdx = (hdr[2] >> 2) & 3;
+  if ((version == 1) || (layer != 1) || (brIdx == 15) || (srIdx == 3)) return -1;
+  if (!brIdx) return 0;
+  int rate = pgm_read_word(&rates[srIdx]) >> ((version == 3) ? 0 : (version == 2) ? 1 : 2);
+  int kbps = pgm_read_word((version == 3) ? &kbpsV1[brIdx] : &kbpsV2[brIdx]);
+  return ((version == 3) ? 144000 : 72000) * kbps / rate + ((hdr[2] >> 1) & 1);
+}
+
 bool AudioGeneratorMP3a::FillBufferWithValidFrame()
 {
-  buff[0] = 0; // Destroy any existing sync word @ 0
-  int nextSync;
-  do {
-    nextSync = MP3FindSyncWord(buff + lastFrameEnd, buffValid - lastFrameEnd);
-    if (nextSync >= 0) nextSync += lastFrameEnd;
-    lastFrameEnd = 0;
-    if (nextSync == -1) {
-      if (buff[buffValid-1]==0xff) { // Could be 1st half of syncword, preserve it...
-        buff[0] = 0xff;
-        buffValid = file->read(buff+1, sizeof(buff)-1);
-        if (buffValid==0) return false; // No data available, EOF
-      } else { // Try a whole new buffer
-        buffValid = file->read(buff, sizeof(buff));
-        if (buffValid==0) return false; // No data available, EOF
+  // Frames are decoded in place wherever they sit in buff[], so a file read is only needed
+  // once the next frame runs off the end of what's already buffered
+  while (true) {
+    int avail = buffValid - lastFrameEnd;
+    int sync = (avail > 0) ? MP3FindSyncWord(buff + lastFrameEnd, avail) : -1;
+    if (sync < 0) {
+      // Could be the 1st half of a syncword, preserve it...
+      lastFrameEnd = (avail > 0 && buff[buffValid - 1] == 0xff) ? buffValid - 1 : buffValid;
+      if (!RefillBuffer()) return false; // No data available, EOF
+      continue;
+    }
+    frameStart = lastFrameEnd + sync;
+    int have = buffValid - frameStart;
+    int need = 4; // Frame header, which gives the frame length
+    if (have >= need) {
+      need = FrameLength(buff + frameStart);
+      if ((need < 0) || (need > (int)sizeof(buff))) {
+        lastFrameEnd = frameStart + 1; // Not a real sync word, keep looking
+        continue;
       }
+      if (!need) need = sizeof(buff); // Free format, the decoder needs to see the next sync word too
     }
-  } while (nextSync == -1);
-
-  // Move the frame to start at offset 0 in the buffer
-  buffValid -= nextSync; // Throw out prior to nextSync
-  memmove(buff, buff+nextSync, buffValid);
-
-  // We have a sync word at 0 now, try and fill remainder of buffer
-  buffValid += file->read(buff + buffValid, sizeof(buff) - buffValid);
-
-  return true;
+    if (have >= need) return true;
+    lastFrameEnd = frameStart;
+    if (!RefillBuffer()) {
+      frameStart = 0;
+      return buffValid > 0; // Truncated last frame, let the decoder have what there is
+    }
+  }
 }
 
 bool AudioGeneratorMP3a::loop()
 {
+  AudioMemory::Scope scope(&mem);
+
   if (!running) goto done; // Nothing to do here!
 
   // If we've got data, try and pump it out...
@@ -107,12 +145,13 @@ bool AudioGeneratorMP3a::loop()
 
   // No samples available, need to decode a new frame
   if (FillBufferWithValidFrame()) {
-    // buff[0] start of frame, decode it...
-    unsigned char *inBuff = reinterpret_cast<unsigned char *>(buff);
-    int bytesLeft = buffValid;
+    // buff[frameStart] start of frame, decode it...
+    unsigned char *inBuff = reinterpret_cast<unsigned char *>(buff + frameStart);
+    int bytesLeft = buffValid - frameStart;
     int ret = MP3Decode(hMP3Decoder, &inBuff, &bytesLeft, outSample, 0);
    if (ret) {
       // Error, skip the frame...
+      lastFrameEnd = frameStart + 1;
       char buff[48];
       sprintf(buff, "MP3 decode error %d", ret);
       cb.st(ret, buff);
@@ -144,6 +183,7 @@ done:
 
 bool AudioGeneratorMP3a::begin(AudioFileSource *source, AudioOutput *output)
 {
+  AudioMemory::Scope scope(&mem);
   if (!source) return false;
   file = source;
   if (!output) return false;
@@ -154,7 +194,11 @@ bool AudioGeneratorMP3a::begin(AudioFileSource *source, AudioOutput *output)
   
   // AAC always comes out at 16 bits
   output->SetBitsPerSample(16);
-  
+
+  buffValid = 0;
+  lastFrameEnd = 0;
+  frameStart = 0;
+
   running = true;
   
   return true;
@@ -40,9 +40,12 @@ class AudioGeneratorMP3a : public AudioGenerator
 
     // Input buffering
     uint8_t buff[1600]; // File buffer required to store at least a whole compressed frame
-    int16_t buffValid;
-    int16_t lastFrameEnd;
-    bool FillBufferWithValidFrame(); // Read until we get a valid syncword and min(feof, 2048) butes in the buffer
+    int16_t buffValid;    // Bytes in buff[]
+    int16_t lastFrameEnd; // Start of the unconsumed data in buff[]
+    int16_t frameStart;   // Where the frame to decode begins
+    bool FillBufferWithValidFrame(); // Find a sync word with its whole frame in buff[], reading only when needed
+    int RefillBuffer();
+    int FrameLength(const uint8_t *hdr);
 
     // Output buffering
     int16_t outSample[1152 * 2]; // Interleaved L/R
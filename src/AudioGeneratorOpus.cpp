@@ -19,53 +19,83 @@
 */
 
 #include <AudioGeneratorOpus.h>
+#include <AudioDownmix.h>
 
-AudioGeneratorOpus::AudioGeneratorOpus()
+AudioGeneratorOpus::AudioGeneratorOpus() : arena(NULL, 0)
 {
+  preallocateSpace = NULL;
+  downmix = DOWNMIX_FULL;
+  mixChannels = 2;
+  userMatrix = nullptr;
+  userMatrixChannels = 0;
   of = nullptr;
-  buff = nullptr;
-  buffPtr = 0;
-  buffLen = 0;
+  pcm = nullptr;
+  pcmChannels = 2;
+  pcmLeft = 0;
+  running = false;
+}
+
+AudioGeneratorOpus::AudioGeneratorOpus(void *space, int size) : arena(space, size)
+{
+  preallocateSpace = space;
+  mem.RegisterAllocator(arena.GetAllocator());
+  downmix = DOWNMIX_FULL;
+  mixChannels = 2;
+  userMatrix = nullptr;
+  userMatrixChannels = 0;
+  of = nullptr;
+  pcm = nullptr;
+  pcmChannels = 2;
+  pcmLeft = 0;
   running = false;
 }
 
 AudioGeneratorOpus::~AudioGeneratorOpus()
 {
+  AudioMemory::Scope scope(&mem);
   if (of) op_free(of);
   of = nullptr;
-  free(buff);
-  buff = nullptr;
 }
 
-#define OPUS_BUFF 1024
-
 bool AudioGeneratorOpus::begin(AudioFileSource *source, AudioOutput *output)
 {
-  buff = (int16_t*)malloc(OPUS_BUFF * sizeof(int16_t));
-  if (!buff) return false;
-
+  AudioMemory::Scope scope(&mem);
   if (!source) return false;
   file = source;
   if (!output) return false;
   this->output = output;
   if (!file->isOpen()) return false; // Error
 
-  of = op_open_callbacks((void*)this, &cb, nullptr, 0, nullptr);
-  if (!of) return false;
+  uint32_t fails = mem.GetStats().failures;
+  of = op_test_callbacks((void*)this, &cb, nullptr, 0, nullptr);
+  if (of) {
+    op_set_mix_callback(of, OPUS_mix, (void*)this);
+    if (op_test_open(of) < 0) {
+      op_free(of);
+      of = nullptr;
+    }
+  }
+  if (!of) {
+    // opusfile doesn't always report running out as OP_EFAULT, so go by the allocator instead
+    if (mem.GetStats().failures != fails) {
+      audioLogger->printf_P(PSTR("OOM error in Opus:  %s too small to open stream\n"), preallocateSpace ? "Preallocated arena" : "Heap");
+    }
+    return false;
+  }
 
   prev_li = -1;
   lastSample[0] = 0;
   lastSample[1] = 0;
 
-  buffPtr = 0;
-  buffLen = 0;
+  pcm = nullptr;
+  pcmLeft = 0;
 
   output->begin();
 
   // These are fixed by Opus
   output->SetRate(48000);
   output->SetBitsPerSample(16);
-  output->SetChannels(2);
+  output->SetChannels(mixChannels);
 
   running = true;
   return true;
@@ -73,29 +103,39 @@ bool AudioGeneratorOpus::begin(AudioFileSource *source, AudioOutput *output)
 
 bool AudioGeneratorOpus::loop()
 {
+  AudioMemory::Scope scope(&mem);
 
   if (!running) goto done;
 
-  if (!output->ConsumeSample(lastSample)) goto done; // Try and send last buffered sample
-
-  do {
-    if (buffPtr == buffLen) {
-      int ret = op_read_stereo(of, (opus_int16 *)buff, OPUS_BUFF);
+  while (true) {
+    if (!pcmLeft) {
+      // Whole packets, however long, come straight from opusfile's buffer with no copying
+      uint32_t fails = mem.GetStats().failures;
+      int ret = op_read_direct(of, &pcm, &pcmChannels, nullptr);
       if (ret == OP_HOLE) {
         // fprintf(stderr,"\nHole detected! Corrupt file segment?\n");
         continue;
       } else if (ret <= 0) {
+        if (mem.GetStats().failures != fails) audioLogger->printf_P(PSTR("OOM error in Opus:  Out of memory while decoding\n"));
         running = false;
         goto done;
       }
-     buffPtr = 0;
-     buffLen = ret * 2;
+      pcmLeft = ret;
     }
 
-    lastSample[AudioOutput::LEFTCHANNEL] = buff[buffPtr] & 0xffff; 
-    lastSample[AudioOutput::RIGHTCHANNEL] = buff[buffPtr+1] & 0xffff; 
-    buffPtr += 2;
-  } while (running && output->ConsumeSample(lastSample));
+    if (pcmChannels == 2) {
+      uint16_t sent = output->ConsumeSamples(const_cast<int16_t*>(pcm), pcmLeft > 0xffff ? 0xffff : pcmLeft);
+      pcm += sent * 2;
+      pcmLeft -= sent;
+      if (pcmLeft) goto done; // Output's full
+    } else {
+      lastSample[AudioOutput::LEFTCHANNEL] = *pcm;
+      lastSample[AudioOutput::RIGHTCHANNEL] = *pcm;
+      if (!output->ConsumeSample(lastSample)) goto done;
+      pcm++;
+      pcmLeft--;
+    }
+  }
 
 done:
   file->loop();
@@ -106,10 +146,10 @@ done:
 
 bool AudioGeneratorOpus::stop()
 {
+  AudioMemory::Scope scope(&mem);
   if (of) op_free(of);
   of = nullptr;
-  free(buff);
-  buff = nullptr;
+  pcmLeft = 0;
   running = false;
   output->stop();
   return true;
@@ -120,6 +160,68 @@ bool AudioGeneratorOpus::isRunning()
   return running;
 }
 
+void AudioGeneratorOpus::SetDownmix(Downmix mode, int outChannels)
+{
+  downmix = mode;
+  mixChannels = (outChannels == 1) ? 1 : 2;
+}
+
+void AudioGeneratorOpus::SetDownmixMatrix(const int16_t *matrix, int channels)
+{
+  userMatrix = matrix;
+  userMatrixChannels = matrix ? channels : 0;
+}
+
+// Called by opusfile as each link's decoder is made, returns the channels to mix to or 0 for none
+int AudioGeneratorOpus::mix_cb(const OpusHead *_head, opus_int16 *_matrix)
+{
+  int n = _head->channel_count;
+  if (userMatrix && (n == userMatrixChannels)) {
+    memcpy(_matrix, userMatrix, n * 2 * sizeof(int16_t));
+  } else if (_head->mapping_family == 2) {
+    // Ambisonics in ACN order (W, Y, Z, X, ...) with SN3D weights, maybe plus a non-diegetic
+    // pair.  A pair of virtual cardioids facing left and right only needs W and Y.
+    int acn = 1;
+    while ((acn + 1) * (acn + 1) <= n) acn++;
+    acn *= acn;
+    _matrix[0] = (acn >= 4) ? 8192 : 16384;
+    _matrix[1] = _matrix[0];
+    if (acn >= 4) {
+      _matrix[2] = 8192;
+      _matrix[3] = -8192;
+    }
+    if (n > acn) {
+      _matrix[acn * 2] = 16384;
+      _matrix[(acn + 1) * 2 + 1] = 16384;
+    }
+  } else if (n > 2) {
+    if (n > 8) return 0; // Not a layout family 1 allows
+    if ((downmix == DOWNMIX_FRONT) && (n != 3)) {
+      // Quad has no center, every other layout starts L, C, R
+      int rows = (n == 4) ? 2 : 3;
+      for (int i = 0; i < rows; i++) {
+        if (n == 4) {
+          _matrix[i * 2] = (i == 0) ? 16384 : 0;
+          _matrix[i * 2 + 1] = (i == 1) ? 16384 : 0;
+        } else {
+          AudioDownmix::Gains(3, i, AudioDownmix::ORDER_VORBIS, &_matrix[i * 2]);
+        }
+      }
+    } else {
+      AudioDownmix::Matrix(n, AudioDownmix::ORDER_VORBIS, _matrix);
+    }
+  } else if ((n == 2) && (mixChannels == 1)) {
+    _matrix[0] = 16384;
+    _matrix[3] = 16384;
+  } else {
+    return 0; // Plain mono or stereo, no mixing needed
+  }
+  if (mixChannels == 1) {
+    for (int i = 0; i < n; i++) _matrix[i * 2] = (_matrix[i * 2] + _matrix[i * 2 + 1]) / 2;
+  }
+  return mixChannels;
+}
+
 int AudioGeneratorOpus::read_cb(unsigned char *_ptr, int _nbytes) {
   if (_nbytes == 0) return 0;
   _nbytes = file->read(_ptr, _nbytes);
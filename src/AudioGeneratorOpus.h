@@ -29,12 +29,68 @@ class AudioGeneratorOpus : public AudioGenerator
 {
   public:
     AudioGeneratorOpus();
+    AudioGeneratorOpus(void *preallocateSpace, int preallocateSize);
     virtual ~AudioGeneratorOpus() override;
     virtual bool begin(AudioFileSource *source, AudioOutput *output) override;
     virtual bool loop() override;
     virtual bool stop() override;
     virtual bool isRunning() override;
 
+    // Streams with more than two channels (5.1, 7.1, ambisonics) are mixed down to outChannels
+    // while decoding, and only the streams that mix draws on are decoded at all.  DOWNMIX_FULL
+    // uses every channel but LFE-only streams, DOWNMIX_FRONT just the front left, center and right
+    // (or W and Y of an ambisonic stream), which for 5.1 is half the streams.  With outChannels
+    // of 1 stereo streams are mixed too.  Call before begin().
+    typedef enum { DOWNMIX_FULL, DOWNMIX_FRONT } Downmix;
+    void SetDownmix(Downmix mode, int outChannels = 2);
+    // Mix streams of exactly this many channels with the caller's matrix instead, one row of Q14
+    // {left, right} weights per channel in Vorbis order.  The matrix is used in place, not copied.
+    void SetDownmixMatrix(const int16_t *matrix, int channels);
+
+    // Arena needed to open and play any stereo Opus stream whose Ogg pages and comment header fit the limits
+    // given, without touching the heap.  Pass 65307 as maxPageSize for a true worst case, encoders normally
+    // flush well before 16K.  maxLinks only matters for chained files on a seekable source.
+    // decoderSize only needs raising for multichannel streams, see preAllocMixDecoderSize().
+    static constexpr int preAllocSize(int maxPageSize = 16384, int maxTagBytes = 2048, int maxComments = 32, int maxLinks = 1,
+                                      int decoderSize = OP_DECODER_SIZE_MAX) {
+      return AudioMemoryArena::Footprint(OP_FILE_SIZE_MAX) +
+             2 * preAllocSyncSize(maxPageSize) +  // Live sync/stream state, plus the copy saved while probing the end
+             2 * preAllocStreamSize(maxPageSize, maxTagBytes) +
+             AudioMemoryArena::Footprint(preAllocBodySize(maxPageSize, maxTagBytes)) + // Spare for one realloc() to copy through
+             2 * AudioMemoryArena::Footprint(maxLinks * OP_LINK_SIZE_MAX) + // Link table, grown by realloc()
+             2 * AudioMemoryArena::Footprint(maxLinks * sizeof(ogg_uint32_t) * 8) + // BOS serial numbers
+             maxLinks * preAllocTagsSize(maxTagBytes, maxComments) +
+             AudioMemoryArena::Footprint(OP_SEEK_RECORDS_SIZE_MAX) +
+             AudioMemoryArena::Footprint(255 * sizeof(ogg_packet)) +
+             AudioMemoryArena::Footprint(decoderSize) +
+             AudioMemoryArena::Footprint(OP_DECODE_BUFFER_SIZE_MAX) +
+             AudioMemoryArena::Footprint(OP_DECODE_BUFFER_SIZE_MAX / 2) + // Outgrown when a longer packet turns up
+             AudioMemoryArena::Footprint(OP_DECODE_SCRATCH_SIZE_MAX) + OP_DECODE_SCRATCH_BLOCKS_MAX * AudioMemoryArena::Footprint(8);
+    }
+    // A mixed stream only holds decoders for the coupled (stereo) and mono streams its mix uses,
+    // i.e. 1 and 1 for DOWNMIX_FRONT of 5.1 or 2 and 1 (the LFE is left out) for DOWNMIX_FULL
+    static constexpr int preAllocMixDecoderSize(int coupledStreams, int monoStreams) {
+      return OP_MIX_DECODER_OVERHEAD_MAX + coupledStreams * OP_COUPLED_DECODER_SIZE_MAX + monoStreams * OP_MONO_DECODER_SIZE_MAX;
+    }
+    // libogg's sync buffer holds one page plus slack
+    static constexpr int preAllocSyncSize(int maxPageSize) {
+      return AudioMemoryArena::Footprint(maxPageSize + OP_SYNC_SLACK);
+    }
+    // The stream body starts at 16K and grows by whole pages when a packet (i.e. a large comment header) spans them
+    static constexpr int preAllocBodySize(int maxPageSize, int maxTagBytes) {
+      return (maxTagBytes + maxPageSize > 16384 ? maxTagBytes + maxPageSize : 16384) + 1024;
+    }
+    static constexpr int preAllocStreamSize(int maxPageSize, int maxTagBytes) {
+      return AudioMemoryArena::Footprint(sizeof(ogg_stream_state)) +
+             AudioMemoryArena::Footprint(preAllocBodySize(maxPageSize, maxTagBytes)) +
+             AudioMemoryArena::Footprint(1024 * sizeof(int)) + AudioMemoryArena::Footprint(1024 * sizeof(ogg_int64_t));
+    }
+    // Vendor string, each comment and the two comment index arrays
+    static constexpr int preAllocTagsSize(int maxTagBytes, int maxComments) {
+      return AudioMemoryArena::Footprint(maxTagBytes) + (maxComments + 2) * AudioMemoryArena::Footprint(8) +
+             AudioMemoryArena::Footprint((maxComments + 1) * sizeof(char*)) + AudioMemoryArena::Footprint((maxComments + 1) * sizeof(int));
+    }
+
   protected:
     // Opus callbacks, need static functions to bounce into C++ from C
     static int OPUS_read(void *_stream, unsigned char *_ptr, int _nbytes) {
@@ -56,14 +112,29 @@ class AudioGeneratorOpus : public AudioGenerator
     opus_int64 tell_cb();
     int close_cb();
 
+    static int OPUS_mix(void *_ctx, const OpusHead *_head, opus_int16 *_matrix) {
+      return static_cast<AudioGeneratorOpus*>(_ctx)->mix_cb(_head, _matrix);
+    }
+    int mix_cb(const OpusHead *_head, opus_int16 *_matrix);
+
   private:
+    // Non-NULL when opusfile, libogg and libopus allocate from a caller-supplied arena
+    void *preallocateSpace;
+    AudioMemoryArena arena;
+
     OpusFileCallbacks cb = {OPUS_read, OPUS_seek, OPUS_tell, OPUS_close};
     OggOpusFile *of;
     int prev_li; // To detect changes in streams
 
-    int16_t *buff;
-    uint32_t buffPtr;
-    uint32_t buffLen;
+    Downmix downmix;
+    int mixChannels;
+    const int16_t *userMatrix;
+    int userMatrixChannels;
+
+    // Rest of the current packet, straight out of opusfile's decode buffer
+    const int16_t *pcm;
+    int pcmChannels;
+    uint32_t pcmLeft;
 };
 
 #endif
@@ -0,0 +1,411 @@
+/*
+  AudioGeneratorOpusPackets
+  Audio output generator for raw (un-encapsulated) Opus packets, with a jitter buffer and loss concealment
+
+  Copyright (C) 2022  Earle F. Philhower, III
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <AudioGeneratorOpusPackets.h>
+
+// Latency trimming, in frames played
+static const int trimWindow = 50;    // Queue depth is judged over this many frames...
+static const int calmLimit = 500;    // ...and the target depth drops after this many without an underrun
+
+AudioGeneratorOpusPackets::AudioGeneratorOpusPackets(int sampleRate, int channels, Framing framing)
+{
+  this->sampleRate = sampleRate;
+  this->channels = channels;
+  this->framing = framing;
+  maxPacketSize = defaultPacketSize;
+  minDepth = 2;
+  maxDepth = 8;
+  dec = nullptr;
+  pool = nullptr;
+  rx = nullptr;
+  outSample = nullptr;
+  running = false;
+  file = nullptr;
+  output = nullptr;
+  memset(&stats, 0, sizeof(stats));
+}
+
+AudioGeneratorOpusPackets::~AudioGeneratorOpusPackets()
+{
+  AudioMemory::Scope scope(&mem);
+  if (dec) opus_decoder_destroy(dec);
+  dec = nullptr;
+  audio_free(pool);
+  pool = nullptr;
+  audio_free(rx);
+  rx = nullptr;
+  audio_free(outSample);
+  outSample = nullptr;
+}
+
+void AudioGeneratorOpusPackets::SetJitterDepth(int minDepth, int maxDepth)
+{
+  if (minDepth < 1) minDepth = 1;
+  if (maxDepth > slots - 2) maxDepth = slots - 2;
+  if (maxDepth < minDepth) maxDepth = minDepth;
+  this->minDepth = minDepth;
+  this->maxDepth = maxDepth;
+}
+
+void AudioGeneratorOpusPackets::SetMaxPacketSize(int bytes)
+{
+  if (bytes < 1) bytes = 1;
+  if (bytes > 0xffff) bytes = 0xffff;
+  maxPacketSize = bytes;
+}
+
+bool AudioGeneratorOpusPackets::begin(AudioFileSource *source, AudioOutput *output)
+{
+  AudioMemory::Scope scope(&mem);
+  if (!source) return false;
+  file = source;
+  if (!output) return false;
+  this->output = output;
+  if (!file->isOpen()) return false; // Error
+  if ((channels < 1) || (channels > 2)) return false;
+
+  int err;
+  dec = opus_decoder_create(sampleRate, channels, &err);
+  pool = (uint8_t*)audio_malloc(slots * maxPacketSize);
+  rx = (uint8_t*)audio_malloc(maxPacketSize + 3); // Room for a sequence number and one byte too many
+  outSample = (int16_t*)audio_malloc((sampleRate * maxFrameMs / 1000) * channels * sizeof(int16_t));
+  if (!dec || !pool || !rx || !outSample) {
+    if (!dec && (err != OPUS_ALLOC_FAIL)) audioLogger->printf_P(PSTR("ERROR: Unsupported Opus packet sample rate %d\n"), sampleRate);
+    else audioLogger->printf_P(PSTR("OOM error in Opus packets\n"));
+    if (dec) opus_decoder_destroy(dec);
+    dec = nullptr;
+    audio_free(pool);
+    pool = nullptr;
+    audio_free(rx);
+    rx = nullptr;
+    audio_free(outSample);
+    outSample = nullptr;
+    return false;
+  }
+
+  memset(slot, 0, sizeof(slot));
+  memset(&stats, 0, sizeof(stats));
+  nextSeq = 0;
+  rxSeq = 0;
+  haveSeq = false;
+  buffering = true;
+  decoded = false;
+  live = false;
+  trimFrame = false;
+  targetDepth = minDepth;
+  windowFrames = 0;
+  windowMin = slots;
+  calmFrames = 0;
+  rxHave = 0;
+  rxNeed = 0;
+  hdrHave = 0;
+  frameSize = sampleRate / 50; // Until a real packet says otherwise
+  validSamples = 0;
+  curSample = 0;
+  lastSample[0] = 0;
+  lastSample[1] = 0;
+
+  output->begin();
+  output->SetRate(sampleRate);
+  output->SetBitsPerSample(16);
+  output->SetChannels(channels);
+
+  running = true;
+  return true;
+}
+
+bool AudioGeneratorOpusPackets::loop()
+{
+  AudioMemory::Scope scope(&mem);
+
+  if (!running) goto done; // Nothing to do here!
+
+  // If we've got data, try and pump it out...
+  while (validSamples) {
+    if (channels == 1) {
+      lastSample[0] = outSample[curSample];
+      lastSample[1] = outSample[curSample];
+    } else {
+      lastSample[0] = outSample[curSample*2];
+      lastSample[1] = outSample[curSample*2 + 1];
+    }
+    if (!output->ConsumeSample(lastSample)) goto done; // Can't send, but no error detected
+    validSamples--;
+    curSample++;
+  }
+
+  // No samples available, need to play the next frame, real or not
+  if (!NextFrame()) running = false; // Source is finished and the queue is empty
+
+done:
+  file->loop();
+  output->loop();
+
+  return running;
+}
+
+bool AudioGeneratorOpusPackets::stop()
+{
+  AudioMemory::Scope scope(&mem);
+  if (dec) opus_decoder_destroy(dec);
+  dec = nullptr;
+  audio_free(pool);
+  pool = nullptr;
+  audio_free(rx);
+  rx = nullptr;
+  audio_free(outSample);
+  outSample = nullptr;
+  running = false;
+  output->stop();
+  return file->close();
+}
+
+bool AudioGeneratorOpusPackets::isRunning()
+{
+  return running;
+}
+
+// A source which has gone quiet, as opposed to one which has ended
+bool AudioGeneratorOpusPackets::SourceDone()
+{
+  return !file->isOpen() || (file->getSize() && (file->getPos() >= file->getSize()));
+}
+
+AudioGeneratorOpusPackets::Slot *AudioGeneratorOpusPackets::Find(uint16_t seq)
+{
+  Slot *s = &slot[seq % slots];
+  return (s->valid && (s->seq == seq)) ? s : nullptr;
+}
+
+int AudioGeneratorOpusPackets::Queued()
+{
+  int n = 0;
+  for (int i = 0; i < slots; i++) {
+    if (slot[i].valid) n++;
+  }
+  return n;
+}
+
+void AudioGeneratorOpusPackets::Enqueue(uint16_t seq, const uint8_t *data, int len)
+{
+  if (!haveSeq) {
+    nextSeq = seq;
+    haveSeq = true;
+  }
+  int16_t delta = seq - nextSeq;
+  if ((delta < -1000) || (delta > 1000)) {
+    // The far end restarted, so start over from here
+    memset(slot, 0, sizeof(slot));
+    nextSeq = seq;
+    buffering = true;
+    delta = 0;
+  }
+  if (delta < 0) {
+    stats.late++;
+    return;
+  }
+  // Too far ahead to hold, so whatever is in the way has run out of time
+  while ((int16_t)(seq - nextSeq) >= slots) {
+    Slot *s = Find(nextSeq);
+    if (s) {
+      s->valid = false;
+      stats.dropped++;
+    } else {
+      stats.lost++;
+    }
+    nextSeq++;
+  }
+  Slot *s = &slot[seq % slots];
+  if (s->valid) { // Only a duplicate can land on an occupied slot
+    stats.late++;
+    return;
+  }
+  s->seq = seq;
+  s->len = len;
+  s->valid = true;
+  memcpy(pool + (seq % slots) * maxPacketSize, data, len);
+  stats.received++;
+}
+
+bool AudioGeneratorOpusPackets::ReadDatagram()
+{
+  int hdrLen = (framing == FRAMING_DATAGRAM_SEQ) ? 2 : 0;
+  // Ask for a byte more than fits, a datagram source truncates what's too long to give and
+  // that spare byte coming back is the only way to tell
+  int n = file->readNonBlock(rx, maxPacketSize + hdrLen + 1);
+  if (!n) {
+    if (!SourceDone()) live = true;
+    return false;
+  }
+  uint16_t seq = hdrLen ? (rx[0] << 8) | rx[1] : rxSeq;
+  rxSeq = seq + 1;
+  if (n > maxPacketSize + hdrLen) stats.dropped++;
+  else if (n > hdrLen) Enqueue(seq, rx + hdrLen, n - hdrLen);
+  return true;
+}
+
+bool AudioGeneratorOpusPackets::ReadLengthFramed()
+{
+  int hdrLen = (framing == FRAMING_LENGTH_SEQ) ? 4 : 2;
+  while (hdrHave < hdrLen) {
+    int n = file->readNonBlock(hdr + hdrHave, hdrLen - hdrHave);
+    if (!n) {
+      if (!SourceDone()) live = true;
+      return false;
+    }
+    hdrHave += n;
+    if (hdrHave == hdrLen) {
+      rxNeed = (hdr[0] << 8) | hdr[1];
+      rxHave = 0;
+    }
+  }
+  while (rxHave < rxNeed) {
+    // Oversized packets are drained through the start of rx[] and dropped
+    bool fits = rxNeed <= maxPacketSize;
+    int want = rxNeed - rxHave;
+    if (!fits && (want > maxPacketSize)) want = maxPacketSize;
+    int n = file->readNonBlock(fits ? rx + rxHave : rx, want);
+    if (!n) {
+      if (!SourceDone()) live = true;
+      return false;
+    }
+    rxHave += n;
+  }
+  hdrHave = 0;
+  uint16_t seq = (framing == FRAMING_LENGTH_SEQ) ? (hdr[2] << 8) | hdr[3] : rxSeq;
+  rxSeq = seq + 1;
+  // A zero length is the sender marking a packet it never had, which just leaves a gap
+  if (rxNeed > maxPacketSize) stats.dropped++;
+  else if (rxNeed) Enqueue(seq, rx, rxNeed);
+  return true;
+}
+
+void AudioGeneratorOpusPackets::ReadPackets()
+{
+  // Take everything that's arrived while there's room, the rest waits in the source
+  bool datagram = (framing == FRAMING_DATAGRAM) || (framing == FRAMING_DATAGRAM_SEQ);
+  while (Queued() < slots - 1) {
+    if (!(datagram ? ReadDatagram() : ReadLengthFramed())) break;
+  }
+}
+
+// Decode into outSample[].  With fec set, data is the packet *after* the lost one and its
+// in-band redundancy (or PLC, if it carries none) stands in for the missing frame.
+int AudioGeneratorOpusPackets::Decode(const uint8_t *data, int len, bool fec)
+{
+  int n;
+  if (!data) {
+    n = opus_decode(dec, nullptr, 0, outSample, frameSize, 0);
+  } else {
+    n = opus_packet_get_nb_samples(data, len, sampleRate);
+    if ((n <= 0) || (n > sampleRate * maxFrameMs / 1000)) return -1;
+    if (fec) n = frameSize;
+    n = opus_decode(dec, data, len, outSample, n, fec ? 1 : 0);
+    if ((n > 0) && !fec) frameSize = n;
+  }
+  if (n > 0) {
+    decoded = true;
+    validSamples = n;
+    curSample = 0;
+  }
+  return n;
+}
+
+bool AudioGeneratorOpusPackets::NextFrame()
+{
+  ReadPackets();
+  int queued = Queued();
+  bool done = SourceDone();
+
+  if (buffering) {
+    if ((queued >= targetDepth) || (done && queued)) {
+      buffering = false;
+    } else if (done) {
+      return false;
+    } else {
+      // Keep the output clocked while the queue fills, silence at first and PLC after that
+      if (!decoded || (Decode(nullptr, 0, false) <= 0)) {
+        memset(outSample, 0, frameSize * channels * sizeof(int16_t));
+        validSamples = frameSize;
+        curSample = 0;
+      }
+      return true;
+    }
+  }
+
+  if (trimFrame) {
+    // The queue has held more than needed for a while, so play one frame less to cut latency.
+    // It's still decoded to keep the decoder's state continuous.
+    trimFrame = false;
+    Slot *s = Find(nextSeq);
+    if (s && Find(nextSeq + 1)) {
+      Decode(pool + (nextSeq % slots) * maxPacketSize, s->len, false);
+      s->valid = false;
+      nextSeq++;
+      stats.dropped++;
+    }
+  }
+
+  Slot *s = Find(nextSeq);
+  if (s) {
+    int n = Decode(pool + (nextSeq % slots) * maxPacketSize, s->len, false);
+    s->valid = false;
+    if (n <= 0) {
+      stats.dropped++;
+      Decode(nullptr, 0, false);
+    }
+    nextSeq++;
+  } else if (queued) {
+    // A gap with later packets already here, so this one isn't coming in time
+    stats.lost++;
+    Slot *n = Find(nextSeq + 1);
+    if (n && (Decode(pool + ((uint16_t)(nextSeq + 1) % slots) * maxPacketSize, n->len, true) > 0)) stats.recovered++;
+    else Decode(nullptr, 0, false);
+    nextSeq++;
+  } else {
+    if (done) return false;
+    // Ran dry, so conceal and wait for a deeper queue than last time
+    stats.underruns++;
+    calmFrames = 0;
+    if (targetDepth < maxDepth) targetDepth++;
+    buffering = true;
+    Decode(nullptr, 0, false);
+    stats.depth = targetDepth;
+    return true;
+  }
+
+  // Only a source which has been seen to run dry says anything about network latency, a file
+  // or pipe read ahead as far as the queue allows would just be trimmed away
+  if (live) {
+    if ((++calmFrames >= calmLimit) && (targetDepth > minDepth)) {
+      targetDepth--;
+      calmFrames = 0;
+    }
+    queued = Queued();
+    if (queued < windowMin) windowMin = queued;
+    if (++windowFrames >= trimWindow) {
+      if (windowMin > targetDepth) trimFrame = true;
+      windowFrames = 0;
+      windowMin = slots;
+    }
+  }
+  stats.depth = targetDepth;
+  return true;
+}
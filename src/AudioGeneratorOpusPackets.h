@@ -0,0 +1,126 @@
+/*
+  AudioGeneratorOpusPackets
+  Audio output generator for raw (un-encapsulated) Opus packets, with a jitter buffer and loss concealment
+
+  Copyright (C) 2022  Earle F. Philhower, III
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _AUDIOGENERATOROPUSPACKETS_H
+#define _AUDIOGENERATOROPUSPACKETS_H
+
+#include <AudioGenerator.h>
+#include "libopus/opus.h"
+
+// Plays Opus packets as they arrive from the source, without Ogg's page buffering in the way.
+// Since there are no headers, the sample rate (8000, 12000, 16000, 24000 or 48000) and channel
+// count to decode at must be given up front.  Sources which deliver one packet per read()
+// (i.e. a UDP socket wrapper) should use one of the DATAGRAM framings, byte streams (pipes,
+// TCP, files) one of the LENGTH ones.  Sequence numbers let lost and reordered packets be told
+// apart, otherwise every packet is taken to follow the last.
+class AudioGeneratorOpusPackets : public AudioGenerator
+{
+  public:
+    typedef enum {
+      FRAMING_LENGTH,        // 16-bit big-endian payload length, then the payload
+      FRAMING_LENGTH_SEQ,    // 16-bit length, 16-bit sequence number, then the payload
+      FRAMING_DATAGRAM,      // Each read() returns one whole packet
+      FRAMING_DATAGRAM_SEQ   // Each read() returns a 16-bit sequence number and then the packet
+    } Framing;
+
+    typedef struct {
+      uint32_t received;   // Packets put in the jitter buffer
+      uint32_t late;       // Arrived after their turn had passed, or duplicates
+      uint32_t dropped;    // Too large, undecodable, or discarded to cut latency
+      uint32_t lost;       // Never arrived in time
+      uint32_t recovered;  // ...of which were rebuilt from the next packet's in-band FEC
+      uint32_t underruns;  // Times the jitter buffer ran dry
+      int depth;           // Current target depth, in packets
+    } Stats;
+
+    AudioGeneratorOpusPackets(int sampleRate = 48000, int channels = 1, Framing framing = FRAMING_DATAGRAM_SEQ);
+    virtual ~AudioGeneratorOpusPackets() override;
+    virtual bool begin(AudioFileSource *source, AudioOutput *output) override;
+    virtual bool loop() override;
+    virtual bool stop() override;
+    virtual bool isRunning() override;
+
+    // Playback starts once minDepth packets are queued.  Each underrun raises the target by one,
+    // up to maxDepth, and a long stretch without one lowers it again.  Call before begin().
+    void SetJitterDepth(int minDepth, int maxDepth);
+    // Largest packet accepted, bigger ones are counted as dropped.  Every jitter buffer slot is
+    // this size, so a link known to send small packets can save RAM by lowering it.  Call before begin().
+    void SetMaxPacketSize(int bytes);
+    const Stats &GetStats() const { return stats; }
+
+    static constexpr int slots = 16;                // Jitter buffer entries, the most that can be queued
+    static constexpr int defaultPacketSize = 1275;  // Bytes, the largest a single Opus frame can be
+    static constexpr int maxFrameMs = 60;           // Longest packet duration accepted
+
+  protected:
+    typedef struct {
+      uint16_t seq;
+      uint16_t len;
+      bool valid;
+    } Slot;
+
+    OpusDecoder *dec;
+    int sampleRate;
+    int channels;
+    Framing framing;
+    int maxPacketSize;
+
+    // Jitter buffer, payloads live in pool[] at slot index * maxPacketSize
+    Slot slot[slots];
+    uint8_t *pool;
+    uint16_t nextSeq;   // Next packet due to play
+    uint16_t rxSeq;     // Sequence number given to the next unnumbered packet
+    bool haveSeq;       // nextSeq is meaningful
+    bool buffering;     // Waiting for the queue to reach targetDepth
+    bool decoded;       // Something has been decoded, so PLC has history to work from
+    bool live;          // Source has run dry before, so queue depth reflects real latency
+    bool trimFrame;     // Skip a frame's output at the next opportunity
+    int minDepth, maxDepth, targetDepth;
+    int windowFrames;   // Frames played in this latency-trimming window
+    int windowMin;      // Fewest packets queued during it
+    int calmFrames;     // Frames since the last underrun
+
+    // Receive staging, for length-prefixed streams which may trickle in a few bytes at a time
+    uint8_t *rx;
+    int rxHave;
+    int rxNeed;
+    uint8_t hdr[4];
+    int hdrHave;
+
+    // Output buffering
+    int16_t *outSample;
+    int frameSize;      // Samples per channel of the last frame, used for concealment
+    int validSamples;
+    int curSample;
+
+    Stats stats;
+
+    void ReadPackets();
+    bool ReadLengthFramed();
+    bool ReadDatagram();
+    void Enqueue(uint16_t seq, const uint8_t *data, int len);
+    int Queued();
+    Slot *Find(uint16_t seq);
+    bool SourceDone();
+    bool NextFrame();
+    int Decode(const uint8_t *data, int len, bool fec);
+};
+
+#endif
@@ -32,11 +32,43 @@ AudioGeneratorRTTTL::AudioGeneratorRTTTL()
   rate = 22050;
   buff = nullptr;
   ptr = 0;
+  for (int i = 0; i < maxTracks; i++) trackWaveform[i] = WAVEFORM_SQUARE;
+  for (int i = 0; i <= WAVEFORM_SINE; i++) tables[i] = nullptr;
+  SetEnvelope(5, 60, 70, 40);
+  tracks = 0;
 }
 
 AudioGeneratorRTTTL::~AudioGeneratorRTTTL()
 {
   free(buff);
+  FreeTables();
+}
+
+bool AudioGeneratorRTTTL::SetWaveform(Waveform wf, int track)
+{
+  if (running || (wf < WAVEFORM_SQUARE) || (wf > WAVEFORM_SINE) || (track >= maxTracks)) return false;
+  for (int i = 0; i < maxTracks; i++) {
+    if ((track < 0) || (track == i)) trackWaveform[i] = wf;
+  }
+  return true;
+}
+
+bool AudioGeneratorRTTTL::SetEnvelope(int attack, int decay, int sustain, int release)
+{
+  if (running || (attack < 0) || (decay < 0) || (sustain < 0) || (sustain > 100) || (release < 0)) return false;
+  attackMS = attack;
+  decayMS = decay;
+  sustainPercent = sustain;
+  releaseMS = release;
+  return true;
+}
+
+void AudioGeneratorRTTTL::FreeTables()
+{
+  for (int i = 0; i <= WAVEFORM_SINE; i++) {
+    free(tables[i]);
+    tables[i] = nullptr;
+  }
 }
 
 bool AudioGeneratorRTTTL::stop()
@@ -46,6 +78,7 @@ bool AudioGeneratorRTTTL::stop()
 	  return false;
   }
   running = false;
+  FreeTables();
   output->stop();
   return file->close();
 }
@@ -59,31 +92,7 @@ bool AudioGeneratorRTTTL::loop()
 {
   if (!running) goto done; // Nothing to do here!
 
-  // Load the next note, if we've hit the end of the last one
-  if (samplesSent == ttlSamples) {
-    if (!GetNextNote()) {
-      running = false;
-      goto done;
-    }
-    samplesSent = 0;
-  }
-  
-  // Try and send out the remainder of the existing note, one per loop()
-  if (ttlSamplesPerWaveFP10 == 0) { // Mute
-    int16_t mute[2] = {0, 0};
-    while ((samplesSent < ttlSamples) && output->ConsumeSample(mute)) {
-      samplesSent++;
-    }
-  } else {
-    while (samplesSent < ttlSamples) {
-      int samplesSentFP10 = samplesSent << 10;
-      int rem = samplesSentFP10 % ttlSamplesPerWaveFP10;
-      int16_t val = (rem > ttlSamplesPerWaveFP10/2) ? 8192:-8192;
-      int16_t s[2] = { val, val };
-      if (!output->ConsumeSample(s)) goto done;
-      samplesSent++;
-    }
-  }
+  if (!PushBlocks(block, &blockLen, &blockPtr)) running = false; // Every track has finished
 
 done:
   file->loop();
@@ -107,7 +116,7 @@ bool AudioGeneratorRTTTL::ReadInt(int *dest)
   if ((buff[ptr] <'0') || (buff[ptr] > '9')) return false;
 
   int t = 0;
-  while ((buff[ptr] >= '0') && (buff[ptr] <='9')) {
+  while ((ptr < len) && (buff[ptr] >= '0') && (buff[ptr] <='9')) {
     t = (t * 10) + (buff[ptr] - '0');
     ptr++;
   }
@@ -127,7 +136,7 @@ bool AudioGeneratorRTTTL::ParseHeader()
   ptr++;
   if (!SkipWhitespace()) return false;
   if (buff[ptr++] != '=') return false;
-  if (!ReadInt(&defaultDuration)) return false;
+  if (!ReadInt(&defaultDuration) || (defaultDuration <= 0)) return false; // Notes are wholeNoteMS / duration
   if (!SkipWhitespace()) return false;
   if (buff[ptr++] != ',') return false;
 
@@ -146,7 +155,7 @@ bool AudioGeneratorRTTTL::ParseHeader()
   ptr++;
   if (!SkipWhitespace()) return false;
   if (buff[ptr++] != '=') return false;
-  if (!ReadInt(&bpm)) return false;
+  if (!ReadInt(&bpm) || (bpm <= 0)) return false;
   if (!SkipWhitespace()) return false;
   if (buff[ptr++] != ':') return false;
 
@@ -209,12 +218,188 @@ static int notes[49] = { 0,
   NOTE_C6, NOTE_CS6, NOTE_D6, NOTE_DS6, NOTE_E6, NOTE_F6, NOTE_FS6, NOTE_G6, NOTE_GS6, NOTE_A6, NOTE_AS6, NOTE_B6,
   NOTE_C7, NOTE_CS7, NOTE_D7, NOTE_DS7, NOTE_E7, NOTE_F7, NOTE_FS7, NOTE_G7, NOTE_GS7, NOTE_A7, NOTE_AS7, NOTE_B7 };
 
-bool AudioGeneratorRTTTL::GetNextNote()
+// One quarter of a sine, Q15, to build the wavetables from
+static const int16_t quarterSine[65] PROGMEM = {
+      0,   804,  1608,  2410,  3212,  4011,  4808,  5602,  6393,  7179,  7962,  8739,  9512,
+  10278, 11039, 11793, 12539, 13279, 14010, 14732, 15446, 16151, 16846, 17530, 18204, 18868,
+  19519, 20159, 20787, 21403, 22005, 22594, 23170, 23731, 24279, 24811, 25329, 25832, 26319,
+  26790, 27245, 27683, 28105, 28510, 28898, 29268, 29621, 29956, 30273, 30571, 30852, 31113,
+  31356, 31580, 31785, 31971, 32137, 32285, 32412, 32521, 32609, 32678, 32728, 32757, 32767
+};
+
+// sin(2 * pi * i / 256), Q15
+static int32_t Sine256(int i)
+{
+  int r = i & 63;
+  int32_t v = (int16_t)pgm_read_word(&quarterSine[(i & 64) ? 64 - r : r]);
+  return (i & 128) ? -v : v;
+}
+
+// Fourier series weight of harmonic n, Q15 and before the table is scaled to full range
+static int32_t Harmonic(int wf, int n)
+{
+  switch (wf) {
+    case AudioGeneratorRTTTL::WAVEFORM_SQUARE:   return (n & 1) ? 32768 / n : 0;
+    case AudioGeneratorRTTTL::WAVEFORM_SAW:      return ((n & 1) ? 32768 : -32768) / n;
+    case AudioGeneratorRTTTL::WAVEFORM_TRIANGLE: return (n & 1) ? ((n & 2) ? -32768 : 32768) / (n * n) : 0;
+    default:                                     return (n == 1) ? 32768 : 0;
+  }
+}
+
+// Sums up one table per octave with only the harmonics which stay under Nyquist for that
+// octave's highest note, so nothing aliases back down.  A sine needs only the one.
+bool AudioGeneratorRTTTL::BuildTable(Waveform wf)
+{
+  int octaves = (wf == WAVEFORM_SINE) ? 1 : OCTAVES;
+  tables[wf] = (int16_t *)malloc(octaves * TABLESIZE * sizeof(int16_t));
+  if (!tables[wf]) return false;
+  for (int o = 0; o < octaves; o++) {
+    int harmonics = (rate / 2) / notes[o * 12 + 12];
+    if (harmonics < 1) harmonics = 1;
+    if (harmonics > 64) harmonics = 64;
+    // Twice through, once for the peak and again to scale it to the full 16 bits
+    int32_t peak = 1;
+    for (int pass = 0; pass < 2; pass++) {
+      for (int j = 0; j < TABLESIZE; j++) {
+        int32_t sum = 0;
+        for (int n = 1; n <= harmonics; n++) {
+          int32_t w = Harmonic(wf, n);
+          if (w) sum += (w * Sine256((j * n) & (TABLESIZE - 1))) >> 15;
+        }
+        if (!pass) {
+          if (abs(sum) > peak) peak = abs(sum);
+        } else {
+          tables[wf][o * TABLESIZE + j] = (int16_t)(((int64_t)sum * 32767) / peak);
+        }
+      }
+    }
+  }
+  return true;
+}
+
+void AudioGeneratorRTTTL::NextSegment(Voice *v)
+{
+  switch (v->segment) {
+    case ENV_ATTACK:
+      v->level = 1 << 24;
+      v->segment = ENV_DECAY;
+      v->segmentLeft = decaySamples;
+      v->slope = (sustainLevel - v->level) / decaySamples;
+      break;
+    case ENV_DECAY:
+      v->level = sustainLevel;
+      v->segment = ENV_SUSTAIN;
+      v->segmentLeft = 0x7fffffff;
+      v->slope = 0;
+      break;
+    default:
+      v->level = 0;
+      v->segment = ENV_OFF;
+      v->segmentLeft = 0x7fffffff;
+      v->slope = 0;
+      break;
+  }
+}
+
+void AudioGeneratorRTTTL::Release(Voice *v)
+{
+  v->gateLeft = -1;
+  if ((v->segment == ENV_OFF) || (v->segment == ENV_RELEASE)) return;
+  v->segment = ENV_RELEASE;
+  v->segmentLeft = releaseSamples;
+  v->slope = -v->level / releaseSamples;
+}
+
+// Starts the track's next note, from wherever the envelope is now so a new note never clicks,
+// or lets the last one go when the track is over
+void AudioGeneratorRTTTL::NextNote(Voice *v)
+{
+  int freq, octave, samples;
+  ptr = v->ptr;
+  len = v->end;
+  bool ok = GetNextNote(&freq, &octave, &samples);
+  v->ptr = ptr;
+  if (!ok) {
+    v->done = true;
+    v->noteLeft = 0x7fffffff;
+    Release(v);
+    return;
+  }
+  v->noteLeft = samples;
+  if (!freq) { // Pause
+    Release(v);
+    return;
+  }
+  v->table = tables[v->waveform] + ((v->waveform == WAVEFORM_SINE) ? 0 : octave * TABLESIZE);
+  v->step = (uint32_t)(((uint64_t)freq << 32) / rate);
+  v->segment = ENV_ATTACK;
+  v->segmentLeft = attackSamples;
+  v->slope = ((1 << 24) - v->level) / attackSamples;
+  v->gateLeft = samples - samples / 8;
+}
+
+// Mixes every track's voice into the next block, returning 0 once they have all finished
+int AudioGeneratorRTTTL::RenderBlock()
+{
+  bool playing = false;
+  for (int t = 0; t < tracks; t++) {
+    if (!voice[t].done || (voice[t].segment != ENV_OFF)) playing = true;
+  }
+  if (!playing) return 0;
+
+  memset(mix, 0, sizeof(mix));
+  for (int t = 0; t < tracks; t++) {
+    Voice *v = &voice[t];
+    int at = 0;
+    while ((at < BLOCKFRAMES) && (!v->done || (v->segment != ENV_OFF))) {
+      // Run up to whichever comes first: the end of the block, the envelope segment or the note
+      int n = BLOCKFRAMES - at;
+      if (n > v->segmentLeft) n = v->segmentLeft;
+      if ((v->gateLeft >= 0) && (n > v->gateLeft)) n = v->gateLeft;
+      if (n > v->noteLeft) n = v->noteLeft;
+      if (v->segment != ENV_OFF) {
+        const int16_t *tab = v->table;
+        uint32_t phase = v->phase, step = v->step;
+        int32_t level = v->level, slope = v->slope;
+        int32_t *out = mix + at;
+        for (int i = 0; i < n; i++) {
+          // Linear interpolation between entries, with a Q14 fraction
+          int idx = phase >> 24;
+          int32_t a = tab[idx];
+          int32_t b = tab[(idx + 1) & (TABLESIZE - 1)];
+          int32_t s = a + (((b - a) * (int32_t)((phase >> 10) & 0x3fff)) >> 14);
+          out[i] += (s * (level >> 9)) >> 17; // Q15 sample by Q15 level, and a quarter of full scale
+          phase += step;
+          level += slope;
+        }
+        v->phase = phase;
+        v->level = level;
+      }
+      at += n;
+      v->segmentLeft -= n;
+      if (v->gateLeft > 0) v->gateLeft -= n;
+      if (!v->done) v->noteLeft -= n;
+      if (!v->segmentLeft) NextSegment(v);
+      if (!v->gateLeft) Release(v);
+      if (!v->noteLeft) NextNote(v);
+    }
+  }
+
+  for (int i = 0; i < BLOCKFRAMES; i++) {
+    int32_t s = mix[i];
+    if (s > 32767) s = 32767;
+    else if (s < -32768) s = -32768;
+    block[i * 2] = block[i * 2 + 1] = (int16_t)s;
+  }
+  return BLOCKFRAMES;
+}
+
+bool AudioGeneratorRTTTL::GetNextNote(int *freq, int *octave, int *samples)
 {
   int dur, note, scale;
   if (ptr >= len) return false;
 
-  if (!ReadInt(&dur)) {
+  if (!ReadInt(&dur) || (dur <= 0)) {
     dur = defaultDuration;
   }
   dur = wholeNoteMS / dur;
@@ -251,16 +436,10 @@ bool AudioGeneratorRTTTL::GetNextNote()
 
   if (scale < 4) scale = 4;
   if (scale > 7) scale = 7;
-  if (note) {
-    int freq = notes[(scale - 4) * 12 + note];
-    // Convert from frequency in Hz to high and low samples in fixed point
-    ttlSamplesPerWaveFP10 = (rate << 10) / freq;
-  } else {
-    ttlSamplesPerWaveFP10 = 0;
-  }
-  ttlSamples = (rate * dur ) / 1000;
-
-  //audioLogger->printf("%d %d %d %d %d\n", dur, note, scale, ttlSamplesPerWaveFP10, ttlSamples );
+  *octave = scale - 4;
+  *freq = note ? notes[(scale - 4) * 12 + note] : 0;
+  *samples = (rate * dur ) / 1000;
+  if (*samples < 1) *samples = 1;
 
   return true;
 }
@@ -273,22 +452,55 @@ bool AudioGeneratorRTTTL::begin(AudioFileSource *source, AudioOutput *output)
   this->output = output;
   if (!file->isOpen()) return false; // Error
   
+  free(buff);
+  FreeTables();
   len = file->getSize();
   buff = (char *)malloc(len);
   if (!buff) return false;
   if (file->read(buff, len) != (uint32_t)len) return false;
 
   ptr = 0;
-  samplesSent = 0;
-  ttlSamples = 0;
 
   if (!ParseHeader()) return false;
 
+  // Every '|' starts another track
+  int songEnd = len;
+  tracks = 0;
+  memset(voice, 0, sizeof(voice));
+  for (int i = ptr, start = ptr; (i <= songEnd) && (tracks < maxTracks); i++) {
+    if ((i == songEnd) || (buff[i] == '|')) {
+      voice[tracks].ptr = start;
+      voice[tracks].end = i;
+      tracks++;
+      start = i + 1;
+    }
+  }
+
+  attackSamples = ((int)rate * attackMS) / 1000;
+  decaySamples = ((int)rate * decayMS) / 1000;
+  releaseSamples = ((int)rate * releaseMS) / 1000;
+  if (attackSamples < 1) attackSamples = 1;
+  if (decaySamples < 1) decaySamples = 1;
+  if (releaseSamples < 1) releaseSamples = 1;
+  sustainLevel = ((1 << 24) / 100) * sustainPercent;
+
+  for (int t = 0; t < tracks; t++) {
+    Voice *v = &voice[t];
+    v->waveform = trackWaveform[t];
+    if (!tables[v->waveform] && !BuildTable(v->waveform)) return false;
+    v->segment = ENV_OFF;
+    v->segmentLeft = 0x7fffffff;
+    v->gateLeft = -1;
+    NextNote(v);
+  }
+
   if (!output->SetRate( rate )) return false;
   if (!output->SetBitsPerSample( 16 )) return false;
   if (!output->SetChannels( 2 )) return false;
   if (!output->begin()) return false;
 
+  blockLen = 0;
+  blockPtr = 0;
   running = true;
   
   return true;
@@ -26,9 +26,21 @@
 
 #include "AudioGenerator.h"
 
+// Plays RTTTL ringtones on a small wavetable synth.  Besides the usual single line of notes, the
+// notes may be split into up to 4 tracks with '|', all sharing the header's defaults, which play
+// at the same time (i.e. "chord:d=4,o=5,b=100:c,e,g|e,g,c6|g,c6,e6").  Every track has its own
+// voice with a band-limited wavetable and an ADSR envelope, all worked in fixed point and
+// rendered in blocks.
 class AudioGeneratorRTTTL : public AudioGenerator
 {
   public:
+    typedef enum {
+      WAVEFORM_SQUARE,
+      WAVEFORM_SAW,
+      WAVEFORM_TRIANGLE,
+      WAVEFORM_SINE
+    } Waveform;
+
     AudioGeneratorRTTTL();
     virtual ~AudioGeneratorRTTTL() override;
     virtual bool begin(AudioFileSource *source, AudioOutput *output) override;
@@ -36,14 +48,37 @@ class AudioGeneratorRTTTL : public AudioGenerator
     virtual bool stop() override;
     virtual bool isRunning() override;
     void SetRate(uint16_t hz) { rate = hz; }
+    // Square (the default) for every track, or only the given one.  Call before begin().
+    bool SetWaveform(Waveform wf, int track = -1);
+    // Times in milliseconds, and the sustain level as a percentage of the peak.  Notes are let go
+    // after 7/8 of their length, so the release has room to be heard between them.
+    bool SetEnvelope(int attackMS, int decayMS, int sustainPercent, int releaseMS);
+
+    static constexpr int maxTracks = 4;
 
   private:
     bool SkipWhitespace();
     bool ReadInt(int *dest);
     bool ParseHeader();
-    bool GetNextNote();
+    bool GetNextNote(int *freq, int *octave, int *samples);
     
   protected:
+    enum { ENV_ATTACK, ENV_DECAY, ENV_SUSTAIN, ENV_RELEASE, ENV_OFF };
+    enum { TABLESIZE = 256, OCTAVES = 4, BLOCKFRAMES = 64 };
+
+    typedef struct {
+      int ptr, end;              // This track's notes in buff[]
+      Waveform waveform;
+      const int16_t *table;      // Band-limited for the octave of the current note
+      uint32_t phase, step;      // Position in the wavetable, the top 8 bits being the entry
+      int32_t level, slope;      // Envelope and its change per sample, Q24
+      int segment;               // ENV_xxx
+      int segmentLeft;           // Samples until the envelope moves on
+      int gateLeft;              // Samples until the note is let go, -1 once it has been
+      int noteLeft;              // Samples until the next note
+      bool done;                 // No notes left
+    } Voice;
+
     uint16_t rate;
 
     // We copy the entire tiny song to a buffer for easier access
@@ -56,11 +91,27 @@ class AudioGeneratorRTTTL : public AudioGenerator
     int defaultOctave;
     int wholeNoteMS;
 
-    // The note we're currently playing
-    int ttlSamplesPerWaveFP10;
-    int ttlSamples;
-    int samplesSent;
+    // Synth
+    Waveform trackWaveform[maxTracks];
+    int attackMS, decayMS, sustainPercent, releaseMS;
+    int attackSamples, decaySamples, releaseSamples;
+    int32_t sustainLevel;
+    int16_t *tables[WAVEFORM_SINE + 1];  // OCTAVES tables of TABLESIZE for each waveform in use
+    Voice voice[maxTracks];
+    int tracks;
+
+    // Rendered block, handed to the output as it will take it
+    int32_t mix[BLOCKFRAMES];
+    int16_t block[BLOCKFRAMES * 2];
+    int blockLen;
+    int blockPtr;
+
+    bool BuildTable(Waveform wf);
+    void FreeTables();
+    void NextNote(Voice *v);
+    void NextSegment(Voice *v);
+    void Release(Voice *v);
+    virtual int RenderBlock() override;
 };
 
 #endif
-
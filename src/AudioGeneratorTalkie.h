@@ -26,6 +26,9 @@
 
 #include "AudioGenerator.h"
 
+// Phrases are queued and spoken back-to-back from loop(), rendered a block at a time through a
+// fixed-point lattice filter.  The LPC data is read where it lies (RAM or PROGMEM) rather than
+// copied, so anything passed to say() must stay valid until it has been spoken.
 class AudioGeneratorTalkie : public AudioGenerator
 {
   public:
@@ -35,32 +38,61 @@ class AudioGeneratorTalkie : public AudioGenerator
     virtual bool loop() override;
     virtual bool stop() override;
     virtual bool isRunning() override;
+    // Queues a phrase.  Async returns straight away (false if the queue is full), otherwise this
+    // plays until the phrase itself has been spoken, along with anything queued ahead of it.
     bool say(const uint8_t *data, size_t len, bool async = false);
-    
+    int queued() const { return queueCount + (speaking ? 1 : 0); } // Phrases not yet finished
+
+    static constexpr int queueSize = 8;
+
   protected:
-    // The data stream we're playing
+    static constexpr int FRAMESAMPLES = 8000 / 40; // Each LPC frame lasts 25ms
+    static constexpr int BLOCKFRAMES = FRAMESAMPLES / 4;
+
+    typedef struct {
+      const uint8_t *data;
+      size_t len;
+    } Phrase;
+
+    // A copy of the file given to begin(), the only data owned here
     uint8_t *buff;
-    
+
+    // Phrases waiting their turn
+    Phrase queue[queueSize];
+    int queueHead;
+    int queueCount;
+    uint32_t phrasesQueued;  // Totals, so say() can tell when its own phrase is done
+    uint32_t phrasesSpoken;
+    bool speaking;
+
     // Codeword stream handlers
-    uint8_t *ptrAddr;
+    const uint8_t *ptrAddr;
+    const uint8_t *ptrEnd;
     uint8_t ptrBit;
 
     bool    lastFrame;
     bool    genOneFrame(); // Fill up one frame's worth of data, returns if this is the last frame
-    int16_t genOneSample(); // Generate one sample of a frame
-    
+    void    synthesize(int16_t *dest, int count); // Run count samples of the frame through the filter
+    virtual int RenderBlock() override;
+
     // Utilities
     uint8_t rev(uint8_t a);
     uint8_t getBits(uint8_t bits);
 
-    // Synthesizer state
+    // Synthesizer state, all coefficients Q15
     uint8_t  synthPeriod;
     uint16_t synthEnergy;
-    int16_t  synthK1, synthK2;
-    int8_t   synthK3, synthK4, synthK5, synthK6, synthK7, synthK8, synthK9, synthK10;
-    
+    int16_t  synthK[10];
+    int16_t  x[10];           // Lattice filter delay line
+    uint8_t  periodCounter;
+    uint16_t synthRand;
+
     int frameLeft;
+
+    // Rendered block, handed to the output as it will take it
+    int16_t block[BLOCKFRAMES * 2];
+    int blockLen;
+    int blockPtr;
 };
 
 #endif
-
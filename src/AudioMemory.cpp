@@ -0,0 +1,279 @@
+/*
+  AudioMemory
+  Allocator hooks and heap/stack usage accounting for the wrapped codec libraries
+
+  Copyright (C) 2022  Earle F. Philhower, III
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include "AudioMemory.h"
+
+// Every block carries a small header so frees can be charged and routed back correctly.
+// Padded to AudioMemory::overhead to keep the returned pointer as aligned as malloc()'s would be.
+typedef struct {
+  AudioMemory *owner;
+  const AudioMemory::Allocator *allocator;
+  size_t size;
+} AudioMemoryHeader;
+static_assert(sizeof(AudioMemoryHeader) <= AudioMemory::overhead, "AudioMemory::overhead too small");
+static const size_t memHdrSize = AudioMemory::overhead;
+
+// Bytes just below the generator's frame which painting leaves alone, to cover the frames
+// of the Scope and paint/measure helpers themselves
+static const uintptr_t paintGuard = 256;
+static const uint8_t paintPattern = 0xa5;
+
+// Anything deeper than this is another task's stack (ESP32) and not ours to measure
+static const uintptr_t maxStackDepth = 64 * 1024;
+
+static void *StdAlloc(void *data, size_t size) { (void) data; return malloc(size); }
+static void *StdRealloc(void *data, void *ptr, size_t size) { (void) data; return realloc(ptr, size); }
+static void StdFree(void *data, void *ptr) { (void) data; free(ptr); }
+
+const AudioMemory::Allocator AudioMemory::defaultAllocator = { StdAlloc, StdRealloc, StdFree, NULL };
+AUDIOMEMORY_THREAD_LOCAL AudioMemory *AudioMemory::active = NULL;
+
+static inline uintptr_t StackPointer()
+{
+  return (uintptr_t)__builtin_frame_address(0);
+}
+
+void AudioMemory::Charge(int32_t bytes)
+{
+  stats.heapCur += bytes;
+  if (stats.heapCur > stats.heapPeak) stats.heapPeak = stats.heapCur;
+}
+
+void *AudioMemory::Alloc(size_t size)
+{
+  AudioMemory *m = active;
+  const Allocator *a = m ? m->allocator : &defaultAllocator;
+  AudioMemoryHeader *h = (AudioMemoryHeader *)a->allocFn(a->data, memHdrSize + size);
+  Probe();
+  if (!h) {
+    if (m) m->stats.failures++;
+    return NULL;
+  }
+  h->owner = m;
+  h->allocator = a;
+  h->size = size;
+  if (m) {
+    m->stats.allocs++;
+    m->Charge(size);
+  }
+  return reinterpret_cast<uint8_t*>(h) + memHdrSize;
+}
+
+void *AudioMemory::Realloc(void *ptr, size_t size)
+{
+  if (!ptr) return Alloc(size);
+  if (!size) {
+    Free(ptr);
+    return NULL;
+  }
+  AudioMemoryHeader *h = (AudioMemoryHeader *)(reinterpret_cast<uint8_t*>(ptr) - memHdrSize);
+  AudioMemory *m = h->owner;
+  const Allocator *a = h->allocator;
+  size_t oldSize = h->size;
+  AudioMemoryHeader *n = (AudioMemoryHeader *)a->reallocFn(a->data, h, memHdrSize + size);
+  Probe();
+  if (!n) {
+    if (m) m->stats.failures++;
+    return NULL;
+  }
+  n->size = size;
+  if (m) m->Charge((int32_t)size - (int32_t)oldSize);
+  return reinterpret_cast<uint8_t*>(n) + memHdrSize;
+}
+
+void AudioMemory::Free(void *ptr)
+{
+  if (!ptr) return;
+  AudioMemoryHeader *h = (AudioMemoryHeader *)(reinterpret_cast<uint8_t*>(ptr) - memHdrSize);
+  if (h->owner) {
+    h->owner->stats.frees++;
+    h->owner->stats.heapCur -= h->size;
+  }
+  h->allocator->freeFn(h->allocator->data, h);
+}
+
+void AudioMemory::Probe()
+{
+  AudioMemory *m = active;
+  if (!m || !m->stackTop) return;
+  uintptr_t sp = StackPointer();
+  if (sp >= m->stackTop) return;
+  uintptr_t depth = m->stackTop - sp;
+  if ((depth < maxStackDepth) && (depth > m->stats.stackPeak)) m->stats.stackPeak = depth;
+}
+
+void __attribute__((noinline)) AudioMemory::Paint()
+{
+  volatile uint8_t *p = (volatile uint8_t *)(stackTop - paintGuard - stackPaint);
+  volatile uint8_t *end = (volatile uint8_t *)(stackTop - paintGuard);
+  while (p < end) *(p++) = paintPattern;
+}
+
+void __attribute__((noinline)) AudioMemory::Measure()
+{
+  // Whatever ran below us scribbled downwards from stackTop, so the lowest changed byte is the high-water mark
+  volatile uint8_t *p = (volatile uint8_t *)(stackTop - paintGuard - stackPaint);
+  volatile uint8_t *end = (volatile uint8_t *)(stackTop - paintGuard);
+  while ((p < end) && (*p == paintPattern)) p++;
+  if (p < end) {
+    uint32_t depth = stackTop - (uintptr_t)p;
+    if (depth > stats.stackPeak) stats.stackPeak = depth;
+  }
+}
+
+AudioMemory::Scope::Scope(AudioMemory *m)
+{
+  mem = m;
+  prev = active;
+  active = m;
+  // Nested scopes on the same object (i.e. loop() calling stop()) keep the outer frame as reference
+  outermost = !m->stackTop;
+  if (outermost) {
+    m->stackTop = StackPointer();
+    if (m->stackPaint) m->Paint();
+  }
+}
+
+AudioMemory::Scope::~Scope()
+{
+  if (outermost) {
+    if (mem->stackPaint) mem->Measure();
+    mem->stackTop = 0;
+  }
+  active = prev;
+}
+
+AudioMemoryArena::AudioMemoryArena(void *space, int size)
+{
+  allocator.allocFn = ArenaAlloc;
+  allocator.reallocFn = ArenaRealloc;
+  allocator.freeFn = ArenaFree;
+  allocator.data = this;
+  highWater = 0;
+
+  uintptr_t start = ((uintptr_t)space + 7) & ~7;
+  uintptr_t stop = ((uintptr_t)space + (space ? size : 0)) & ~7;
+  if (stop < start + hdrSize) {
+    base = end = NULL; // Everything will fail, which is what's asked for
+    return;
+  }
+  base = reinterpret_cast<uint8_t*>(start);
+  end = reinterpret_cast<uint8_t*>(stop);
+  Block *b = reinterpret_cast<Block*>(base);
+  b->size = (end - base) - hdrSize;
+  b->used = 0;
+}
+
+// Absorb any free blocks following this one
+void AudioMemoryArena::Merge(Block *b)
+{
+  Block *n = Next(b);
+  while (((uint8_t*)n < end) && !n->used) {
+    b->size += hdrSize + n->size;
+    n = Next(b);
+  }
+}
+
+// Trim b to size bytes, returning the tail as a free block if it's worth keeping
+void AudioMemoryArena::Split(Block *b, uint32_t size)
+{
+  if (b->size >= size + hdrSize + 8) {
+    Block *tail = reinterpret_cast<Block*>(reinterpret_cast<uint8_t*>(b) + hdrSize + size);
+    tail->size = b->size - size - hdrSize;
+    tail->used = 0;
+    b->size = size;
+  }
+  int top = (reinterpret_cast<uint8_t*>(b) + hdrSize + b->size) - base;
+  if (top > highWater) highWater = top;
+}
+
+void *AudioMemoryArena::Alloc(size_t size)
+{
+  uint32_t want = (size + 7) & ~7;
+  for (Block *b = reinterpret_cast<Block*>(base); (uint8_t*)b < end; b = Next(b)) {
+    if (b->used) continue;
+    Merge(b);
+    if (b->size >= want) {
+      b->used = 1;
+      Split(b, want);
+      return reinterpret_cast<uint8_t*>(b) + hdrSize;
+    }
+  }
+  return NULL;
+}
+
+void *AudioMemoryArena::Realloc(void *ptr, size_t size)
+{
+  if (!ptr) return Alloc(size);
+  uint32_t want = (size + 7) & ~7;
+  Block *b = reinterpret_cast<Block*>(reinterpret_cast<uint8_t*>(ptr) - hdrSize);
+  uint32_t oldSize = b->size;
+  // Grow or shrink in place when possible, this is the common case for libflac's rice tables
+  Merge(b);
+  if (b->size >= want) {
+    Split(b, want);
+    return ptr;
+  }
+  void *n = Alloc(size);
+  if (!n) return NULL;
+  Split(b, oldSize); // Give back whatever Merge() absorbed before copying out
+  memcpy(n, ptr, oldSize);
+  Free(ptr);
+  return n;
+}
+
+void AudioMemoryArena::Free(void *ptr)
+{
+  if (!ptr) return;
+  Block *b = reinterpret_cast<Block*>(reinterpret_cast<uint8_t*>(ptr) - hdrSize);
+  b->used = 0;
+  Merge(b);
+}
+
+extern "C" {
+  void *audio_malloc(size_t size)
+  {
+    return AudioMemory::Alloc(size);
+  }
+
+  void *audio_calloc(size_t nmemb, size_t size)
+  {
+    if (size && (nmemb > SIZE_MAX / size)) return NULL;
+    void *p = AudioMemory::Alloc(nmemb * size);
+    if (p) memset(p, 0, nmemb * size);
+    return p;
+  }
+
+  void *audio_realloc(void *ptr, size_t size)
+  {
+    return AudioMemory::Realloc(ptr, size);
+  }
+
+  void audio_free(void *ptr)
+  {
+    AudioMemory::Free(ptr);
+  }
+
+  void audio_stack_probe(void)
+  {
+    AudioMemory::Probe();
+  }
+}
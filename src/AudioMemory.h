@@ -0,0 +1,186 @@
+/*
+  AudioMemory
+  Allocator hooks and heap/stack usage accounting for the wrapped codec libraries
+
+  Copyright (C) 2022  Earle F. Philhower, III
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _AUDIOMEMORY_H
+#define _AUDIOMEMORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Which AudioMemory is active is tracked per thread where the platform has threads which may
+// run generators side by side (ESP32's FreeRTOS tasks, host builds), and globally elsewhere
+#if defined(ESP32) || defined(__linux__) || defined(__APPLE__)
+#define AUDIOMEMORY_THREAD_LOCAL __thread
+#else
+#define AUDIOMEMORY_THREAD_LOCAL
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Drop-in replacements for the C library allocator, used by libmad, helix, libflac, libogg,
+// libopus, opusfile and tinysoundfont.  Every block is charged to the AudioMemory which
+// was active (see AudioMemory::Scope) when it was allocated, no matter who frees it.
+void *audio_malloc(size_t size);
+void *audio_calloc(size_t nmemb, size_t size);
+void *audio_realloc(void *ptr, size_t size);
+void audio_free(void *ptr);
+
+// Sample the current stack depth against the active AudioMemory.  Cheap, may be sprinkled
+// into codec paths which are suspected of being stack hogs.
+void audio_stack_probe(void);
+
+#ifdef __cplusplus
+}
+
+class AudioMemory
+{
+  public:
+    // Pluggable allocator.  The structure must outlive every block allocated through it,
+    // a static const instance is the usual way to go.
+    typedef struct {
+      void *(*allocFn)(void *data, size_t size);
+      void *(*reallocFn)(void *data, void *ptr, size_t size);
+      void (*freeFn)(void *data, void *ptr);
+      void *data;
+    } Allocator;
+
+    typedef struct {
+      uint32_t heapCur;   // Bytes currently allocated by this instance
+      uint32_t heapPeak;  // High-water mark of heapCur
+      uint32_t allocs;    // Successful allocations
+      uint32_t frees;     // Blocks returned
+      uint32_t failures;  // Allocations which returned NULL
+      uint32_t stackPeak; // Deepest stack seen below the generator's entry point, in bytes
+    } Stats;
+
+    AudioMemory() { allocator = &defaultAllocator; stackTop = 0; stackPaint = 0; memset(&stats, 0, sizeof(stats)); };
+    ~AudioMemory() {};
+
+    // NULL restores plain malloc/realloc/free.  Blocks already allocated are still returned
+    // to the allocator which created them.
+    bool RegisterAllocator(const Allocator *a) { allocator = a ? a : &defaultAllocator; return true; }
+    const Stats &GetStats() const { return stats; }
+    void ResetPeaks() { stats.heapPeak = stats.heapCur; stats.stackPeak = 0; }
+
+    // Stack probes only see the depth at allocation time.  For a true high-water mark, this
+    // many bytes below the generator's frame are filled with a pattern on entry and scanned
+    // on exit.  Costs a memset per loop(), and the caller must ensure that much stack exists.
+    void SetStackPaint(uint32_t bytes) { stackPaint = bytes; }
+
+    // While in existence, directs all audio_* allocations made by the calling thread to the given
+    // AudioMemory.  Scopes nest and must be destroyed in reverse order on the thread which created
+    // them.  Separate generators (each with its own AudioMemory) may run in different tasks, but
+    // any one generator must only be driven from one task at a time.  On platforms without
+    // AUDIOMEMORY_THREAD_LOCAL all generators must run from the same task.
+    class Scope
+    {
+      public:
+        Scope(AudioMemory *m);
+        ~Scope();
+
+      private:
+        AudioMemory *mem;
+        AudioMemory *prev;
+        bool outermost;
+    };
+
+    // Bytes of bookkeeping added in front of every block handed to an Allocator
+    static constexpr int overhead = (3 * sizeof(void*) + 7) & ~7;
+
+    // Backends for the C shims above
+    static void *Alloc(size_t size);
+    static void *Realloc(void *ptr, size_t size);
+    static void Free(void *ptr);
+    static void Probe();
+
+  private:
+    static const Allocator defaultAllocator;
+    static AUDIOMEMORY_THREAD_LOCAL AudioMemory *active;
+
+    const Allocator *allocator;
+    uintptr_t stackTop;
+    uint32_t stackPaint;
+    Stats stats;
+
+    void Charge(int32_t bytes);
+    void Paint();
+    void Measure();
+};
+
+// First-fit allocator carved out of a caller-supplied block.  Lets a generator run a codec
+// without ever touching the system heap, and once the codec has freed everything (i.e. at
+// stop()) the arena is pristine again, so back-to-back files behave identically.
+class AudioMemoryArena
+{
+  public:
+    AudioMemoryArena(void *space, int size);
+    ~AudioMemoryArena() {};
+
+    const AudioMemory::Allocator *GetAllocator() const { return &allocator; }
+    int GetHighWater() const { return highWater; } // Most arena ever used, for sizing it
+
+    // Arena bytes consumed by one audio_malloc(bytes), for computing preAllocSize()s
+    static constexpr int Footprint(int bytes) { return hdrSize + AudioMemory::overhead + ((bytes + 7) & ~7); }
+
+  private:
+    typedef struct {
+      uint32_t size; // Payload bytes following this header
+      uint32_t used;
+    } Block;
+    static constexpr int hdrSize = (sizeof(Block) + 7) & ~7;
+
+    AudioMemory::Allocator allocator;
+    uint8_t *base;
+    uint8_t *end;
+    int highWater;
+
+    Block *Next(Block *b) { return reinterpret_cast<Block*>(reinterpret_cast<uint8_t*>(b) + hdrSize + b->size); }
+    void Merge(Block *b);
+    void Split(Block *b, uint32_t size);
+    void *Alloc(size_t size);
+    void *Realloc(void *ptr, size_t size);
+    void Free(void *ptr);
+
+    static void *ArenaAlloc(void *data, size_t size) { return static_cast<AudioMemoryArena*>(data)->Alloc(size); }
+    static void *ArenaRealloc(void *data, void *ptr, size_t size) { return static_cast<AudioMemoryArena*>(data)->Realloc(ptr, size); }
+    static void ArenaFree(void *data, void *ptr) { static_cast<AudioMemoryArena*>(data)->Free(ptr); }
+};
+
+#endif // __cplusplus
+
+#endif // _AUDIOMEMORY_H
+
+// Codec libraries define AUDIOMEMORY_REDIRECT and include this from their config.h, which
+// sends their plain malloc()/calloc()/realloc()/free() calls through the shims above
+#if defined(AUDIOMEMORY_REDIRECT) && !defined(_AUDIOMEMORY_REDIRECTED)
+#define _AUDIOMEMORY_REDIRECTED
+#include <stdlib.h>
+#undef malloc
+#undef calloc
+#undef realloc
+#undef free
+#define malloc(s)     audio_malloc(s)
+#define calloc(n, s)  audio_calloc(n, s)
+#define realloc(p, s) audio_realloc(p, s)
+#define free(p)       audio_free(p)
+#endif
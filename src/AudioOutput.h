@@ -44,6 +44,10 @@ class AudioOutput
       }
       return count;
     }
+    // Outputs which can carry more than 16 bits override both of these.  Wide samples arrive planar,
+    // one array per channel, right-justified to the bits given to SetBitsPerSample()
+    virtual bool SupportsBitsPerSample(int bits) { return (bits == 8) || (bits == 16); }
+    virtual uint16_t ConsumeSamplesWide(const int32_t *const chan[], uint16_t count) { (void)chan; (void)count; return 0; }
     virtual bool stop() { return false; }
     virtual void flush() { return; }
     virtual bool loop() { return true; }
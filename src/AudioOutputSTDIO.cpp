@@ -73,6 +73,20 @@ bool AudioOutputSTDIO::ConsumeSample(int16_t sample[2])
   return true;
 }
 
+uint16_t AudioOutputSTDIO::ConsumeSamplesWide(const int32_t *const chan[], uint16_t count)
+{
+  int bytes = bps / 8;
+  for (uint16_t i=0; i<count; i++) {
+    for (int c=0; c<channels; c++) {
+      uint32_t v = (uint32_t)chan[c][i];
+      for (int b=0; b<bytes; b++) {
+        uint8_t l = (v >> (b * 8)) & 0xff;
+        fwrite(&l, sizeof(l), 1, f);
+      }
+    }
+  }
+  return count;
+}
 
 bool AudioOutputSTDIO::stop()
 {
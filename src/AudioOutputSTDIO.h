@@ -34,6 +34,8 @@ class AudioOutputSTDIO : public AudioOutput
     ~AudioOutputSTDIO() { free(filename); };
     virtual bool begin() override;
     virtual bool ConsumeSample(int16_t sample[2]) override;
+    virtual bool SupportsBitsPerSample(int bits) override { return (bits == 8) || (bits == 16) || (bits == 24) || (bits == 32); }
+    virtual uint16_t ConsumeSamplesWide(const int32_t *const chan[], uint16_t count) override;
     virtual bool stop() override;
     void SetFilename(const char *name);
 
@@ -24,6 +24,7 @@
 
 // Actual decode/audio generation logic
 #include "AudioGeneratorAAC.h"
+#include "AudioGeneratorM4A.h"
 #include "AudioGeneratorFLAC.h"
 #include "AudioGenerator.h"
 #include "AudioGeneratorMIDI.h"
@@ -31,6 +32,7 @@
 #include "AudioGeneratorMP3a.h"
 #include "AudioGeneratorMP3.h"
 #include "AudioGeneratorOpus.h"
+#include "AudioGeneratorOpusPackets.h"
 #include "AudioGeneratorRTTTL.h"
 #include "AudioGeneratorTalkie.h"
 #include "AudioGeneratorWAV.h"
@@ -35,6 +35,7 @@
 
 #include "export.h"
 #include "ordinals.h"
+#include "../../AudioConfig.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -102,8 +103,13 @@ extern "C" {
  *  sample rates up to 48kHz. */
 #define FLAC__SUBSET_MAX_BLOCK_SIZE_48000HZ (4608u)
 
-/** The maximum number of channels permitted by the format. */
+/** The maximum number of channels permitted by the format.
+ *  ESP8266Audio: or the decoder, when built with AUDIO_MONO_ONLY (see AudioConfig.h). */
+#ifdef AUDIO_MONO_ONLY
+#define FLAC__MAX_CHANNELS (1u)
+#else
 #define FLAC__MAX_CHANNELS (8u)
+#endif
 
 /** The minimum sample resolution permitted by the format. */
 #define FLAC__MIN_BITS_PER_SAMPLE (4u)
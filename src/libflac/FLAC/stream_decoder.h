@@ -465,6 +465,23 @@ typedef struct {
 	struct FLAC__StreamDecoderPrivate *private_; /* avoid the C++ keyword 'private' */
 } FLAC__StreamDecoder;
 
+/* ESP8266Audio: upper bounds on everything FLAC__stream_decoder_new() and
+ * _init_stream() allocate, so callers can size a preallocated arena.  The
+ * opaque structure sizes are checked at compile time in stream_decoder.c and
+ * bitreader.c.
+ */
+#define FLAC__STREAM_DECODER_PROTECTED_SIZE_MAX 64
+#define FLAC__STREAM_DECODER_PRIVATE_SIZE_MAX 7168
+#define FLAC__STREAM_DECODER_FILTER_IDS_SIZE 64 /* initial metadata_filter_ids */
+#define FLAC__STREAM_DECODER_SEEKPOINT_SIZE 8 /* per usable SEEKTABLE point */
+#define FLAC__BITREADER_SIZE_MAX 64
+#if defined(ESP8266)
+/* Reduced bitreader buffer, saves some RAM */
+#define FLAC__BITREADER_BUFFER_SIZE 1024
+#else
+#define FLAC__BITREADER_BUFFER_SIZE 8192
+#endif
+
 /** Signature for the read callback.
  *
  *  A function pointer matching this signature must be passed to
@@ -1006,6 +1023,18 @@ FLAC_API uint32_t FLAC__stream_decoder_get_blocksize(const FLAC__StreamDecoder *
  */
 FLAC_API FLAC__bool FLAC__stream_decoder_get_decode_position(const FLAC__StreamDecoder *decoder, FLAC__uint64 *position);
 
+/* ESP8266Audio: the SEEKTABLE is kept in a compact form and not passed to
+ * the metadata callback, this reads it back.
+ *
+ * \param  decoder        A decoder instance to query.
+ * \param  index          Which usable seek point, from 0.
+ * \param  sample_number  Address at which to return its first sample.
+ * \param  stream_offset  Address at which to return its byte offset from the first frame.
+ * \retval FLAC__bool
+ *    \c false once \a index is past the last point, or there's no table.
+ */
+FLAC_API FLAC__bool FLAC__stream_decoder_get_seek_point(const FLAC__StreamDecoder *decoder, uint32_t index, FLAC__uint64 *sample_number, FLAC__uint64 *stream_offset);
+
 /** Initialize the decoder instance to decode native FLAC streams.
  *
  *  This flavor of initialization sets up the decoder to decode from a
@@ -41,6 +41,7 @@
 #include "private/crc.h"
 #include "private/macros.h"
 #include "FLAC/assert.h"
+#include "FLAC/stream_decoder.h"
 #include "share/compat.h"
 #include "share/endswap.h"
 
@@ -99,12 +100,8 @@ typedef FLAC__uint64 brword;
  * also depends on the CPU cache size and other factors; some twiddling
  * may be necessary to squeeze out the best performance.
  */
-#if defined(ESP8266)
-/* Reduced bitreader buffer, saves some RAM */
-static const uint32_t FLAC__BITREADER_DEFAULT_CAPACITY = 8192u / FLAC__BITS_PER_WORD; /* in words */
-#else
-static const uint32_t FLAC__BITREADER_DEFAULT_CAPACITY = 65536u / FLAC__BITS_PER_WORD; /* in words */
-#endif
+/* Size lives in FLAC/stream_decoder.h so preallocated arenas can account for it */
+static const uint32_t FLAC__BITREADER_DEFAULT_CAPACITY = FLAC__BITREADER_BUFFER_SIZE / FLAC__BYTES_PER_WORD; /* in words */
 
 struct FLAC__BitReader {
 	/* any partially-consumed word at the head will stay right-justified as bits are consumed from the left */
@@ -121,6 +118,9 @@ struct FLAC__BitReader {
 	void *client_data;
 };
 
+/* Keep FLAC__BITREADER_SIZE_MAX honest */
+typedef char FLAC__bitreader_size_check[(sizeof(struct FLAC__BitReader) <= FLAC__BITREADER_SIZE_MAX) ? 1 : -1];
+
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wstrict-aliasing"
 static inline void crc16_update_word_(FLAC__BitReader *br, brword word)
@@ -37,7 +37,7 @@
 /* #undef FLAC__CPU_SPARC */
 
 /* define if building for x86_64 */
-#undef FLAC__CPU_X86_64
+/* #undef FLAC__CPU_X86_64 */
 
 /* define if you have docbook-to-man or docbook2man */
 #undef FLAC__HAS_DOCBOOK_TO_MAN
@@ -52,7 +52,7 @@
 #undef FLAC__HAS_X86INTRIN
 
 /* define to disable use of assembly code */
-#define FLAC__NO_ASM 1
+/* ESP8266Audio: set at the end of this file */
 
 /* define if building for Darwin / MacOS X */
 /* #undef FLAC__SYS_DARWIN */
@@ -246,3 +246,30 @@
 
 /* Define to __typeof__ if your compiler spells it that way. */
 /* #undef typeof */
+
+/* ESP8266Audio: host builds get the vectorized LPC restore kernels, picked at run time
+ * from FLAC__cpu_info() on x86 and always on AArch64.  Microcontrollers stay plain C, as
+ * does anything built with -DFLAC__NO_ASM (handy for checking the kernels are bit-exact). */
+#if !defined(FLAC__NO_ASM) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FLAC__HAS_X86INTRIN 1
+#define FLAC__USE_AVX 1
+#define HAVE_CPUID_H 1
+#elif !defined(FLAC__NO_ASM) && defined(__GNUC__) && defined(__aarch64__)
+#define FLAC__HAS_NEONINTRIN 1
+#else
+#undef FLAC__NO_ASM
+#define FLAC__NO_ASM 1
+#endif
+
+/* ESP8266Audio: footprint options, see AudioConfig.h */
+#include "../AudioConfig.h"
+#if defined(AUDIO_DECODE_ONLY)
+#define FLAC__DECODE_ONLY
+#endif
+#if defined(AUDIO_NO_FLAC_MD5)
+#define FLAC__NO_MD5
+#endif
+
+/* ESP8266Audio: charge all heap use to the owning AudioGenerator, see AudioMemory.h */
+#define AUDIOMEMORY_REDIRECT
+#include "../AudioMemory.h"
@@ -0,0 +1,167 @@
+/* libFLAC - Free Lossless Audio Codec library
+ * Copyright (C) 2000-2009  Josh Coalson
+ * Copyright (C) 2011-2016  Xiph.Org Foundation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * - Neither the name of the Xiph.org Foundation nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//#ifdef HAVE_CONFIG_H
+#  include "config.h"
+//#endif
+
+#include "private/cpu.h"
+
+#ifndef FLAC__INTEGER_ONLY_LIBRARY
+#ifndef FLAC__NO_ASM
+#if (defined FLAC__CPU_IA32 || defined FLAC__CPU_X86_64) && FLAC__HAS_X86INTRIN
+#include "private/lpc.h"
+#ifdef FLAC__AVX2_SUPPORTED
+
+#include "FLAC/assert.h"
+#include <immintrin.h> /* AVX2 */
+
+#pragma GCC optimize ("O3")
+
+/*
+ * ESP8266Audio: same layout as the SSE4.1 kernels (scalar lag 1, lags 2..5 in a
+ * shifting register), but lags 6..order are read eight at a time.  That only pays
+ * off for long predictors, shorter ones are handed to the SSE4.1 versions.
+ */
+
+FLAC__SSE_TARGET("avx2")
+void FLAC__lpc_restore_signal_intrin_avx2(const FLAC__int32 residual[], uint32_t data_len, const FLAC__int32 qlp_coeff[], uint32_t order, int lp_quantization, FLAC__int32 data[])
+{
+	__m256i coef[4];
+	__m128i coef0, hist;
+	int offs[4];
+	FLAC__int32 tmp[8], prev;
+	const FLAC__uint32 c0 = (FLAC__uint32)qlp_coeff[0];
+	const FLAC__int32 *base;
+	int i, l, g, groups;
+
+	if(order < 20 || order > 32) {
+		FLAC__lpc_restore_signal_intrin_sse41(residual, data_len, qlp_coeff, order, lp_quantization, data);
+		return;
+	}
+
+	for(l = 0; l < 4; l++)
+		tmp[l] = qlp_coeff[4-l];
+	coef0 = _mm_loadu_si128((const __m128i*)tmp);
+	hist = _mm_loadu_si128((const __m128i*)(data-5));
+
+	/*
+	 * Group g covers lags order-8g down to order-8g-7, except that the newest
+	 * group is pulled back to lags 13..6; reading samples stored only an
+	 * iteration or two ago would stall on store forwarding
+	 */
+	groups = (order - 5 + 7) / 8;
+	for(g = 0; g < groups; g++) {
+		const int top = (int)order - 8*g > 13 ? (int)order - 8*g : 13;
+		for(l = 0; l < 8; l++) {
+			const int lag = top - l;
+			tmp[l] = (lag >= 6 && lag <= (int)order - 8*g) ? qlp_coeff[lag-1] : 0;
+		}
+		coef[g] = _mm256_loadu_si256((const __m256i*)tmp);
+		offs[g] = order - top;
+	}
+
+	base = data - order;
+	prev = data[-1];
+	for(i = 0; i < (int)data_len; i++) {
+		__m256i acc = _mm256_mullo_epi32(_mm256_loadu_si256((const __m256i*)(base+i+offs[0])), coef[0]);
+		__m128i sum;
+		for(g = 1; g < groups; g++)
+			acc = _mm256_add_epi32(acc, _mm256_mullo_epi32(_mm256_loadu_si256((const __m256i*)(base+i+offs[g])), coef[g]));
+		sum = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+		sum = _mm_add_epi32(sum, _mm_mullo_epi32(hist, coef0));
+		sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1,0,3,2)));
+		sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2,3,0,1)));
+		hist = _mm_alignr_epi8(_mm_cvtsi32_si128(prev), hist, 4);
+		prev = residual[i] + ((FLAC__int32)((FLAC__uint32)_mm_cvtsi128_si32(sum) + c0 * (FLAC__uint32)prev) >> lp_quantization);
+		data[i] = prev;
+	}
+}
+
+FLAC__SSE_TARGET("avx2")
+void FLAC__lpc_restore_signal_wide_intrin_avx2(const FLAC__int32 residual[], uint32_t data_len, const FLAC__int32 qlp_coeff[], uint32_t order, int lp_quantization, FLAC__int32 data[])
+{
+	__m256i coef[4];
+	__m128i coef0, hist;
+	int offs[4];
+	FLAC__int32 tmp[8], prev;
+	FLAC__int64 sum;
+	const FLAC__int64 c0 = qlp_coeff[0];
+	const FLAC__int32 *base;
+	int i, l, g, groups;
+
+	if(order < 13 || order > 32) {
+		FLAC__lpc_restore_signal_wide_intrin_sse41(residual, data_len, qlp_coeff, order, lp_quantization, data);
+		return;
+	}
+
+	for(l = 0; l < 4; l++)
+		tmp[l] = qlp_coeff[4-l];
+	coef0 = _mm_loadu_si128((const __m128i*)tmp);
+	hist = _mm_loadu_si128((const __m128i*)(data-5));
+
+	groups = (order - 5 + 7) / 8;
+	for(g = 0; g < groups; g++) {
+		const int top = (int)order - 8*g > 13 ? (int)order - 8*g : 13;
+		for(l = 0; l < 8; l++) {
+			const int lag = top - l;
+			tmp[l] = (lag >= 6 && lag <= (int)order - 8*g) ? qlp_coeff[lag-1] : 0;
+		}
+		coef[g] = _mm256_loadu_si256((const __m256i*)tmp);
+		offs[g] = order - top;
+	}
+
+	base = data - order;
+	prev = data[-1];
+	for(i = 0; i < (int)data_len; i++) {
+		__m256i acc = _mm256_setzero_si256();
+		__m128i acc128;
+		for(g = 0; g < groups; g++) {
+			const __m256i d = _mm256_loadu_si256((const __m256i*)(base+i+offs[g]));
+			acc = _mm256_add_epi64(acc, _mm256_mul_epi32(d, coef[g]));
+			acc = _mm256_add_epi64(acc, _mm256_mul_epi32(_mm256_srli_epi64(d, 32), _mm256_srli_epi64(coef[g], 32)));
+		}
+		acc128 = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+		acc128 = _mm_add_epi64(acc128, _mm_mul_epi32(hist, coef0));
+		acc128 = _mm_add_epi64(acc128, _mm_mul_epi32(_mm_srli_epi64(hist, 32), _mm_srli_epi64(coef0, 32)));
+		acc128 = _mm_add_epi64(acc128, _mm_unpackhi_epi64(acc128, acc128));
+		_mm_storel_epi64((__m128i*)&sum, acc128);
+		hist = _mm_alignr_epi8(_mm_cvtsi32_si128(prev), hist, 4);
+		prev = residual[i] + (FLAC__int32)((sum + c0 * prev) >> lp_quantization);
+		data[i] = prev;
+	}
+}
+
+#endif /* FLAC__AVX2_SUPPORTED */
+#endif /* (FLAC__CPU_IA32 || FLAC__CPU_X86_64) && FLAC__HAS_X86INTRIN */
+#endif /* FLAC__NO_ASM */
+#endif /* FLAC__INTEGER_ONLY_LIBRARY */
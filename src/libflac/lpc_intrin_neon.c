@@ -0,0 +1,146 @@
+/* libFLAC - Free Lossless Audio Codec library
+ * Copyright (C) 2000-2009  Josh Coalson
+ * Copyright (C) 2011-2016  Xiph.Org Foundation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * - Neither the name of the Xiph.org Foundation nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//#ifdef HAVE_CONFIG_H
+#  include "config.h"
+//#endif
+
+#include "private/cpu.h"
+
+#ifndef FLAC__INTEGER_ONLY_LIBRARY
+#ifndef FLAC__NO_ASM
+#if defined FLAC__CPU_ARM64 && FLAC__HAS_NEONINTRIN
+#include "private/lpc.h"
+#include "FLAC/assert.h"
+#include <arm_neon.h>
+
+#pragma GCC optimize ("O3")
+
+/*
+ * ESP8266Audio: same layout as the SSE4.1 kernels (scalar lag 1, lags 2..5 in a
+ * shifting register, lags 6..order read back four at a time, the newest group
+ * pulled back to lags 9..6).  NEON is part of
+ * the AArch64 baseline so these are picked at compile time, and they serve the
+ * 16-bit case as well since vmlaq_s32 is as cheap as the 16-bit forms.
+ */
+
+void FLAC__lpc_restore_signal_intrin_neon(const FLAC__int32 residual[], uint32_t data_len, const FLAC__int32 qlp_coeff[], uint32_t order, int lp_quantization, FLAC__int32 data[])
+{
+	int32x4_t coef[8], hist;
+	int offs[7];
+	FLAC__int32 tmp[4], prev;
+	const FLAC__uint32 c0 = (FLAC__uint32)qlp_coeff[0];
+	const FLAC__int32 *base;
+	int i, l, g, groups;
+
+	if(order < 12 || order > 32) {
+		FLAC__lpc_restore_signal(residual, data_len, qlp_coeff, order, lp_quantization, data);
+		return;
+	}
+
+	for(l = 0; l < 4; l++)
+		tmp[l] = qlp_coeff[4-l];
+	coef[0] = vld1q_s32(tmp);
+	hist = vld1q_s32(data-5);
+
+	groups = (order - 5 + 3) / 4;
+	for(g = 0; g < groups; g++) {
+		const int top = (int)order - 4*g > 9 ? (int)order - 4*g : 9;
+		for(l = 0; l < 4; l++) {
+			const int lag = top - l;
+			tmp[l] = (lag >= 6 && lag <= (int)order - 4*g) ? qlp_coeff[lag-1] : 0;
+		}
+		coef[g+1] = vld1q_s32(tmp);
+		offs[g] = order - top;
+	}
+
+	base = data - order;
+	prev = data[-1];
+	for(i = 0; i < (int)data_len; i++) {
+		int32x4_t sum = vmulq_s32(hist, coef[0]);
+		for(g = 0; g < groups; g++)
+			sum = vmlaq_s32(sum, vld1q_s32(base+i+offs[g]), coef[g+1]);
+		hist = vextq_s32(hist, vdupq_n_s32(prev), 1);
+		prev = residual[i] + ((FLAC__int32)((FLAC__uint32)vaddvq_s32(sum) + c0 * (FLAC__uint32)prev) >> lp_quantization);
+		data[i] = prev;
+	}
+}
+
+void FLAC__lpc_restore_signal_wide_intrin_neon(const FLAC__int32 residual[], uint32_t data_len, const FLAC__int32 qlp_coeff[], uint32_t order, int lp_quantization, FLAC__int32 data[])
+{
+	int32x4_t coef[8], hist;
+	int offs[7];
+	FLAC__int32 tmp[4], prev;
+	const FLAC__int64 c0 = qlp_coeff[0];
+	const FLAC__int32 *base;
+	int i, l, g, groups;
+
+	if(order < 8 || order > 32) {
+		FLAC__lpc_restore_signal_wide(residual, data_len, qlp_coeff, order, lp_quantization, data);
+		return;
+	}
+
+	for(l = 0; l < 4; l++)
+		tmp[l] = qlp_coeff[4-l];
+	coef[0] = vld1q_s32(tmp);
+	hist = vld1q_s32(data-5);
+
+	groups = (order - 5 + 3) / 4;
+	for(g = 0; g < groups; g++) {
+		const int top = (int)order - 4*g > 9 ? (int)order - 4*g : 9;
+		for(l = 0; l < 4; l++) {
+			const int lag = top - l;
+			tmp[l] = (lag >= 6 && lag <= (int)order - 4*g) ? qlp_coeff[lag-1] : 0;
+		}
+		coef[g+1] = vld1q_s32(tmp);
+		offs[g] = order - top;
+	}
+
+	base = data - order;
+	prev = data[-1];
+	for(i = 0; i < (int)data_len; i++) {
+		int64x2_t sum = vmull_s32(vget_low_s32(hist), vget_low_s32(coef[0]));
+		sum = vmlal_high_s32(sum, hist, coef[0]);
+		for(g = 0; g < groups; g++) {
+			const int32x4_t d = vld1q_s32(base+i+offs[g]);
+			sum = vmlal_s32(sum, vget_low_s32(d), vget_low_s32(coef[g+1]));
+			sum = vmlal_high_s32(sum, d, coef[g+1]);
+		}
+		hist = vextq_s32(hist, vdupq_n_s32(prev), 1);
+		prev = residual[i] + (FLAC__int32)((vaddvq_s64(sum) + c0 * prev) >> lp_quantization);
+		data[i] = prev;
+	}
+}
+
+#endif /* FLAC__CPU_ARM64 && FLAC__HAS_NEONINTRIN */
+#endif /* FLAC__NO_ASM */
+#endif /* FLAC__INTEGER_ONLY_LIBRARY */
@@ -0,0 +1,222 @@
+/* libFLAC - Free Lossless Audio Codec library
+ * Copyright (C) 2000-2009  Josh Coalson
+ * Copyright (C) 2011-2016  Xiph.Org Foundation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * - Neither the name of the Xiph.org Foundation nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//#ifdef HAVE_CONFIG_H
+#  include "config.h"
+//#endif
+
+#include "private/cpu.h"
+
+#ifndef FLAC__INTEGER_ONLY_LIBRARY
+#ifndef FLAC__NO_ASM
+#if (defined FLAC__CPU_IA32 || defined FLAC__CPU_X86_64) && FLAC__HAS_X86INTRIN
+#include "private/lpc.h"
+#ifdef FLAC__SSE4_1_SUPPORTED
+
+#include "FLAC/assert.h"
+#include <smmintrin.h> /* SSE4.1 */
+
+#pragma GCC optimize ("O3")
+
+/*
+ * ESP8266Audio: restore kernels for host builds.
+ *
+ * Prediction of data[i] needs data[i-1], which the previous iteration has only
+ * just produced, so that tap is done in a scalar register.  Taps 2..5 are kept
+ * in a vector which has each new sample shifted in, and taps 6..order are read
+ * back from data[] in groups counted from the oldest end.  The newest group is
+ * pulled back so it never loads a sample stored in the last few iterations
+ * (that stalls on store forwarding), which may reach into the zeroed words
+ * allocate_output_() leaves in front of each channel.  Sums wrap exactly like
+ * the C versions do, and for short predictors those are simply faster.
+ */
+
+FLAC__SSE_TARGET("sse4.1")
+void FLAC__lpc_restore_signal_intrin_sse41(const FLAC__int32 residual[], uint32_t data_len, const FLAC__int32 qlp_coeff[], uint32_t order, int lp_quantization, FLAC__int32 data[])
+{
+	__m128i coef[8], hist;
+	int offs[7];
+	FLAC__int32 tmp[4], prev;
+	const FLAC__uint32 c0 = (FLAC__uint32)qlp_coeff[0];
+	const FLAC__int32 *base;
+	int i, l, g, groups;
+
+	if(order < 12 || order > 32) {
+		FLAC__lpc_restore_signal(residual, data_len, qlp_coeff, order, lp_quantization, data);
+		return;
+	}
+
+	/* lane l of the register holds lag 5-l */
+	for(l = 0; l < 4; l++)
+		tmp[l] = qlp_coeff[4-l];
+	coef[0] = _mm_loadu_si128((const __m128i*)tmp);
+	hist = _mm_loadu_si128((const __m128i*)(data-5));
+
+	/* lane l of group g holds lag top-l, those below 6 are the register's */
+	groups = (order - 5 + 3) / 4;
+	for(g = 0; g < groups; g++) {
+		const int top = (int)order - 4*g > 9 ? (int)order - 4*g : 9;
+		for(l = 0; l < 4; l++) {
+			const int lag = top - l;
+			tmp[l] = (lag >= 6 && lag <= (int)order - 4*g) ? qlp_coeff[lag-1] : 0;
+		}
+		coef[g+1] = _mm_loadu_si128((const __m128i*)tmp);
+		offs[g] = order - top;
+	}
+
+	base = data - order;
+	prev = data[-1];
+	for(i = 0; i < (int)data_len; i++) {
+		__m128i sum = _mm_mullo_epi32(hist, coef[0]);
+		for(g = 0; g < groups; g++)
+			sum = _mm_add_epi32(sum, _mm_mullo_epi32(_mm_loadu_si128((const __m128i*)(base+i+offs[g])), coef[g+1]));
+		sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1,0,3,2)));
+		sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2,3,0,1)));
+		hist = _mm_alignr_epi8(_mm_cvtsi32_si128(prev), hist, 4);
+		prev = residual[i] + ((FLAC__int32)((FLAC__uint32)_mm_cvtsi128_si32(sum) + c0 * (FLAC__uint32)prev) >> lp_quantization);
+		data[i] = prev;
+	}
+}
+
+/* Samples and coefficients both fit 16 bits here, so eight taps go through one pmaddwd */
+FLAC__SSE_TARGET("sse4.1")
+void FLAC__lpc_restore_signal_16_intrin_sse41(const FLAC__int32 residual[], uint32_t data_len, const FLAC__int32 qlp_coeff[], uint32_t order, int lp_quantization, FLAC__int32 data[])
+{
+	__m128i coef[4], hist;
+	int offs[3];
+	FLAC__int16 tmp[8];
+	FLAC__int32 prev;
+	const FLAC__uint32 c0 = (FLAC__uint32)qlp_coeff[0];
+	const FLAC__int32 *base;
+	int i, l, g, groups;
+
+	if(order < 9 || order > 32) {
+		FLAC__lpc_restore_signal(residual, data_len, qlp_coeff, order, lp_quantization, data);
+		return;
+	}
+
+	/* lane l of the register holds lag 9-l */
+	for(l = 0; l < 8; l++) {
+		const int lag = 9 - l;
+		tmp[l] = lag <= (int)order ? (FLAC__int16)qlp_coeff[lag-1] : 0;
+	}
+	coef[0] = _mm_loadu_si128((const __m128i*)tmp);
+	for(l = 0; l < 8; l++) {
+		const int lag = 9 - l;
+		tmp[l] = lag <= (int)order ? (FLAC__int16)data[-lag] : 0;
+	}
+	hist = _mm_loadu_si128((const __m128i*)tmp);
+
+	/* lane l of group g holds lag top-l, those below 10 are the register's */
+	groups = order > 9 ? (order - 9 + 7) / 8 : 0;
+	for(g = 0; g < groups; g++) {
+		const int low = order + 4 < 17 ? order + 4 : 17;
+		const int top = (int)order - 8*g > low ? (int)order - 8*g : low;
+		for(l = 0; l < 8; l++) {
+			const int lag = top - l;
+			tmp[l] = (lag >= 10 && lag <= (int)order - 8*g) ? (FLAC__int16)qlp_coeff[lag-1] : 0;
+		}
+		coef[g+1] = _mm_loadu_si128((const __m128i*)tmp);
+		offs[g] = order - top;
+	}
+
+	base = data - order;
+	prev = data[-1];
+	for(i = 0; i < (int)data_len; i++) {
+		__m128i sum = _mm_madd_epi16(hist, coef[0]);
+		for(g = 0; g < groups; g++) {
+			const __m128i lo = _mm_loadu_si128((const __m128i*)(base+i+offs[g]));
+			const __m128i hi = _mm_loadu_si128((const __m128i*)(base+i+offs[g]+4));
+			sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_packs_epi32(lo, hi), coef[g+1]));
+		}
+		sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1,0,3,2)));
+		sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2,3,0,1)));
+		hist = _mm_alignr_epi8(_mm_cvtsi32_si128(prev), hist, 2);
+		prev = residual[i] + ((FLAC__int32)((FLAC__uint32)_mm_cvtsi128_si32(sum) + c0 * (FLAC__uint32)prev) >> lp_quantization);
+		data[i] = prev;
+	}
+}
+
+/* pmuldq only multiplies the even lanes, so the odd ones are shifted down for a second pass */
+FLAC__SSE_TARGET("sse4.1")
+void FLAC__lpc_restore_signal_wide_intrin_sse41(const FLAC__int32 residual[], uint32_t data_len, const FLAC__int32 qlp_coeff[], uint32_t order, int lp_quantization, FLAC__int32 data[])
+{
+	__m128i coef[8], hist;
+	int offs[7];
+	FLAC__int32 tmp[4], prev;
+	FLAC__int64 sum;
+	const FLAC__int64 c0 = qlp_coeff[0];
+	const FLAC__int32 *base;
+	int i, l, g, groups;
+
+	if(order < 8 || order > 32) {
+		FLAC__lpc_restore_signal_wide(residual, data_len, qlp_coeff, order, lp_quantization, data);
+		return;
+	}
+
+	for(l = 0; l < 4; l++)
+		tmp[l] = qlp_coeff[4-l];
+	coef[0] = _mm_loadu_si128((const __m128i*)tmp);
+	hist = _mm_loadu_si128((const __m128i*)(data-5));
+
+	groups = (order - 5 + 3) / 4;
+	for(g = 0; g < groups; g++) {
+		const int top = (int)order - 4*g > 9 ? (int)order - 4*g : 9;
+		for(l = 0; l < 4; l++) {
+			const int lag = top - l;
+			tmp[l] = (lag >= 6 && lag <= (int)order - 4*g) ? qlp_coeff[lag-1] : 0;
+		}
+		coef[g+1] = _mm_loadu_si128((const __m128i*)tmp);
+		offs[g] = order - top;
+	}
+
+	base = data - order;
+	prev = data[-1];
+	for(i = 0; i < (int)data_len; i++) {
+		__m128i acc = _mm_add_epi64(_mm_mul_epi32(hist, coef[0]), _mm_mul_epi32(_mm_srli_epi64(hist, 32), _mm_srli_epi64(coef[0], 32)));
+		for(g = 0; g < groups; g++) {
+			const __m128i d = _mm_loadu_si128((const __m128i*)(base+i+offs[g]));
+			acc = _mm_add_epi64(acc, _mm_mul_epi32(d, coef[g+1]));
+			acc = _mm_add_epi64(acc, _mm_mul_epi32(_mm_srli_epi64(d, 32), _mm_srli_epi64(coef[g+1], 32)));
+		}
+		acc = _mm_add_epi64(acc, _mm_unpackhi_epi64(acc, acc));
+		_mm_storel_epi64((__m128i*)&sum, acc);
+		hist = _mm_alignr_epi8(_mm_cvtsi32_si128(prev), hist, 4);
+		prev = residual[i] + (FLAC__int32)((sum + c0 * prev) >> lp_quantization);
+		data[i] = prev;
+	}
+}
+
+#endif /* FLAC__SSE4_1_SUPPORTED */
+#endif /* (FLAC__CPU_IA32 || FLAC__CPU_X86_64) && FLAC__HAS_X86INTRIN */
+#endif /* FLAC__NO_ASM */
+#endif /* FLAC__INTEGER_ONLY_LIBRARY */
@@ -2,6 +2,8 @@
 #  include "config.h"
 //#endif
 
+#ifndef FLAC__NO_MD5 /* ESP8266Audio: see AudioConfig.h */
+
 #include <stdlib.h>		/* for malloc() */
 #include <string.h>		/* for memcpy() */
 
@@ -516,3 +518,5 @@ FLAC__bool FLAC__MD5Accumulate(FLAC__MD5Context *ctx, const FLAC__int32 * const
 
 	return true;
 }
+
+#endif /* FLAC__NO_MD5 */
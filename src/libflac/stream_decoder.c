@@ -52,7 +52,9 @@
 #include "private/fixed.h"
 #include "private/format.h"
 #include "private/lpc.h"
+#ifndef FLAC__NO_MD5
 #include "private/md5.h"
+#endif
 #include "private/memory.h"
 #include "private/macros.h"
 
@@ -148,7 +150,10 @@ typedef struct FLAC__StreamDecoderPrivate {
 	FLAC__uint64 samples_decoded;
 	FLAC__bool has_stream_info, has_seek_table;
 	FLAC__StreamMetadata stream_info;
-	FLAC__StreamMetadata seek_table;
+	/* ESP8266Audio: the seek table is kept as 32-bit {sample, offset} pairs, 8 bytes a point instead of 24,
+	 * with placeholders and points out of 32-bit reach dropped as it's read */
+	FLAC__uint32 *seek_points;
+	uint32_t seek_points_count;
 	FLAC__bool metadata_filter[128]; /* MAGIC number 128 == total number of metadata block types == 1 << 7 */
 	FLAC__byte *metadata_filter_ids;
 	size_t metadata_filter_ids_count, metadata_filter_ids_capacity; /* units for both are IDs, not bytes */
@@ -162,7 +167,9 @@ typedef struct FLAC__StreamDecoderPrivate {
 	FLAC__bool do_md5_checking; /* initially gets protected_->md5_checking but is turned off after a seek or if the metadata has a zero MD5 */
 	FLAC__bool internal_reset_hack; /* used only during init() so we can call reset to set up the decoder without rewinding the input */
 	FLAC__bool is_seeking;
+#ifndef FLAC__NO_MD5
 	FLAC__MD5Context md5context;
+#endif
 	FLAC__byte computed_md5sum[16]; /* this is the sum we computed from the decoded data */
 	/* (the rest of these are only used for seeking) */
 	FLAC__Frame last_frame; /* holds the info of the last frame we seeked to */
@@ -172,6 +179,10 @@ typedef struct FLAC__StreamDecoderPrivate {
 	FLAC__bool got_a_frame; /* hack needed in Ogg FLAC seek routine to check when process_single() actually writes a frame */
 } FLAC__StreamDecoderPrivate;
 
+/* Keep the arena size hints in FLAC/stream_decoder.h honest */
+typedef char FLAC__stream_decoder_private_size_check[(sizeof(FLAC__StreamDecoderPrivate) <= FLAC__STREAM_DECODER_PRIVATE_SIZE_MAX) ? 1 : -1];
+typedef char FLAC__stream_decoder_protected_size_check[(sizeof(FLAC__StreamDecoderProtected) <= FLAC__STREAM_DECODER_PROTECTED_SIZE_MAX) ? 1 : -1];
+
 /***********************************************************************
  *
  * Public static class data
@@ -410,9 +421,30 @@ static FLAC__StreamDecoderInitStatus init_stream_internal_(
 #endif
 #elif defined FLAC__CPU_X86_64
 		FLAC__ASSERT(decoder->private_->cpuinfo.type == FLAC__CPUINFO_TYPE_X86_64);
-		/* No useful SSE optimizations yet */
+#if FLAC__HAS_X86INTRIN && ! defined FLAC__INTEGER_ONLY_LIBRARY
+		/* ESP8266Audio: the 16-bit case stays on SSE4.1 even with AVX2, pmaddwd beats 8-wide pmulld there */
+# if defined FLAC__SSE4_1_SUPPORTED
+		if (decoder->private_->cpuinfo.x86.sse41) {
+			decoder->private_->local_lpc_restore_signal = FLAC__lpc_restore_signal_intrin_sse41;
+			decoder->private_->local_lpc_restore_signal_16bit = FLAC__lpc_restore_signal_16_intrin_sse41;
+			decoder->private_->local_lpc_restore_signal_64bit = FLAC__lpc_restore_signal_wide_intrin_sse41;
+		}
+# endif
+# if defined FLAC__AVX2_SUPPORTED
+		if (decoder->private_->cpuinfo.x86.avx2) {
+			decoder->private_->local_lpc_restore_signal = FLAC__lpc_restore_signal_intrin_avx2;
+			decoder->private_->local_lpc_restore_signal_64bit = FLAC__lpc_restore_signal_wide_intrin_avx2;
+		}
+# endif
+#endif
 #endif
 	}
+#if defined FLAC__CPU_ARM64 && FLAC__HAS_NEONINTRIN && ! defined FLAC__INTEGER_ONLY_LIBRARY
+	/* ESP8266Audio: NEON is always there on AArch64 */
+	decoder->private_->local_lpc_restore_signal = FLAC__lpc_restore_signal_intrin_neon;
+	decoder->private_->local_lpc_restore_signal_16bit = FLAC__lpc_restore_signal_intrin_neon;
+	decoder->private_->local_lpc_restore_signal_64bit = FLAC__lpc_restore_signal_wide_intrin_neon;
+#endif
 #endif
 
 	/* from here on, errors are fatal */
@@ -644,10 +676,13 @@ FLAC_API FLAC__bool FLAC__stream_decoder_finish(FLAC__StreamDecoder *decoder)
 	/* see the comment in FLAC__stream_decoder_reset() as to why we
 	 * always call FLAC__MD5Final()
 	 */
+#ifndef FLAC__NO_MD5
 	FLAC__MD5Final(decoder->private_->computed_md5sum, &decoder->private_->md5context);
+#endif
 
-	free(decoder->private_->seek_table.data.seek_table.points);
-	decoder->private_->seek_table.data.seek_table.points = 0;
+	free(decoder->private_->seek_points);
+	decoder->private_->seek_points = 0;
+	decoder->private_->seek_points_count = 0;
 	decoder->private_->has_seek_table = false;
 
 	FLAC__bitreader_free(decoder->private_->input);
@@ -717,6 +752,11 @@ FLAC_API FLAC__bool FLAC__stream_decoder_set_md5_checking(FLAC__StreamDecoder *d
 	FLAC__ASSERT(0 != decoder->protected_);
 	if(decoder->protected_->state != FLAC__STREAM_DECODER_UNINITIALIZED)
 		return false;
+#ifdef FLAC__NO_MD5
+	/* ESP8266Audio: MD5 support compiled out, see AudioConfig.h */
+	if(value)
+		return false;
+#endif
 	decoder->protected_->md5_checking = value;
 	return true;
 }
@@ -919,6 +959,18 @@ FLAC_API FLAC__bool FLAC__stream_decoder_get_decode_position(const FLAC__StreamD
 	return true;
 }
 
+FLAC_API FLAC__bool FLAC__stream_decoder_get_seek_point(const FLAC__StreamDecoder *decoder, uint32_t index, FLAC__uint64 *sample_number, FLAC__uint64 *stream_offset)
+{
+	FLAC__ASSERT(0 != decoder);
+	FLAC__ASSERT(0 != decoder->private_);
+
+	if(!decoder->private_->has_seek_table || index >= decoder->private_->seek_points_count)
+		return false;
+	*sample_number = decoder->private_->seek_points[index * 2];
+	*stream_offset = decoder->private_->seek_points[index * 2 + 1];
+	return true;
+}
+
 FLAC_API FLAC__bool FLAC__stream_decoder_flush(FLAC__StreamDecoder *decoder)
 {
 	FLAC__ASSERT(0 != decoder);
@@ -982,8 +1034,9 @@ FLAC_API FLAC__bool FLAC__stream_decoder_reset(FLAC__StreamDecoder *decoder)
 
 	decoder->private_->has_stream_info = false;
 
-	free(decoder->private_->seek_table.data.seek_table.points);
-	decoder->private_->seek_table.data.seek_table.points = 0;
+	free(decoder->private_->seek_points);
+	decoder->private_->seek_points = 0;
+	decoder->private_->seek_points_count = 0;
 	decoder->private_->has_seek_table = false;
 
 	decoder->private_->do_md5_checking = decoder->protected_->md5_checking;
@@ -999,7 +1052,9 @@ FLAC_API FLAC__bool FLAC__stream_decoder_reset(FLAC__StreamDecoder *decoder)
 	 * FLAC__stream_decoder_finish() to make sure things are always cleaned up
 	 * properly.
 	 */
+#ifndef FLAC__NO_MD5
 	FLAC__MD5Init(&decoder->private_->md5context);
+#endif
 
 	decoder->private_->first_frame_offset = 0;
 	decoder->private_->unparseable_frame_count = 0;
@@ -1428,9 +1483,9 @@ FLAC__bool read_metadata_(FLAC__StreamDecoder *decoder)
 		if(!read_metadata_seektable_(decoder, is_last, length))
 			return false;
 
-		decoder->private_->has_seek_table = true;
-		if(!decoder->private_->is_seeking && decoder->private_->metadata_filter[FLAC__METADATA_TYPE_SEEKTABLE] && decoder->private_->metadata_callback)
-			decoder->private_->metadata_callback(decoder, &decoder->private_->seek_table, decoder->private_->client_data);
+		decoder->private_->has_seek_table = decoder->private_->seek_points_count > 0;
+		/* ESP8266Audio: the compact table can't be handed out as a FLAC__StreamMetadata, so SEEKTABLE never
+		 * reaches the metadata callback.  See FLAC__stream_decoder_get_seek_point() instead. */
 	}
 	else {
 		FLAC__bool skip_it = !decoder->private_->metadata_filter[type];
@@ -1647,36 +1702,35 @@ FLAC__bool read_metadata_streaminfo_(FLAC__StreamDecoder *decoder, FLAC__bool is
 
 FLAC__bool read_metadata_seektable_(FLAC__StreamDecoder *decoder, FLAC__bool is_last, uint32_t length)
 {
-	FLAC__uint32 i, x;
-	FLAC__uint64 xx;
+	FLAC__uint32 i, n, x;
+	FLAC__uint64 sample, offset;
 
+	(void)is_last;
 	FLAC__ASSERT(FLAC__bitreader_is_consumed_byte_aligned(decoder->private_->input));
 
-	decoder->private_->seek_table.type = FLAC__METADATA_TYPE_SEEKTABLE;
-	decoder->private_->seek_table.is_last = is_last;
-	decoder->private_->seek_table.length = length;
-
-	decoder->private_->seek_table.data.seek_table.num_points = length / FLAC__STREAM_METADATA_SEEKPOINT_LENGTH;
+	n = length / FLAC__STREAM_METADATA_SEEKPOINT_LENGTH;
+	decoder->private_->seek_points_count = 0;
 
 	/* use realloc since we may pass through here several times (e.g. after seeking) */
-	if(0 == (decoder->private_->seek_table.data.seek_table.points = safe_realloc_mul_2op_(decoder->private_->seek_table.data.seek_table.points, decoder->private_->seek_table.data.seek_table.num_points, /*times*/sizeof(FLAC__StreamMetadata_SeekPoint)))) {
+	if(n > 0 && 0 == (decoder->private_->seek_points = safe_realloc_mul_2op_(decoder->private_->seek_points, n, /*times*/2 * sizeof(FLAC__uint32)))) {
 		decoder->protected_->state = FLAC__STREAM_DECODER_MEMORY_ALLOCATION_ERROR;
 		return false;
 	}
-	for(i = 0; i < decoder->private_->seek_table.data.seek_table.num_points; i++) {
-		if(!FLAC__bitreader_read_raw_uint64(decoder->private_->input, &xx, FLAC__STREAM_METADATA_SEEKPOINT_SAMPLE_NUMBER_LEN))
+	for(i = 0; i < n; i++) {
+		if(!FLAC__bitreader_read_raw_uint64(decoder->private_->input, &sample, FLAC__STREAM_METADATA_SEEKPOINT_SAMPLE_NUMBER_LEN))
 			return false; /* read_callback_ sets the state for us */
-		decoder->private_->seek_table.data.seek_table.points[i].sample_number = xx;
-
-		if(!FLAC__bitreader_read_raw_uint64(decoder->private_->input, &xx, FLAC__STREAM_METADATA_SEEKPOINT_STREAM_OFFSET_LEN))
+		if(!FLAC__bitreader_read_raw_uint64(decoder->private_->input, &offset, FLAC__STREAM_METADATA_SEEKPOINT_STREAM_OFFSET_LEN))
 			return false; /* read_callback_ sets the state for us */
-		decoder->private_->seek_table.data.seek_table.points[i].stream_offset = xx;
-
 		if(!FLAC__bitreader_read_raw_uint32(decoder->private_->input, &x, FLAC__STREAM_METADATA_SEEKPOINT_FRAME_SAMPLES_LEN))
 			return false; /* read_callback_ sets the state for us */
-		decoder->private_->seek_table.data.seek_table.points[i].frame_samples = x;
+		/* placeholders and points with frame_samples==0 are no use for seeking, nor are points past 4G */
+		if(sample == FLAC__STREAM_METADATA_SEEKPOINT_PLACEHOLDER || x == 0 || sample > 0xffffffff || offset > 0xffffffff)
+			continue;
+		decoder->private_->seek_points[decoder->private_->seek_points_count * 2] = (FLAC__uint32)sample;
+		decoder->private_->seek_points[decoder->private_->seek_points_count * 2 + 1] = (FLAC__uint32)offset;
+		decoder->private_->seek_points_count++;
 	}
-	length -= (decoder->private_->seek_table.data.seek_table.num_points * FLAC__STREAM_METADATA_SEEKPOINT_LENGTH);
+	length -= (n * FLAC__STREAM_METADATA_SEEKPOINT_LENGTH);
 	/* if there is a partial point left, skip over it */
 	if(length > 0) {
 		/*@@@ do a send_error_to_client_() here?  there's an argument for either way */
@@ -2026,8 +2080,10 @@ FLAC__bool frame_sync_(FLAC__StreamDecoder *decoder)
 FLAC__bool read_frame_(FLAC__StreamDecoder *decoder, FLAC__bool *got_a_frame, FLAC__bool do_full_decode)
 {
 	uint32_t channel;
+#if FLAC__MAX_CHANNELS > 1
 	uint32_t i;
 	FLAC__int32 mid, side;
+#endif
 	uint32_t frame_crc; /* the one we calculate from the input stream */
 	FLAC__uint32 x;
 
@@ -2098,6 +2154,8 @@ FLAC__bool read_frame_(FLAC__StreamDecoder *decoder, FLAC__bool *got_a_frame, FL
 				case FLAC__CHANNEL_ASSIGNMENT_INDEPENDENT:
 					/* do nothing */
 					break;
+#if FLAC__MAX_CHANNELS > 1
+				/* ESP8266Audio: AUDIO_MONO_ONLY has already rejected stereo frames, and these would overrun output[] */
 				case FLAC__CHANNEL_ASSIGNMENT_LEFT_SIDE:
 					FLAC__ASSERT(decoder->private_->frame.header.channels == 2);
 					for(i = 0; i < decoder->private_->frame.header.blocksize; i++)
@@ -2126,6 +2184,7 @@ FLAC__bool read_frame_(FLAC__StreamDecoder *decoder, FLAC__bool *got_a_frame, FL
 #endif
 					}
 					break;
+#endif
 				default:
 					FLAC__ASSERT(0);
 					break;
@@ -2335,6 +2394,10 @@ FLAC__bool read_frame_header_(FLAC__StreamDecoder *decoder)
 		decoder->private_->frame.header.channel_assignment = FLAC__CHANNEL_ASSIGNMENT_INDEPENDENT;
 	}
 
+	/* ESP8266Audio: FLAC__MAX_CHANNELS may be cut down by AUDIO_MONO_ONLY, don't overrun the per-channel arrays */
+	if(decoder->private_->frame.header.channels > FLAC__MAX_CHANNELS)
+		is_unparseable = true;
+
 	switch(x = (uint32_t)(raw_header[3] & 0x0e) >> 1) {
 		case 0:
 			if(decoder->private_->has_stream_info)
@@ -2986,10 +3049,12 @@ FLAC__StreamDecoderWriteStatus write_audio_frame_to_client_(FLAC__StreamDecoder
 		 */
 		if(!decoder->private_->has_stream_info)
 			decoder->private_->do_md5_checking = false;
+#ifndef FLAC__NO_MD5
 		if(decoder->private_->do_md5_checking) {
 			if(!FLAC__MD5Accumulate(&decoder->private_->md5context, buffer, frame->header.channels, frame->header.blocksize, (frame->header.bits_per_sample+7) / 8))
 				return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
 		}
+#endif
 		return decoder->private_->write_callback(decoder, frame, buffer, decoder->private_->client_data);
 	}
 }
@@ -3017,7 +3082,8 @@ FLAC__bool seek_to_absolute_sample_(FLAC__StreamDecoder *decoder, FLAC__uint64 s
 	/* take these from the current frame in case they've changed mid-stream */
 	uint32_t channels = FLAC__stream_decoder_get_channels(decoder);
 	uint32_t bps = FLAC__stream_decoder_get_bits_per_sample(decoder);
-	const FLAC__StreamMetadata_SeekTable *seek_table = decoder->private_->has_seek_table? &decoder->private_->seek_table.data.seek_table : 0;
+	const FLAC__uint32 *seek_points = decoder->private_->has_seek_table? decoder->private_->seek_points : 0;
+	const int num_points = seek_points? (int)decoder->private_->seek_points_count : 0;
 
 	/* use values from stream info if we didn't decode a frame */
 	if(channels == 0)
@@ -3059,41 +3125,38 @@ FLAC__bool seek_to_absolute_sample_(FLAC__StreamDecoder *decoder, FLAC__uint64 s
 	 *
 	 * Note: to protect against invalid seek tables we will ignore points
 	 * that have frame_samples==0 or sample_number>=total_samples
+	 * (ESP8266Audio: the former, and placeholders, never make it into seek_points[])
 	 */
-	if(seek_table) {
+	if(seek_points) {
 		FLAC__uint64 new_lower_bound = lower_bound;
 		FLAC__uint64 new_upper_bound = upper_bound;
 		FLAC__uint64 new_lower_bound_sample = lower_bound_sample;
 		FLAC__uint64 new_upper_bound_sample = upper_bound_sample;
 
 		/* find the closest seek point <= target_sample, if it exists */
-		for(i = (int)seek_table->num_points - 1; i >= 0; i--) {
+		for(i = num_points - 1; i >= 0; i--) {
 			if(
-				seek_table->points[i].sample_number != FLAC__STREAM_METADATA_SEEKPOINT_PLACEHOLDER &&
-				seek_table->points[i].frame_samples > 0 && /* defense against bad seekpoints */
-				(total_samples <= 0 || seek_table->points[i].sample_number < total_samples) && /* defense against bad seekpoints */
-				seek_table->points[i].sample_number <= target_sample
+				(total_samples <= 0 || seek_points[i * 2] < total_samples) && /* defense against bad seekpoints */
+				seek_points[i * 2] <= target_sample
 			)
 				break;
 		}
 		if(i >= 0) { /* i.e. we found a suitable seek point... */
-			new_lower_bound = first_frame_offset + seek_table->points[i].stream_offset;
-			new_lower_bound_sample = seek_table->points[i].sample_number;
+			new_lower_bound = first_frame_offset + seek_points[i * 2 + 1];
+			new_lower_bound_sample = seek_points[i * 2];
 		}
 
 		/* find the closest seek point > target_sample, if it exists */
-		for(i = 0; i < (int)seek_table->num_points; i++) {
+		for(i = 0; i < num_points; i++) {
 			if(
-				seek_table->points[i].sample_number != FLAC__STREAM_METADATA_SEEKPOINT_PLACEHOLDER &&
-				seek_table->points[i].frame_samples > 0 && /* defense against bad seekpoints */
-				(total_samples <= 0 || seek_table->points[i].sample_number < total_samples) && /* defense against bad seekpoints */
-				seek_table->points[i].sample_number > target_sample
+				(total_samples <= 0 || seek_points[i * 2] < total_samples) && /* defense against bad seekpoints */
+				seek_points[i * 2] > target_sample
 			)
 				break;
 		}
-		if(i < (int)seek_table->num_points) { /* i.e. we found a suitable seek point... */
-			new_upper_bound = first_frame_offset + seek_table->points[i].stream_offset;
-			new_upper_bound_sample = seek_table->points[i].sample_number;
+		if(i < num_points) { /* i.e. we found a suitable seek point... */
+			new_upper_bound = first_frame_offset + seek_points[i * 2 + 1];
+			new_upper_bound_sample = seek_points[i * 2];
 		}
 		/* final protection against unsorted seek tables; keep original values if bogus */
 		if(new_upper_bound >= new_lower_bound) {
@@ -34,6 +34,8 @@
 #  include "config.h"
 //#endif
 
+#ifndef FLAC__DECODE_ONLY /* ESP8266Audio: apodization windows are only used when encoding, see AudioConfig.h */
+
 #include <math.h>
 #include "share/compat.h"
 #include "FLAC/assert.h"
@@ -282,3 +284,5 @@ void FLAC__window_welch(FLAC__real *window, const FLAC__int32 L)
 }
 
 #endif /* !defined FLAC__INTEGER_ONLY_LIBRARY */
+
+#endif /* FLAC__DECODE_ONLY */
@@ -49,11 +49,6 @@
 #include <Arduino.h>
 #include <pgmspace.h>
 
-// Can't fit in ESP8266 RAM
-#ifndef ESP8266
-  #define AAC_ENABLE_SBR 1 
-#endif
-
 #pragma GCC optimize ("O3")
 
 #include "aacdec.h"
@@ -149,6 +144,7 @@ typedef struct _AACDecInfo {
 	int profile;
 	int format;
 	int sbrEnabled;
+	int sbrBypass;		/* ESP8266Audio: ignore SBR data, output only the AAC-LC core */
 	int tnsUsed;
 	int pnsUsed;
 	int frameCount;
@@ -266,6 +266,39 @@ int AACFlushCodec(HAACDecoder hAACDecoder)
 	return ERR_AAC_NONE;
 }
 
+/**************************************************************************************
+ * Function:    AACSetSBRBypass
+ *
+ * Description: ESP8266Audio: choose whether HE-AAC streams run the SBR tool
+ *
+ * Inputs:      valid AAC decoder instance pointer (HAACDecoder)
+ *              nonzero to skip SBR and output the AAC-LC core at half the sample rate
+ *
+ * Outputs:     updated codec state
+ *
+ * Return:      0 if successful, error code (< 0) if error
+ *
+ * Notes:       takes effect on the next frame, and the output rate and number of
+ *                samples per frame change with it (see AACGetLastFrameInfo)
+ *              SBR state is flushed when re-enabling, so stale QMF history from
+ *                before the bypass never reaches the output
+ **************************************************************************************/
+int AACSetSBRBypass(HAACDecoder hAACDecoder, int bypass)
+{
+	AACDecInfo *aacDecInfo = (AACDecInfo *)hAACDecoder;
+
+	if (!aacDecInfo)
+		return ERR_AAC_NULL_POINTER;
+
+#ifdef AAC_ENABLE_SBR
+	if (aacDecInfo->sbrBypass && !bypass)
+		FlushCodecSBR(aacDecInfo);
+#endif
+	aacDecInfo->sbrBypass = bypass ? 1 : 0;
+
+	return ERR_AAC_NONE;
+}
+
 /**************************************************************************************
  * Function:    AACDecode
  *
@@ -78,6 +78,8 @@
 #define USE_DEFAULT_STDLIB
 #endif
 
+#include "../AudioConfig.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -89,8 +91,12 @@ extern "C" {
  *       0 bits =    0 bytes per CCE-D (uses bits from the SCE/CPE/CCE-I it is coupled to)
  */
 #ifndef AAC_MAX_NCHANS				/* if max channels isn't set in makefile, */
+#ifdef AUDIO_MONO_ONLY
+#define AAC_MAX_NCHANS		1		/* ESP8266Audio: see AudioConfig.h */
+#else
 #define AAC_MAX_NCHANS		2		/* set to default max number of channels  */
 #endif
+#endif
 #define AAC_MAX_NSAMPS		1024
 #define AAC_MAINBUF_SIZE	(768 * AAC_MAX_NCHANS)
 
@@ -100,7 +106,8 @@ extern "C" {
 #define AAC_PROFILE_SSR		2
 
 /* define these to enable decoder features */
-#if defined(HELIX_FEATURE_AUDIO_CODEC_AAC_SBR)
+/* ESP8266Audio: SBR can't fit in ESP8266 RAM, and may be compiled out elsewhere (see AudioConfig.h) */
+#if (defined(HELIX_FEATURE_AUDIO_CODEC_AAC_SBR) || !defined(ESP8266)) && !defined(AUDIO_NO_AAC_SBR)
 #define AAC_ENABLE_SBR
 #endif //  HELIX_FEATURE_AUDIO_CODEC_AAC_SBR.
 #define AAC_ENABLE_MPEG4
@@ -160,6 +167,7 @@ int AACFindSyncWord(unsigned char *buf, int nBytes);
 void AACGetLastFrameInfo(HAACDecoder hAACDecoder, AACFrameInfo *aacFrameInfo);
 int AACSetRawBlockParams(HAACDecoder hAACDecoder, int copyLast, AACFrameInfo *aacFrameInfo);
 int AACFlushCodec(HAACDecoder hAACDecoder);
+int AACSetSBRBypass(HAACDecoder hAACDecoder, int bypass);	/* ESP8266Audio */
 
 #ifdef HELIX_CONFIG_AAC_GENERATE_TRIGTABS_FLOAT
 int AACInitTrigtabsFloat(void);
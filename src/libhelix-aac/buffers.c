@@ -51,6 +51,10 @@
 
 #include "coder.h"
 
+/* ESP8266Audio: charge all heap use to the owning AudioGenerator, see AudioMemory.h */
+#define AUDIOMEMORY_REDIRECT
+#include "../AudioMemory.h"
+
 /**************************************************************************************
  * Function:    ClearBuffer
  *
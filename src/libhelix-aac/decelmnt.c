@@ -330,7 +330,8 @@ static int DecodeFillElement(AACDecInfo *aacDecInfo, BitStreamInfo *bsi)
 	 */
 	if (psi->fillCount > 0) {
 		aacDecInfo->fillExtType = (int)((psi->fillBuf[0] >> 4) & 0x0f);
-		if (aacDecInfo->fillExtType == EXT_SBR_DATA || aacDecInfo->fillExtType == EXT_SBR_DATA_CRC)
+		/* ESP8266Audio: when bypassed, SBR fill elements are skipped like any other fill data */
+		if ((aacDecInfo->fillExtType == EXT_SBR_DATA || aacDecInfo->fillExtType == EXT_SBR_DATA_CRC) && !aacDecInfo->sbrBypass)
 			aacDecInfo->sbrEnabled = 1;
 	}
 #endif
@@ -52,6 +52,12 @@
 
 #include "sbr.h"
 
+/* ESP8266Audio: charge all heap use to the owning AudioGenerator, see AudioMemory.h */
+#define AUDIOMEMORY_REDIRECT
+#include "../AudioMemory.h"
+
+#ifdef AAC_ENABLE_SBR /* ESP8266Audio: whole file compiled out otherwise, see AudioConfig.h */
+
 /**************************************************************************************
  * Function:    InitSBRState
  *
@@ -429,3 +435,5 @@ int FlushCodecSBR(AACDecInfo *aacDecInfo)
 
 	return 0;
 }
+
+#endif /* AAC_ENABLE_SBR */
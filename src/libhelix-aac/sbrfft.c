@@ -46,6 +46,8 @@
 #include "sbr.h"
 #include "assembly.h"
 
+#ifdef AAC_ENABLE_SBR /* ESP8266Audio: whole file compiled out otherwise, see AudioConfig.h */
+
 #define SQRT1_2	0x5a82799a
 
 /* swap RE{p0} with RE{p1} and IM{P0} with IM{P1} */
@@ -366,3 +368,5 @@ void FFT32C(int *x)
 	R8FirstPass32(x);	/* gain 1 int bit,  lose 2 GB (making assumptions about input) */
 	R4Core32(x);		/* gain 2 int bits, lose 0 GB (making assumptions about input) */
 }
+
+#endif /* AAC_ENABLE_SBR */
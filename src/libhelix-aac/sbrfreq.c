@@ -46,6 +46,8 @@
 #include "sbr.h"
 #include "assembly.h"
 
+#ifdef AAC_ENABLE_SBR /* ESP8266Audio: whole file compiled out otherwise, see AudioConfig.h */
+
 /**************************************************************************************
  * Function:    BubbleSort
  *
@@ -639,3 +641,5 @@ int CalcFreqTables(SBRHeader *sbrHdr, SBRFreq *sbrFreq, int sampRateIdx)
 
 	return 0;
 }
+
+#endif /* AAC_ENABLE_SBR */
@@ -46,6 +46,8 @@
 #include "sbr.h"
 #include "assembly.h"
 
+#ifdef AAC_ENABLE_SBR /* ESP8266Audio: whole file compiled out otherwise, see AudioConfig.h */
+
 /* invBandTab[i] = 1.0 / (i + 1), Q31 */
 static const int invBandTab[64] PROGMEM = {
 	0x7fffffff, 0x40000000, 0x2aaaaaab, 0x20000000, 0x1999999a, 0x15555555, 0x12492492, 0x10000000, 
@@ -851,3 +853,5 @@ void AdjustHighFreq(PSInfoSBR *psi, SBRHeader *sbrHdr, SBRGrid *sbrGrid, SBRFreq
 	else
 		sbrChan->laPrev = -1;
 }
+
+#endif /* AAC_ENABLE_SBR */
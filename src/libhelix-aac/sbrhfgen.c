@@ -46,6 +46,8 @@
 #include "sbr.h"
 #include "assembly.h"
 
+#ifdef AAC_ENABLE_SBR /* ESP8266Audio: whole file compiled out otherwise, see AudioConfig.h */
+
 #define FBITS_LPCOEFS	29	/* Q29 for range of (-4, 4) */
 #define MAG_16			(16 * (1 << (32 - (2*(32-FBITS_LPCOEFS)))))		/* i.e. 16 in Q26 format */
 #define RELAX_COEF		0x7ffff79c	/* 1.0 / (1.0 + 1e-6), Q31 */
@@ -613,4 +615,4 @@ void GenerateHighFreq(PSInfoSBR *psi, SBRGrid *sbrGrid, SBRFreq *sbrFreq, SBRCha
 	}
 }
 
-
+#endif /* AAC_ENABLE_SBR */
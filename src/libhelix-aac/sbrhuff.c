@@ -46,6 +46,8 @@
 #include "sbr.h"
 #include "assembly.h"
 
+#ifdef AAC_ENABLE_SBR /* ESP8266Audio: whole file compiled out otherwise, see AudioConfig.h */
+
 /**************************************************************************************
  * Function:    DecodeHuffmanScalar
  *
@@ -474,3 +476,5 @@ void UncoupleSBRNoise(PSInfoSBR *psi, SBRGrid *sbrGrid, SBRFreq *sbrFreq, SBRCha
 		}
 	}
 }
+
+#endif /* AAC_ENABLE_SBR */
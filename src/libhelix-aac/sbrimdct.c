@@ -46,6 +46,8 @@
 #include "coder.h"
 #include "assembly.h"
 
+#ifdef AAC_ENABLE_SBR /* ESP8266Audio: whole file compiled out otherwise, see AudioConfig.h */
+
 /**************************************************************************************
  * Function:    DecWindowOverlapNoClip
  *
@@ -445,3 +447,5 @@ void DecWindowOverlapShortNoClip(int *buf0, int *over0, int *out0, int winTypeCu
 		i -= 4;
 	} while (i);
 }
+
+#endif /* AAC_ENABLE_SBR */
@@ -46,6 +46,8 @@
 #include "sbr.h"
 #include "assembly.h"
 
+#ifdef AAC_ENABLE_SBR /* ESP8266Audio: whole file compiled out otherwise, see AudioConfig.h */
+
 #define Q28_2	0x20000000	/* Q28: 2.0 */
 #define Q28_15	0x30000000	/* Q28: 1.5 */
 
@@ -193,3 +195,5 @@ int SqrtFix(int q, int fBitsIn, int *fBitsOut)
 	*fBitsOut = ((fBitsIn + 2*z) >> 1);
 	return lo;
 }
+
+#endif /* AAC_ENABLE_SBR */
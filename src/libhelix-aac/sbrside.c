@@ -45,6 +45,8 @@
 
 #include "sbr.h"
 
+#ifdef AAC_ENABLE_SBR /* ESP8266Audio: whole file compiled out otherwise, see AudioConfig.h */
+
 /**************************************************************************************
  * Function:    GetSampRateIdx
  *
@@ -573,3 +575,5 @@ void UnpackSBRChannelPair(BitStreamInfo *bsi, PSInfoSBR *psi, int chBase)
 		}
 	}
 }
+
+#endif /* AAC_ENABLE_SBR */
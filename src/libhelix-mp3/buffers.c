@@ -50,6 +50,10 @@
 #include <string.h>
 #include "coder.h"
 
+/* ESP8266Audio: charge all heap use to the owning AudioGenerator, see AudioMemory.h */
+#define AUDIOMEMORY_REDIRECT
+#include "../AudioMemory.h"
+
 /**************************************************************************************
  * Function:    ClearBuffer
  *
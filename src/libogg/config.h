@@ -102,3 +102,7 @@
 
 /* Define to empty if `const' does not conform to ANSI C. */
 /* #undef const */
+
+/* ESP8266Audio: charge all heap use to the owning AudioGenerator, see AudioMemory.h */
+#define AUDIOMEMORY_REDIRECT
+#include "../AudioMemory.h"
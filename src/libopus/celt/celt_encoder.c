@@ -31,6 +31,8 @@
 #include "../config.h"
 //#endif
 
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
+
 #define CELT_ENCODER_C
 
 #include "cpu_support.h"
@@ -2605,3 +2607,5 @@ bad_request:
    va_end(ap);
    return OPUS_UNIMPLEMENTED;
 }
+
+#endif /* OPUS_DECODE_ONLY */
@@ -208,3 +208,13 @@
 #endif
 
 #include <stdlib.h>
+
+/* ESP8266Audio: footprint options, see AudioConfig.h */
+#include "../AudioConfig.h"
+#if defined(AUDIO_DECODE_ONLY)
+#define OPUS_DECODE_ONLY
+#endif
+
+/* ESP8266Audio: charge all heap use to the owning AudioGenerator, see AudioMemory.h */
+#define AUDIOMEMORY_REDIRECT
+#include "../AudioMemory.h"
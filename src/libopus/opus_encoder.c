@@ -29,6 +29,8 @@
 #include "config.h"
 //#endif
 
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
+
 #include <stdarg.h>
 #include "celt/celt.h"
 #include "celt/entenc.h"
@@ -2781,3 +2783,5 @@ void opus_encoder_destroy(OpusEncoder *st)
 {
     opus_free(st);
 }
+
+#endif /* OPUS_DECODE_ONLY */
@@ -651,6 +651,32 @@ OPUS_EXPORT void opus_multistream_decoder_destroy(OpusMSDecoder *st);
 
 /**@}*/
 
+/** ESP8266Audio: a multistream decoder which mixes straight down to one or two channels.
+  * <code>matrix[c*out_channels+o]</code> is the Q14 weight of coded channel
+  * <code>c</code> in output channel <code>o</code>.  Streams none of whose
+  * channels carry any weight have no decoder state and are never decoded.
+  * The only ctls handled are OPUS_SET_GAIN and OPUS_RESET_STATE.
+  */
+typedef struct OpusMixDecoder OpusMixDecoder;
+
+OPUS_EXPORT opus_int32 opus_mix_decoder_get_size(int channels, int streams,
+      int coupled_streams, const unsigned char *mapping, const opus_int16 *matrix,
+      int out_channels);
+
+OPUS_EXPORT OpusMixDecoder *opus_mix_decoder_create(opus_int32 Fs, int channels,
+      int streams, int coupled_streams, const unsigned char *mapping,
+      const opus_int16 *matrix, int out_channels, int *error);
+
+/** Returns the number of samples per output channel decoded, or an error code.
+  * A <code>len</code> of zero runs packet loss concealment.
+  */
+OPUS_EXPORT int opus_mix_decode(OpusMixDecoder *st, const unsigned char *data,
+      opus_int32 len, opus_int16 *pcm, int frame_size);
+
+OPUS_EXPORT int opus_mix_decoder_ctl(OpusMixDecoder *st, int request, ...);
+
+OPUS_EXPORT void opus_mix_decoder_destroy(OpusMixDecoder *st);
+
 /**@}*/
 
 #ifdef __cplusplus
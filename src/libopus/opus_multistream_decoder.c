@@ -547,3 +547,273 @@ void opus_multistream_decoder_destroy(OpusMSDecoder *st)
 {
     opus_free(st);
 }
+
+/* ESP8266Audio: a multistream decoder for players which only want one or two channels out.
+   Only the streams which feed a nonzero matrix entry have a decoder state allocated and are
+   decoded, the rest are just parsed past, and each decoded stream is mixed straight into the
+   output so no full-width channel buffer is ever needed.  The one stream's worth of samples
+   that is needed lives at the end of the state rather than on the stack, where 120 ms of
+   stereo would be too much for a small task. */
+struct OpusMixDecoder {
+   int nb_channels;
+   int nb_streams;
+   int nb_coupled_streams;
+   int out_channels;
+   opus_int32 Fs;
+   opus_int32 scratch_offset;
+   /* Followed by the matrix, the mapping, a used flag per stream, the decoder states and the
+      scratch buffer each stream is decoded into before it's mixed */
+};
+
+static opus_int16 *mix_matrix(OpusMixDecoder *st)
+{
+   return (opus_int16*)((char*)st + align(sizeof(OpusMixDecoder)));
+}
+
+static unsigned char *mix_mapping(OpusMixDecoder *st)
+{
+   return (unsigned char*)(mix_matrix(st) + st->nb_channels*st->out_channels);
+}
+
+static unsigned char *mix_used(OpusMixDecoder *st)
+{
+   return mix_mapping(st) + st->nb_channels;
+}
+
+static opus_val16 *mix_scratch(OpusMixDecoder *st)
+{
+   return (opus_val16*)((char*)st + st->scratch_offset);
+}
+
+/* Up to 120 ms of a coupled stream at 48 kHz, the most opus_mix_decode() is ever asked for */
+static opus_int32 mix_scratch_size(void)
+{
+   return align(2*(48000/25*3)*sizeof(opus_val16));
+}
+
+static int mix_header_size(int channels, int streams, int out_channels)
+{
+   return align(sizeof(OpusMixDecoder)) +
+          align(channels*out_channels*sizeof(opus_int16) + channels + streams);
+}
+
+/* Does any channel carried by stream s have a nonzero weight in the mix? */
+static int mix_stream_used(int s, int channels, int coupled_streams,
+      const unsigned char *mapping, const opus_int16 *matrix, int out_channels)
+{
+   int c, o;
+   for (c=0;c<channels;c++)
+   {
+      int idx = mapping[c];
+      int from = (idx == 255) ? -1 : (idx < 2*coupled_streams) ? idx/2 : idx - coupled_streams;
+      if (from != s)
+         continue;
+      for (o=0;o<out_channels;o++)
+         if (matrix[c*out_channels+o])
+            return 1;
+   }
+   return 0;
+}
+
+opus_int32 opus_mix_decoder_get_size(int channels, int streams, int coupled_streams,
+      const unsigned char *mapping, const opus_int16 *matrix, int out_channels)
+{
+   int s;
+   opus_int32 size;
+   if ((channels>255) || (channels<1) || (coupled_streams>streams) || (streams<1) ||
+       (coupled_streams<0) || (streams>255-coupled_streams) || (out_channels<1) || (out_channels>2))
+      return 0;
+   size = mix_header_size(channels, streams, out_channels);
+   for (s=0;s<streams;s++)
+      if (mix_stream_used(s, channels, coupled_streams, mapping, matrix, out_channels))
+         size += align(opus_decoder_get_size(s < coupled_streams ? 2 : 1));
+   return size + mix_scratch_size();
+}
+
+OpusMixDecoder *opus_mix_decoder_create(opus_int32 Fs, int channels, int streams,
+      int coupled_streams, const unsigned char *mapping, const opus_int16 *matrix,
+      int out_channels, int *error)
+{
+   OpusMixDecoder *st;
+   char *ptr;
+   int i, ret;
+   opus_int32 size = opus_mix_decoder_get_size(channels, streams, coupled_streams, mapping, matrix, out_channels);
+   /* As validate_layout(), without a 255 byte ChannelLayout on the stack */
+   for (i=0;i<channels && size;i++)
+      if (mapping[i] >= streams+coupled_streams && mapping[i] != 255)
+         size = 0;
+   if (!size)
+   {
+      if (error)
+         *error = OPUS_BAD_ARG;
+      return NULL;
+   }
+   st = (OpusMixDecoder *)opus_alloc(size);
+   if (st==NULL)
+   {
+      if (error)
+         *error = OPUS_ALLOC_FAIL;
+      return NULL;
+   }
+   st->nb_channels = channels;
+   st->nb_streams = streams;
+   st->nb_coupled_streams = coupled_streams;
+   st->out_channels = out_channels;
+   st->Fs = Fs;
+   st->scratch_offset = size - mix_scratch_size();
+   OPUS_COPY(mix_matrix(st), matrix, channels*out_channels);
+   OPUS_COPY(mix_mapping(st), mapping, channels);
+   ptr = (char*)st + mix_header_size(channels, streams, out_channels);
+   ret = OPUS_OK;
+   for (i=0;i<streams;i++)
+   {
+      int stream_channels = (i < coupled_streams) ? 2 : 1;
+      mix_used(st)[i] = mix_stream_used(i, channels, coupled_streams, mapping, matrix, out_channels);
+      if (!mix_used(st)[i])
+         continue;
+      ret = opus_decoder_init((OpusDecoder*)ptr, Fs, stream_channels);
+      if (ret != OPUS_OK)
+         break;
+      ptr += align(opus_decoder_get_size(stream_channels));
+   }
+   if (error)
+      *error = ret;
+   if (ret != OPUS_OK)
+   {
+      opus_free(st);
+      st = NULL;
+   }
+   return st;
+}
+
+/* Add one decoded stream's channels into the output with their Q14 weights */
+static void mix_stream_out(OpusMixDecoder *st, opus_int16 *pcm, const opus_val16 *buf, int s, int frame_size)
+{
+   const opus_int16 *matrix = mix_matrix(st);
+   const unsigned char *mapping = mix_mapping(st);
+   int coupled = s < st->nb_coupled_streams;
+   int c, o, i;
+   for (c=0;c<st->nb_channels;c++)
+   {
+      const opus_val16 *src;
+      int idx = mapping[c];
+      if (coupled && (idx >> 1) == s && idx < 2*st->nb_coupled_streams)
+         src = buf + (idx & 1);
+      else if (!coupled && idx != 255 && idx - st->nb_coupled_streams == s)
+         src = buf;
+      else
+         continue;
+      for (o=0;o<st->out_channels;o++)
+      {
+         opus_int32 w = matrix[c*st->out_channels+o];
+         if (!w)
+            continue;
+         for (i=0;i<frame_size;i++)
+         {
+            opus_int16 *dst = pcm + i*st->out_channels + o;
+#if defined(FIXED_POINT)
+            *dst = SAT16(*dst + ((w*src[i*(1+coupled)] + 8192) >> 14));
+#else
+            *dst = SAT16(*dst + (opus_int32)float2int(w*(1/16384.f)*32768.f*src[i*(1+coupled)]));
+#endif
+         }
+      }
+   }
+}
+
+int opus_mix_decode(OpusMixDecoder *st, const unsigned char *data, opus_int32 len,
+      opus_int16 *pcm, int frame_size)
+{
+   char *ptr;
+   int s;
+   int do_plc;
+   opus_val16 *buf = mix_scratch(st);
+
+   if (frame_size <= 0 || len < 0)
+      return OPUS_BAD_ARG;
+   frame_size = IMIN(frame_size, st->Fs/25*3);
+   do_plc = (len == 0);
+   if (!do_plc)
+   {
+      int ret;
+      if (len < 2*st->nb_streams-1)
+      {
+         return OPUS_INVALID_PACKET;
+      }
+      ret = opus_multistream_packet_validate(data, len, st->nb_streams, st->Fs);
+      if (ret < 0)
+      {
+         return ret;
+      } else if (ret > frame_size)
+      {
+         return OPUS_BUFFER_TOO_SMALL;
+      }
+      frame_size = ret;
+   }
+   OPUS_CLEAR(pcm, frame_size*st->out_channels);
+   ptr = (char*)st + mix_header_size(st->nb_channels, st->nb_streams, st->out_channels);
+   for (s=0;s<st->nb_streams;s++)
+   {
+      opus_int32 packet_offset = 0;
+      int last = (s == st->nb_streams-1);
+      if (mix_used(st)[s])
+      {
+         OpusDecoder *dec = (OpusDecoder*)ptr;
+         int ret;
+         ptr += align(opus_decoder_get_size(s < st->nb_coupled_streams ? 2 : 1));
+         ret = opus_decode_native(dec, data, len, buf, frame_size, 0, !last, &packet_offset, 0);
+         if (ret <= 0)
+         {
+            return ret;
+         }
+         frame_size = ret;
+         mix_stream_out(st, pcm, buf, s, frame_size);
+      } else if (!do_plc && !last)
+      {
+         unsigned char toc;
+         opus_int16 size[48];
+         int ret = opus_packet_parse_impl(data, len, 1, &toc, NULL, size, NULL, &packet_offset);
+         if (ret < 0)
+         {
+            return ret;
+         }
+      }
+      data += packet_offset;
+      len -= packet_offset;
+   }
+   return frame_size;
+}
+
+int opus_mix_decoder_ctl(OpusMixDecoder *st, int request, ...)
+{
+   va_list ap;
+   char *ptr;
+   int s;
+   int ret = OPUS_OK;
+   opus_int32 value = 0;
+
+   va_start(ap, request);
+   if (request == OPUS_SET_GAIN_REQUEST)
+      value = va_arg(ap, opus_int32);
+   else if (request != OPUS_RESET_STATE)
+      ret = OPUS_UNIMPLEMENTED;
+   va_end(ap);
+   ptr = (char*)st + mix_header_size(st->nb_channels, st->nb_streams, st->out_channels);
+   for (s=0;s<st->nb_streams && ret==OPUS_OK;s++)
+   {
+      OpusDecoder *dec = (OpusDecoder*)ptr;
+      if (!mix_used(st)[s])
+         continue;
+      ptr += align(opus_decoder_get_size(s < st->nb_coupled_streams ? 2 : 1));
+      if (request == OPUS_RESET_STATE)
+         ret = opus_decoder_ctl(dec, OPUS_RESET_STATE);
+      else
+         ret = opus_decoder_ctl(dec, OPUS_SET_GAIN(value));
+   }
+   return ret;
+}
+
+void opus_mix_decoder_destroy(OpusMixDecoder *st)
+{
+   opus_free(st);
+}
@@ -29,6 +29,8 @@
 #include "config.h"
 //#endif
 
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
+
 #include "opus_multistream.h"
 #include "opus.h"
 #include "opus_private.h"
@@ -1326,3 +1328,5 @@ void opus_multistream_encoder_destroy(OpusMSEncoder *st)
 {
     opus_free(st);
 }
+
+#endif /* OPUS_DECODE_ONLY */
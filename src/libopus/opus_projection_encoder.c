@@ -29,6 +29,8 @@
 #include "config.h"
 //#endif
 
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
+
 #include "celt/mathops.h"
 #include "celt/os_support.h"
 #include "opus_private.h"
@@ -466,3 +468,4 @@ bad_arg:
   return OPUS_BAD_ARG;
 }
 
+#endif /* OPUS_DECODE_ONLY */
@@ -35,6 +35,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "../config.h"
 //#endif
 
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
+
 #include "SigProc_FIX.h"
 #include "tables.h"
 
@@ -265,3 +267,5 @@ void silk_A2NLSF(
         }
     }
 }
+
+#endif /* OPUS_DECODE_ONLY */
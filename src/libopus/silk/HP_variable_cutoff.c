@@ -28,6 +28,8 @@ POSSIBILITY OF SUCH DAMAGE.
 //#ifdef HAVE_CONFIG_H
 #include "../config.h"
 //#endif
+
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
 #ifdef FIXED_POINT
 #include "fixed/main_FIX.h"
 #else
@@ -75,3 +77,5 @@ void silk_HP_variable_cutoff(
             silk_LSHIFT( silk_lin2log( VARIABLE_HP_MAX_CUTOFF_HZ ), 8 ) );
    }
 }
+
+#endif /* OPUS_DECODE_ONLY */
@@ -29,6 +29,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "../config.h"
 //#endif
 
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
+
 /*
     Elliptic/Cauer filters designed with 0.1 dB passband ripple,
     80 dB minimum stopband attenuation, and
@@ -133,3 +135,5 @@ void silk_LP_variable_cutoff(
         silk_biquad_alt_stride1( frame, B_Q28, A_Q28, psLP->In_LP_State, frame, frame_length);
     }
 }
+
+#endif /* OPUS_DECODE_ONLY */
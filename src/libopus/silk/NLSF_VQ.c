@@ -29,6 +29,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "../config.h"
 //#endif
 
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
+
 #include "main.h"
 
 /* Compute quantization errors for an LPC_order element input vector for a VQ codebook */
@@ -74,3 +76,5 @@ void silk_NLSF_VQ(
         w_Q9_ptr += LPC_order;
     }
 }
+
+#endif /* OPUS_DECODE_ONLY */
@@ -29,6 +29,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "../config.h"
 //#endif
 
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
+
 #include "define.h"
 #include "SigProc_FIX.h"
 
@@ -78,3 +80,5 @@ void silk_NLSF_VQ_weights_laroia(
     pNLSFW_Q_OUT[ D - 1 ] = (opus_int16)silk_min_int( tmp1_int + tmp2_int, silk_int16_MAX );
     silk_assert( pNLSFW_Q_OUT[ D - 1 ] > 0 );
 }
+
+#endif /* OPUS_DECODE_ONLY */
@@ -29,6 +29,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "../config.h"
 //#endif
 
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
+
 #include "main.h"
 
 /* Delayed-decision quantizer for NLSF residuals */
@@ -213,3 +215,5 @@ opus_int32 silk_NLSF_del_dec_quant(                             /* O    Returns
     silk_assert( min_Q25 >= 0 );
     return min_Q25;
 }
+
+#endif /* OPUS_DECODE_ONLY */
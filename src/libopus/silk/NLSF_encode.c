@@ -29,6 +29,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "../config.h"
 //#endif
 
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
+
 #include "main.h"
 #include "../celt/stack_alloc.h"
 
@@ -122,3 +124,5 @@ opus_int32 silk_NLSF_encode(                                    /* O    Returns
     RESTORE_STACK;
     return ret;
 }
+
+#endif /* OPUS_DECODE_ONLY */
@@ -29,6 +29,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "../config.h"
 //#endif
 
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
+
 #include "main.h"
 #include "../celt/stack_alloc.h"
 #include "NSQ.h"
@@ -731,3 +733,5 @@ static OPUS_INLINE void silk_nsq_del_dec_scale_states(
         NSQ->prev_gain_Q16 = Gains_Q16[ subfr ];
     }
 }
+
+#endif /* OPUS_DECODE_ONLY */
@@ -28,6 +28,8 @@ POSSIBILITY OF SUCH DAMAGE.
 //#ifdef HAVE_CONFIG_H
 #include "../config.h"
 //#endif
+
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
 #include  <pgmspace.h>
 
 #include "main.h"
@@ -359,3 +361,5 @@ void silk_VAD_GetNoiseLevels(
         psSilk_VAD->NL[ k ] = nl;
     }
 }
+
+#endif /* OPUS_DECODE_ONLY */
@@ -29,6 +29,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "../config.h"
 //#endif
 
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
+
 #include "main.h"
 
 /* Entropy constrained matrix-weighted VQ, hard-coded to 5-element vectors, for a single input data vector */
@@ -129,3 +131,5 @@ void silk_VQ_WMat_EC_c(
         cb_row_Q7 += LTP_ORDER;
     }
 }
+
+#endif /* OPUS_DECODE_ONLY */
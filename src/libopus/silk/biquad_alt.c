@@ -36,6 +36,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "../config.h"
 //#endif
 
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
+
 #include "SigProc_FIX.h"
 
 /* Second order ARMA filter, alternative implementation */
@@ -119,3 +121,5 @@ void silk_biquad_alt_stride2_c(
         out[ 2 * k + 1 ] = (opus_int16)silk_SAT16( silk_RSHIFT( out32_Q14[ 1 ] + (1<<14) - 1, 14 ) );
     }
 }
+
+#endif /* OPUS_DECODE_ONLY */
@@ -29,6 +29,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "../config.h"
 //#endif
 
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
+
 #include "main.h"
 #include "control.h"
 #include "errors.h"
@@ -104,3 +106,5 @@ opus_int check_control_input(
 
     return SILK_NO_ERROR;
 }
+
+#endif /* OPUS_DECODE_ONLY */
@@ -29,6 +29,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "../config.h"
 //#endif
 
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
+
 #include "main.h"
 #include "tuning_parameters.h"
 
@@ -111,3 +113,5 @@ opus_int silk_control_SNR(
     }
     return SILK_NO_ERROR;
 }
+
+#endif /* OPUS_DECODE_ONLY */
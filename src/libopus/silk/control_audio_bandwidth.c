@@ -29,6 +29,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "../config.h"
 //#endif
 
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
+
 #include "main.h"
 #include "tuning_parameters.h"
 
@@ -130,3 +132,5 @@ opus_int silk_control_audio_bandwidth(
 
     return fs_kHz;
 }
+
+#endif /* OPUS_DECODE_ONLY */
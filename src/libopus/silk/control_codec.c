@@ -28,6 +28,8 @@ POSSIBILITY OF SUCH DAMAGE.
 //#ifdef HAVE_CONFIG_H
 #include "../config.h"
 //#endif
+
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
 #ifdef FIXED_POINT
 #include "fixed/main_FIX.h"
 #define silk_encoder_state_Fxx      silk_encoder_state_FIX
@@ -421,3 +423,5 @@ static OPUS_INLINE opus_int silk_setup_LBRR(
 
     return ret;
 }
+
+#endif /* OPUS_DECODE_ONLY */
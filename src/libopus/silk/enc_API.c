@@ -28,6 +28,8 @@ POSSIBILITY OF SUCH DAMAGE.
 //#ifdef HAVE_CONFIG_H
 #include "../config.h"
 //#endif
+
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
 #include "define.h"
 #include "API.h"
 #include "control.h"
@@ -574,3 +576,4 @@ opus_int silk_Encode(                                   /* O    Returns error co
     return ret;
 }
 
+#endif /* OPUS_DECODE_ONLY */
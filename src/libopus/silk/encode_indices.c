@@ -29,6 +29,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "../config.h"
 //#endif
 
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
+
 #include "main.h"
 
 /* Encode side-information parameters to payload */
@@ -179,3 +181,5 @@ void silk_encode_indices(
     silk_assert( psIndices->Seed >= 0 && psIndices->Seed < 4 );
     ec_enc_icdf( psRangeEnc, psIndices->Seed, silk_uniform4_iCDF, 8 );
 }
+
+#endif /* OPUS_DECODE_ONLY */
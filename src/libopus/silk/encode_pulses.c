@@ -29,6 +29,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "../config.h"
 //#endif
 
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
+
 #include "main.h"
 #include "../celt/stack_alloc.h"
 
@@ -204,3 +206,5 @@ void silk_encode_pulses(
     silk_encode_signs( psRangeEnc, pulses, frame_length, signalType, quantOffsetType, sum_pulses );
     RESTORE_STACK;
 }
+
+#endif /* OPUS_DECODE_ONLY */
@@ -29,6 +29,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "../../config.h"
 //#endif
 
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
+
 #include "main_FIX.h"
 
 void silk_LTP_analysis_filter_FIX(
@@ -88,3 +90,4 @@ void silk_LTP_analysis_filter_FIX(
     }
 }
 
+#endif /* OPUS_DECODE_ONLY */
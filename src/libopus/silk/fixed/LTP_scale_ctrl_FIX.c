@@ -29,6 +29,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "../../config.h"
 //#endif
 
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
+
 #include "main_FIX.h"
 
 /* Calculation of LTP state scaling */
@@ -51,3 +53,5 @@ void silk_LTP_scale_ctrl_FIX(
     }
     psEncCtrl->LTP_scale_Q14 = silk_LTPScales_table_Q14[ psEnc->sCmn.indices.LTP_scaleIndex ];
 }
+
+#endif /* OPUS_DECODE_ONLY */
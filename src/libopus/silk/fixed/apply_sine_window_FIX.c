@@ -29,6 +29,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "../../config.h"
 //#endif
 
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
+
 #include "../SigProc_FIX.h"
 
 /* Apply sine window to signal vector.                                      */
@@ -99,3 +101,5 @@ void silk_apply_sine_window(
         S1_Q16 = silk_min( S1_Q16, ( (opus_int32)1 << 16 ) );
     }
 }
+
+#endif /* OPUS_DECODE_ONLY */
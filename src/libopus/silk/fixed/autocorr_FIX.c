@@ -29,6 +29,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "../../config.h"
 //#endif
 
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
+
 #include "../SigProc_FIX.h"
 #include "../../celt/celt_lpc.h"
 
@@ -46,3 +48,5 @@ void silk_autocorr(
     corrCount = silk_min_int( inputDataSize, correlationCount );
     *scale = _celt_autocorr(inputData, results, NULL, 0, corrCount-1, inputDataSize, arch);
 }
+
+#endif /* OPUS_DECODE_ONLY */
@@ -29,6 +29,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "../../config.h"
 //#endif
 
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
+
 #include "../SigProc_FIX.h"
 #include "../define.h"
 #include "../tuning_parameters.h"
@@ -284,3 +286,5 @@ void silk_burg_modified_c(
     free(CAb);
     free(xcorr);
 }
+
+#endif /* OPUS_DECODE_ONLY */
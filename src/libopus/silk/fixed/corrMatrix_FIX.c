@@ -29,6 +29,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "../../config.h"
 //#endif
 
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
+
 /**********************************************************************
  * Correlation Matrix Computations for LS estimate.
  **********************************************************************/
@@ -148,3 +150,4 @@ void silk_corrMatrix_FIX(
     }
 }
 
+#endif /* OPUS_DECODE_ONLY */
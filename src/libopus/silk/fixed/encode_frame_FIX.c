@@ -29,6 +29,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "../../config.h"
 //#endif
 
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
+
 #include <stdlib.h>
 #include "main_FIX.h"
 #include "../../celt/stack_alloc.h"
@@ -446,3 +448,5 @@ static OPUS_INLINE void silk_LBRR_encode_FIX(
         silk_memcpy( psEncCtrl->Gains_Q16, TempGains_Q16, psEnc->sCmn.nb_subfr * sizeof( opus_int32 ) );
     }
 }
+
+#endif /* OPUS_DECODE_ONLY */
@@ -29,6 +29,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "../../config.h"
 //#endif
 
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
+
 #include "main_FIX.h"
 #include "../../celt/stack_alloc.h"
 #include "../tuning_parameters.h"
@@ -149,3 +151,5 @@ void silk_find_LPC_FIX(
     celt_assert( psEncC->indices.NLSFInterpCoef_Q2 == 4 || ( psEncC->useInterpolatedNLSFs && !psEncC->first_frame_after_reset && psEncC->nb_subfr == MAX_NB_SUBFR ) );
     RESTORE_STACK;
 }
+
+#endif /* OPUS_DECODE_ONLY */
@@ -29,6 +29,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "../../config.h"
 //#endif
 
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
+
 #include "main_FIX.h"
 #include "../tuning_parameters.h"
 
@@ -97,3 +99,5 @@ TOC(div)
         xXLTP_Q17_ptr += LTP_ORDER;
     }
 }
+
+#endif /* OPUS_DECODE_ONLY */
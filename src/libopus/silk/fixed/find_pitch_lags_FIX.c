@@ -29,6 +29,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "../../config.h"
 //#endif
 
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
+
 #include "main_FIX.h"
 #include "../../celt/stack_alloc.h"
 #include "../tuning_parameters.h"
@@ -141,3 +143,5 @@ void silk_find_pitch_lags_FIX(
     }
     RESTORE_STACK;
 }
+
+#endif /* OPUS_DECODE_ONLY */
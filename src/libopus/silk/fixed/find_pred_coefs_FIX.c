@@ -29,6 +29,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "../../config.h"
 //#endif
 
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
+
 #include "main_FIX.h"
 #include "../../celt/stack_alloc.h"
 
@@ -143,3 +145,5 @@ void silk_find_pred_coefs_FIX(
     silk_memcpy( psEnc->sCmn.prev_NLSFq_Q15, NLSF_Q15, sizeof( psEnc->sCmn.prev_NLSFq_Q15 ) );
     RESTORE_STACK;
 }
+
+#endif /* OPUS_DECODE_ONLY */
@@ -29,6 +29,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "../../config.h"
 //#endif
 
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
+
 #include "../SigProc_FIX.h"
 
 /* Step up function, converts reflection coefficients to prediction coefficients */
@@ -52,3 +54,5 @@ void silk_k2a(
         A_Q24[ k ] = -silk_LSHIFT( (opus_int32)rc_Q15[ k ], 9 );
     }
 }
+
+#endif /* OPUS_DECODE_ONLY */
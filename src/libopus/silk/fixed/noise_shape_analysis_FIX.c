@@ -29,6 +29,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "../../config.h"
 //#endif
 
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
+
 #include "main_FIX.h"
 #include "../../celt/stack_alloc.h"
 #include "../tuning_parameters.h"
@@ -405,3 +407,5 @@ void silk_noise_shape_analysis_FIX(
     RESTORE_STACK;
 }
 #endif /* OVERRIDE_silk_noise_shape_analysis_FIX */
+
+#endif /* OPUS_DECODE_ONLY */
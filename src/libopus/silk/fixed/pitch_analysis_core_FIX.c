@@ -29,6 +29,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "../../config.h"
 //#endif
 
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
+
 /***********************************************************
 * Pitch analyser function
 ********************************************************** */
@@ -719,3 +721,5 @@ static void silk_P_Ana_calc_energy_st3(
     }
     RESTORE_STACK;
 }
+
+#endif /* OPUS_DECODE_ONLY */
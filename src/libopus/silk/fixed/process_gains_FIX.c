@@ -29,6 +29,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "../../config.h"
 //#endif
 
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
+
 #include "main_FIX.h"
 #include "../tuning_parameters.h"
 
@@ -115,3 +117,5 @@ void silk_process_gains_FIX(
     silk_assert( psEncCtrl->Lambda_Q10 > 0 );
     silk_assert( psEncCtrl->Lambda_Q10 < SILK_FIX_CONST( 2, 10 ) );
 }
+
+#endif /* OPUS_DECODE_ONLY */
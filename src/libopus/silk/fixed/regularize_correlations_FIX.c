@@ -29,6 +29,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "../../config.h"
 //#endif
 
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
+
 #include "main_FIX.h"
 
 /* Add noise to matrix diagonal */
@@ -45,3 +47,5 @@ void silk_regularize_correlations_FIX(
     }
     xx[ 0 ] += noise;
 }
+
+#endif /* OPUS_DECODE_ONLY */
@@ -29,6 +29,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "../../config.h"
 //#endif
 
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
+
 #include "main_FIX.h"
 
 /* Residual energy: nrg = wxx - 2 * wXx * c + c' * wXX * c */
@@ -101,3 +103,5 @@ opus_int32 silk_residual_energy16_covar_FIX(
     return nrg;
 
 }
+
+#endif /* OPUS_DECODE_ONLY */
@@ -29,6 +29,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "../../config.h"
 //#endif
 
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
+
 #include "../SigProc_FIX.h"
 
 /* Slower than schur(), but more accurate.                              */
@@ -91,3 +93,5 @@ opus_int32 silk_schur64(                            /* O    returns residual ene
 
     return silk_max_32( 1, C[ 0 ][ 1 ] );
 }
+
+#endif /* OPUS_DECODE_ONLY */
@@ -29,6 +29,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "../../config.h"
 //#endif
 
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
+
 #include "../SigProc_FIX.h"
 
 /* Faster than schur64(), but much less accurate.                       */
@@ -105,3 +107,5 @@ opus_int32 silk_schur(                              /* O    Returns residual ene
     /* return residual energy */
     return silk_max_32( 1, C[ 0 ][ 1 ] );
 }
+
+#endif /* OPUS_DECODE_ONLY */
@@ -29,6 +29,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "../../config.h"
 //#endif
 
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
+
 #include "../SigProc_FIX.h"
 #include "../../celt/pitch.h"
 
@@ -100,3 +102,5 @@ opus_int64 silk_inner_prod16_aligned_64_c(
     }
     return sum;
 }
+
+#endif /* OPUS_DECODE_ONLY */
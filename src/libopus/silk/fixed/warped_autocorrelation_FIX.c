@@ -29,6 +29,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "../../config.h"
 //#endif
 
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
+
 #include "main_FIX.h"
 
 #if defined(MIPSr1_ASM)
@@ -92,3 +94,5 @@ void silk_warped_autocorrelation_FIX_c(
     free(corr_QC);
 }
 #endif /* OVERRIDE_silk_warped_autocorrelation_FIX_c */
+
+#endif /* OPUS_DECODE_ONLY */
@@ -28,6 +28,8 @@ POSSIBILITY OF SUCH DAMAGE.
 //#ifdef HAVE_CONFIG_H
 #include "../config.h"
 //#endif
+
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
 #ifdef FIXED_POINT
 #include "fixed/main_FIX.h"
 #else
@@ -62,3 +64,5 @@ opus_int silk_init_encoder(
 
     return  ret;
 }
+
+#endif /* OPUS_DECODE_ONLY */
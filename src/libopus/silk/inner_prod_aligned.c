@@ -29,6 +29,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "../config.h"
 //#endif
 
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
+
 #include "SigProc_FIX.h"
 
 opus_int32 silk_inner_prod_aligned_scale(
@@ -45,3 +47,5 @@ opus_int32 silk_inner_prod_aligned_scale(
     }
     return sum;
 }
+
+#endif /* OPUS_DECODE_ONLY */
@@ -28,6 +28,8 @@ POSSIBILITY OF SUCH DAMAGE.
 //#ifdef HAVE_CONFIG_H
 #include "../config.h"
 //#endif
+
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
 #include <pgmspace.h>
 
 /* Approximate sigmoid function */
@@ -75,3 +77,4 @@ opus_int silk_sigm_Q15(
     }
 }
 
+#endif /* OPUS_DECODE_ONLY */
@@ -29,6 +29,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "../config.h"
 //#endif
 
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
+
 #include "main.h"
 #include "../celt/stack_alloc.h"
 
@@ -227,3 +229,5 @@ void silk_stereo_LR_to_MS(
     state->width_prev_Q14     = (opus_int16)width_Q14;
     RESTORE_STACK;
 }
+
+#endif /* OPUS_DECODE_ONLY */
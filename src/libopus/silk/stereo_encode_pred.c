@@ -29,6 +29,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "../config.h"
 //#endif
 
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
+
 #include "main.h"
 
 /* Entropy code the mid/side quantization indices */
@@ -60,3 +62,5 @@ void silk_stereo_encode_mid_only(
     /* Encode flag that only mid channel is coded */
     ec_enc_icdf( psRangeEnc, mid_only_flag, silk_stereo_only_code_mid_iCDF, 8 );
 }
+
+#endif /* OPUS_DECODE_ONLY */
@@ -29,6 +29,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "../config.h"
 //#endif
 
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
+
 #include "main.h"
 
 /* Find least-squares prediction gain for one signal based on another and quantize it */
@@ -77,3 +79,5 @@ opus_int32 silk_stereo_find_predictor(                          /* O    Returns
 
     return pred_Q13;
 }
+
+#endif /* OPUS_DECODE_ONLY */
@@ -29,6 +29,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "../config.h"
 //#endif
 
+#ifndef OPUS_DECODE_ONLY /* ESP8266Audio: encoder only, see AudioConfig.h */
+
 #include "main.h"
 
 /* Quantize mid/side predictors */
@@ -71,3 +73,5 @@ void silk_stereo_quant_pred(
     /* Subtract second from first predictor (helps when actually applying these) */
     pred_Q13[ 0 ] -= pred_Q13[ 1 ];
 }
+
+#endif /* OPUS_DECODE_ONLY */
@@ -11,6 +11,8 @@
 
    [OPTIONAL] #define TSF_NO_STDIO to remove stdio dependency
    [OPTIONAL] #define TSF_MALLOC, TSF_REALLOC, and TSF_FREE to avoid stdlib.h
+   [OPTIONAL] #define TSF_CACHE_MALLOC and TSF_CACHE_FREE to put cache blocks elsewhere (i.e. PSRAM)
+   [OPTIONAL] #define TSF_FIXEDPOINT 1 to have tsf_render_short_fast use the fixed-point renderer
    [OPTIONAL] #define TSF_MEMCPY, TSF_MEMSET to avoid string.h
    [OPTIONAL] #define TSF_POW, TSF_POWF, TSF_EXPF, TSF_LOG, TSF_TAN, TSF_LOG10, TSF_SQRT to avoid math.h
 
@@ -163,6 +165,23 @@ TSFDEF void tsf_note_off_all(tsf* f);
 // Returns the number of active voices
 TSFDEF int tsf_active_voice_count(tsf* f);
 
+// Caps the voices playing at once, 0 (the default) for no limit.  At the cap a new note takes over
+// the voice which will be missed least: a released one before a held one, then the quietest, then
+// the oldest.  Lowering it below the voices playing now fades the extra ones out quickly.
+TSFDEF void tsf_set_max_voices(tsf* f, int max_voices);
+
+// Voices taken over or faded out early because of the cap, since tsf_load
+TSFDEF unsigned int tsf_get_stolen_voices(tsf* f);
+
+// Resize the sample cache to 'blocks' blocks of 'block_samples' samples (rounded up to a power of 2).
+// On a miss, up to 'read_ahead' following blocks are read in the same pass, saving a seek each.
+// Returns 0 and keeps the old cache if there is not enough memory.
+TSFDEF int tsf_set_cache(tsf* f, int blocks, int block_samples, int read_ahead);
+
+// Sample cache lookups served from memory and those which had to read the stream.  A voice looks
+// a block up once when it enters it, not once per sample.
+TSFDEF void tsf_get_cache_stats(tsf* f, unsigned int* hits, unsigned int* misses);
+
 // Render output samples into a buffer
 // You can either render as signed 16-bit values (tsf_render_short) or
 // as 32-bit float values (tsf_render_float)
@@ -172,6 +191,11 @@ TSFDEF int tsf_active_voice_count(tsf* f);
 TSFDEF void tsf_render_short(tsf* f, short* buffer, int samples, int flag_mixing CPP_DEFAULT0);
 TSFDEF void tsf_render_float(tsf* f, float* buffer, int samples, int flag_mixing CPP_DEFAULT0);
 
+// Renders like tsf_render_short, but without any floating point per sample or per effect block:
+// Q30 envelopes and LFOs, table-driven pitch and gain, a fixed-point biquad lowpass and a
+// saturating 32-bit mix.  For CPUs without an FPU.
+TSFDEF void tsf_render_short_fixed(tsf* f, short* buffer, int samples, int flag_mixing CPP_DEFAULT0);
+
 // Higher level channel based functions, set up channel parameters
 //   channel: channel number
 //   preset_index: preset index >= 0 and < tsf_get_presetcount()
@@ -243,6 +267,11 @@ TSFDEF float tsf_channel_get_tuning(tsf* f, int channel);
 #  define TSF_REALLOC realloc
 #endif
 
+#if !defined(TSF_CACHE_MALLOC) || !defined(TSF_CACHE_FREE)
+#  define TSF_CACHE_MALLOC TSF_MALLOC
+#  define TSF_CACHE_FREE   TSF_FREE
+#endif
+
 #if !defined(TSF_MEMCPY) || !defined(TSF_MEMSET)
 #  include <string.h>
 #  define TSF_MEMCPY  memcpy
@@ -293,6 +322,124 @@ typedef char tsf_char20[20];
 #define TSF_BUFFS 16
 #define TSF_BUFFSIZE 512
 
+// Lowpass cutoffs from 0 to 13500 cents, in 100 cent steps
+#define TSF_LOWPASS_STEPS 137
+
+// Block cache, used for both the SF2 samples and tsf_stream_wrap_cached().  Blocks are found
+// through a hash of their number and replaced least-recently-used first, both in O(1).
+#define TSF_CACHE_EMPTY 0xffffffff
+
+struct tsf_cache
+{
+	unsigned char* pool;    // blocks << shift bytes of data
+	unsigned int* tag;      // Block number held in each slot
+	short* hashHead;        // First slot in each hash bucket, or -1
+	short* hashNext;        // Next slot in the same bucket
+	short* lruPrev;         // Toward the most recently used slot
+	short* lruNext;         // Toward the least recently used slot
+	int blocks, shift, hashMask, lruHead, lruTail;
+	unsigned int hits, misses;
+};
+
+static int tsf_cache_init(struct tsf_cache* c, int blocks, int blockBytes)
+{
+	int buckets = 1, i;
+	TSF_MEMSET(c, 0, sizeof(*c));
+	if (blocks < 1 || blocks > 16384 || blockBytes < 1) return 0;
+	for (c->shift = 0; (1 << c->shift) < blockBytes; c->shift++);
+	while (buckets < blocks * 2) buckets <<= 1;
+	c->tag = (unsigned int*)TSF_MALLOC(blocks * sizeof(unsigned int) + (buckets + 3 * blocks) * sizeof(short));
+	c->pool = (unsigned char*)TSF_CACHE_MALLOC((size_t)blocks << c->shift);
+	if (!c->tag || !c->pool)
+	{
+		if (c->tag) TSF_FREE(c->tag);
+		if (c->pool) TSF_CACHE_FREE(c->pool);
+		c->tag = TSF_NULL; c->pool = TSF_NULL;
+		return 0;
+	}
+	c->hashHead = (short*)(c->tag + blocks);
+	c->hashNext = c->hashHead + buckets;
+	c->lruPrev = c->hashNext + blocks;
+	c->lruNext = c->lruPrev + blocks;
+	c->blocks = blocks;
+	c->hashMask = buckets - 1;
+	for (i = 0; i < buckets; i++) c->hashHead[i] = -1;
+	for (i = 0; i < blocks; i++)
+	{
+		c->tag[i] = TSF_CACHE_EMPTY;
+		c->hashNext[i] = -1;
+		c->lruPrev[i] = i - 1;
+		c->lruNext[i] = (i == blocks - 1) ? -1 : i + 1;
+	}
+	c->lruHead = 0;
+	c->lruTail = blocks - 1;
+	return 1;
+}
+
+static void tsf_cache_free(struct tsf_cache* c)
+{
+	if (c->pool) TSF_CACHE_FREE(c->pool);
+	if (c->tag) TSF_FREE(c->tag);
+	c->pool = TSF_NULL;
+	c->tag = TSF_NULL;
+}
+
+static int tsf_cache_hash(struct tsf_cache* c, unsigned int block)
+{
+	return (int)((block ^ (block >> 9)) & c->hashMask);
+}
+
+// Slot holding the block, or -1.  Doesn't count or reorder anything.
+static int tsf_cache_slot(struct tsf_cache* c, unsigned int block)
+{
+	int i;
+	for (i = c->hashHead[tsf_cache_hash(c, block)]; i >= 0; i = c->hashNext[i])
+		if (c->tag[i] == block) return i;
+	return -1;
+}
+
+static void tsf_cache_touch(struct tsf_cache* c, int i)
+{
+	if (c->lruHead == i) return;
+	// Unlink, i can't be the head so it always has a predecessor
+	c->lruNext[c->lruPrev[i]] = c->lruNext[i];
+	if (c->lruNext[i] >= 0) c->lruPrev[c->lruNext[i]] = c->lruPrev[i];
+	else c->lruTail = c->lruPrev[i];
+	// Push on the front
+	c->lruPrev[i] = -1;
+	c->lruNext[i] = c->lruHead;
+	c->lruPrev[c->lruHead] = i;
+	c->lruHead = i;
+}
+
+// Data for the block if it's cached (counted as a hit), otherwise NULL
+static unsigned char* tsf_cache_find(struct tsf_cache* c, unsigned int block)
+{
+	int i = tsf_cache_slot(c, block);
+	if (i < 0) return TSF_NULL;
+	tsf_cache_touch(c, i);
+	c->hits++;
+	return c->pool + ((size_t)i << c->shift);
+}
+
+// Evicts the least recently used block and hands its space over to 'block', for the caller to fill
+static unsigned char* tsf_cache_claim(struct tsf_cache* c, unsigned int block)
+{
+	int i = c->lruTail;
+	if (c->tag[i] != TSF_CACHE_EMPTY)
+	{
+		short* p = &c->hashHead[tsf_cache_hash(c, c->tag[i])];
+		while (*p != i) p = &c->hashNext[*p];
+		*p = c->hashNext[i];
+	}
+	c->tag[i] = block;
+	c->hashNext[i] = c->hashHead[tsf_cache_hash(c, block)];
+	c->hashHead[tsf_cache_hash(c, block)] = i;
+	tsf_cache_touch(c, i);
+	c->misses++;
+	return c->pool + ((size_t)i << c->shift);
+}
+
 struct tsf
 {
 	struct tsf_preset* presets;
@@ -308,6 +455,10 @@ struct tsf
 	int outputSampleSize;
 	unsigned int voicePlayIndex;
 
+	// Polyphony cap, 0 for none, and how often it has cut a voice short
+	int maxVoices;
+	unsigned int voicesStolen;
+
 	enum TSFOutputMode outputmode;
 	float outSampleRate;
 	float globalGainDB;
@@ -315,64 +466,44 @@ struct tsf
 	struct tsf_hydra *hydra;
 
 	// Cached sample read 
-	short *buffer[TSF_BUFFS];
-	int offset[TSF_BUFFS];
-	int timestamp[TSF_BUFFS];
-	int epoch;
+	struct tsf_cache cache;
+	int readAhead;
+
+	// Fixed-point renderer: mix buffer, and tan(pi * Fc) for each 100 cents of cutoff in Q24
+	int32_t* mixSamples;
+	int mixSampleSize;
+	int32_t lowpassK[TSF_LOWPASS_STEPS];
+	int lowpassMaxCents;
 };
 
 struct tsf_stream_cached_data {
-	int buffs;
-	int buffsize;
 	struct tsf_stream *stream;
 	unsigned int size, pos;
-	unsigned char **buffer;
-	unsigned int *offset;
-	unsigned int *timestamp;
-	unsigned int epoch;
-	unsigned int hit;
-	unsigned int miss;
+	struct tsf_cache cache;
 };
 
 static int tsf_stream_cached_read(void* v, void* ptr, unsigned int size)
 {
 	struct tsf_stream_cached_data *d = (struct tsf_stream_cached_data*)v;
 	unsigned char *p = (unsigned char *)ptr;
+	unsigned int blockSize = 1 << d->cache.shift;
 
 	while (size) {
 		if (d->pos >= d->size) return 0; // EOF
-		for (int i=0; i < d->buffs; i++) {
-			if ((d->offset[i] <= d->pos) && ((d->offset[i] + d->buffsize) > d->pos) ) {
-				d->timestamp[i] = d->epoch++;
-				// Handle case of epoch rollover by just setting low, random epochs
-				if (d->epoch==0) {
-					for (int i=0; i<d->buffs; i++) d->timestamp[i] = d->epoch++;
-				}
-				unsigned int startOffset = d->pos - d->offset[i];
-				unsigned int len = d->buffsize - (d->pos % d->buffsize);
-				if (len > size) len = size;
-				TSF_MEMCPY(p, &d->buffer[i][startOffset], len);
-				size -= len;
-				d->pos += len;
-				p += len;
-				d->hit++;
-				if (size == 0) return 1;
-				i = -1; // Restart the for() at block 0 after postincrement
-			}
-		}
-		
-		int repl = 0;
-		for (int i=1; i < d->buffs; i++) {
-			if (d->timestamp[i] < d->timestamp[repl]) repl = i;
+		unsigned int block = d->pos >> d->cache.shift;
+		unsigned char *data = tsf_cache_find(&d->cache, block);
+		if (!data) {
+			data = tsf_cache_claim(&d->cache, block);
+			d->stream->seek(d->stream->data, block << d->cache.shift);
+			d->stream->read(d->stream->data, data, blockSize);
 		}
-		int readOff = d->pos - (d->pos % d->buffsize);
-		d->stream->seek(d->stream->data, readOff);
-		d->stream->read(d->stream->data, d->buffer[repl], d->buffsize);
-		d->timestamp[repl] = d->epoch++;
-		d->offset[repl] = readOff;
-		d->miss++;
-		d->hit--; // Avoid counting this as a hit on next loop that returns data
-		// Don't actually do anything yet, we'll retry the search on next loop where it will notice new data
+		unsigned int startOffset = d->pos & (blockSize - 1);
+		unsigned int len = blockSize - startOffset;
+		if (len > size) len = size;
+		TSF_MEMCPY(p, data + startOffset, len);
+		size -= len;
+		d->pos += len;
+		p += len;
 	}
 	return 1;
 }
@@ -412,37 +543,27 @@ static int tsf_stream_cached_seek(void* v, unsigned int pos)
 static int tsf_stream_cached_close(void* v)
 {
 	struct tsf_stream_cached_data *d = (struct tsf_stream_cached_data*)v;
-	free(d->timestamp);
-	free(d->offset);
-	for (int i = d->buffs - 1; i >=0; i--) free(d->buffer[i]);
-	free(d->buffer);
+	tsf_cache_free(&d->cache);
 	int ret = d->stream->close(d->stream->data);
-	free(d);
+	TSF_FREE(d);
 	return ret;
 }
 
 /* Wraps an existing stream with a caching layer.  First create the stream you need, then
    call this to create a new stream.  Use this new stream only, and when done close() will
-   close both this stream as well as the wrapped one. */
+   close both this stream as well as the wrapped one.  buffsize is rounded up to a power of 2.
+   Returns NULL if there is not enough memory. */
 TSFDEF struct tsf_stream *tsf_stream_wrap_cached(struct tsf_stream *stream, int buffs, int buffsize, struct tsf_stream *dest) 
 {
 	struct tsf_stream_cached_data *s = (struct tsf_stream_cached_data*)TSF_MALLOC(sizeof(*s));
-	s->buffs  = buffs;
-	s->buffsize = buffsize;
+	if (!s) return TSF_NULL;
+	if (!tsf_cache_init(&s->cache, buffs, buffsize)) {
+		TSF_FREE(s);
+		return TSF_NULL;
+	}
 	s->stream = stream;
 	s->size = stream->size(stream->data);
 	s->pos = stream->tell(stream->data);
-	s->buffer = (unsigned char **)TSF_MALLOC(sizeof(*s->buffer) * buffs);
-	s->offset = (unsigned int *)TSF_MALLOC(sizeof(s->offset) * buffs);
-	s->timestamp = (unsigned int *)TSF_MALLOC(sizeof(s->timestamp) * buffs);
-	s->epoch = 0;
-	s->hit = 0;
-	s->miss = 0;
-	for (int i=0; i<buffs; i++) {
-		s->buffer[i] = (unsigned char *)TSF_MALLOC(buffsize);
-		s->offset[i] = 0xfffffff;
-		s->timestamp[i] = 0;
-	}
 	dest->data = (void*)s;
 	dest->read = &tsf_stream_cached_read;
 	dest->tell = &tsf_stream_cached_tell;
@@ -453,6 +574,14 @@ TSFDEF struct tsf_stream *tsf_stream_wrap_cached(struct tsf_stream *stream, int
 	return dest;
 }
 
+/* Blocks found in memory and blocks which had to be read from the wrapped stream */
+TSFDEF void tsf_stream_cached_stats(struct tsf_stream *cached, unsigned int *hits, unsigned int *misses)
+{
+	struct tsf_stream_cached_data *d = (struct tsf_stream_cached_data*)cached->data;
+	*hits = d->cache.hits;
+	*misses = d->cache.misses;
+}
+
 
 #ifndef TSF_NO_STDIO
 static int tsf_stream_stdio_read(FILE* f, void* ptr, unsigned int size) { return (int)fread(ptr, 1, size, f); }
@@ -569,9 +698,11 @@ typedef int32_t fixed8p24;
 
 struct tsf_riffchunk { tsf_fourcc id; tsf_u32 size; };
 struct tsf_envelope { float delay, attack, hold, decay, sustain, release, keynumToHold, keynumToDecay; };
-struct tsf_voice_envelope { float level, slope; int samplesUntilNextSegment; short segment, midiVelocity; struct tsf_envelope parameters; TSF_BOOL segmentIsExponential, isAmpEnv; };
-struct tsf_voice_lowpass { double QInv, a0, a1, b1, b2, z1, z2; TSF_BOOL active; };
-struct tsf_voice_lfo { int samplesUntil; float level, delta; };
+struct tsf_voice_envelope { float level, slope; int samplesUntilNextSegment; short segment, midiVelocity; struct tsf_envelope parameters; TSF_BOOL segmentIsExponential, isAmpEnv;
+                            int32_t levelFP, slopeFP; TSF_BOOL levelIsFixed; };
+struct tsf_voice_lowpass { double QInv, a0, a1, b1, b2, z1, z2; TSF_BOOL active;
+                           int32_t QInvFP, a0FP, a1FP, b1FP, b2FP; int64_t z1FP, z2FP; };
+struct tsf_voice_lfo { int samplesUntil; float level, delta; int32_t levelFP, deltaFP; };
 
 struct tsf_region
 {
@@ -610,6 +741,12 @@ struct tsf_voice
 	struct tsf_voice_envelope ampenv, modenv;
 	struct tsf_voice_lowpass lowpass;
 	struct tsf_voice_lfo modlfo, viblfo;
+	// Fixed-point renderer's copies of the values above, redone whenever those change
+	float fixedGainDB, fixedPanLeft, fixedPanRight;
+	double fixedTimecents, fixedOutputFactor;
+	int32_t gainC16;
+	int32_t panLeftFP, panRightFP;
+	fixed32p32 pitchRatioFP;
 };
 
 struct tsf_channel
@@ -1042,7 +1179,7 @@ static void tsf_load_samples(int *fontSamplesOffset, unsigned int* fontSampleCou
 	stream->skip(stream->data, samplesLeft * sizeof(short));
 }
 
-static void tsf_voice_envelope_nextsegment(struct tsf_voice_envelope* e, short active_segment, float outSampleRate)
+static void tsf_voice_envelope_segment(struct tsf_voice_envelope* e, short active_segment, float outSampleRate)
 {
 	switch (active_segment)
 	{
@@ -1147,6 +1284,16 @@ static void tsf_voice_envelope_nextsegment(struct tsf_voice_envelope* e, short a
 	}
 }
 
+static void tsf_voice_envelope_nextsegment(struct tsf_voice_envelope* e, short active_segment, float outSampleRate)
+{
+	// The fixed-point renderer only keeps levelFP up to date, segment changes are still worked out in float
+	if (e->levelIsFixed) e->level = e->levelFP * (1.0f / (1 << 30));
+	tsf_voice_envelope_segment(e, active_segment, outSampleRate);
+	e->levelFP = (int32_t)(e->level * (1 << 30));
+	e->slopeFP = (int32_t)(e->slope * (1 << 30));
+	e->levelIsFixed = TSF_FALSE;
+}
+
 static void tsf_voice_envelope_setup(struct tsf_voice_envelope* e, struct tsf_envelope* new_parameters, int midiNoteNumber, short midiVelocity, TSF_BOOL isAmpEnv, float outSampleRate)
 {
 	e->parameters = *new_parameters;
@@ -1162,6 +1309,7 @@ static void tsf_voice_envelope_setup(struct tsf_voice_envelope* e, struct tsf_en
 	}
 	e->midiVelocity = midiVelocity;
 	e->isAmpEnv = isAmpEnv;
+	e->levelIsFixed = TSF_FALSE;
 	tsf_voice_envelope_nextsegment(e, TSF_SEGMENT_NONE, outSampleRate);
 }
 
@@ -1185,6 +1333,10 @@ static void tsf_voice_lowpass_setup(struct tsf_voice_lowpass* e, float Fc)
 	e->a1 = 2 * e->a0;
 	e->b1 = 2 * (KK - 1) * norm;
 	e->b2 = (1 - K * e->QInv + KK) * norm;
+	e->a0FP = (int32_t)(e->a0 * (1 << 28));
+	e->a1FP = (int32_t)(e->a1 * (1 << 28));
+	e->b1FP = (int32_t)(e->b1 * (1 << 28));
+	e->b2FP = (int32_t)(e->b2 * (1 << 28));
 }
 
 static float tsf_voice_lowpass_process(struct tsf_voice_lowpass* e, double In)
@@ -1197,6 +1349,8 @@ static void tsf_voice_lfo_setup(struct tsf_voice_lfo* e, float delay, int freqCe
 	e->samplesUntil = (int)(delay * outSampleRate);
 	e->delta = (4.0f * tsf_cents2Hertz((float)freqCents) / outSampleRate);
 	e->level = 0;
+	e->deltaFP = (int32_t)(e->delta * (1 << 30));
+	e->levelFP = 0;
 }
 
 static void tsf_voice_lfo_process(struct tsf_voice_lfo* e, int blockSamples)
@@ -1229,6 +1383,37 @@ static void tsf_voice_endquick(struct tsf_voice* v, float outSampleRate)
 	v->modenv.parameters.release = 0.0f; tsf_voice_envelope_nextsegment(&v->modenv, TSF_SEGMENT_SUSTAIN, outSampleRate);
 }
 
+// Already on its way out after tsf_voice_endquick(), or a release that short anyway
+static TSF_BOOL tsf_voice_fading(struct tsf_voice* v)
+{
+	return (v->ampenv.segment >= TSF_SEGMENT_RELEASE && v->ampenv.parameters.release <= 0);
+}
+
+// The voice least missed if it stopped now: released before held, then quietest, then oldest.
+// Voices of the note being started (playIndex) are never picked, nor fading ones if asked.
+static struct tsf_voice* tsf_voice_victim(tsf* f, unsigned int playIndex, TSF_BOOL skipFading)
+{
+	struct tsf_voice *v = f->voices, *vEnd = v + f->voiceNum, *best = TSF_NULL;
+	TSF_BOOL bestReleased = TSF_FALSE;
+	float bestDB = 0;
+	for (; v != vEnd; v++)
+	{
+		TSF_BOOL released; float level, db;
+		if (v->playingPreset == -1 || v->playIndex == playIndex) continue;
+		if (skipFading && tsf_voice_fading(v)) continue;
+		released = (v->ampenv.segment >= TSF_SEGMENT_RELEASE);
+		level = (v->ampenv.levelIsFixed ? v->ampenv.levelFP * (1.0f / (1 << 30)) : v->ampenv.level);
+		db = v->noteGainDB + tsf_gainToDecibels(level);
+		if (best)
+		{
+			if (bestReleased != released) { if (bestReleased) continue; }
+			else if (db > bestDB || (db == bestDB && v->playIndex > best->playIndex)) continue;
+		}
+		best = v; bestReleased = released; bestDB = db;
+	}
+	return best;
+}
+
 static void tsf_voice_calcpitchratio(struct tsf_voice* v, float pitchShift, float outSampleRate)
 {
 	double note = v->playingKey + v->region->transpose + v->region->tune / 100.0;
@@ -1238,39 +1423,32 @@ static void tsf_voice_calcpitchratio(struct tsf_voice* v, float pitchShift, floa
 	v->pitchOutputFactor = v->region->sample_rate / (tsf_timecents2Secsd(v->region->pitch_keycenter * 100.0) * outSampleRate);
 }
 
+// The cached block holding sample pos, whose first sample is returned in *first
+static const short* tsf_cache_samples(tsf *f, unsigned int pos, unsigned int *first)
+{
+	struct tsf_cache *c = &f->cache;
+	unsigned int block = pos >> (c->shift - 1);
+	unsigned char *data = tsf_cache_find(c, block);
+	*first = block << (c->shift - 1);
+	if (data) return (const short*)data;
+
+	// Read the block, and the ones after it while they're missing since the stream is already there
+	struct tsf_stream *stream = f->hydra->stream;
+	data = tsf_cache_claim(c, block);
+	stream->seek(stream->data, block << c->shift);
+	stream->read(stream->data, data, 1 << c->shift);
+	int slot = c->lruHead;
+	for (int i = 1; i <= f->readAhead && tsf_cache_slot(c, block + i) < 0; i++)
+		stream->read(stream->data, tsf_cache_claim(c, block + i), 1 << c->shift);
+	tsf_cache_touch(c, slot);
+	return (const short*)data;
+}
+
 short tsf_read_short_cached(tsf *f, int pos)
 {
-	static int hits = 0;
-	static int misses = 0;
-//	static int call =0;
-//	call++;
-//	if ((call % 88000) ==0) printf("Hit: %d, Miss: %d, Ratio: %f\n", hits, misses, (double)hits/(double)(misses+hits));
-
-	for (int i=0; i<TSF_BUFFS; i++) {
-		if ((f->offset[i] <= pos) && ((f->offset[i] + TSF_BUFFSIZE) > pos) ) {
-			f->timestamp[i] = f->epoch++;
-			if (f->epoch==0) {
-				for (int i=0; i<TSF_BUFFS; i++) f->timestamp[i] = f->epoch++;
-			}
-			hits++;
-      return f->buffer[i][pos - f->offset[i]];
-		}
-	}
-	int repl = 0;
-	for (int i=1; i<TSF_BUFFS; i++) {
-		if (f->timestamp[i] < f->timestamp[repl]) repl = i;
-	}
-	int readOff = pos - (pos % TSF_BUFFSIZE);
-// for (int i=0; i<TSF_BUFFSIZE; i++) { f->buffer[repl][i] = i; }
-	f->hydra->stream->seek(f->hydra->stream->data, readOff * sizeof(short));
-	f->hydra->stream->read(f->hydra->stream->data, f->buffer[repl], TSF_BUFFSIZE * sizeof(short));
-//static uint32_t *bp = NULL; if (!bp) bp = (uint32_t*)malloc(512);
-//printf("off=%08x, buff=%p, len=%08x\n", readOff * sizeof(short), bp, TSF_BUFFSIZE); spi_flash_read(0x0000, bp, 512/4-4) ;
-	f->timestamp[repl] = f->epoch++;
-	f->offset[repl] = readOff;
-	misses++;
-//	fprintf(stderr, "buffer[%d][%d-%d = %d]\n", repl, pos, readOff, pos - readOff);
-	return f->buffer[repl][pos - readOff];
+	unsigned int first;
+	const short *data = tsf_cache_samples(f, pos, &first);
+	return data[pos - first];
 }
 
 static void tsf_voice_render(tsf* f, struct tsf_voice* v, float* outputBuffer, int numSamples)
@@ -1422,6 +1600,7 @@ static void tsf_voice_render(tsf* f, struct tsf_voice* v, float* outputBuffer, i
 }
 
 
+#if !defined(TSF_FIXEDPOINT) || !TSF_FIXEDPOINT
 //void DumpF32P32(char *name, long long x) {
 //  printf("%s = %08x.%08x\n", name, (int32_t)((x>>32)&0xffffffff), (int32_t)(x&0xffffffff));
 //}
@@ -1445,6 +1624,10 @@ static void tsf_voice_render_fast(tsf* f, struct tsf_voice* v, short* outputBuff
   fixed32p32 tmpSourceSamplePositionF32P32 = v->sourceSamplePositionF32P32;
   struct tsf_voice_lowpass tmpLowpass = v->lowpass;
 
+  // The cache block the voice is reading from, only looked up again once it steps outside
+  const short* blk = TSF_NULL;
+  unsigned int blkFirst = 0, blkLen = 0, blkSize = 1 << (f->cache.shift - 1);
+
   TSF_BOOL dynamicLowpass = (region->modLfoToFilterFc || region->modEnvToFilterFc);
   float tmpSampleRate = f->outSampleRate, tmpInitialFilterFc, tmpModLfoToFilterFc, tmpModEnvToFilterFc;
 
@@ -1501,11 +1684,32 @@ static void tsf_voice_render_fast(tsf* f, struct tsf_voice* v, short* outputBuff
     if (updateModLFO) tsf_voice_lfo_process(&v->modlfo, blockSamples);
     if (updateVibLFO) tsf_voice_lfo_process(&v->viblfo, blockSamples);
 
-    while (blockSamples-- && tmpSourceSamplePositionF32P32 < tmpSampleEndF32P32)
+    if (f->outputmode == TSF_STEREO_INTERLEAVED)
+    {
+      // Panned, written as left/right pairs
+      short gainLeftFP = gainMono * v->panFactorLeft * 32767, gainRightFP = gainMono * v->panFactorRight * 32767;
+      while (blockSamples-- && tmpSourceSamplePositionF32P32 < tmpSampleEndF32P32)
+      {
+        unsigned int pos = (unsigned int)(tmpSourceSamplePositionF32P32>>32);
+        if (pos == 0xffffffff) pos = 0;
+        if (pos - blkFirst >= blkLen) { blk = tsf_cache_samples(f, pos, &blkFirst); blkLen = blkSize; }
+        int val = blk[pos - blkFirst];
+
+        *outL++ += (val * gainLeftFP)>>16;
+        *outL++ += (val * gainRightFP)>>16;
+
+        // Next sample.
+        tmpSourceSamplePositionF32P32 += pitchRatioF32P32;
+        if (tmpSourceSamplePositionF32P32 >= tmpLoopEndF32P32 && isLooping)
+          tmpSourceSamplePositionF32P32 -= (tmpLoopEndF32P32 - tmpLoopStartF32P32 + (1LL<<32));
+      }
+    }
+    else while (blockSamples-- && tmpSourceSamplePositionF32P32 < tmpSampleEndF32P32)
     {
       unsigned int pos = (unsigned int)(tmpSourceSamplePositionF32P32>>32);
       if (pos == 0xffffffff) pos = 0;
-      short val = tsf_read_short_cached(f, pos);
+      if (pos - blkFirst >= blkLen) { blk = tsf_cache_samples(f, pos, &blkFirst); blkLen = blkSize; }
+      short val = blk[pos - blkFirst];
       int32_t val32 = (int)val * (int)gainMonoFP;
 
       *outL++ += val32>>16;
@@ -1527,6 +1731,255 @@ static void tsf_voice_render_fast(tsf* f, struct tsf_voice* v, short* outputBuff
   v->sourceSamplePositionF32P32 = tmpSourceSamplePositionF32P32;
   if (tmpLowpass.active || dynamicLowpass) v->lowpass = tmpLowpass;
 }
+#endif
+
+// 2^(i/64) in Q30, for table-driven pitch ratios and gains
+static const uint32_t tsf_pow2_table[65] PROGMEM = {
+	1073741824, 1085434106, 1097253708, 1109202018, 1121280436, 1133490379, 1145833280, 1158310587,
+	1170923762, 1183674286, 1196563654, 1209593378, 1222764986, 1236080024, 1249540052, 1263146652,
+	1276901417, 1290805962, 1304861917, 1319070932, 1333434672, 1347954824, 1362633090, 1377471191,
+	1392470869, 1407633882, 1422962010, 1438457051, 1454120821, 1469955159, 1485961921, 1502142985,
+	1518500250, 1535035634, 1551751076, 1568648537, 1585730000, 1602997467, 1620452965, 1638098541,
+	1655936265, 1673968228, 1692196547, 1710623359, 1729250827, 1748081133, 1767116489, 1786359126,
+	1805811301, 1825475297, 1845353420, 1865448001, 1885761398, 1906295993, 1927054196, 1948038440,
+	1969251188, 1990694927, 2012372174, 2034285470, 2056437387, 2078830522, 2101467502, 2124350982,
+	2147483648
+};
+
+// 2^(c16 / 19200) in Q30, c16 being in 1/16ths of a cent
+static uint64_t tsf_pow2_c16(int32_t c16)
+{
+	int32_t oct = c16 / 19200, rem = c16 % 19200;
+	if (rem < 0) { rem += 19200; oct--; }
+	int idx = rem / 300, frac = rem - idx * 300;
+	uint32_t lo = pgm_read_dword(&tsf_pow2_table[idx]), hi = pgm_read_dword(&tsf_pow2_table[idx + 1]);
+	uint64_t m = lo + (((uint64_t)(hi - lo) * frac) / 300);
+	if (oct >= 0) return m << (oct > 24 ? 24 : oct);
+	return (oct < -62) ? 0 : (m >> -oct);
+}
+
+// base^n, for a Q30 base between 0 and 1
+static int32_t tsf_pow_q30(int32_t base, int n)
+{
+	int64_t r = 1 << 30, b = base;
+	while (n) {
+		if (n & 1) r = (r * b) >> 30;
+		b = (b * b) >> 30;
+		n >>= 1;
+	}
+	return (int32_t)r;
+}
+
+static void tsf_voice_envelope_process_fixed(struct tsf_voice_envelope* e, int numSamples, float outSampleRate)
+{
+	if (e->slopeFP)
+	{
+		if (e->segmentIsExponential) e->levelFP = (int32_t)(((int64_t)e->levelFP * tsf_pow_q30(e->slopeFP, numSamples)) >> 30);
+		else
+		{
+			int64_t level = e->levelFP + (int64_t)e->slopeFP * numSamples;
+			e->levelFP = (int32_t)(level > 0x7fffffff ? 0x7fffffff : (level < -0x7fffffff ? -0x7fffffff : level));
+		}
+		e->levelIsFixed = TSF_TRUE;
+	}
+	if ((e->samplesUntilNextSegment -= numSamples) <= 0)
+		tsf_voice_envelope_nextsegment(e, e->segment, outSampleRate);
+}
+
+static void tsf_voice_lfo_process_fixed(struct tsf_voice_lfo* e, int blockSamples)
+{
+	int64_t level;
+	if (e->samplesUntil > blockSamples) { e->samplesUntil -= blockSamples; return; }
+	level = e->levelFP + (int64_t)e->deltaFP * blockSamples;
+	if      (level >  (1 << 30)) { e->deltaFP = -e->deltaFP; level =  (2LL << 30) - level; }
+	else if (level < -(1 << 30)) { e->deltaFP = -e->deltaFP; level = -(2LL << 30) - level; }
+	e->levelFP = (int32_t)level;
+}
+
+// Only done once per output rate, the per-block coefficients then come from this table
+static void tsf_lowpass_table(tsf* f)
+{
+	int i;
+	double maxCents = 1200.0 * TSF_LOG(0.499 * f->outSampleRate / 8.176) / TSF_LOG(2.0);
+	f->lowpassMaxCents = (maxCents > 13500.0 ? 13501 : (int)maxCents);
+	for (i = 0; i < TSF_LOWPASS_STEPS; i++)
+	{
+		float Fc = tsf_cents2Hertz((float)(i * 100)) / f->outSampleRate;
+		double K = (Fc < 0.4975f ? TSF_TAN(TSF_PI * Fc) : 127.0);
+		f->lowpassK[i] = (int32_t)(K * (1 << 24));
+	}
+}
+
+// Same filter as tsf_voice_lowpass_setup, with K interpolated from the table and Q28 coefficients
+static void tsf_voice_lowpass_setup_fixed(tsf* f, struct tsf_voice_lowpass* e, int32_t cents)
+{
+	int idx, frac;
+	int64_t K, KK, KQ, norm;
+	if (cents < 0) cents = 0;
+	idx = cents / 100, frac = cents - idx * 100;
+	K = f->lowpassK[idx] + (((int64_t)(f->lowpassK[idx + 1] - f->lowpassK[idx]) * frac) / 100);
+	KK = (K * K) >> 24;
+	KQ = (K * e->QInvFP) >> 24;
+	norm = (1LL << 52) / ((1 << 24) + KQ + KK);
+	e->a0FP = (int32_t)((KK * norm) >> 24);
+	e->a1FP = 2 * e->a0FP;
+	e->b1FP = (int32_t)((2 * (KK - (1 << 24)) * norm) >> 24);
+	e->b2FP = (int32_t)((((1 << 24) - KQ + KK) * norm) >> 24);
+}
+
+// Q15 in and out, the state is kept at Q43 and the fed back output at Q20
+static int32_t tsf_voice_lowpass_process_fixed(struct tsf_voice_lowpass* e, int32_t In)
+{
+	int64_t acc = (int64_t)In * e->a0FP + e->z1FP;
+	int32_t Out;
+	if (acc > (1LL << 53)) acc = 1LL << 53;
+	else if (acc < -(1LL << 53)) acc = -(1LL << 53);
+	Out = (int32_t)(acc >> 23);
+	e->z1FP = (int64_t)In * e->a1FP + e->z2FP - (((int64_t)e->b1FP * Out) >> 5);
+	e->z2FP = (int64_t)In * e->a0FP - (((int64_t)e->b2FP * Out) >> 5);
+	Out >>= 5;
+	return (Out > 65535 ? 65535 : (Out < -65535 ? -65535 : Out));
+}
+
+// Redo the fixed-point copies of the voice's gain, pan and pitch, only when they've changed
+static void tsf_voice_fixed_params(struct tsf_voice* v)
+{
+	v->fixedGainDB = v->noteGainDB;
+	v->fixedPanLeft = v->panFactorLeft;
+	v->fixedPanRight = v->panFactorRight;
+	v->fixedTimecents = v->pitchInputTimecents;
+	v->fixedOutputFactor = v->pitchOutputFactor;
+	// 6.0206dB per octave of 19200
+	v->gainC16 = (v->noteGainDB > -100.f ? (int32_t)(v->noteGainDB * (19200.0f / 6.0206f)) : -0x40000000);
+	v->panLeftFP = (int32_t)(v->panFactorLeft * 32767);
+	v->panRightFP = (int32_t)(v->panFactorRight * 32767);
+	v->pitchRatioFP = (fixed32p32)(tsf_timecents2Secsd(v->pitchInputTimecents) * v->pitchOutputFactor * 4294967296.0);
+}
+
+// Q15 gain from 1/16 cents of 2^x and the amp envelope, at most 1.0
+static int32_t tsf_voice_gain_fixed(int32_t gainC16, int32_t ampLevelFP)
+{
+	uint64_t noteGain = tsf_pow2_c16(gainC16 > 38400 ? 38400 : gainC16);
+	int64_t gain = (int64_t)((noteGain * (uint64_t)(ampLevelFP > 0 ? ampLevelFP : 0)) >> 45);
+	return (int32_t)(gain > 32767 ? 32767 : gain);
+}
+
+static void tsf_voice_render_fixed(tsf* f, struct tsf_voice* v, int32_t* outputBuffer, int numSamples)
+{
+	struct tsf_region* region = v->region;
+	int32_t* outL = outputBuffer;
+	int32_t* outR = (f->outputmode == TSF_STEREO_UNWEAVED ? outL + numSamples : TSF_NULL);
+
+	// Cache some values, to give them at least some chance of ending up in registers.
+	TSF_BOOL updateModEnv = (region->modEnvToPitch || region->modEnvToFilterFc);
+	TSF_BOOL updateModLFO = (v->modlfo.deltaFP && (region->modLfoToPitch || region->modLfoToFilterFc || region->modLfoToVolume));
+	TSF_BOOL updateVibLFO = (v->viblfo.deltaFP && (region->vibLfoToPitch));
+	TSF_BOOL isLooping    = (v->loopStart < v->loopEnd);
+	unsigned int tmpLoopStart = v->loopStart, tmpLoopEnd = v->loopEnd;
+	fixed32p32 tmpSampleEndF32P32 = ((fixed32p32)(region->end)) << 32;
+	fixed32p32 tmpLoopEndF32P32 = ((fixed32p32)(tmpLoopEnd + 1)) << 32;
+	fixed32p32 tmpLoopLengthF32P32 = ((fixed32p32)(tmpLoopEnd - tmpLoopStart + 1)) << 32;
+	fixed32p32 tmpSourceSamplePositionF32P32 = v->sourceSamplePositionF32P32;
+	struct tsf_voice_lowpass* lowpass = &v->lowpass;
+
+	// The cache block the voice is reading from, only looked up again once it steps outside
+	const short* blk = TSF_NULL;
+	unsigned int blkFirst = 0, blkLen = 0, blkSize = 1 << (f->cache.shift - 1);
+
+	TSF_BOOL dynamicLowpass = (region->modLfoToFilterFc || region->modEnvToFilterFc);
+	TSF_BOOL dynamicPitchRatio = (region->modLfoToPitch || region->modEnvToPitch || region->vibLfoToPitch);
+	TSF_BOOL dynamicGain = (region->modLfoToVolume != 0);
+	fixed32p32 pitchRatioF32P32;
+
+	if (v->noteGainDB != v->fixedGainDB || v->panFactorLeft != v->fixedPanLeft || v->panFactorRight != v->fixedPanRight ||
+	    v->pitchInputTimecents != v->fixedTimecents || v->pitchOutputFactor != v->fixedOutputFactor)
+		tsf_voice_fixed_params(v);
+	pitchRatioF32P32 = v->pitchRatioFP;
+
+	while (numSamples)
+	{
+		int32_t gainMono, gainLeft, gainRight, gainC16 = v->gainC16;
+		int blockSamples = (numSamples > TSF_RENDER_EFFECTSAMPLEBLOCK ? TSF_RENDER_EFFECTSAMPLEBLOCK : numSamples);
+		numSamples -= blockSamples;
+
+		if (dynamicLowpass)
+		{
+			int32_t fres = region->initialFilterFc + (int32_t)(((int64_t)v->modlfo.levelFP * region->modLfoToFilterFc + (int64_t)v->modenv.levelFP * region->modEnvToFilterFc) >> 30);
+			lowpass->active = (fres < f->lowpassMaxCents);
+			if (lowpass->active) tsf_voice_lowpass_setup_fixed(f, lowpass, fres);
+		}
+
+		if (dynamicPitchRatio)
+		{
+			// Cents to 1/16 cents is Q30 to Q26, kept within 4 octaves either way
+			int64_t modC16 = ((int64_t)v->modlfo.levelFP * region->modLfoToPitch + (int64_t)v->viblfo.levelFP * region->vibLfoToPitch + (int64_t)v->modenv.levelFP * region->modEnvToPitch) >> 26;
+			if (modC16 > 76800) modC16 = 76800;
+			else if (modC16 < -76800) modC16 = -76800;
+			pitchRatioF32P32 = (fixed32p32)(((uint64_t)(v->pitchRatioFP >> 14) * tsf_pow2_c16((int32_t)modC16)) >> 16);
+		}
+
+		// Centibels are 318.9 1/16 cents each
+		if (dynamicGain)
+			gainC16 += (int32_t)(((int64_t)v->modlfo.levelFP * region->modLfoToVolume * 319) >> 30);
+
+		gainMono = tsf_voice_gain_fixed(gainC16, v->ampenv.levelFP);
+
+		// Update EG.
+		tsf_voice_envelope_process_fixed(&v->ampenv, blockSamples, f->outSampleRate);
+		if (updateModEnv) tsf_voice_envelope_process_fixed(&v->modenv, blockSamples, f->outSampleRate);
+
+		// Update LFOs.
+		if (updateModLFO) tsf_voice_lfo_process_fixed(&v->modlfo, blockSamples);
+		if (updateVibLFO) tsf_voice_lfo_process_fixed(&v->viblfo, blockSamples);
+
+		gainLeft = (gainMono * v->panLeftFP) >> 15, gainRight = (gainMono * v->panRightFP) >> 15;
+		while (blockSamples-- && tmpSourceSamplePositionF32P32 < tmpSampleEndF32P32)
+		{
+			unsigned int pos = (unsigned int)(tmpSourceSamplePositionF32P32 >> 32), nextPos;
+			int32_t val, next;
+			if (pos == 0xffffffff) pos = 0;
+			nextPos = (pos >= tmpLoopEnd && isLooping ? tmpLoopStart : pos + 1);
+			if (pos - blkFirst >= blkLen) { blk = tsf_cache_samples(f, pos, &blkFirst); blkLen = blkSize; }
+			val = blk[pos - blkFirst];
+			next = (nextPos - blkFirst < blkLen) ? blk[nextPos - blkFirst] : tsf_read_short_cached(f, nextPos);
+
+			// Linear interpolation, with a Q14 fraction so the product stays within 32 bits
+			val += ((next - val) * (int32_t)((uint32_t)tmpSourceSamplePositionF32P32 >> 18)) >> 14;
+
+			// Low-pass filter.
+			if (lowpass->active) val = tsf_voice_lowpass_process_fixed(lowpass, val);
+
+			switch (f->outputmode)
+			{
+				case TSF_STEREO_INTERLEAVED:
+					*outL++ += (val * gainLeft + 0x4000) >> 15;
+					*outL++ += (val * gainRight + 0x4000) >> 15;
+					break;
+				case TSF_STEREO_UNWEAVED:
+					*outL++ += (val * gainLeft + 0x4000) >> 15;
+					*outR++ += (val * gainRight + 0x4000) >> 15;
+					break;
+				case TSF_MONO:
+					*outL++ += (val * gainMono + 0x4000) >> 15;
+					break;
+			}
+
+			// Next sample.
+			tmpSourceSamplePositionF32P32 += pitchRatioF32P32;
+			if (tmpSourceSamplePositionF32P32 >= tmpLoopEndF32P32 && isLooping)
+				tmpSourceSamplePositionF32P32 -= tmpLoopLengthF32P32;
+		}
+
+		if (tmpSourceSamplePositionF32P32 >= tmpSampleEndF32P32 || v->ampenv.segment == TSF_SEGMENT_DONE)
+		{
+			tsf_voice_kill(v);
+			return;
+		}
+	}
+
+	v->sourceSamplePositionF32P32 = tmpSourceSamplePositionF32P32;
+}
+
 
 
 
@@ -1607,18 +2060,19 @@ TSFDEF tsf* tsf_load(struct tsf_stream* stream)
 		res->fontSamplesOffset = fontSamplesOffset;
  		res->fontSampleCount = fontSampleCount; 
 		res->outSampleRate = 44100.0f;
+		tsf_lowpass_table(res);
 		res->hydra = (struct tsf_hydra*)TSF_MALLOC(sizeof(struct tsf_hydra));
 		TSF_MEMCPY(res->hydra, &hydra, sizeof(*res->hydra));
 		res->hydra->stream = (struct tsf_stream*)TSF_MALLOC(sizeof(struct tsf_stream));
 		TSF_MEMCPY(res->hydra->stream, stream, sizeof(*res->hydra->stream));
 
 		// Cached sample
-		for (int i=0; i<TSF_BUFFS; i++) {
-			res->buffer[i] = (short*)TSF_MALLOC(TSF_BUFFSIZE * sizeof(short));
-			res->offset[i] = 0xfffffff;
-			res->timestamp[i] = -1;
+		if (!tsf_cache_init(&res->cache, TSF_BUFFS, TSF_BUFFSIZE * sizeof(short)))
+		{
+			tsf_close(res);
+			return TSF_NULL;
 		}
-		res->epoch = 0;
+		res->readAhead = 0;
 	}
 	return res;
 }
@@ -1633,13 +2087,33 @@ TSFDEF void tsf_close(tsf* f)
 	TSF_FREE(f->voices);
 	if (f->channels) { TSF_FREE(f->channels->channels); TSF_FREE(f->channels); }
 	TSF_FREE(f->outputSamples);
+	TSF_FREE(f->mixSamples);
 	f->hydra->stream->close(f->hydra->stream->data);
 	TSF_FREE(f->hydra->stream);
 	TSF_FREE(f->hydra);
-	for (int i=0; i<TSF_BUFFS; i++) TSF_FREE(f->buffer[i]);
+	tsf_cache_free(&f->cache);
 	TSF_FREE(f);
 }
 
+TSFDEF int tsf_set_cache(tsf* f, int blocks, int block_samples, int read_ahead)
+{
+	struct tsf_cache c;
+	// Voices interpolate across block edges, which needs room for two
+	if (blocks < 2) blocks = 2;
+	if (!tsf_cache_init(&c, blocks, block_samples * sizeof(short))) return 0;
+	tsf_cache_free(&f->cache);
+	f->cache = c;
+	// Read-ahead must leave the block which was asked for in the cache
+	f->readAhead = (read_ahead < 0) ? 0 : (read_ahead >= blocks) ? blocks - 1 : read_ahead;
+	return 1;
+}
+
+TSFDEF void tsf_get_cache_stats(tsf* f, unsigned int* hits, unsigned int* misses)
+{
+	*hits = f->cache.hits;
+	*misses = f->cache.misses;
+}
+
 TSFDEF void tsf_reset(tsf* f)
 {
 	struct tsf_voice *v = f->voices, *vEnd = v + f->voiceNum;
@@ -1679,6 +2153,7 @@ TSFDEF void tsf_set_output(tsf* f, enum TSFOutputMode outputmode, int samplerate
 {
 	f->outputmode = outputmode;
 	f->outSampleRate = (float)(samplerate >= 1 ? samplerate : 44100.0f);
+	tsf_lowpass_table(f);
 	f->globalGainDB = global_gain_db;
 }
 
@@ -1708,6 +2183,14 @@ TSFDEF void tsf_note_on(tsf* f, int preset_index, int key, float vel)
 		}
 		else for (; v != vEnd; v++) if (v->playingPreset == -1) { voice = v; break; }
 
+		if (f->maxVoices && tsf_active_voice_count(f) >= f->maxVoices)
+		{
+			// Over the cap, so take a playing voice over instead of starting another
+			voice = tsf_voice_victim(f, voicePlayIndex, TSF_FALSE);
+			if (!voice) continue;
+			f->voicesStolen++;
+		}
+
 		if (!voice)
 		{
 			f->voiceNum += 4;
@@ -1757,13 +2240,16 @@ TSFDEF void tsf_note_on(tsf* f, int preset_index, int key, float vel)
 		lowpassFc = (region->initialFilterFc <= 13500 ? tsf_cents2Hertz((float)region->initialFilterFc) / f->outSampleRate : 1.0f);
 		lowpassFilterQDB = region->initialFilterQ / 10.0f;
 		voice->lowpass.QInv = 1.0 / TSF_POW(10.0, (lowpassFilterQDB / 20.0));
+		voice->lowpass.QInvFP = (int32_t)(voice->lowpass.QInv * (1 << 24));
 		voice->lowpass.z1 = voice->lowpass.z2 = 0;
+		voice->lowpass.z1FP = voice->lowpass.z2FP = 0;
 		voice->lowpass.active = (lowpassFc < 0.499f);
 		if (voice->lowpass.active) tsf_voice_lowpass_setup(&voice->lowpass, lowpassFc);
 
 		// Setup LFO filters.
 		tsf_voice_lfo_setup(&voice->modlfo, region->delayModLFO, region->freqModLFO, f->outSampleRate);
 		tsf_voice_lfo_setup(&voice->viblfo, region->delayVibLFO, region->freqVibLFO, f->outSampleRate);
+		tsf_voice_fixed_params(voice);
 	}
 }
 
@@ -1818,6 +2304,28 @@ TSFDEF int tsf_active_voice_count(tsf* f)
 	return count;
 }
 
+TSFDEF void tsf_set_max_voices(tsf* f, int max_voices)
+{
+	struct tsf_voice *v, *vEnd;
+	int held = 0;
+	f->maxVoices = (max_voices > 0 ? max_voices : 0);
+	if (!f->maxVoices) return;
+	for (v = f->voices, vEnd = v + f->voiceNum; v != vEnd; v++)
+		if (v->playingPreset != -1 && !tsf_voice_fading(v)) held++;
+	for (; held > f->maxVoices; held--)
+	{
+		v = tsf_voice_victim(f, f->voicePlayIndex, TSF_TRUE);
+		if (!v) break;
+		tsf_voice_endquick(v, f->outSampleRate);
+		f->voicesStolen++;
+	}
+}
+
+TSFDEF unsigned int tsf_get_stolen_voices(tsf* f)
+{
+	return f->voicesStolen;
+}
+
 TSFDEF void tsf_render_short(tsf* f, short* buffer, int samples, int flag_mixing)
 {
 	float *floatSamples;
@@ -1857,8 +2365,39 @@ TSFDEF void tsf_render_float(tsf* f, float* buffer, int samples, int flag_mixing
 			tsf_voice_render(f, v, buffer, samples);
 }
 
+TSFDEF void tsf_render_short_fixed(tsf* f, short* buffer, int samples, int flag_mixing)
+{
+	struct tsf_voice *v = f->voices, *vEnd = v + f->voiceNum;
+	int channelSamples = (f->outputmode == TSF_MONO ? 1 : 2) * samples, mixBufferSize = channelSamples * sizeof(int32_t);
+	int32_t *mix, *mixEnd;
+	if (mixBufferSize > f->mixSampleSize)
+	{
+		TSF_FREE(f->mixSamples);
+		f->mixSamples = (int32_t*)TSF_MALLOC(mixBufferSize);
+		f->mixSampleSize = (f->mixSamples ? mixBufferSize : 0);
+		if (!f->mixSamples) return;
+	}
+
+	TSF_MEMSET(f->mixSamples, 0, mixBufferSize);
+	for (; v != vEnd; v++) {
+		if (v->playingPreset != -1)
+			tsf_voice_render_fixed(f, v, f->mixSamples, samples);
+		yield();
+	}
+
+	// Voices are summed at 32 bits and only saturated once, here
+	for (mix = f->mixSamples, mixEnd = mix + channelSamples; mix != mixEnd; mix++, buffer++)
+	{
+		int32_t vi = *mix + (flag_mixing ? *buffer : 0);
+		*buffer = (short)(vi < -32768 ? -32768 : (vi > 32767 ? 32767 : vi));
+	}
+}
+
 TSFDEF void tsf_render_short_fast(tsf* f, short* buffer, int samples, int flag_mixing)
 {
+#if defined(TSF_FIXEDPOINT) && TSF_FIXEDPOINT
+  tsf_render_short_fixed(f, buffer, samples, flag_mixing);
+#else
   struct tsf_voice *v = f->voices, *vEnd = v + f->voiceNum;
   if (!flag_mixing) TSF_MEMSET(buffer, 0, (f->outputmode == TSF_MONO ? 1 : 2) * sizeof(short) * samples);
   for (; v != vEnd; v++) {
@@ -1866,6 +2405,7 @@ TSFDEF void tsf_render_short_fast(tsf* f, short* buffer, int samples, int flag_m
       tsf_voice_render_fast(f, v, buffer, samples);
     yield();
   }
+#endif
 }
 
 
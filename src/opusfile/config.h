@@ -126,3 +126,7 @@
 
 /* We need at least WindowsXP for getaddrinfo/freeaddrinfo */
 /* #undef _WIN32_WINNT */
+
+/* ESP8266Audio: charge all heap use to the owning AudioGenerator, see AudioMemory.h */
+#define AUDIOMEMORY_REDIRECT
+#include "../AudioMemory.h"
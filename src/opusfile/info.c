@@ -60,10 +60,27 @@ int opus_head_parse(OpusHead *_head,const unsigned char *_data,size_t _len){
       _head->mapping[1]=1;
     }
   }
-  else if(head.mapping_family==1){
+  /*ESP8266Audio: family 2 (RFC 8486 ambisonics) is laid out exactly like
+     family 1, only the channel counts differ.
+    Family 3 needs a demixing matrix and isn't supported.*/
+  else if(head.mapping_family==1||head.mapping_family==2){
     size_t size;
     int    ci;
-    if(head.channel_count<1||head.channel_count>8)return OP_EBADHEADER;
+    if(head.mapping_family==1){
+      if(head.channel_count<1||head.channel_count>8)return OP_EBADHEADER;
+    }
+    else{
+      int order_plus_one;
+      int acn_channels;
+      /*(order+1)^2 ambisonic channels, optionally plus a non-diegetic pair.*/
+      for(order_plus_one=1;order_plus_one*order_plus_one<=head.channel_count
+       &&order_plus_one<=15;order_plus_one++);
+      acn_channels=(order_plus_one-1)*(order_plus_one-1);
+      if(head.channel_count<1||(head.channel_count!=acn_channels
+       &&head.channel_count!=acn_channels+2)){
+        return OP_EBADHEADER;
+      }
+    }
     size=21+head.channel_count;
     if(_len<size||head.version<=1&&_len>size)return OP_EBADHEADER;
     head.stream_count=_data[19];
@@ -80,7 +97,8 @@ int opus_head_parse(OpusHead *_head,const unsigned char *_data,size_t _len){
   }
   /*General purpose players should not attempt to play back content with
      channel mapping family 255.*/
-  else if(head.mapping_family==255)return OP_EIMPL;
+  else if(head.mapping_family==255
+   ||head.mapping_family==3)return OP_EIMPL;
   /*No other channel mapping families are currently defined.*/
   else return OP_EBADHEADER;
   if(_head!=NULL)memcpy(_head,&head,head.mapping-(unsigned char *)&head);
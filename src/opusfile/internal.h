@@ -110,6 +110,9 @@ void op_fatal_impl(const char *_str,const char *_file,int _line);
 
 /*The maximum channel count for any mapping we'll actually decode.*/
 # define OP_NCHANNELS_MAX (2)
+/*ESP8266Audio: ...and for any we'll decode through a mix, up to 7.1 or
+   third order ambisonics with a non-diegetic stereo pair.*/
+# define OP_MIX_CHANNELS_MAX (18)
 
 /*Initial state.*/
 # define  OP_NOTOPEN   (0)
@@ -224,13 +227,21 @@ struct OggOpusFile{
   /*The channel count used to initialize the decoder.*/
   int                od_channel_count;
   /*The channel mapping used to initialize the decoder.*/
-  unsigned char      od_mapping[OP_NCHANNELS_MAX];
+  unsigned char      od_mapping[OP_MIX_CHANNELS_MAX];
+  /*ESP8266Audio: the mixing decoder used instead of od, when mix_cb picks one.*/
+  OpusMixDecoder    *omd;
+  op_mix_cb_func     mix_cb;
+  void              *mix_cb_ctx;
+  /*The number of channels decoded into od_buffer.*/
+  int                od_out_channels;
   /*The buffered data for one decoded packet.*/
   op_sample         *od_buffer;
   /*The current position in the decoded buffer.*/
   int                od_buffer_pos;
   /*The number of valid samples in the decoded buffer.*/
   int                od_buffer_size;
+  /*ESP8266Audio: the number of samples per channel od_buffer has room for.*/
+  int                od_buffer_frames;
   /*The type of gain offset to apply.
     One of OP_HEADER_GAIN, OP_ALBUM_GAIN, OP_TRACK_GAIN, or OP_ABSOLUTE_GAIN.*/
   int                gain_type;
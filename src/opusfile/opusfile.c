@@ -149,6 +149,7 @@ static int op_get_data(OggOpusFile *_of,int _nbytes){
   int            nbytes;
   OP_ASSERT(_nbytes>0);
   buffer=(unsigned char *)ogg_sync_buffer(&_of->oy,_nbytes);
+  if(OP_UNLIKELY(buffer==NULL))return OP_EFAULT;
   nbytes=(int)(*_of->callbacks.read)(_of->stream,buffer,_nbytes);
   OP_ASSERT(nbytes<=_nbytes);
   if(OP_LIKELY(nbytes>0))ogg_sync_wrote(&_of->oy,nbytes);
@@ -291,6 +292,15 @@ struct OpusSeekRecord{
   ogg_int64_t  gp;
 };
 
+/*ESP8266Audio: keep the arena bounds published in opusfile.h honest.*/
+typedef char op_file_size_check[sizeof(OggOpusFile)<=OP_FILE_SIZE_MAX?1:-1];
+typedef char op_link_size_check[sizeof(OggOpusLink)<=OP_LINK_SIZE_MAX?1:-1];
+typedef char op_seek_records_size_check[
+ 64*sizeof(OpusSeekRecord)<=OP_SEEK_RECORDS_SIZE_MAX?1:-1];
+typedef char op_decode_buffer_size_check[
+ OP_NCHANNELS_MAX*120*48*sizeof(op_sample)<=OP_DECODE_BUFFER_SIZE_MAX?1:-1];
+typedef char op_sync_slack_check[OP_READ_SIZE+4096<=OP_SYNC_SLACK?1:-1];
+
 /*Find the last page beginning before _offset with a valid granule position.
   There is no '_boundary' parameter as it will always have to read more data.
   This is much dirtier than the above, as Ogg doesn't have any backward search
@@ -1344,9 +1354,10 @@ static void op_update_gain(OggOpusFile *_of){
     default:OP_ASSERT(0);
   }
   gain_q8=OP_CLAMP(-32768,gain_q8,32767);
-  OP_ASSERT(_of->od!=NULL);
+  OP_ASSERT(_of->od!=NULL||_of->omd!=NULL);
 #if defined(OPUS_SET_GAIN)
-  opus_multistream_decoder_ctl(_of->od,OPUS_SET_GAIN(gain_q8));
+  if(_of->omd!=NULL)opus_mix_decoder_ctl(_of->omd,OPUS_SET_GAIN(gain_q8));
+  else opus_multistream_decoder_ctl(_of->od,OPUS_SET_GAIN(gain_q8));
 #else
 /*A fallback that works with both float and fixed-point is a bunch of work,
    so just force people to use a sufficiently new version.
@@ -1368,22 +1379,58 @@ static int op_make_decode_ready(OggOpusFile *_of){
   stream_count=head->stream_count;
   coupled_count=head->coupled_count;
   channel_count=head->channel_count;
-  /*Check to see if the current decoder is compatible with the current link.*/
-  if(_of->od!=NULL&&_of->od_stream_count==stream_count
+  if(OP_UNLIKELY(channel_count>OP_MIX_CHANNELS_MAX))return OP_EIMPL;
+  /*Check to see if the current decoder is compatible with the current link.
+    ESP8266Audio: the mix callback is taken to always pick the same mix for the
+     same layout.*/
+  if((_of->od!=NULL||_of->omd!=NULL)&&_of->od_stream_count==stream_count
    &&_of->od_coupled_count==coupled_count&&_of->od_channel_count==channel_count
    &&memcmp(_of->od_mapping,head->mapping,
    sizeof(*head->mapping)*channel_count)==0){
-    opus_multistream_decoder_ctl(_of->od,OPUS_RESET_STATE);
+    if(_of->omd!=NULL)opus_mix_decoder_ctl(_of->omd,OPUS_RESET_STATE);
+    else opus_multistream_decoder_ctl(_of->od,OPUS_RESET_STATE);
   }
   else{
-    int err;
+    opus_int16 matrix[OP_MIX_CHANNELS_MAX*2];
+    int        out_channels;
+    int        err;
     opus_multistream_decoder_destroy(_of->od);
-    _of->od=opus_multistream_decoder_create(48000,channel_count,
-     stream_count,coupled_count,head->mapping,&err);
-    if(_of->od==NULL)return OP_EFAULT;
+    _of->od=NULL;
+    if(_of->omd!=NULL)opus_mix_decoder_destroy(_of->omd);
+    _of->omd=NULL;
+    /*Force a rebuild next time if this fails part way.*/
+    _of->od_channel_count=0;
+    out_channels=0;
+    if(_of->mix_cb!=NULL){
+      memset(matrix,0,sizeof(matrix));
+      out_channels=(*_of->mix_cb)(_of->mix_cb_ctx,head,matrix);
+      if(OP_UNLIKELY(out_channels<0||out_channels>OP_NCHANNELS_MAX))return OP_EIMPL;
+    }
+    if(out_channels>0){
+      int ci;
+      /*The callback fills two columns, the decoder takes out_channels.*/
+      if(out_channels==1)for(ci=1;ci<channel_count;ci++)matrix[ci]=matrix[ci*2];
+      OP_ASSERT(opus_mix_decoder_get_size(channel_count,stream_count,
+       coupled_count,head->mapping,matrix,out_channels)<=OP_MIX_DECODER_OVERHEAD_MAX
+       +coupled_count*OP_COUPLED_DECODER_SIZE_MAX
+       +(stream_count-coupled_count)*OP_MONO_DECODER_SIZE_MAX);
+      _of->omd=opus_mix_decoder_create(48000,channel_count,stream_count,
+       coupled_count,head->mapping,matrix,out_channels,&err);
+      if(_of->omd==NULL)return OP_EFAULT;
+    }
+    else{
+      if(OP_UNLIKELY(channel_count>OP_NCHANNELS_MAX))return OP_EIMPL;
+      OP_ASSERT(opus_multistream_decoder_get_size(stream_count,coupled_count)
+       <=OP_DECODER_SIZE_MAX);
+      _of->od=opus_multistream_decoder_create(48000,channel_count,
+       stream_count,coupled_count,head->mapping,&err);
+      if(_of->od==NULL)return OP_EFAULT;
+      out_channels=channel_count;
+    }
     _of->od_stream_count=stream_count;
     _of->od_coupled_count=coupled_count;
     _of->od_channel_count=channel_count;
+    _of->od_out_channels=out_channels;
     memcpy(_of->od_mapping,head->mapping,sizeof(*head->mapping)*channel_count);
   }
   _of->ready_state=OP_INITSET;
@@ -1497,6 +1544,7 @@ static void op_clear(OggOpusFile *_of){
   OggOpusLink *links;
   _ogg_free(_of->od_buffer);
   if(_of->od!=NULL)opus_multistream_decoder_destroy(_of->od);
+  if(_of->omd!=NULL)opus_mix_decoder_destroy(_of->omd);
   links=_of->links;
   if(!_of->seekable){
     if(_of->ready_state>OP_OPENED||_of->ready_state==OP_PARTOPEN){
@@ -2741,6 +2789,12 @@ void op_set_decode_callback(OggOpusFile *_of,
   _of->decode_cb_ctx=_ctx;
 }
 
+void op_set_mix_callback(OggOpusFile *_of,
+ op_mix_cb_func _mix_cb,void *_ctx){
+  _of->mix_cb=_mix_cb;
+  _of->mix_cb_ctx=_ctx;
+}
+
 int op_set_gain_offset(OggOpusFile *_of,
  int _gain_type,opus_int32 _gain_offset_q8){
   if(_gain_type!=OP_HEADER_GAIN&&_gain_type!=OP_ALBUM_GAIN
@@ -2769,8 +2823,9 @@ void op_set_dither_enabled(OggOpusFile *_of,int _enabled){
 /*Allocate the decoder scratch buffer.
   This is done lazily, since if the user provides large enough buffers, we'll
    never need it.*/
-static int op_init_buffer(OggOpusFile *_of){
+static int op_init_buffer(OggOpusFile *_of,int _duration){
   int nchannels_max;
+  int frames;
   if(_of->seekable){
     const OggOpusLink *links;
     int                nlinks;
@@ -2779,13 +2834,25 @@ static int op_init_buffer(OggOpusFile *_of){
     nlinks=_of->nlinks;
     nchannels_max=1;
     for(li=0;li<nlinks;li++){
-      nchannels_max=OP_MAX(nchannels_max,links[li].head.channel_count);
+      nchannels_max=OP_MAX(nchannels_max,
+       OP_MIN(links[li].head.channel_count,OP_NCHANNELS_MAX));
     }
   }
   else nchannels_max=OP_NCHANNELS_MAX;
+  /*ESP8266Audio: size it for the packets actually seen rather than the 120 ms
+     any packet might last.
+    The first allocation covers the first packet (and at least 20 ms), and a
+     longer one later jumps straight to the maximum, so at most one smaller
+     buffer is ever thrown away.*/
+  frames=_of->od_buffer==NULL?OP_MAX(_duration,20*48):120*48;
+  _ogg_free(_of->od_buffer);
   _of->od_buffer=(op_sample *)_ogg_malloc(
-   sizeof(*_of->od_buffer)*nchannels_max*120*48);
-  if(_of->od_buffer==NULL)return OP_EFAULT;
+   sizeof(*_of->od_buffer)*nchannels_max*frames);
+  if(_of->od_buffer==NULL){
+    _of->od_buffer_frames=0;
+    return OP_EFAULT;
+  }
+  _of->od_buffer_frames=frames;
   return 0;
 }
 
@@ -2794,7 +2861,7 @@ static int op_decode(OggOpusFile *_of,op_sample *_pcm,
  const ogg_packet *_op,int _nsamples,int _nchannels){
   int ret;
   /*First we try using the application-provided decode callback.*/
-  if(_of->decode_cb!=NULL){
+  if(_of->decode_cb!=NULL&&_of->omd==NULL){
 #if defined(OP_FIXED_POINT)
     ret=(*_of->decode_cb)(_of->decode_cb_ctx,_of->od,_pcm,_op,
      _nsamples,_nchannels,OP_DEC_FORMAT_SHORT,_of->cur_link);
@@ -2805,7 +2872,16 @@ static int op_decode(OggOpusFile *_of,op_sample *_pcm,
   }
   else ret=OP_DEC_USE_DEFAULT;
   /*If the application didn't want to handle decoding, do it ourselves.*/
-  if(ret==OP_DEC_USE_DEFAULT){
+  if(ret==OP_DEC_USE_DEFAULT&&_of->omd!=NULL){
+    OP_ASSERT(_nchannels==_of->od_out_channels);
+#if defined(OP_FIXED_POINT)
+    ret=opus_mix_decode(_of->omd,_op->packet,_op->bytes,_pcm,_nsamples);
+#else
+# error "The ESP8266Audio mix decoder is fixed-point only"
+#endif
+    OP_ASSERT(ret<0||ret==_nsamples);
+  }
+  else if(ret==OP_DEC_USE_DEFAULT){
 #if defined(OP_FIXED_POINT)
     ret=opus_multistream_decode(_of->od,
      _op->packet,_op->bytes,_pcm,_nsamples,0);
@@ -2834,7 +2910,7 @@ static int op_read_native(OggOpusFile *_of,
       int od_buffer_pos;
       int nsamples;
       int op_pos;
-      nchannels=_of->links[_of->seekable?_of->cur_link:0].head.channel_count;
+      nchannels=_of->od_out_channels;
       od_buffer_pos=_of->od_buffer_pos;
       nsamples=_of->od_buffer_size-od_buffer_pos;
       /*If we have buffered samples, return them.*/
@@ -2885,8 +2961,8 @@ static int op_read_native(OggOpusFile *_of,
           op_sample *buf;
           /*If the user's buffer is too small, decode into a scratch buffer.*/
           buf=_of->od_buffer;
-          if(OP_UNLIKELY(buf==NULL)){
-            ret=op_init_buffer(_of);
+          if(OP_UNLIKELY(duration>_of->od_buffer_frames)){
+            ret=op_init_buffer(_of,duration);
             if(OP_UNLIKELY(ret<0))return ret;
             buf=_of->od_buffer;
           }
@@ -2964,7 +3040,7 @@ static int op_filter_read_native(OggOpusFile *_of,void *_dst,int _dst_sz,
     ret=_of->od_buffer_size-od_buffer_pos;
     if(OP_LIKELY(ret>0)){
       int nchannels;
-      nchannels=_of->links[_of->seekable?_of->cur_link:0].head.channel_count;
+      nchannels=_of->od_out_channels;
       ret=(*_filter)(_of,_dst,_dst_sz,
        _of->od_buffer+nchannels*od_buffer_pos,ret,nchannels);
       OP_ASSERT(ret>=0);
@@ -3097,6 +3173,25 @@ int op_read_stereo(OggOpusFile *_of,opus_int16 *_pcm,int _buf_size){
   return op_filter_read_native(_of,_pcm,_buf_size,op_stereo_filter,NULL);
 }
 
+int op_read_direct(OggOpusFile *_of,const opus_int16 **_pcm,int *_nchannels,
+ int *_li){
+  int ret;
+  /*Decode a packet into od_buffer if it's empty, exactly as
+     op_filter_read_native() does, and then hand all of it over.*/
+  ret=op_read_native(_of,NULL,0,_li);
+  if(OP_LIKELY(ret>=0)&&OP_LIKELY(_of->ready_state>=OP_INITSET)){
+    int od_buffer_pos;
+    od_buffer_pos=_of->od_buffer_pos;
+    ret=_of->od_buffer_size-od_buffer_pos;
+    if(OP_LIKELY(ret>0)){
+      *_pcm=_of->od_buffer+_of->od_out_channels*od_buffer_pos;
+      *_nchannels=_of->od_out_channels;
+      _of->od_buffer_pos=_of->od_buffer_size;
+    }
+  }
+  return ret;
+}
+
 # if !defined(OP_DISABLE_FLOAT_API)
 
 static int op_short2float_filter(OggOpusFile *_of,void *_dst,int _dst_sz,
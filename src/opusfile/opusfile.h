@@ -132,6 +132,37 @@ typedef struct OpusServerInfo    OpusServerInfo;
 typedef struct OpusFileCallbacks OpusFileCallbacks;
 typedef struct OggOpusFile       OggOpusFile;
 
+/*ESP8266Audio: upper bounds on what opusfile and libopus allocate on their own
+   behalf, so a caller can size a preallocated arena ahead of time.
+  The structure sizes are checked at compile time in opusfile.c, and the
+   decoder size is asserted where it is created.*/
+/*sizeof(OggOpusFile), which includes the ogg_stream_state and packet table.*/
+# define OP_FILE_SIZE_MAX           (14336)
+/*sizeof(OggOpusLink), one per link of a chained stream.*/
+# define OP_LINK_SIZE_MAX           (512)
+/*opus_multistream_decoder_get_size() for the worst mapping we accept, two
+   uncoupled mono streams.*/
+# define OP_DECODER_SIZE_MAX        (36864)
+/*opus_decoder_get_size() for one coupled and for one mono stream, and the
+   rest of a mix decoder, which only holds the streams its mix uses: its
+   header and the 120 ms stereo buffer each stream is decoded into.*/
+# define OP_COUPLED_DECODER_SIZE_MAX (27648)
+# define OP_MONO_DECODER_SIZE_MAX    (18432)
+# define OP_MIX_DECODER_OVERHEAD_MAX (256+2*120*48*2)
+/*The decoded-packet buffer, 120 ms of stereo 16-bit samples.
+  It starts out sized for the first packet's duration, so growing it may
+   leave up to 60 ms worth behind as well.*/
+# define OP_DECODE_BUFFER_SIZE_MAX  (2*120*48*2)
+/*The seek records used while enumerating the links of a seekable stream.*/
+# define OP_SEEK_RECORDS_SIZE_MAX   (2048)
+/*Ogg sync buffer space beyond the largest page: one read plus libogg's spare page.*/
+# define OP_SYNC_SLACK              (2048+4096)
+/*Transient allocations made while decoding a page (packet durations, CELT
+   pitch buffer, SILK resampler and LPC scratch), as total bytes and as a
+   count of blocks.*/
+# define OP_DECODE_SCRATCH_SIZE_MAX   (6144)
+# define OP_DECODE_SCRATCH_BLOCKS_MAX (8)
+
 /*Warning attributes for libopusfile functions.*/
 # if OP_GNUC_PREREQ(3,4)
 #  define OP_WARN_UNUSED_RESULT __attribute__((__warn_unused_result__))
@@ -1815,6 +1846,28 @@ typedef int (*op_decode_cb_func)(void *_ctx,OpusMSDecoder *_decoder,void *_pcm,
 void op_set_decode_callback(OggOpusFile *_of,
  op_decode_cb_func _decode_cb,void *_ctx) OP_ARG_NONNULL(1);
 
+/**ESP8266Audio: called as each link's decoder is set up, to pick the mix it is
+    decoded to.
+   \param _ctx       The application-provided callback context.
+   \param _head      The link's ID header.
+   \param[out] _matrix Zeroed on entry, holds <code>_head->channel_count</code>
+                      rows of two Q14 weights, one for each output channel
+                      (only the first is used for mono output).
+   \return The number of output channels (1 or 2), or 0 to decode the link as
+            is (only possible for one and two channel links).*/
+typedef int (*op_mix_cb_func)(void *_ctx,const OpusHead *_head,
+ opus_int16 *_matrix);
+
+/**ESP8266Audio: decodes through a mixing matrix rather than channel by channel.
+   Links with more than two channels are then decoded straight to the output
+    layout the callback picks, only decoding the streams it gives some weight,
+    and without that nothing wider than stereo will play.
+   It must be set between op_test_callbacks() and op_test_open().
+   Links the callback mixes (a non-zero return) bypass any callback set with
+    op_set_decode_callback(), which is only called for links decoded as is.*/
+void op_set_mix_callback(OggOpusFile *_of,
+ op_mix_cb_func _mix_cb,void *_ctx) OP_ARG_NONNULL(1);
+
 /**Gain offset type that indicates that the provided offset is relative to the
     header gain.
    This is the default.*/
@@ -2089,6 +2142,23 @@ OP_WARN_UNUSED_RESULT int op_read_float(OggOpusFile *_of,
 OP_WARN_UNUSED_RESULT int op_read_stereo(OggOpusFile *_of,
  opus_int16 *_pcm,int _buf_size) OP_ARG_NONNULL(1);
 
+/**ESP8266Audio: reads the rest of the current packet without copying it.
+   Decodes the next packet if need be and returns a pointer to its samples in
+    <tt>libopusfile</tt>'s own buffer, so a whole packet (up to 120 ms) comes
+    back in one call and is never copied in pieces as op_read_stereo() would.
+   The samples stay valid until the next call to any function that reads or
+    seeks.
+   \param _of             The \c OggOpusFile from which to read.
+   \param[out] _pcm       Set to the decoded samples, interleaved.
+   \param[out] _nchannels Set to the channels in \a _pcm, 1 or 2 (so only
+                           mono, stereo and mixed streams can be read).
+   \param[out] _li        The index of the link the samples came from, or
+                           <code>NULL</code>.
+   \return The number of samples per channel read, 0 at the end of the
+            stream, or a negative value on error as for op_read_stereo().*/
+OP_WARN_UNUSED_RESULT int op_read_direct(OggOpusFile *_of,
+ const opus_int16 **_pcm,int *_nchannels,int *_li) OP_ARG_NONNULL(1);
+
 /**Reads more samples from the stream and downmixes to stereo, if necessary.
    This function is intended for simple players that want a uniform output
     format, even if the channel count changes between links in a chained
@@ -10,12 +10,16 @@
 #include <string.h>
 #include <stdint.h>
 #include <stdarg.h>
+#include <time.h>
 
 #define PROGMEM
 #define PSTR
 #define memcpy_P memcpy
 #define sprintf_P sprintf
 #define yield() do {} while(0)
+
+static inline unsigned long micros() { struct timespec ts; clock_gettime(CLOCK_MONOTONIC, &ts); return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000; }
+static inline unsigned long millis() { return micros() / 1000; }
 #define printf_P printf
 #define strcpy_P strcpy
 #define snprintf_P snprintf
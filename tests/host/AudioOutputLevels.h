@@ -0,0 +1,31 @@
+#ifndef _AUDIOOUTPUTLEVELS_H
+#define _AUDIOOUTPUTLEVELS_H
+
+#include <Arduino.h>
+#include "AudioOutputNull.h"
+
+// Throws the audio away, but keeps its peak level, how many frames had L and R differ, and an FNV-1a
+// hash of it all.  Given refuseEvery, turns down one sample in that many, like a full I2S FIFO would.
+class AudioOutputLevels : public AudioOutputNull
+{
+  public:
+    AudioOutputLevels(int refuseEvery = 0) : refuseEvery(refuseEvery) { begin(); }
+    virtual bool begin() override { peak = 0; calls = 0; mismatch = 0; hash = 2166136261u; return AudioOutputNull::begin(); }
+    virtual bool ConsumeSample(int16_t sample[2]) override
+    {
+        if (refuseEvery && !(++calls % refuseEvery)) return false;
+        if (abs(sample[0]) > peak) peak = abs(sample[0]);
+        if (abs(sample[1]) > peak) peak = abs(sample[1]);
+        if (sample[0] != sample[1]) mismatch++;
+        hash = (hash ^ (uint16_t)sample[0]) * 16777619u;
+        hash = (hash ^ (uint16_t)sample[1]) * 16777619u;
+        return AudioOutputNull::ConsumeSample(sample);
+    }
+    int refuseEvery;
+    int peak;
+    int calls;
+    int mismatch;
+    uint32_t hash;
+};
+
+#endif
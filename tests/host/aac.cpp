@@ -2,8 +2,64 @@
 #include "AudioFileSourceSTDIO.h"
 #include "AudioOutputSTDIO.h"
 #include "AudioGeneratorAAC.h"
+#include "AudioGeneratorM4A.h"
+#include "AudioOutputLevels.h"
 
 #define AAC "../../examples/PlayAACFromPROGMEM/homer.aac"
+#define M4A "homer.m4a"
+#define HEAAC "heaac.aac" // 22.05kHz AAC-LC core with implicit SBR signalled in fill elements
+
+static void SBRStatusCB(void *cbData, int code, const char *string)
+{
+  (void) string;
+  if (code == AudioGeneratorAAC::STATUS_SBR_BYPASSED) (*(int *)cbData)++;
+}
+
+static void DecodeSBR(const char *name, const char *file, AudioGeneratorAAC::SBRMode mode, int maxLoad, AudioOutputLevels *out)
+{
+  AudioFileSourceSTDIO *in = new AudioFileSourceSTDIO(file);
+  AudioGeneratorAAC *aac = new AudioGeneratorAAC();
+  int bypassed = 0;
+  aac->RegisterStatusCB(SBRStatusCB, &bypassed);
+  aac->SetSBRMode(mode, maxLoad);
+  aac->begin(in, out);
+  while (aac->loop()) { /*noop*/ }
+  int load = aac->GetDecodeLoad();
+  Serial.printf("%s: %d samples at %dHz, hash %08x, bypassed=%d, status=%d, load=%d%%, load sane=%d\n", name,
+                out->GetSamples(), out->GetFrequency(), out->hash, aac->IsSBRBypassed(), bypassed, load,
+                (load >= 0) && (load < 100));
+  aac->stop();
+  // The SBR state is the decoder's largest block, and must be charged to the generator with the rest
+  Serial.printf("%s: heap peak=%u\n", name, aac->GetMemoryStats().heapPeak);
+  delete aac;
+  delete in;
+}
+
+static void TestSBR()
+{
+  // Plain AAC-LC has no SBR to drop, every mode must give the same bits
+  AudioOutputLevels *on = new AudioOutputLevels();
+  AudioOutputLevels *off = new AudioOutputLevels();
+  AudioOutputLevels *autom = new AudioOutputLevels();
+  DecodeSBR("LC SBR_ON", AAC, AudioGeneratorAAC::SBR_ON, 80, on);
+  DecodeSBR("LC SBR_OFF", AAC, AudioGeneratorAAC::SBR_OFF, 80, off);
+  DecodeSBR("LC SBR_AUTO", AAC, AudioGeneratorAAC::SBR_AUTO, -1, autom);
+  Serial.printf("LC identical: %d\n", (on->hash == off->hash) && (on->hash == autom->hash) &&
+                (on->GetSamples() == off->GetSamples()) && (on->GetSamples() == autom->GetSamples()));
+
+  // HE-AAC with SBR bypassed plays the core at half the rate and half the samples
+  DecodeSBR("HE SBR_ON", HEAAC, AudioGeneratorAAC::SBR_ON, 80, on);
+  DecodeSBR("HE SBR_OFF", HEAAC, AudioGeneratorAAC::SBR_OFF, 80, off);
+  Serial.printf("HE bypass halves: rate=%d samples=%d\n", on->GetFrequency() == 2 * off->GetFrequency(),
+                on->GetSamples() == 2 * off->GetSamples());
+  // A negative limit is always exceeded, so SBR_AUTO drops SBR as soon as the average settles
+  DecodeSBR("HE SBR_AUTO", HEAAC, AudioGeneratorAAC::SBR_AUTO, -1, autom);
+  Serial.printf("HE auto bypass: rate=%d\n", autom->GetFrequency() == off->GetFrequency());
+
+  delete autom;
+  delete off;
+  delete on;
+}
 
 int main(int argc, char **argv)
 {
@@ -12,8 +68,8 @@ int main(int argc, char **argv)
     AudioFileSourceSTDIO *in = new AudioFileSourceSTDIO(AAC);
     AudioOutputSTDIO *out = new AudioOutputSTDIO();
     out->SetFilename("out.aac.wav");
-    void *space = malloc(28000+60000);
-    AudioGeneratorAAC *aac = new AudioGeneratorAAC(space, 28000+60000);
+    void *space = malloc(28000+64096);
+    AudioGeneratorAAC *aac = new AudioGeneratorAAC(space, 28000+64096);
 
     aac->begin(in, out);
     while (aac->loop()) { /*noop*/ }
@@ -23,5 +79,36 @@ int main(int argc, char **argv)
     delete out;
     delete in;
 
+    // Same audio in an MP4 container, the edit list drops the 2112 priming samples
+    in = new AudioFileSourceSTDIO(M4A);
+    out = new AudioOutputSTDIO();
+    out->SetFilename("out.m4a.wav");
+    AudioGeneratorM4A *m4a = new AudioGeneratorM4A(space, 28000+64096);
+
+    m4a->begin(in, out);
+    while (m4a->loop()) { /*noop*/ }
+    m4a->stop();
+
+    delete m4a;
+    delete out;
+    delete in;
+
+    // And from one second in, which must match the tail of out.m4a.wav
+    in = new AudioFileSourceSTDIO(M4A);
+    out = new AudioOutputSTDIO();
+    out->SetFilename("out.m4a.seek.wav");
+    m4a = new AudioGeneratorM4A();
+
+    m4a->begin(in, out);
+    m4a->seek(m4a->getTimescale());
+    while (m4a->loop()) { /*noop*/ }
+    m4a->stop();
+
+    delete m4a;
+    delete out;
+    delete in;
+
     free(space);
+
+    TestSBR();
 }
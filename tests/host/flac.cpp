@@ -1,10 +1,432 @@
 #include <Arduino.h>
+#include <math.h>
 #include "AudioFileSourceSTDIO.h"
 #include "AudioOutputSTDIO.h"
+#include "AudioOutputNull.h"
 #include "AudioGeneratorFLAC.h"
+#include <pthread.h>
 
 #define AAC "gs-16b-2c-44100hz.flac"
 
+// libflac's LPC restore routines, the C ones and whichever vectorized kernels this host has
+typedef void (*RestoreFn)(const int32_t residual[], uint32_t data_len, const int32_t qlp_coeff[], uint32_t order, int lp_quantization, int32_t data[]);
+extern "C" {
+    void FLAC__lpc_restore_signal(const int32_t residual[], uint32_t data_len, const int32_t qlp_coeff[], uint32_t order, int lp_quantization, int32_t data[]);
+    void FLAC__lpc_restore_signal_wide(const int32_t residual[], uint32_t data_len, const int32_t qlp_coeff[], uint32_t order, int lp_quantization, int32_t data[]);
+#if !defined(FLAC__NO_ASM) && (defined(__x86_64__) || defined(__i386__))
+    void FLAC__lpc_restore_signal_intrin_sse41(const int32_t residual[], uint32_t data_len, const int32_t qlp_coeff[], uint32_t order, int lp_quantization, int32_t data[]);
+    void FLAC__lpc_restore_signal_16_intrin_sse41(const int32_t residual[], uint32_t data_len, const int32_t qlp_coeff[], uint32_t order, int lp_quantization, int32_t data[]);
+    void FLAC__lpc_restore_signal_wide_intrin_sse41(const int32_t residual[], uint32_t data_len, const int32_t qlp_coeff[], uint32_t order, int lp_quantization, int32_t data[]);
+    void FLAC__lpc_restore_signal_intrin_avx2(const int32_t residual[], uint32_t data_len, const int32_t qlp_coeff[], uint32_t order, int lp_quantization, int32_t data[]);
+    void FLAC__lpc_restore_signal_wide_intrin_avx2(const int32_t residual[], uint32_t data_len, const int32_t qlp_coeff[], uint32_t order, int lp_quantization, int32_t data[]);
+#elif !defined(FLAC__NO_ASM) && defined(__aarch64__)
+    void FLAC__lpc_restore_signal_intrin_neon(const int32_t residual[], uint32_t data_len, const int32_t qlp_coeff[], uint32_t order, int lp_quantization, int32_t data[]);
+    void FLAC__lpc_restore_signal_wide_intrin_neon(const int32_t residual[], uint32_t data_len, const int32_t qlp_coeff[], uint32_t order, int lp_quantization, int32_t data[]);
+#endif
+}
+
+// Test streams are written with VERBATIM subframes, which need no encoder to produce
+static uint8_t Crc8(const uint8_t *d, int len)
+{
+    uint8_t crc = 0;
+    while (len--) {
+        crc ^= *d++;
+        for (int i = 0; i < 8; i++) crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+    }
+    return crc;
+}
+
+static uint16_t Crc16(const uint8_t *d, int len)
+{
+    uint16_t crc = 0;
+    while (len--) {
+        crc ^= *d++ << 8;
+        for (int i = 0; i < 8; i++) crc = (crc & 0x8000) ? (crc << 1) ^ 0x8005 : crc << 1;
+    }
+    return crc;
+}
+
+// A slow sine per channel, each at its own pitch, 2 seconds at 44.1KHz
+static int32_t TestTone(int bits, int c, int i)
+{
+    return (int32_t)(sin(i * 2 * M_PI * (330 + 110 * c) / 44100) * (1 << (bits - 3)));
+}
+
+static void PutBE(uint8_t *p, uint64_t v, int bytes)
+{
+    while (bytes--) p[bytes] = (uint8_t)v, v >>= 8;
+}
+
+static void PutLE(uint8_t *p, uint32_t v)
+{
+    for (int i = 0; i < 4; i++) p[i] = (uint8_t)(v >> (i * 8));
+}
+
+// SEEKTABLE (every 4th frame, and a placeholder), VORBIS_COMMENT and a two-track CUESHEET
+static void WriteMetadata(FILE *f, const uint32_t *frameOffset, int total)
+{
+    static uint8_t md[1024];
+    int len = 0;
+    md[len++] = 3;
+    PutBE(md + len, 7 * 18, 3);
+    len += 3;
+    for (int i = 0; i < 6; i++, len += 18) {
+        PutBE(md + len, i * 4 * 4096, 8);
+        PutBE(md + len + 8, frameOffset[i * 4], 8);
+        PutBE(md + len + 16, 4096, 2);
+    }
+    PutBE(md + len, 0xffffffffffffffffULL, 8);
+    PutBE(md + len + 8, 0, 10);
+    len += 18;
+
+    const char *comments[] = { "TITLE=Test tone", "ARTIST=ESP8266Audio" };
+    int start = len;
+    md[len] = 4;
+    len += 4;
+    PutLE(md + len, 4);
+    memcpy(md + len + 4, "test", 4);
+    PutLE(md + len + 8, 2);
+    len += 12;
+    for (int i = 0; i < 2; i++) {
+        PutLE(md + len, strlen(comments[i]));
+        memcpy(md + len + 4, comments[i], strlen(comments[i]));
+        len += 4 + strlen(comments[i]);
+    }
+    PutBE(md + start + 1, len - start - 4, 3);
+
+    start = len;
+    md[len] = 0x80 | 5;
+    len += 4;
+    memset(md + len, 0, 128 + 8 + 259);
+    len += 128 + 8 + 259;
+    md[len++] = 3;
+    const int tracks[3][4] = { { 0, 1, 0, 0 }, { 44100, 2, 588, 2 }, { total, 255, 0, 0 } }; // Offset, number, INDEX 01, indices
+    for (int t = 0; t < 3; t++) {
+        PutBE(md + len, tracks[t][0], 8);
+        md[len + 8] = tracks[t][1];
+        memset(md + len + 9, 0, 12 + 14);
+        md[len + 35] = tracks[t][3];
+        len += 36;
+        for (int i = 0; i < tracks[t][3]; i++, len += 12) {
+            PutBE(md + len, i ? tracks[t][2] : 0, 8);
+            md[len + 8] = (tracks[t][3] == 1) ? 1 : i;
+            memset(md + len + 9, 0, 3);
+        }
+    }
+    PutBE(md + start + 1, len - start - 4, 3);
+    fwrite(md, 1, len, f);
+}
+
+enum { BAD_SIGNATURE = 1, METADATA = 2, SILENT_TAIL = 4 };
+
+// The second second is silence when SILENT_TAIL is given, in CONSTANT subframes which are tiny next to VERBATIM
+// ones, so the file's bytes no longer track its samples and seeking without a table has to search
+static void WriteFLAC(const char *name, int channels, int bits, int flags = 0)
+{
+    const int rate = 44100, total = 2 * rate, blocksize = 4096;
+    FILE *f = fopen(name, "wb");
+    uint8_t si[42] = { 'f', 'L', 'a', 'C', 0x80, 0, 0, 34, blocksize >> 8, blocksize & 0xff, blocksize >> 8, blocksize & 0xff };
+    si[18] = (uint8_t)(rate >> 12);
+    si[19] = (uint8_t)(rate >> 4);
+    si[20] = (uint8_t)(((rate & 0x0f) << 4) | ((channels - 1) << 1) | ((bits - 1) >> 4));
+    si[21] = (uint8_t)((bits - 1) << 4); // Total samples < 2^32
+    si[22] = (uint8_t)(total >> 24);
+    si[23] = (uint8_t)(total >> 16);
+    si[24] = (uint8_t)(total >> 8);
+    si[25] = (uint8_t)total;
+    fwrite(si, 1, sizeof(si), f);
+    if (flags & METADATA) {
+        static uint32_t frameOffset[(total + blocksize - 1) / blocksize];
+        for (int pos = 0, num = 0, offset = 0; pos < total; pos += blocksize, num++) {
+            int n = (total - pos < blocksize) ? total - pos : blocksize;
+            frameOffset[num] = offset;
+            offset += 8 + channels * (1 + ((flags & SILENT_TAIL) && (pos >= rate) ? 1 : n) * bits / 8) + 2;
+        }
+        si[4] = 0; // STREAMINFO isn't the last block
+        fseek(f, 0, SEEK_SET);
+        fwrite(si, 1, sizeof(si), f);
+        WriteMetadata(f, frameOffset, total);
+    }
+
+    static uint8_t frame[16 + 8 * (1 + 4 * blocksize) + 2];
+    static FLAC__int32 pcm[8][blocksize];
+#ifndef AUDIO_NO_FLAC_MD5
+    const FLAC__int32 *signal[8];
+    static FLAC__MD5Context md5;
+    FLAC__MD5Init(&md5);
+#endif
+    for (int pos = 0, num = 0; pos < total; pos += blocksize, num++) {
+        int n = (total - pos < blocksize) ? total - pos : blocksize;
+        int len = 0;
+        frame[len++] = 0xff;
+        frame[len++] = 0xf8;
+        frame[len++] = 0x70;  // 16-bit block size at the end, rate from STREAMINFO
+        frame[len++] = ((channels - 1) << 4) | ((bits == 24) ? 0x0c : 0x00);
+        frame[len++] = num;   // Fewer than 128 frames, so UTF-8 is one byte
+        frame[len++] = (n - 1) >> 8;
+        frame[len++] = (n - 1) & 0xff;
+        frame[len] = Crc8(frame, len);
+        len++;
+        for (int c = 0; c < channels; c++) {
+#ifndef AUDIO_NO_FLAC_MD5
+            signal[c] = pcm[c];
+#endif
+            if ((flags & SILENT_TAIL) && (pos >= rate)) {
+                frame[len++] = 0x00; // CONSTANT
+                for (int b = bits - 8; b >= 0; b -= 8) frame[len++] = 0;
+                memset(pcm[c], 0, n * sizeof(pcm[c][0]));
+                continue;
+            }
+            frame[len++] = 0x02; // VERBATIM, no wasted bits
+            for (int i = 0; i < n; i++) {
+                int32_t v = pcm[c][i] = TestTone(bits, c, pos + i);
+                for (int b = bits - 8; b >= 0; b -= 8) frame[len++] = (uint8_t)(v >> b);
+            }
+        }
+#ifndef AUDIO_NO_FLAC_MD5
+        FLAC__MD5Accumulate(&md5, signal, channels, n, bits / 8);
+#endif
+        uint16_t crc = Crc16(frame, len);
+        frame[len++] = crc >> 8;
+        frame[len++] = crc & 0xff;
+        fwrite(frame, 1, len, f);
+    }
+    // Without libflac's MD5 the signature stays zero, which FLAC defines as "not computed"
+#ifndef AUDIO_NO_FLAC_MD5
+    FLAC__MD5Final(si + 26, &md5);
+#endif
+    if (flags & BAD_SIGNATURE) si[26] ^= 1;
+    fseek(f, 26, SEEK_SET);
+    fwrite(si + 26, 1, 16, f);
+    fclose(f);
+}
+
+// An output which, like the I2S ones, can only take 16 bits
+class AudioOutputSTDIO16 : public AudioOutputSTDIO
+{
+  public:
+    virtual bool SupportsBitsPerSample(int bits) override { return bits <= 16; }
+};
+
+static void MetadataCB(void *cbData, const char *type, bool isUnicode, const char *string)
+{
+    (void) cbData;
+    Serial.printf("FLAC metadata: %s%s = '%s'\n", type, isUnicode ? " (unicode)" : "", string);
+}
+
+// Counts the traffic a seek costs, which on SD over SPI is what takes the time
+class AudioFileSourceCounted : public AudioFileSourceSTDIO
+{
+  public:
+    AudioFileSourceCounted(const char *name) : AudioFileSourceSTDIO(name) { seeks = 0; bytes = 0; }
+    virtual uint32_t read(void *data, uint32_t len) override { uint32_t r = AudioFileSourceSTDIO::read(data, len); bytes += r; return r; }
+    virtual bool seek(int32_t pos, int dir) override { seeks++; return AudioFileSourceSTDIO::seek(pos, dir); }
+    int seeks;
+    uint32_t bytes;
+};
+
+// Play a little of name, then jump to sample 60000 and play the rest to wavName
+static void SeekFLAC(const char *name, const char *wavName)
+{
+    AudioFileSourceCounted *in = new AudioFileSourceCounted(name);
+    AudioOutputSTDIO *out = new AudioOutputSTDIO16(); // Takes 99 samples a loop(), so a little really is a little
+    out->SetFilename(wavName);
+    AudioGeneratorFLAC *flac = new AudioGeneratorFLAC();
+    flac->RegisterMetadataCB(MetadataCB, NULL);
+    flac->begin(in, out);
+    for (int i = 0; i < 50; i++) flac->loop();
+    in->seeks = 0;
+    in->bytes = 0;
+    bool ok = flac->seek(60000);
+    Serial.printf("FLAC seek in %s: %s, %d seeks and %u bytes read, length %u\n", name, ok ? "ok" : "failed",
+                  in->seeks, in->bytes, flac->getLength());
+    while (flac->loop()) { /*noop*/ }
+    flac->stop();
+    delete flac;
+    delete out;
+    delete in;
+}
+
+static void StatusCB(void *cbData, int code, const char *string)
+{
+    Serial.printf("%s: status %d '%s'\n", (const char *)cbData, code, string);
+}
+
+// Time a run through name to a null output, with and without the signature check
+static void TimeMD5(const char *name)
+{
+    for (int check = 0; check < 2; check++) {
+        AudioFileSourceSTDIO *in = new AudioFileSourceSTDIO(name);
+        AudioOutputNull *out = new AudioOutputNull();
+        AudioGeneratorFLAC *flac = new AudioGeneratorFLAC();
+        flac->SetMD5Check(check);
+        flac->RegisterStatusCB(StatusCB, (void *)name);
+        unsigned long start = micros();
+        flac->begin(in, out);
+        while (flac->loop()) { /*noop*/ }
+        flac->stop();
+        Serial.printf("%s: %s MD5 check, %lu us\n", name, check ? "with" : "without", micros() - start);
+        delete flac;
+        delete out;
+        delete in;
+    }
+}
+
+// Check name's signature inside an arena sized for its 4096 sample blocks.  The null output never
+// refuses, so the hashing all happens in whole block chunks when libflac moves on.
+static void ArenaMD5(const char *name)
+{
+    static uint8_t arena[AudioGeneratorFLAC::preAllocSize(4096, 2, 16)];
+    AudioFileSourceSTDIO *in = new AudioFileSourceSTDIO(name);
+    AudioOutputNull *out = new AudioOutputNull();
+    AudioGeneratorFLAC *flac = new AudioGeneratorFLAC(arena, sizeof(arena));
+    flac->SetMD5Check(true);
+    flac->RegisterStatusCB(StatusCB, (void *)name);
+    flac->begin(in, out);
+    while (flac->loop()) { /*noop*/ }
+    flac->stop();
+    Serial.printf("%s: MD5 check in arena, size=%u peak=%u fails=%u\n", name, (unsigned)sizeof(arena),
+                  flac->GetMemoryStats().heapPeak, flac->GetMemoryStats().failures);
+    delete flac;
+    delete out;
+    delete in;
+}
+
+static void PlayFLAC(const char *name, AudioOutputSTDIO *out, const char *wavName)
+{
+    AudioFileSourceSTDIO *in = new AudioFileSourceSTDIO(name);
+    out->SetFilename(wavName);
+    AudioGeneratorFLAC *flac = new AudioGeneratorFLAC();
+    flac->begin(in, out);
+    while (flac->loop()) { /*noop*/ }
+    flac->stop();
+    delete flac;
+    delete out;
+    delete in;
+}
+
+// Runs one kernel over a random signal of the given width, predicted with random coefficients
+// of the given precision, and counts the samples it restores differently from the C routine.
+// The buffers are laid out like the decoder's, four zeros then the warmup then the frame.
+static int CheckKernel(RestoreFn kernel, RestoreFn reference, int bps, int precision, uint32_t order, uint32_t len, uint32_t *seed)
+{
+    auto rnd = [seed](int bits) {
+        *seed = *seed * 1103515245 + 12345;
+        return (int32_t)((int64_t)((*seed >> 1) & 0x3fffffff) % (1 << bits)) - (1 << (bits - 1));
+    };
+    int32_t coeff[32];
+    for (uint32_t j = 0; j < order; j++) coeff[j] = rnd(precision) / (int32_t)(order + 1);
+    int shift = precision - 1;
+
+    int32_t *signal = (int32_t *)malloc(sizeof(int32_t) * (order + len));
+    int32_t *residual = (int32_t *)malloc(sizeof(int32_t) * len);
+    int32_t *want = (int32_t *)calloc(4 + order + len, sizeof(int32_t));
+    int32_t *got = (int32_t *)calloc(4 + order + len, sizeof(int32_t));
+    for (uint32_t i = 0; i < order + len; i++) signal[i] = rnd(bps - 1);
+    for (uint32_t i = 0; i < len; i++) {
+        int64_t sum = 0;
+        for (uint32_t j = 0; j < order; j++) sum += (int64_t)coeff[j] * signal[order + i - j - 1];
+        residual[i] = signal[order + i] - (int32_t)(sum >> shift);
+    }
+    memcpy(want + 4, signal, sizeof(int32_t) * order);
+    memcpy(got + 4, signal, sizeof(int32_t) * order);
+    reference(residual, len, coeff, order, shift, want + 4 + order);
+    kernel(residual, len, coeff, order, shift, got + 4 + order);
+
+    int bad = 0;
+    for (uint32_t i = 0; i < len; i++) {
+        if (got[4 + order + i] != want[4 + order + i]) bad++;
+        if (want[4 + order + i] != signal[order + i]) bad++; // The C routine should undo the prediction
+    }
+    free(signal);
+    free(residual);
+    free(want);
+    free(got);
+    return bad;
+}
+
+// Every order from 1 to 32, over frame lengths which end in each possible partial group
+static void CheckKernels(const char *name, RestoreFn kernel, RestoreFn reference, int bps, int precision)
+{
+    uint32_t seed = 1;
+    int bad = 0, runs = 0;
+    for (uint32_t order = 1; order <= 32; order++) {
+        for (uint32_t len = 1; len <= 40; len++) {
+            bad += CheckKernel(kernel, reference, bps, precision, order, len, &seed);
+            runs++;
+        }
+        bad += CheckKernel(kernel, reference, bps, precision, order, 4096 - order, &seed);
+        runs++;
+    }
+    Serial.printf("LPC kernel %s (%d bits, %d bit coefficients): %d runs, %d mismatches\n", name, bps, precision, runs, bad);
+}
+
+// The vectorized restore kernels against libflac's C ones, at the widths the decoder gives each
+static void CheckLPC()
+{
+#if !defined(FLAC__NO_ASM) && (defined(__x86_64__) || defined(__i386__))
+    if (__builtin_cpu_supports("sse4.1")) {
+        CheckKernels("sse41-16", FLAC__lpc_restore_signal_16_intrin_sse41, FLAC__lpc_restore_signal, 16, 11);
+        CheckKernels("sse41", FLAC__lpc_restore_signal_intrin_sse41, FLAC__lpc_restore_signal, 17, 10);
+        CheckKernels("sse41-wide", FLAC__lpc_restore_signal_wide_intrin_sse41, FLAC__lpc_restore_signal_wide, 24, 15);
+    } else {
+        Serial.printf("LPC kernel sse41: not supported here\n");
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        CheckKernels("avx2", FLAC__lpc_restore_signal_intrin_avx2, FLAC__lpc_restore_signal, 17, 10);
+        CheckKernels("avx2-wide", FLAC__lpc_restore_signal_wide_intrin_avx2, FLAC__lpc_restore_signal_wide, 24, 15);
+    } else {
+        Serial.printf("LPC kernel avx2: not supported here\n");
+    }
+#elif !defined(FLAC__NO_ASM) && defined(__aarch64__)
+    CheckKernels("neon", FLAC__lpc_restore_signal_intrin_neon, FLAC__lpc_restore_signal, 17, 10);
+    CheckKernels("neon-wide", FLAC__lpc_restore_signal_wide_intrin_neon, FLAC__lpc_restore_signal_wide, 24, 15);
+#else
+    Serial.printf("LPC kernels: plain C only\n");
+#endif
+}
+
+// Two generators decoding at once on their own threads, each confined to its own arena
+typedef struct {
+    uint8_t *arena;
+    int size;
+    uint32_t samples, fails, left;
+} FLACThread;
+
+static void *ThreadFLAC(void *arg)
+{
+    FLACThread *t = (FLACThread *)arg;
+    AudioFileSourceSTDIO *in = new AudioFileSourceSTDIO(AAC);
+    AudioOutputNull *out = new AudioOutputNull();
+    AudioGeneratorFLAC *flac = new AudioGeneratorFLAC(t->arena, t->size);
+    flac->begin(in, out);
+    while (flac->loop()) { /*noop*/ }
+    flac->stop();
+    t->samples = out->GetSamples();
+    t->fails = flac->GetMemoryStats().failures;
+    t->left = flac->GetMemoryStats().heapCur;
+    delete flac;
+    delete out;
+    delete in;
+    return NULL;
+}
+
+static void ThreadedFLAC()
+{
+    static uint8_t arena[2][AudioGeneratorFLAC::preAllocSize()];
+    FLACThread t[2];
+    pthread_t id[2];
+    for (int i = 0; i < 2; i++) {
+        t[i].arena = arena[i];
+        t[i].size = sizeof(arena[i]);
+        pthread_create(&id[i], NULL, ThreadFLAC, &t[i]);
+    }
+    for (int i = 0; i < 2; i++) {
+        pthread_join(id[i], NULL);
+        Serial.printf("FLAC thread %d: %u samples, fails=%u, left allocated=%u\n", i, t[i].samples, t[i].fails, t[i].left);
+    }
+}
+
 int main(int argc, char **argv)
 {
     (void) argc;
@@ -14,11 +436,56 @@ int main(int argc, char **argv)
     out->SetFilename("out.flac.wav");
     AudioGeneratorFLAC *flac = new AudioGeneratorFLAC();
 
+    flac->SetStackPaint(8192);
     flac->begin(in, out);
     while (flac->loop()) { /*noop*/ }
     flac->stop();
 
+    const AudioMemory::Stats &st = flac->GetMemoryStats();
+    Serial.printf("FLAC heap: cur=%u peak=%u allocs=%u frees=%u fails=%u, stack peak=%u\n",
+                  st.heapCur, st.heapPeak, st.allocs, st.frees, st.failures, st.stackPeak);
+
     delete flac;
     delete out;
     delete in;
+
+    // Same file again, with libflac confined to a preallocated arena
+    static uint8_t arena[AudioGeneratorFLAC::preAllocSize()];
+    in = new AudioFileSourceSTDIO(AAC);
+    out = new AudioOutputSTDIO();
+    out->SetFilename("out.flac.pre.wav");
+    flac = new AudioGeneratorFLAC(arena, sizeof(arena));
+    flac->begin(in, out);
+    while (flac->loop()) { /*noop*/ }
+    flac->stop();
+    Serial.printf("FLAC arena: size=%u peak=%u fails=%u\n", (unsigned)sizeof(arena),
+                  flac->GetMemoryStats().heapPeak, flac->GetMemoryStats().failures);
+
+    delete flac;
+    delete out;
+    delete in;
+
+    ThreadedFLAC();
+    CheckLPC();
+
+    // 24 bits, both at full depth and dithered to 16, and 5.1 mixed down to stereo
+    WriteFLAC("flac24.flac", 2, 24);
+    WriteFLAC("flac51.flac", 6, 24);
+    PlayFLAC("flac24.flac", new AudioOutputSTDIO(), "out.flac24.wav");
+    PlayFLAC("flac24.flac", new AudioOutputSTDIO16(), "out.flac24to16.wav");
+    PlayFLAC("flac51.flac", new AudioOutputSTDIO(), "out.flac51.wav");
+
+    // Signature checks, the generated files carry a correct one too
+    TimeMD5(AAC);
+    TimeMD5("flac24.flac");
+    TimeMD5("flac51.flac");
+    WriteFLAC("flacbad.flac", 2, 24, BAD_SIGNATURE);
+    TimeMD5("flacbad.flac");
+    ArenaMD5("flac24.flac");
+
+    // The same audio with and without a seek table, tags and cue sheet
+    WriteFLAC("flacmeta.flac", 2, 24, METADATA | SILENT_TAIL);
+    WriteFLAC("flacgap.flac", 2, 24, SILENT_TAIL);
+    SeekFLAC("flacmeta.flac", "out.flacseek.wav");
+    SeekFLAC("flacgap.flac", "out.flacseek2.wav");
 }
@@ -1,26 +1,157 @@
 #include <Arduino.h>
 #include "AudioFileSourceSTDIO.h"
 #include "AudioOutputSTDIO.h"
+#include "AudioOutputNull.h"
 #include "AudioGeneratorMIDI.h"
+#include <math.h>
 
 #define SF2 "../../examples/PlayMIDIFromLittleFS/data/1mgm.sf2"
 #define MIDI "../../examples/PlayMIDIFromLittleFS/data/furelise.mid"
 
+// Plays the same notes through the float and the fixed-point renderers and reports how far apart they are
+void CompareRenderers()
+{
+    FILE *fp = fopen(SF2, "rb");
+    fseek(fp, 0, SEEK_END);
+    long len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    char *sf2 = (char *)malloc(len);
+    if (fread(sf2, 1, len, fp) != (size_t)len) len = 0;
+    fclose(fp);
 
-int main(int argc, char **argv)
+    tsf *flt = tsf_load_memory(sf2, len);
+    tsf *fix = tsf_load_memory(sf2, len);
+    tsf *both[2] = { flt, fix };
+    for (int i = 0; i < 2; i++) {
+        tsf_set_output(both[i], TSF_STEREO_INTERLEAVED, 22050, -10);
+        tsf_channel_set_presetnumber(both[i], 0, 0);   // Piano
+        tsf_channel_set_presetnumber(both[i], 1, 48);  // Strings
+        tsf_channel_set_presetnumber(both[i], 2, 81);  // Saw lead
+        tsf_channel_set_presetnumber(both[i], 9, 0, 1);
+        tsf_channel_set_pan(both[i], 1, 0.2f);
+        tsf_channel_note_on(both[i], 0, 60, 0.8f);
+        tsf_channel_note_on(both[i], 0, 64, 0.8f);
+        tsf_channel_note_on(both[i], 0, 67, 0.8f);
+        tsf_channel_note_on(both[i], 1, 48, 0.6f);
+        tsf_channel_note_on(both[i], 2, 72, 0.5f);
+        tsf_channel_note_on(both[i], 9, 36, 1.0f);
+    }
+
+    static short a[256], b[256];
+    double sig = 0, err = 0;
+    int peak = 0;
+    uint32_t usFloat = 0, usFixed = 0;
+    for (int blk = 0; blk < 22050 * 4 / 128; blk++) {
+        if (blk == 22050 / 128) {
+            tsf_channel_set_pitchwheel(flt, 2, 12000);
+            tsf_channel_set_pitchwheel(fix, 2, 12000);
+        } else if (blk == 22050 * 2 / 128) {
+            tsf_note_off_all(flt);
+            tsf_note_off_all(fix);
+        }
+        uint32_t t0 = micros();
+        tsf_render_short(flt, a, 128, 0);
+        uint32_t t1 = micros();
+        tsf_render_short_fixed(fix, b, 128, 0);
+        uint32_t t2 = micros();
+        usFloat += t1 - t0;
+        usFixed += t2 - t1;
+        for (int i = 0; i < 256; i++) {
+            int d = a[i] - b[i];
+            sig += (double)a[i] * a[i];
+            err += (double)d * d;
+            if (abs(d) > peak) peak = abs(d);
+        }
+    }
+    Serial.printf("fixed vs float renderer: SNR %.1f dB, peak difference %d, %u us float, %u us fixed\n",
+                  10.0 * log10(sig / (err ? err : 1)), peak, usFloat, usFixed);
+
+    tsf_close(flt);
+    tsf_close(fix);
+    free(sf2);
+}
+
+
+void PlayMIDI(const char *name, bool stereo, bool preparse = false)
+{
+    AudioFileSourceSTDIO *midifile = new AudioFileSourceSTDIO(MIDI);
+    AudioFileSourceSTDIO *sf2file = new AudioFileSourceSTDIO(SF2);
+    AudioOutputSTDIO *out = new AudioOutputSTDIO();
+    out->SetFilename(name);
+    AudioGeneratorMIDI *midi = new AudioGeneratorMIDI();
+
+    midi->SetSoundfont(sf2file);
+    midi->SetSampleRate(22050);
+    midi->SetStereo(stereo);
+    if (!stereo) midi->SetCache(32, 256, 1); // Smaller blocks, with read-ahead
+    midi->SetPreparse(preparse);
+
+    midi->begin(midifile, out);
+    if (preparse) Serial.printf("%s: preparsed=%d, %u bytes of events\n", name, midi->IsPreparsed() ? 1 : 0, midi->GetPreparsedSize());
+    while (midi->loop()) { /*noop*/ }
+    midi->stop();
+    const AudioGeneratorMIDI::CacheStats &cs = midi->GetCacheStats();
+    Serial.printf("%s: stereo=%d, sample cache %u hits %u misses, MIDI cache %u hits %u misses\n", name, stereo ? 1 : 0,
+                  cs.sampleHits, cs.sampleMisses, cs.midiHits, cs.midiMisses);
+
+    const AudioGeneratorMIDI::PolyphonyStats &ps = midi->GetPolyphonyStats();
+    Serial.printf("%s: peak %d voices\n", name, ps.peakVoices);
+
+    delete out;
+    delete midi;
+    delete midifile;
+    delete sf2file;
+}
+
+// Plays with a voice cap, and optionally a CPU budget too small to ever meet so the cap keeps dropping
+void PlayPolyphony(const char *name, int maxVoices, int cpuPercent)
+{
+    AudioFileSourceSTDIO *midifile = new AudioFileSourceSTDIO(MIDI);
+    AudioFileSourceSTDIO *sf2file = new AudioFileSourceSTDIO(SF2);
+    AudioOutput *out;
+    if (cpuPercent) {
+        out = new AudioOutputNull(); // Depends on timing, so nothing to compare from run to run
+    } else {
+        AudioOutputSTDIO *wav = new AudioOutputSTDIO();
+        wav->SetFilename(name);
+        out = wav;
+    }
+    AudioGeneratorMIDI *midi = new AudioGeneratorMIDI();
+
+    midi->SetSoundfont(sf2file);
+    midi->SetSampleRate(22050);
+    midi->SetPolyphony(maxVoices, cpuPercent);
+
+    midi->begin(midifile, out);
+    while (midi->loop()) { /*noop*/ }
+    midi->stop();
+    const AudioGeneratorMIDI::PolyphonyStats &ps = midi->GetPolyphonyStats();
+    Serial.printf("%s: max %d voices, %d%% CPU: peak %d voices, limit ended at %d, %u stolen\n", name, maxVoices, cpuPercent,
+                  ps.peakVoices, ps.limit, ps.stolen);
+
+    delete out;
+    delete midi;
+    delete midifile;
+    delete sf2file;
+}
+
+// Jumps 30 seconds in before playing the rest, which should come out the same either way
+void PlaySeek(const char *name, bool preparse)
 {
-    (void) argc;
-    (void) argv;
     AudioFileSourceSTDIO *midifile = new AudioFileSourceSTDIO(MIDI);
     AudioFileSourceSTDIO *sf2file = new AudioFileSourceSTDIO(SF2);
     AudioOutputSTDIO *out = new AudioOutputSTDIO();
-    out->SetFilename("midi.wav");
+    out->SetFilename(name);
     AudioGeneratorMIDI *midi = new AudioGeneratorMIDI();
 
     midi->SetSoundfont(sf2file);
     midi->SetSampleRate(22050);
+    midi->SetPreparse(preparse);
 
     midi->begin(midifile, out);
+    uint32_t start = micros();
+    bool ok = midi->seek(22050 * 30);
+    Serial.printf("%s: preparsed=%d, seek=%d, %u us\n", name, midi->IsPreparsed() ? 1 : 0, ok ? 1 : 0, (unsigned)(micros() - start));
     while (midi->loop()) { /*noop*/ }
     midi->stop();
 
@@ -29,3 +160,60 @@ int main(int argc, char **argv)
     delete midifile;
     delete sf2file;
 }
+
+// Plays a few bars the way a keyboard on a serial port would, one loop() between messages
+void PlayLive()
+{
+    AudioFileSourceSTDIO *sf2file = new AudioFileSourceSTDIO(SF2);
+    AudioOutputSTDIO *out = new AudioOutputSTDIO();
+    out->SetFilename("midi.live.wav");
+    AudioGeneratorMIDI *midi = new AudioGeneratorMIDI();
+
+    midi->SetSoundfont(sf2file);
+    midi->SetSampleRate(22050);
+    bool ok = midi->beginLive(out);
+    midi->ProgramChange(1, 48);        // Strings
+    midi->ControlChange(1, 10, 32);    // ...a little to the left
+    const int chords[4][3] = { { 60, 64, 67 }, { 57, 60, 64 }, { 53, 57, 60 }, { 55, 59, 62 } };
+    for (int bar = 0; bar < 4; bar++) {
+        for (int n = 0; n < 3; n++) midi->NoteOn(0, chords[bar][n], 100);
+        midi->NoteOn(1, chords[bar][0] - 12, 80);
+        midi->NoteOn(9, 36, 120);      // Kick
+        for (int i = 0; i < 150; i++) {
+            if (i == 75) midi->NoteOn(9, 38, 100); // Snare
+            if (bar == 3) midi->PitchBend(1, 8192 + i * 20);
+            midi->loop();
+        }
+        for (int n = 0; n < 3; n++) midi->NoteOff(0, chords[bar][n]);
+        midi->NoteOff(1, chords[bar][0] - 12);
+    }
+    for (int i = 0; i < 200; i++) midi->loop(); // Let the releases ring out
+
+    // More than the queue holds, with no loop() to empty it
+    int accepted = 0;
+    for (int i = 0; i < 100; i++) accepted += midi->ControlChange(0, 7, 100) ? 1 : 0;
+    midi->loop();
+    Serial.printf("midi.live.wav: begin=%d, %d of 100 queued, %u dropped\n", ok ? 1 : 0, accepted, midi->GetDroppedMessages());
+    midi->stop();
+
+    delete out;
+    delete midi;
+    delete sf2file;
+}
+
+int main(int argc, char **argv)
+{
+    (void) argc;
+    (void) argv;
+
+    PlayMIDI("midi.wav", true);
+    PlayMIDI("midi.mono.wav", false);
+    PlayMIDI("midi.pre.wav", true, true);
+    PlaySeek("midi.seek.wav", true);
+    PlaySeek("midi.seek.stream.wav", false);
+    PlayLive();
+    PlayPolyphony("midi.poly.wav", 4, 0);
+    PlayPolyphony("budget", 0, 1);
+
+    CompareRenderers();
+}
@@ -1,26 +1,268 @@
 #include <Arduino.h>
 #include "AudioFileSourcePROGMEM.h"
 #include "AudioOutputSTDIO.h"
+#include "AudioOutputLevels.h"
 #include "AudioGeneratorMOD.h"
+#include <math.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 #include "../../examples/PlayMODFromPROGMEMToDAC/enigma.h"
 
-int main(int argc, char **argv)
+// Counts how often the player has to go back to the file
+class AudioFileSourceCounted : public AudioFileSourcePROGMEM
 {
-    (void) argc;
-    (void) argv;
+  public:
+    AudioFileSourceCounted(const void *data, uint32_t len) : AudioFileSourcePROGMEM(data, len) { seeks = 0; bytes = 0; }
+    virtual bool seek(int32_t pos, int dir) override { seeks++; return AudioFileSourcePROGMEM::seek(pos, dir); }
+    virtual uint32_t read(void *data, uint32_t len) override { uint32_t r = AudioFileSourcePROGMEM::read(data, len); bytes += r; return r; }
+    int seeks;
+    uint32_t bytes;
+};
 
-    AudioFileSourcePROGMEM *file = new AudioFileSourcePROGMEM(enigma_mod, sizeof(enigma_mod));
+void PlayMOD(const char *name, bool preload)
+{
+    AudioFileSourceCounted *file = new AudioFileSourceCounted(enigma_mod, sizeof(enigma_mod));
     AudioOutputSTDIO *out = new AudioOutputSTDIO();
-    out->SetFilename("mod.wav");
+    out->SetFilename(name);
     AudioGeneratorMOD *mod = new AudioGeneratorMOD();
+    mod->SetPreload(preload);
 
     mod->begin(file, out);
+    bool preloaded = mod->IsPreloaded();
     // The MOD plays forever, so only run for ~30 seconds worth
     for (int i=0; i<10000; i++) mod->loop();
     mod->stop();
+    Serial.printf("%s: preloaded=%d, %d seeks, %u bytes read\n", name, preloaded ? 1 : 0, file->seeks, file->bytes);
 
     delete out;
     delete mod;
     delete file;
 }
+
+static uint64_t Cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return micros() * 1000ULL; // No cycle counter here, so nanoseconds will have to do
+#endif
+}
+
+// What each interpolation tier costs, from preloaded samples so the file isn't being timed too
+void BenchInterpolation()
+{
+    const char *names[] = { "nearest", "linear", "cubic", "sinc" };
+    for (int q = AudioGeneratorMOD::INTERPOLATION_NEAREST; q <= AudioGeneratorMOD::INTERPOLATION_SINC; q++) {
+        AudioFileSourcePROGMEM *file = new AudioFileSourcePROGMEM(enigma_mod, sizeof(enigma_mod));
+        AudioOutputLevels *out = new AudioOutputLevels(1024); // Hands control back every so often
+        AudioGeneratorMOD *mod = new AudioGeneratorMOD();
+        mod->SetPreload(true);
+        mod->SetInterpolation((AudioGeneratorMOD::Interpolation)q);
+        mod->begin(file, out);
+
+        uint64_t start = Cycles();
+        while (out->GetSamples() < 44100 * 30) mod->loop();
+        uint64_t cycles = Cycles() - start;
+        Serial.printf("interpolation %s: %.1f cycles per channel-sample\n", names[q], (double)cycles / ((double)out->GetSamples() * mod->GetChannels()));
+        mod->stop();
+
+        delete out;
+        delete mod;
+        delete file;
+    }
+}
+
+// Small S3M and XM songs are put together here, rather than carrying more binaries around
+static uint8_t song[16384];
+static uint32_t songLen;
+static void Put8(uint32_t at, uint8_t v) { song[at] = v; if (at + 1 > songLen) songLen = at + 1; }
+static void Put16(uint32_t at, uint16_t v) { Put8(at, v & 0xff); Put8(at + 1, v >> 8); }
+static void Put32(uint32_t at, uint32_t v) { Put16(at, v & 0xffff); Put16(at + 2, v >> 16); }
+static void PutString(uint32_t at, const char *s) { while (*s) Put8(at++, *s++); }
+
+// One cycle of a sine, 64 frames long, as 16-bit values
+static int16_t Sine(int i) { return (int16_t)(24000.0 * sin(2.0 * M_PI * i / 64.0)); }
+
+// 10 channels, a looped 16-bit sine played as C-5 on the tenth channel, stopped at row 16
+static void MakeS3M()
+{
+    memset(song, 0, sizeof(song));
+    songLen = 0;
+    PutString(0, "sine");
+    Put8(28, 0x1a);
+    Put8(29, 16);
+    Put16(32, 2);      // Orders
+    Put16(34, 1);      // Instruments
+    Put16(36, 1);      // Patterns
+    Put16(40, 0x1320);
+    Put16(42, 2);      // Unsigned samples
+    PutString(44, "SCRM");
+    Put8(48, 64);      // Global volume
+    Put8(49, 6);       // Speed
+    Put8(50, 125);     // Tempo
+    Put8(51, 0x80 | 48);
+    for (int i = 0; i < 32; i++) Put8(64 + i, (i < 10) ? ((i < 5) ? i : 8 + i - 5) : 255);
+    Put8(96, 0);       // Orders
+    Put8(97, 255);
+    Put16(98, 0x100 / 16);  // Instrument
+    Put16(100, 0x200 / 16); // Pattern
+
+    Put8(0x100, 1);
+    Put8(0x100 + 14, 0x400 / 16);
+    Put32(0x100 + 16, 64);  // Length
+    Put32(0x100 + 20, 0);   // Loop
+    Put32(0x100 + 24, 64);
+    Put8(0x100 + 28, 64);
+    Put8(0x100 + 31, 1 | 4); // Looped, 16-bit
+    Put32(0x100 + 32, 8363);
+    PutString(0x100 + 76, "SCRS");
+    for (int i = 0; i < 64; i++) Put16(0x400 + i * 2, Sine(i) ^ 0x8000);
+
+    uint32_t at = 0x202;
+    Put8(at++, 32 | 64 | 9);  // Row 0, C-5 on the tenth channel
+    Put8(at++, 0x50);
+    Put8(at++, 1);
+    Put8(at++, 64);
+    Put8(at++, 0);
+    for (int row = 1; row < 64; row++) {
+        if (row == 16) {
+            Put8(at++, 32 | 9);
+            Put8(at++, 254);      // Note off
+            Put8(at++, 0);
+        }
+        Put8(at++, 0);
+    }
+    Put16(0x200, at - 0x200);
+}
+
+// 10 channels, linear frequencies, an instrument with a decaying volume envelope playing the sine
+// as C-4 on the tenth channel, released at row 16
+static void MakeXM()
+{
+    memset(song, 0, sizeof(song));
+    songLen = 0;
+    PutString(0, "Extended Module: sine");
+    Put8(37, 0x1a);
+    Put16(58, 0x104);
+    Put32(60, 20 + 256);
+    Put16(64, 1);      // Song length
+    Put16(68, 10);     // Channels
+    Put16(70, 1);      // Patterns
+    Put16(72, 1);      // Instruments
+    Put16(74, 1);      // Linear frequencies
+    Put16(76, 6);      // Speed
+    Put16(78, 125);    // BPM
+    Put8(80, 0);       // Order 0
+
+    uint32_t at = 60 + 20 + 256;
+    uint32_t pattern = at;
+    Put32(at, 9);
+    Put16(at + 5, 32); // Rows
+    at += 9;
+    for (int row = 0; row < 32; row++) {
+        for (int channel = 0; channel < 10; channel++) {
+            if ((channel == 9) && (row == 0)) {
+                Put8(at++, 0x80 | 1 | 2);
+                Put8(at++, 49);   // C-4
+                Put8(at++, 1);
+            } else if ((channel == 9) && (row == 16)) {
+                Put8(at++, 0x80 | 1);
+                Put8(at++, 97);   // Key off
+            } else {
+                Put8(at++, 0x80);
+            }
+        }
+    }
+    Put16(pattern + 7, at - pattern - 9);
+
+    // Instrument, then its sample header and delta-coded data
+    Put32(at, 263);
+    Put8(at + 26, 0);
+    Put16(at + 27, 1);
+    Put32(at + 29, 40);
+    const uint16_t envelope[] = { 0, 64, 8, 48, 16, 48, 24, 0 };
+    for (int i = 0; i < 8; i++) Put16(at + 129 + i * 2, envelope[i]);
+    Put8(at + 225, 4);  // Points
+    Put8(at + 227, 2);  // Sustain at the third
+    Put8(at + 233, 1 | 2);
+    Put16(at + 239, 2048); // Fadeout
+    at += 263;
+    Put32(at, 128);     // Length in bytes
+    Put32(at + 4, 0);
+    Put32(at + 8, 128);
+    Put8(at + 12, 64);
+    Put8(at + 14, 1 | 0x10); // Forward loop, 16-bit
+    Put8(at + 15, 128);
+    at += 40;
+    int16_t last = 0;
+    for (int i = 0; i < 64; i++) {
+        Put16(at + i * 2, (uint16_t)(Sine(i) - last));
+        last = Sine(i);
+    }
+}
+
+// Writes the song out, keeping the peak level of every row (six ticks at 125 BPM, 5292 frames at 44.1kHz)
+class AudioOutputRows : public AudioOutputSTDIO
+{
+  public:
+    AudioOutputRows() { frames = 0; memset(peak, 0, sizeof(peak)); }
+    virtual bool ConsumeSample(int16_t sample[2]) override
+    {
+        if (!AudioOutputSTDIO::ConsumeSample(sample)) return false;
+        int row = frames++ / 5292;
+        if ((row < 64) && (abs(sample[0]) > peak[row])) peak[row] = abs(sample[0]);
+        if ((row < 64) && (abs(sample[1]) > peak[row])) peak[row] = abs(sample[1]);
+        return true;
+    }
+    int frames;
+    int peak[64];
+};
+
+// Plays the song to its end, and returns the output for checking
+AudioOutputRows *PlaySong(const char *name)
+{
+    AudioFileSourcePROGMEM *file = new AudioFileSourcePROGMEM(song, songLen);
+    AudioOutputRows *out = new AudioOutputRows();
+    out->SetFilename(name);
+    AudioGeneratorMOD *mod = new AudioGeneratorMOD();
+
+    bool ok = mod->begin(file, out);
+    Serial.printf("%s: begin=%d, format=%d, %d channels\n", name, ok ? 1 : 0, (int)mod->GetFormat(), mod->GetChannels());
+    while (mod->loop()) { }
+    mod->stop();
+    Serial.printf("%s: %d frames, row peaks %d %d %d ... %d %d\n", name, out->frames, out->peak[0], out->peak[1], out->peak[8],
+                  out->peak[15], out->peak[20]);
+
+    delete mod;
+    delete file;
+    return out;
+}
+
+int main(int argc, char **argv)
+{
+    (void) argc;
+    (void) argv;
+
+    PlayMOD("mod.wav", false);
+    PlayMOD("mod.pre.wav", true);
+
+    // The sine sounds until the note off at row 16, and the song plays all 64 rows of its pattern once
+    MakeS3M();
+    AudioOutputRows *out = PlaySong("s3m.wav");
+    Serial.printf("s3m.wav: length ok=%d, note ok=%d, note off ok=%d\n", out->frames == 64 * 5292,
+                  (out->peak[0] > 0) && (out->peak[15] == out->peak[0]), out->peak[20] == 0);
+    delete out;
+
+    // The envelope falls from 64 to its sustain level of 48 over the first 8 ticks, holds there until
+    // the key off at row 16, and is down to nothing 8 ticks later
+    MakeXM();
+    out = PlaySong("xm.wav");
+    Serial.printf("xm.wav: length ok=%d, decay ok=%d, sustain ok=%d, release ok=%d\n", out->frames == 32 * 5292,
+                  (out->peak[0] > 0) && (out->peak[8] < out->peak[0] * 4 / 5), (out->peak[8] > 0) && (out->peak[15] == out->peak[8]),
+                  out->peak[20] == 0);
+    delete out;
+
+    BenchInterpolation();
+}
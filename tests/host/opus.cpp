@@ -2,9 +2,205 @@
 #include "AudioFileSourceSTDIO.h"
 #include "AudioOutputSTDIO.h"
 #include "AudioGeneratorOpus.h"
+#include "AudioGeneratorOpusPackets.h"
+#include "libopus/opus_multistream.h"
+#include <math.h>
 
 #define OPUS "../../examples/PlayOpusFromSPIFFS/data/gs-16b-2c-44100hz.opus"
 
+// Output which counts what it's written, to clock the network stand-in below
+class AudioOutputClocked : public AudioOutputSTDIO
+{
+  public:
+    uint32_t played = 0;
+    virtual bool ConsumeSample(int16_t sample[2]) override { played++; return AudioOutputSTDIO::ConsumeSample(sample); }
+};
+
+// A lossy, jittery network between an Opus encoder and the packet player.  Every packet is
+// encoded up front and given an arrival time, and read() hands over whatever has "arrived"
+// by the output's clock, one sequence-numbered datagram at a time.
+class AudioFileSourceLoopback : public AudioFileSource
+{
+  public:
+    static const int rate = 16000;
+    static const int frame = rate / 50;
+    static const int count = 300;
+
+    AudioFileSourceLoopback(AudioOutputClocked *clock) : clock(clock)
+    {
+        int err;
+        OpusEncoder *enc = opus_encoder_create(rate, 1, OPUS_APPLICATION_VOIP, &err);
+        opus_encoder_ctl(enc, OPUS_SET_BITRATE(20000));
+        opus_encoder_ctl(enc, OPUS_SET_INBAND_FEC(1));
+        opus_encoder_ctl(enc, OPUS_SET_PACKET_LOSS_PERC(20));
+        uint32_t seed = 1;
+        for (int i = 0; i < count; i++) {
+            // Voice-ish: a wandering pitch with a few harmonics, in syllable-length bursts
+            for (int j = 0; j < frame; j++) {
+                double t = (double)(i * frame + j) / rate;
+                double f0 = 150 + 40 * sin(2 * M_PI * 0.7 * t);
+                double env = sin(M_PI * fmod(t, 0.25) / 0.25);
+                double v = 0;
+                for (int h = 1; h <= 6; h++) v += sin(2 * M_PI * f0 * h * t) / h;
+                pcm[j] = (int16_t)(6000 * env * v);
+            }
+            pkt[i].len = opus_encode(enc, pcm, frame, pkt[i].data, sizeof(pkt[i].data));
+            // Up to 3 frames of jitter, 1 in 12 lost, and a stall which has to underrun
+            seed = seed * 1103515245 + 12345;
+            pkt[i].arrival = (i + 2) * frame + ((seed >> 16) % (3 * frame));
+            if ((i >= 150) && (i < 160)) pkt[i].arrival += 12 * frame;
+            pkt[i].sent = ((seed >> 8) % 12) == 0;
+        }
+        opus_encoder_destroy(enc);
+        left = count;
+        for (int i = 0; i < count; i++) if (pkt[i].sent) left--;
+    }
+    virtual uint32_t read(void *data, uint32_t len) override
+    {
+        int best = -1;
+        for (int i = 0; i < count; i++) {
+            if (!pkt[i].sent && (pkt[i].arrival <= clock->played) && ((best < 0) || (pkt[i].arrival < pkt[best].arrival))) best = i;
+        }
+        if ((best < 0) || (len < 2)) return 0;
+        pkt[best].sent = true;
+        left--;
+        // Like a UDP socket, whatever doesn't fit in the caller's buffer is lost
+        uint32_t n = pkt[best].len;
+        if (n > len - 2) {
+            n = len - 2;
+            truncated++;
+        }
+        uint8_t *p = (uint8_t *)data;
+        p[0] = best >> 8;
+        p[1] = best & 0xff;
+        memcpy(p + 2, pkt[best].data, n);
+        return n + 2;
+    }
+    virtual bool isOpen() override { return left > 0; }
+    int truncated = 0;
+    virtual bool close() override { return true; }
+
+  private:
+    AudioOutputClocked *clock;
+    struct {
+        uint8_t data[AudioGeneratorOpusPackets::defaultPacketSize];
+        int len;
+        uint32_t arrival;
+        bool sent;
+    } pkt[count];
+    int16_t pcm[frame];
+    int left;
+};
+
+// One tone per channel, except ambisonics which get a single source hard left (W = Y)
+static int16_t TestTone(int family, int ch, int n)
+{
+    if (family == 2) return (ch < 2) ? (int16_t)(8000 * sin(2 * M_PI * 440 * n / 48000)) : 0;
+    return (int16_t)(4000 * sin(2 * M_PI * (220 + 110 * ch) * n / 48000));
+}
+
+// Encode a second of test tones with libopus' surround encoder into an Ogg Opus file
+static void WriteOggOpus(const char *name, int channels, int family, int frameSize)
+{
+    int streams, coupled, err;
+    static unsigned char mapping[255];
+    OpusMSEncoder *enc = opus_multistream_surround_encoder_create(48000, channels, family, &streams, &coupled,
+                                                                  mapping, OPUS_APPLICATION_AUDIO, &err);
+    opus_int32 preskip;
+    opus_multistream_encoder_ctl(enc, OPUS_GET_LOOKAHEAD(&preskip));
+    FILE *f = fopen(name, "wb");
+    static ogg_stream_state os;
+    ogg_stream_init(&os, 1234);
+    ogg_page pg;
+    ogg_packet op;
+
+    static unsigned char head[21 + 255];
+    unsigned char hdr[21] = { 'O', 'p', 'u', 's', 'H', 'e', 'a', 'd', 1, (unsigned char)channels,
+                                     (unsigned char)preskip, (unsigned char)(preskip >> 8), 0x80, 0xbb, 0, 0, 0, 0,
+                                     (unsigned char)family, (unsigned char)streams, (unsigned char)coupled };
+    memcpy(head, hdr, sizeof(hdr));
+    memcpy(head + 21, mapping, channels);
+    unsigned char tags[] = { 'O', 'p', 'u', 's', 'T', 'a', 'g', 's', 4, 0, 0, 0, 't', 'e', 's', 't', 0, 0, 0, 0 };
+    memset(&op, 0, sizeof(op));
+    op.packet = head;
+    op.bytes = family ? 21 + channels : 19; // Family 0 has no mapping table
+    op.b_o_s = 1;
+    ogg_stream_packetin(&os, &op);
+    while (ogg_stream_flush(&os, &pg)) { fwrite(pg.header, 1, pg.header_len, f); fwrite(pg.body, 1, pg.body_len, f); }
+    op.packet = tags;
+    op.bytes = sizeof(tags);
+    op.b_o_s = 0;
+    op.packetno = 1;
+    ogg_stream_packetin(&os, &op);
+    while (ogg_stream_flush(&os, &pg)) { fwrite(pg.header, 1, pg.header_len, f); fwrite(pg.body, 1, pg.body_len, f); }
+
+    static int16_t pcm[5760 * 8];
+    static unsigned char pkt[4000 * 8];
+    int frames = 48000 / frameSize;
+    for (int i = 0; i < frames; i++) {
+        for (int j = 0; j < frameSize; j++) {
+            for (int c = 0; c < channels; c++) pcm[j * channels + c] = TestTone(family, c, i * frameSize + j);
+        }
+        op.packet = pkt;
+        op.bytes = opus_multistream_encode(enc, pcm, frameSize, pkt, sizeof(pkt));
+        op.packetno = 2 + i;
+        op.granulepos = preskip + (i + 1) * frameSize;
+        op.e_o_s = (i == frames - 1);
+        ogg_stream_packetin(&os, &op);
+        while (ogg_stream_pageout(&os, &pg)) { fwrite(pg.header, 1, pg.header_len, f); fwrite(pg.body, 1, pg.body_len, f); }
+    }
+    while (ogg_stream_flush(&os, &pg)) { fwrite(pg.header, 1, pg.header_len, f); fwrite(pg.body, 1, pg.body_len, f); }
+    ogg_stream_clear(&os);
+    fclose(f);
+    opus_multistream_encoder_destroy(enc);
+}
+
+// Play name to wavName through the given downmix, returning the peak heap the decode needed
+static uint32_t PlayDownmix(const char *name, const char *wavName, AudioGeneratorOpus::Downmix mode, int outChannels)
+{
+    AudioFileSourceSTDIO *file = new AudioFileSourceSTDIO(name);
+    AudioOutputSTDIO *out = new AudioOutputSTDIO();
+    out->SetFilename(wavName);
+    AudioGeneratorOpus *opus = new AudioGeneratorOpus();
+    opus->SetDownmix(mode, outChannels);
+    opus->begin(file, out);
+    while (opus->loop()) { /*noop*/ }
+    opus->stop();
+    uint32_t peak = opus->GetMemoryStats().heapPeak;
+    delete out;
+    delete opus;
+    delete file;
+    return peak;
+}
+
+// Decode name both ways, returning microseconds and read calls per packet for each
+static void BenchPacketReads(const char *name, int frameSize)
+{
+    static int16_t buff[1024]; // The generator's old op_read_stereo() buffer
+    double us[2];
+    double reads[2];
+    int packets = 48000 / frameSize;
+    for (int direct = 0; direct < 2; direct++) {
+        uint32_t calls = 0;
+        uint32_t start = micros();
+        for (int rep = 0; rep < 10; rep++) {
+            OggOpusFile *of = op_open_file(name, nullptr);
+            while (true) {
+                const opus_int16 *pcm;
+                int ch;
+                int ret = direct ? op_read_direct(of, &pcm, &ch, nullptr) : op_read_stereo(of, buff, 1024);
+                if (ret <= 0) break;
+                calls++;
+            }
+            op_free(of);
+        }
+        us[direct] = (double)(uint32_t)(micros() - start) / (10 * packets);
+        reads[direct] = (double)calls / (10 * packets);
+    }
+    Serial.printf("Opus %5.1fms packets: op_read_stereo %4.1f reads %6.1fus, op_read_direct %4.1f reads %6.1fus per packet\n",
+                  frameSize / 48.0, reads[0], us[0], reads[1], us[1]);
+}
+
 int main(int argc, char **argv)
 {
     (void) argc;
@@ -22,4 +218,67 @@ int main(int argc, char **argv)
     delete out;
     delete opus;
     delete file;
+
+    // Same file twice more from a preallocated arena, which must come back pristine between tracks
+    static uint8_t arena[AudioGeneratorOpus::preAllocSize()];
+    opus = new AudioGeneratorOpus(arena, sizeof(arena));
+    for (int i = 0; i < 2; i++) {
+        file = new AudioFileSourceSTDIO(OPUS);
+        out = new AudioOutputSTDIO();
+        out->SetFilename("opus.pre.wav");
+        opus->begin(file, out);
+        while (opus->loop()) { /*noop*/ }
+        opus->stop();
+        Serial.printf("Opus arena: size=%u peak=%u fails=%u\n", (unsigned)sizeof(arena),
+                      opus->GetMemoryStats().heapPeak, opus->GetMemoryStats().failures);
+        delete out;
+        delete file;
+    }
+    delete opus;
+
+    // 5.1 and first order ambisonics, mixed down as they're decoded
+    WriteOggOpus("opus51.opus", 6, 1, 960);
+    WriteOggOpus("opusfoa.opus", 4, 2, 960);
+    Serial.printf("Opus 5.1 heap peak: full=%u front=%u mono=%u\n",
+                  PlayDownmix("opus51.opus", "opus51.wav", AudioGeneratorOpus::DOWNMIX_FULL, 2),
+                  PlayDownmix("opus51.opus", "opus51front.wav", AudioGeneratorOpus::DOWNMIX_FRONT, 2),
+                  PlayDownmix("opus51.opus", "opus51mono.wav", AudioGeneratorOpus::DOWNMIX_FULL, 1));
+    Serial.printf("Opus FOA heap peak: %u\n", PlayDownmix("opusfoa.opus", "opusfoa.wav", AudioGeneratorOpus::DOWNMIX_FULL, 2));
+
+    // What reading whole packets in place saves over copying them out through a fixed buffer
+    const int frameSizes[] = { 120, 480, 960, 2880, 5760 };
+    for (int i = 0; i < 5; i++) {
+        WriteOggOpus("opusbench.opus", 2, 0, frameSizes[i]);
+        BenchPacketReads("opusbench.opus", frameSizes[i]);
+    }
+
+    // Raw packets over a simulated network, with loss, reordering and a stall
+    AudioOutputClocked *clocked = new AudioOutputClocked();
+    clocked->SetFilename("opuspkt.wav");
+    AudioFileSourceLoopback *net = new AudioFileSourceLoopback(clocked);
+    AudioGeneratorOpusPackets *pkts = new AudioGeneratorOpusPackets(AudioFileSourceLoopback::rate, 1);
+    pkts->begin(net, clocked);
+    while (pkts->loop()) { /*noop*/ }
+    pkts->stop();
+    const AudioGeneratorOpusPackets::Stats &st = pkts->GetStats();
+    Serial.printf("Opus packets: received=%u late=%u dropped=%u lost=%u recovered=%u underruns=%u depth=%d played=%u\n",
+                  st.received, st.late, st.dropped, st.lost, st.recovered, st.underruns, st.depth, clocked->played);
+    delete pkts;
+    delete net;
+    delete clocked;
+
+    // Again with slots too small for some of the packets, which must be dropped rather than truncated
+    clocked = new AudioOutputClocked();
+    clocked->SetFilename("opuspkt.small.wav");
+    net = new AudioFileSourceLoopback(clocked);
+    pkts = new AudioGeneratorOpusPackets(AudioFileSourceLoopback::rate, 1);
+    pkts->SetMaxPacketSize(50);
+    pkts->begin(net, clocked);
+    while (pkts->loop()) { /*noop*/ }
+    pkts->stop();
+    Serial.printf("Opus small packets: received=%u dropped=%u truncated=%d\n", pkts->GetStats().received,
+                  pkts->GetStats().dropped, net->truncated);
+    delete pkts;
+    delete net;
+    delete clocked;
 }
@@ -0,0 +1,51 @@
+#include <Arduino.h>
+#include "AudioFileSourcePROGMEM.h"
+#include "AudioOutputLevels.h"
+#include "AudioGeneratorRTTTL.h"
+
+// At 120bpm a quarter note is 500ms, 11025 samples at the default 22050Hz
+static const char melody[] PROGMEM = "melody:d=4,o=5,b=120:c,e,g";
+static const char chord[] PROGMEM = "chord:d=4,o=5,b=120:c,e,g|e,g,c6|g,c6,e6";
+static const char zeroDuration[] PROGMEM = "x:d=0,o=5,b=100:c,e,g|";
+static const char zeroTempo[] PROGMEM = "x:d=4,o=5,b=0:c,e,g";
+
+// Plays the song into out, which is left holding its length and peak level
+static bool Play(const char *name, const char *song, AudioOutputLevels *out)
+{
+    AudioFileSourcePROGMEM *file = new AudioFileSourcePROGMEM(song, strlen(song));
+    AudioGeneratorRTTTL *rtttl = new AudioGeneratorRTTTL();
+    bool ok = rtttl->begin(file, out);
+    if (ok) {
+        while (rtttl->loop()) { /*noop*/ }
+        rtttl->stop();
+        Serial.printf("%s: samples=%d peak=%d\n", name, out->GetSamples(), out->peak);
+    }
+    delete rtttl;
+    delete file;
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    (void) argc;
+    (void) argv;
+
+    // Three quarter notes, rendered up to the end of the 64 sample block they finish in
+    const int notes = 3 * 11025;
+    AudioOutputLevels *out = new AudioOutputLevels(1000);
+    Play("melody", melody, out);
+    int melodyPeak = out->peak;
+    Serial.printf("melody: length ok=%d, level ok=%d\n", (out->GetSamples() >= notes) && (out->GetSamples() < notes + 64),
+                  (melodyPeak > 4000) && (melodyPeak <= 8192));
+
+    // The same three notes on three tracks at once, which must be louder but no longer
+    Play("chord", chord, out);
+    Serial.printf("chord: length ok=%d, level ok=%d, stereo ok=%d\n", (out->GetSamples() >= notes) && (out->GetSamples() < notes + 64),
+                  (out->peak > melodyPeak) && (out->peak <= 3 * 8192), !out->mismatch);
+
+    // A zero duration or tempo would divide by zero, so the song is refused
+    Serial.printf("d=0 refused=%d\n", !Play("d=0", zeroDuration, out));
+    Serial.printf("b=0 refused=%d\n", !Play("b=0", zeroTempo, out));
+
+    delete out;
+}
@@ -0,0 +1,61 @@
+#include <Arduino.h>
+#include "AudioOutputLevels.h"
+#include "AudioGeneratorTalkie.h"
+
+// A few words from examples/TalkingClockI2S, originally from the Talkie library's US clock vocabulary
+static const uint8_t spONE[]       PROGMEM = {0xCC,0x67,0x75,0x42,0x59,0x5D,0x3A,0x4F,0x9D,0x36,0x63,0xB7,0x59,0xDC,0x30,0x5B,0x5C,0x23,0x61,0xF3,0xE2,0x1C,0xF1,0xF0,0x98,0xC3,0x4B,0x7D,0x39,0xCA,0x1D,0x2C,0x2F,0xB7,0x15,0xEF,0x70,0x79,0xBC,0xD2,0x46,0x7C,0x52,0xE5,0xF1,0x4A,0x6A,0xB3,0x71,0x47,0xC3,0x2D,0x39,0x34,0x4B,0x23,0x35,0xB7,0x7A,0x55,0x33,0x8F,0x59,0xDC,0xA2,0x44,0xB5,0xBC,0x66,0x72,0x8B,0x64,0xF5,0xF6,0x98,0xC1,0x4D,0x42,0xD4,0x27,0x62,0x38,0x2F,0x4A,0xB6,0x9C,0x88,0x68,0xBC,0xA6,0x95,0xF8,0x5C,0xA1,0x09,0x86,0x77,0x91,0x11,0x5B,0xFF,0x0F};
+static const uint8_t spTWO[]       PROGMEM = {0x0E,0x38,0x6E,0x25,0x00,0xA3,0x0D,0x3A,0xA0,0x37,0xC5,0xA0,0x05,0x9E,0x56,0x35,0x86,0xAA,0x5E,0x8C,0xA4,0x82,0xB2,0xD7,0x74,0x31,0x22,0x69,0xAD,0x1C,0xD3,0xC1,0xD0,0xFA,0x28,0x2B,0x2D,0x47,0xC3,0x1B,0xC2,0xC4,0xAE,0xC6,0xCD,0x9C,0x48,0x53,0x9A,0xFF,0x0F};
+static const uint8_t spTHREE[]     PROGMEM = {0x02,0xD8,0x2E,0x9C,0x01,0xDB,0xA6,0x33,0x60,0xFB,0x30,0x01,0xEC,0x20,0x12,0x8C,0xE4,0xD8,0xCA,0x32,0x96,0x73,0x63,0x41,0x39,0x89,0x98,0xC1,0x4D,0x0D,0xED,0xB0,0x2A,0x05,0x37,0x0F,0xB4,0xA5,0xAE,0x5C,0xDC,0x36,0xD0,0x83,0x2F,0x4A,0x71,0x7B,0x03,0xF7,0x38,0x59,0xCD,0xED,0x1E,0xB4,0x6B,0x14,0x35,0xB7,0x6B,0x94,0x99,0x91,0xD5,0xDC,0x26,0x48,0x77,0x4B,0x66,0x71,0x1B,0x21,0xDB,0x2D,0x8A,0xC9,0x6D,0x88,0xFC,0x26,0x28,0x3A,0xB7,0x21,0xF4,0x1F,0xA3,0x65,0xBC,0x02,0x38,0xBB,0x3D,0x8E,0xF0,0x2B,0xE2,0x08,0xB7,0x34,0xFF,0x0F};
+static const uint8_t spSIX[]       PROGMEM = {0x0E,0xD8,0xAE,0xDD,0x03,0x0E,0x38,0xA6,0xD2,0x01,0xD3,0xB4,0x2C,0xAD,0x6A,0x35,0x9D,0xB1,0x7D,0xDC,0xEE,0xC4,0x65,0xD7,0xF1,0x72,0x47,0x24,0xB3,0x19,0xD9,0xD9,0x05,0x70,0x40,0x49,0xEA,0x02,0x98,0xBE,0x42,0x01,0xDF,0xA4,0x69,0x40,0x00,0xDF,0x95,0xFC,0x3F};
+
+// Samples in one phrase said on its own
+static int Length(const uint8_t *data, size_t len)
+{
+    AudioOutputLevels *out = new AudioOutputLevels(1000);
+    AudioGeneratorTalkie *talkie = new AudioGeneratorTalkie();
+    talkie->begin(nullptr, out);
+    talkie->say(data, len);
+    talkie->stop();
+    int samples = out->GetSamples();
+    delete talkie;
+    delete out;
+    return samples;
+}
+
+int main(int argc, char **argv)
+{
+    (void) argc;
+    (void) argv;
+
+    const uint8_t *words[4] = { spONE, spTWO, spTHREE, spSIX };
+    const size_t sizes[4] = { sizeof(spONE), sizeof(spTWO), sizeof(spTHREE), sizeof(spSIX) };
+    int lengths[4];
+    for (int i = 0; i < 4; i++) {
+        lengths[i] = Length(words[i], sizes[i]);
+        Serial.printf("word %d: %d samples\n", i, lengths[i]);
+    }
+
+    AudioOutputLevels *out = new AudioOutputLevels(1000);
+    AudioGeneratorTalkie *talkie = new AudioGeneratorTalkie();
+    talkie->begin(nullptr, out);
+
+    // Fill the queue without playing any of it, so the next async phrase has nowhere to go
+    int accepted = 0;
+    for (int i = 0; i < AudioGeneratorTalkie::queueSize + 1; i++) {
+        if (talkie->say(words[i % 4], sizes[i % 4], true)) accepted++;
+    }
+    Serial.printf("async: accepted=%d queued=%d ok=%d\n", accepted, talkie->queued(),
+                  (accepted == AudioGeneratorTalkie::queueSize) && (talkie->queued() == AudioGeneratorTalkie::queueSize));
+
+    // A synchronous phrase waits for room, then returns once it and everything ahead of it is said
+    bool said = talkie->say(spSIX, sizeof(spSIX));
+    int expect = 2 * (lengths[0] + lengths[1] + lengths[2] + lengths[3]) + lengths[3];
+    Serial.printf("sync: said=%d queued=%d samples=%d expected=%d peak=%d\n", said, talkie->queued(),
+                  out->GetSamples(), expect, out->peak);
+    Serial.printf("sync: ok=%d, length ok=%d, level ok=%d\n", said && !talkie->queued(),
+                  out->GetSamples() == expect, out->peak > 1000);
+    talkie->stop();
+
+    delete talkie;
+    delete out;
+}